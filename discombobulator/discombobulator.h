@@ -0,0 +1,162 @@
+// Header only obfuscation of string literals at compile time, there is no generator step
+// https://github.com/pilkch/tests/tree/master/discombobulator
+//
+//  const auto secret = DISCOMBOBULATE("my password");
+//
+//  const auto decoded = secret.Decode(); // A null terminated std::array<char, 12> on the stack, decoded.data() is "my password"
+//  secret.Decode(szBuffer);              // Or into a buffer with room for secret.size() + 1 characters
+//
+// Each byte is xored with a keystream from a counter based hash of the seed and the position, there are no per byte keys stored next to the data
+// Each DISCOMBOBULATE gets its own seed from the build seed, the line and __COUNTER__
+// The build seed is DISCOMBOBULATOR_SEED if it is defined, for reproducible builds pass -DDISCOMBOBULATOR_SEED=<number>
+// Otherwise it comes from __DATE__ and __TIME__ so it changes every time the file is compiled
+//
+// Larger binary data is generated into a header with discombobulator --blob and decoded with DecodeBlob, which uses 4 keystream bytes from each hash
+//
+// This keeps strings out of "strings" and a hex editor, it doesn't stop someone with a debugger
+// Requires C++17
+
+#ifndef DISCOMBOBULATOR_H
+#define DISCOMBOBULATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <array>
+
+namespace discombobulator
+{
+  // FNV-1a
+  constexpr uint32_t Hash(const char* szText, uint32_t hash = 2166136261u)
+  {
+    return (*szText == 0) ? hash : Hash(szText + 1, (hash ^ uint8_t(*szText)) * 16777619u);
+  }
+
+  // A 32 bit integer hash with good avalanche, only 32 bit multiplies so the decode loop vectorises
+  constexpr uint32_t Mix32(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  // The keystream byte for position i
+  constexpr uint8_t GetKeyByte(uint32_t seed, size_t i)
+  {
+    return uint8_t(Mix32(seed + (uint32_t(i) * 0x9e3779b9u)) >> 24);
+  }
+
+#ifdef DISCOMBOBULATOR_SEED
+  constexpr uint32_t BUILD_SEED = uint32_t(DISCOMBOBULATOR_SEED);
+#else
+  constexpr uint32_t BUILD_SEED = Hash(__DATE__ " " __TIME__);
+#endif
+
+  // Stops the compiler from knowing the value, otherwise it could decode a secret at compile time and store the plain text after all
+  inline uint32_t HideFromOptimiser(uint32_t value)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__("" : "+r"(value));
+    return value;
+#else
+    volatile uint32_t hidden = value;
+    return hidden;
+#endif
+  }
+
+
+  // ** cObfuscated
+  //
+  // N characters encoded with the keystream for SEED, only the encoded bytes are stored
+
+  template <size_t N, uint32_t SEED>
+  class cObfuscated
+  {
+  public:
+    constexpr explicit cObfuscated(const char (&szText)[N + 1]);
+
+    constexpr size_t size() const { return N; }
+
+    std::array<char, N + 1> Decode() const;
+
+    // pOutput must have room for size() + 1 characters, it is null terminated
+    void Decode(char* pOutput) const;
+
+  private:
+    std::array<uint8_t, N> data;
+  };
+
+  template <size_t N, uint32_t SEED>
+  constexpr cObfuscated<N, SEED>::cObfuscated(const char (&szText)[N + 1]) :
+    data()
+  {
+    for (size_t i = 0; i < N; i++) data[i] = uint8_t(szText[i]) ^ GetKeyByte(SEED, i);
+  }
+
+  template <size_t N, uint32_t SEED>
+  inline std::array<char, N + 1> cObfuscated<N, SEED>::Decode() const
+  {
+    std::array<char, N + 1> decoded;
+    Decode(decoded.data());
+    return decoded;
+  }
+
+  template <size_t N, uint32_t SEED>
+  inline void cObfuscated<N, SEED>::Decode(char* pOutput) const
+  {
+    const uint32_t seed = HideFromOptimiser(SEED);
+    for (size_t i = 0; i < N; i++) pOutput[i] = char(data[i] ^ GetKeyByte(seed, i));
+    pOutput[N] = 0;
+  }
+
+
+  // ** Blobs
+  //
+  // Byte p of a blob is xored with byte (p % 4) of the little endian word Mix32(seed + ((p / 4) * 0x9e3779b9))
+  // Any range can be decoded on its own, the whole words in the middle are one hash and one xor each, which the compiler vectorises
+
+  inline uint32_t GetBlobKeyWord(uint32_t seed, size_t word)
+  {
+    return Mix32(seed + (uint32_t(word) * 0x9e3779b9u));
+  }
+
+  // Decodes bytes [offset, offset + length) of the blob pData into pOutput, encoding is the same operation
+  inline void DecodeBlob(const uint8_t* pData, size_t offset, size_t length, uint32_t seed, uint8_t* pOutput)
+  {
+    seed = HideFromOptimiser(seed);
+
+    size_t position = offset;
+    const size_t end = offset + length;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    // Bytes up to the first whole word
+    for (; ((position % 4) != 0) && (position < end); position++) *pOutput++ = pData[position] ^ uint8_t(GetBlobKeyWord(seed, position / 4) >> (8 * (position % 4)));
+
+    const size_t firstWord = position / 4;
+    const size_t nWords = (end - position) / 4;
+    for (size_t i = 0; i < nWords; i++) {
+      uint32_t value;
+      memcpy(&value, pData + position + (4 * i), sizeof(value));
+      value ^= GetBlobKeyWord(seed, firstWord + i);
+      memcpy(pOutput + (4 * i), &value, sizeof(value));
+    }
+    position += 4 * nWords;
+    pOutput += 4 * nWords;
+#endif
+
+    for (; position < end; position++) *pOutput++ = pData[position] ^ uint8_t(GetBlobKeyWord(seed, position / 4) >> (8 * (position % 4)));
+  }
+}
+
+// The constexpr variable forces the encoding to happen at compile time, only the encoded bytes are returned from the lambda
+#define DISCOMBOBULATE(TEXT) \
+  ([]() { \
+    constexpr ::discombobulator::cObfuscated<sizeof(TEXT) - 1, ::discombobulator::Mix32(::discombobulator::BUILD_SEED ^ (uint32_t(__LINE__) * 2654435761u) ^ uint32_t(__COUNTER__))> obfuscated(TEXT); \
+    return obfuscated; \
+  }())
+
+#endif // DISCOMBOBULATOR_H
@@ -1,16 +1,22 @@
 // This program creates a function to build a value from obfuscated data
 // The idea being that you can use this function to store sensitive data instead of just storing it as raw strings that can be viewed in a hex editor or with the "strings" utility
+// discombobulator.h does the same at compile time with no generator step, --benchmark compares decoding with it against decoding with a generated header
 
 // Standard headers
 #include <cassert>
-#include <ctime>
 #include <algorithm>
+#include <random>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
 #include <sstream>
 
+#include "benchmark.h"
+#include "discombobulator.h"
+
 #if defined(__LINUX__) || defined(__APPLE__)
 #define BUILD_LINUX_OR_UNIX
 #endif
@@ -37,19 +43,60 @@ namespace string
   }
 }
 
-unsigned int GetRandomNumber(unsigned int uiMax)
+// ** Seeds
+//
+// Headers are generated from a seed so that the same input always creates a byte identical header, which keeps ccache hits and doesn't rebuild everything that includes it
+// The seed is a hash of --seed (0 by default), the name and the secret
+// std::mt19937_64's output is the same with every standard library, the distributions aren't so only its raw output is used
+
+// FNV-1a 64
+uint64_t Hash64(const std::string& sText, uint64_t hash = 14695981039346656037ull)
+{
+  for (const char c : sText) hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+  return hash;
+}
+
+uint64_t GetSeedForSecret(uint64_t userSeed, const std::string& sName, const std::string& sSecret)
 {
-  return (rand() % uiMax);
+  // Hash the lengths too so that "ab" "c" and "a" "bc" are different
+  return Hash64(sSecret, Hash64(std::to_string(sSecret.length()), Hash64(sName, Hash64(std::to_string(sName.length()), Hash64(std::to_string(userSeed))))));
+}
+
+// Only writes the file if its contents would change so that its modification time stays the same
+bool WriteFileIfChanged(const std::string& sFilePath, const std::string& sContents)
+{
+  {
+    std::ifstream existing(sFilePath.c_str(), std::ios::binary);
+    if (existing.good()) {
+      std::ostringstream o;
+      o<<existing.rdbuf();
+      if (o.str() == sContents) {
+        std::cout<<sFilePath<<" is unchanged"<<std::endl;
+        return true;
+      }
+    }
+  }
+
+  std::ofstream file(sFilePath.c_str(), std::ios::binary);
+  file<<sContents;
+  if (!file.good()) {
+    std::cerr<<"Could not write "<<sFilePath<<std::endl;
+    return false;
+  }
+
+  std::cout<<"Wrote "<<sFilePath<<std::endl;
+  return true;
 }
 
-void CreateHeaderForNameAndSecret(const std::string& sName, const std::string& sSecret)
+bool CreateHeaderForNameAndSecret(const std::string& sName, const std::string& sSecret, uint64_t userSeed)
 {
-  srand(time(nullptr));
+  std::mt19937_64 generator(GetSeedForSecret(userSeed, sName, sSecret));
 
   std::string sIndent;
   sIndent.append(nSpacesInEachTab, ' ');
 
-  std::ofstream f(("discombobulator_" + string::ToLower(sName) + ".h").c_str());
+  const std::string sHeaderFilePath = "discombobulator_" + string::ToLower(sName) + ".h";
+  std::ostringstream f;
 
   f<<"// This header was automatically generate by discombobulator"<<std::endl;
   f<<"// https://github.com/pilkch/tests/tree/master/discombobulator"<<std::endl;
@@ -76,7 +123,7 @@ void CreateHeaderForNameAndSecret(const std::string& sName, const std::string& s
   // Note that the decryption relies on the values wrapping at 255
   const size_t n = sSecret.length();
   for (size_t i = 0; i < n; i++) {
-    uint8_t uiRandom = GetRandomNumber(255);
+    uint8_t uiRandom = uint8_t(generator());
     uint8_t uiSecret = sSecret[i] - uiRandom;
     f<<sIndent<<sIndent<<"o<<char(uint8_t("<<uint32_t(uiSecret)<<") + uint8_t("<<uint32_t(uiRandom)<<"));"<<std::endl;
 
@@ -93,6 +140,7 @@ void CreateHeaderForNameAndSecret(const std::string& sName, const std::string& s
   f<<"#endif // DISCOMBOBULATOR_"<<string::ToUpper(sName)<<"_H"<<std::endl;
   f<<std::endl;
 
+  if (!WriteFileIfChanged(sHeaderFilePath, f.str())) return false;
 
   // Test decryption
   std::ostringstream o;
@@ -102,30 +150,524 @@ void CreateHeaderForNameAndSecret(const std::string& sName, const std::string& s
   std::cout<<"Input \""<<sSecret<<"\""<<std::endl;
   std::cout<<"Output \""<<o.str()<<"\""<<std::endl;
   assert(o.str() == sSecret);
+
+  return true;
+}
+
+// ** Manifest
+//
+// Many secrets in one header, the secrets are packed into one byte array and decoded by one shared function
+// Each secret is decoded the first time it is asked for, std::call_once makes that safe from several threads, after that it is a reference to the cached string
+// The keystream is the same one that discombobulator.h uses
+
+struct cManifestSecret {
+  std::string sName;
+  std::string sSecret;
+  uint32_t seed;
+};
+
+bool IsValidIdentifier(const std::string& sName)
+{
+  if (sName.empty() || ((sName[0] >= '0') && (sName[0] <= '9'))) return false;
+
+  for (const char c : sName) {
+    if (!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '_'))) return false;
+  }
+
+  return true;
+}
+
+// Each line is "NAME VALUE", the value is the rest of the line after the space, empty lines and lines starting with # are skipped
+bool ReadManifest(const std::string& sFilePath, std::vector<cManifestSecret>& secrets)
+{
+  std::ifstream f(sFilePath.c_str());
+  if (!f.good()) {
+    std::cerr<<"Could not open "<<sFilePath<<std::endl;
+    return false;
+  }
+
+  std::string sLine;
+  size_t line = 0;
+  while (std::getline(f, sLine)) {
+    line++;
+
+    if (!sLine.empty() && (sLine[sLine.length() - 1] == '\r')) sLine.erase(sLine.length() - 1);
+    if (sLine.empty() || (sLine[0] == '#')) continue;
+
+    const size_t space = sLine.find(' ');
+    cManifestSecret secret;
+    secret.sName = sLine.substr(0, space);
+    secret.sSecret = (space == std::string::npos) ? "" : sLine.substr(space + 1);
+    secret.seed = 0;
+
+    if (!IsValidIdentifier(secret.sName)) {
+      std::cerr<<sFilePath<<":"<<line<<": \""<<secret.sName<<"\" is not a valid name, use letters, numbers and underscores"<<std::endl;
+      return false;
+    }
+
+    for (const cManifestSecret& other : secrets) {
+      if (other.sName == secret.sName) {
+        std::cerr<<sFilePath<<":"<<line<<": "<<secret.sName<<" is already in the manifest"<<std::endl;
+        return false;
+      }
+    }
+
+    secrets.push_back(secret);
+  }
+
+  return true;
+}
+
+std::string GetManifestNamespace(const std::string& sHeaderFilePath)
+{
+  // The file name without the folder or extension, so that headers from different manifests can be included together
+  std::string sNamespace = sHeaderFilePath.substr(sHeaderFilePath.find_last_of("/\\") + 1);
+  sNamespace = sNamespace.substr(0, sNamespace.find('.'));
+  for (char& c : sNamespace) {
+    if (!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')))) c = '_';
+  }
+
+  // Identifiers can't start with a digit, for example "9x-secrets.h"
+  if (sNamespace.empty()) sNamespace = "secrets";
+  else if ((sNamespace[0] >= '0') && (sNamespace[0] <= '9')) sNamespace = "secrets_" + sNamespace;
+
+  return string::ToLower(sNamespace);
+}
+
+bool CreateHeaderForManifest(const std::string& sHeaderFilePath, std::vector<cManifestSecret>& secrets, uint64_t userSeed)
+{
+  for (cManifestSecret& secret : secrets) {
+    std::mt19937_64 generator(GetSeedForSecret(userSeed, secret.sName, secret.sSecret));
+    secret.seed = uint32_t(generator());
+  }
+
+  const std::string sNamespace = GetManifestNamespace(sHeaderFilePath);
+  if (!IsValidIdentifier(sNamespace)) {
+    std::cerr<<"Could not create a namespace from "<<sHeaderFilePath<<", \""<<sNamespace<<"\" is not a valid name"<<std::endl;
+    return false;
+  }
+
+  const std::string sGuard = "DISCOMBOBULATOR_" + string::ToUpper(sNamespace) + "_H";
+
+  std::string sIndent;
+  sIndent.append(nSpacesInEachTab, ' ');
+  const std::string sIndent2 = sIndent + sIndent;
+  const std::string sIndent3 = sIndent2 + sIndent;
+
+  // Encode every secret into one array
+  std::vector<uint8_t> data;
+  std::vector<size_t> offsets;
+  for (const cManifestSecret& secret : secrets) {
+    offsets.push_back(data.size());
+    for (size_t i = 0; i < secret.sSecret.length(); i++) data.push_back(uint8_t(secret.sSecret[i]) ^ discombobulator::GetKeyByte(secret.seed, i));
+  }
+
+  std::ostringstream f;
+
+  f<<"// This header was automatically generate by discombobulator --manifest"<<std::endl;
+  f<<"// https://github.com/pilkch/tests/tree/master/discombobulator"<<std::endl;
+  f<<std::endl;
+  f<<"#ifndef "<<sGuard<<std::endl;
+  f<<"#define "<<sGuard<<std::endl;
+  f<<std::endl;
+  f<<"#include <cstddef>"<<std::endl;
+  f<<"#include <cstdint>"<<std::endl;
+  f<<"#include <mutex>"<<std::endl;
+  f<<"#include <string>"<<std::endl;
+  f<<std::endl;
+  f<<"// The secrets are packed into one array, each byte is xored with a keystream from a hash of the secret's seed and the position"<<std::endl;
+  f<<"// Each secret is decoded the first time it is asked for and then cached, this is thread safe"<<std::endl;
+  f<<std::endl;
+  f<<"namespace discombobulator"<<std::endl;
+  f<<"{"<<std::endl;
+  f<<sIndent<<"namespace "<<sNamespace<<std::endl;
+  f<<sIndent<<"{"<<std::endl;
+  f<<sIndent2<<"struct cSecret {"<<std::endl;
+  f<<sIndent3<<"size_t offset;"<<std::endl;
+  f<<sIndent3<<"size_t length;"<<std::endl;
+  f<<sIndent3<<"uint32_t seed;"<<std::endl;
+  f<<sIndent2<<"};"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"const size_t SECRET_COUNT = "<<secrets.size()<<";"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline const uint8_t* GetData()"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"static const uint8_t data["<<std::max<size_t>(1, data.size())<<"] = {"<<std::endl;
+  for (size_t i = 0; i < data.size(); i += 16) {
+    f<<sIndent3<<sIndent;
+    for (size_t j = i; (j < data.size()) && (j < (i + 16)); j++) f<<"0x"<<std::hex<<((data[j] < 16) ? "0" : "")<<uint32_t(data[j])<<std::dec<<",";
+    f<<std::endl;
+  }
+  f<<sIndent3<<"};"<<std::endl;
+  f<<sIndent3<<"return data;"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline const cSecret& GetSecret(size_t index)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"static const cSecret secrets["<<std::max<size_t>(1, secrets.size())<<"] = {"<<std::endl;
+  for (size_t i = 0; i < secrets.size(); i++) f<<sIndent3<<sIndent<<"{ "<<offsets[i]<<", "<<secrets[i].sSecret.length()<<", 0x"<<std::hex<<secrets[i].seed<<std::dec<<" }, // "<<secrets[i].sName<<std::endl;
+  f<<sIndent3<<"};"<<std::endl;
+  f<<sIndent3<<"return secrets[index];"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline uint32_t Mix32(uint32_t x)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 16;"<<std::endl;
+  f<<sIndent3<<"x *= 0x7feb352du;"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 15;"<<std::endl;
+  f<<sIndent3<<"x *= 0x846ca68bu;"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 16;"<<std::endl;
+  f<<sIndent3<<"return x;"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline void Decode(const cSecret& secret, char* pOutput)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"const uint8_t* pData = GetData() + secret.offset;"<<std::endl;
+  f<<sIndent3<<"for (size_t i = 0; i < secret.length; i++) pOutput[i] = char(pData[i] ^ uint8_t(Mix32(secret.seed + (uint32_t(i) * 0x9e3779b9u)) >> 24));"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline const std::string& GetDecoded(size_t index)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"static std::once_flag flags["<<std::max<size_t>(1, secrets.size())<<"];"<<std::endl;
+  f<<sIndent3<<"static std::string decoded["<<std::max<size_t>(1, secrets.size())<<"];"<<std::endl;
+  f<<sIndent3<<"std::call_once(flags[index], [index]() {"<<std::endl;
+  f<<sIndent3<<sIndent<<"const cSecret& secret = GetSecret(index);"<<std::endl;
+  f<<sIndent3<<sIndent<<"decoded[index].resize(secret.length);"<<std::endl;
+  f<<sIndent3<<sIndent<<"if (secret.length != 0) Decode(secret, &decoded[index][0]);"<<std::endl;
+  f<<sIndent3<<"});"<<std::endl;
+  f<<sIndent3<<"return decoded[index];"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<sIndent<<"}"<<std::endl;
+  f<<std::endl;
+  for (size_t i = 0; i < secrets.size(); i++) f<<sIndent<<"inline const std::string& GetSecret"<<secrets[i].sName<<"UTF8() { return "<<sNamespace<<"::GetDecoded("<<i<<"); }"<<std::endl;
+  f<<"}"<<std::endl;
+  f<<std::endl;
+  f<<"#endif // "<<sGuard<<std::endl;
+
+  if (!WriteFileIfChanged(sHeaderFilePath, f.str())) return false;
+
+  // Test decryption
+  for (size_t i = 0; i < secrets.size(); i++) {
+    std::string sDecoded;
+    for (size_t j = 0; j < secrets[i].sSecret.length(); j++) sDecoded.push_back(char(data[offsets[i] + j] ^ discombobulator::GetKeyByte(secrets[i].seed, j)));
+    assert(sDecoded == secrets[i].sSecret);
+  }
+
+  return true;
+}
+
+
+// ** Blobs
+//
+// Binary files such as certificates, licenses or lookup tables, embedded as an aligned byte array and decoded into a buffer that the caller provides
+// See DecodeBlob in discombobulator.h for the keystream, the generated header has its own copy so that it doesn't need C++17
+
+bool ReadBinaryFile(const std::string& sFilePath, std::vector<uint8_t>& contents)
+{
+  std::ifstream f(sFilePath.c_str(), std::ios::binary);
+  if (!f.good()) return false;
+
+  contents.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  return !f.bad();
+}
+
+bool CreateHeaderForBlob(const std::string& sName, const std::string& sInputFilePath, const std::string& sHeaderFilePath, uint64_t userSeed)
+{
+  if (!IsValidIdentifier(sName)) {
+    std::cerr<<"\""<<sName<<"\" is not a valid name, use letters, numbers and underscores"<<std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> contents;
+  if (!ReadBinaryFile(sInputFilePath, contents)) {
+    std::cerr<<"Could not read "<<sInputFilePath<<std::endl;
+    return false;
+  }
+
+  std::mt19937_64 generator(GetSeedForSecret(userSeed, sName, std::string(contents.begin(), contents.end())));
+  const uint32_t seed = uint32_t(generator());
+
+  std::vector<uint8_t> data(contents.size());
+  if (!contents.empty()) discombobulator::DecodeBlob(contents.data(), 0, contents.size(), seed, data.data());
+
+  const std::string sNamespace = "blob_" + string::ToLower(sName);
+  const std::string sGuard = "DISCOMBOBULATOR_BLOB_" + string::ToUpper(sName) + "_H";
+
+  std::string sIndent;
+  sIndent.append(nSpacesInEachTab, ' ');
+  const std::string sIndent2 = sIndent + sIndent;
+  const std::string sIndent3 = sIndent2 + sIndent;
+
+  std::ostringstream f;
+
+  f<<"// This header was automatically generate by discombobulator --blob"<<std::endl;
+  f<<"// https://github.com/pilkch/tests/tree/master/discombobulator"<<std::endl;
+  f<<std::endl;
+  f<<"#ifndef "<<sGuard<<std::endl;
+  f<<"#define "<<sGuard<<std::endl;
+  f<<std::endl;
+  f<<"#include <cstddef>"<<std::endl;
+  f<<"#include <cstdint>"<<std::endl;
+  f<<"#include <cstring>"<<std::endl;
+  f<<std::endl;
+  f<<"// Byte p is xored with byte (p % 4) of a 32 bit hash of the seed and p / 4, so any range can be decoded on its own"<<std::endl;
+  f<<"// The loop over whole words vectorises when optimisations are on"<<std::endl;
+  f<<std::endl;
+  f<<"namespace discombobulator"<<std::endl;
+  f<<"{"<<std::endl;
+  f<<sIndent<<"namespace "<<sNamespace<<std::endl;
+  f<<sIndent<<"{"<<std::endl;
+  f<<sIndent2<<"const size_t SIZE = "<<data.size()<<";"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline const uint8_t* GetData()"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"alignas(64) static const uint8_t data["<<std::max<size_t>(1, data.size())<<"] = {"<<std::endl;
+
+  // Formatting each byte with the stream is slow for several MB
+  const char* szHex = "0123456789abcdef";
+  std::string sLine;
+  for (size_t i = 0; i < data.size(); i += 16) {
+    sLine = sIndent3 + sIndent;
+    for (size_t j = i; (j < data.size()) && (j < (i + 16)); j++) {
+      const char szByte[] = { '0', 'x', szHex[data[j] >> 4], szHex[data[j] & 0xf], ',', 0 };
+      sLine += szByte;
+    }
+    f<<sLine<<"\n";
+  }
+
+  f<<sIndent3<<"};"<<std::endl;
+  f<<sIndent3<<"return data;"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline uint32_t GetKeyWord(uint32_t seed, size_t word)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"uint32_t x = seed + (uint32_t(word) * 0x9e3779b9u);"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 16;"<<std::endl;
+  f<<sIndent3<<"x *= 0x7feb352du;"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 15;"<<std::endl;
+  f<<sIndent3<<"x *= 0x846ca68bu;"<<std::endl;
+  f<<sIndent3<<"x ^= x >> 16;"<<std::endl;
+  f<<sIndent3<<"return x;"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent2<<"inline void Decode(size_t offset, size_t length, uint8_t* pOutput)"<<std::endl;
+  f<<sIndent2<<"{"<<std::endl;
+  f<<sIndent3<<"// Hide the seed from the optimiser, otherwise it could decode the data at compile time"<<std::endl;
+  f<<"#if defined(__GNUC__) || defined(__clang__)"<<std::endl;
+  f<<sIndent3<<"uint32_t seed = 0x"<<std::hex<<seed<<std::dec<<"u;"<<std::endl;
+  f<<sIndent3<<"__asm__(\"\" : \"+r\"(seed));"<<std::endl;
+  f<<"#else"<<std::endl;
+  f<<sIndent3<<"volatile uint32_t hiddenSeed = 0x"<<std::hex<<seed<<std::dec<<"u;"<<std::endl;
+  f<<sIndent3<<"const uint32_t seed = hiddenSeed;"<<std::endl;
+  f<<"#endif"<<std::endl;
+  f<<std::endl;
+  f<<sIndent3<<"const uint8_t* pData = GetData();"<<std::endl;
+  f<<sIndent3<<"size_t position = offset;"<<std::endl;
+  f<<sIndent3<<"const size_t end = offset + length;"<<std::endl;
+  f<<std::endl;
+  f<<"#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)"<<std::endl;
+  f<<sIndent3<<"for (; ((position % 4) != 0) && (position < end); position++) *pOutput++ = pData[position] ^ uint8_t(GetKeyWord(seed, position / 4) >> (8 * (position % 4)));"<<std::endl;
+  f<<std::endl;
+  f<<sIndent3<<"const size_t firstWord = position / 4;"<<std::endl;
+  f<<sIndent3<<"const size_t nWords = (end - position) / 4;"<<std::endl;
+  f<<sIndent3<<"for (size_t i = 0; i < nWords; i++) {"<<std::endl;
+  f<<sIndent3<<sIndent<<"uint32_t value;"<<std::endl;
+  f<<sIndent3<<sIndent<<"memcpy(&value, pData + position + (4 * i), sizeof(value));"<<std::endl;
+  f<<sIndent3<<sIndent<<"value ^= GetKeyWord(seed, firstWord + i);"<<std::endl;
+  f<<sIndent3<<sIndent<<"memcpy(pOutput + (4 * i), &value, sizeof(value));"<<std::endl;
+  f<<sIndent3<<"}"<<std::endl;
+  f<<sIndent3<<"position += 4 * nWords;"<<std::endl;
+  f<<sIndent3<<"pOutput += 4 * nWords;"<<std::endl;
+  f<<"#endif"<<std::endl;
+  f<<std::endl;
+  f<<sIndent3<<"for (; position < end; position++) *pOutput++ = pData[position] ^ uint8_t(GetKeyWord(seed, position / 4) >> (8 * (position % 4)));"<<std::endl;
+  f<<sIndent2<<"}"<<std::endl;
+  f<<sIndent<<"}"<<std::endl;
+  f<<std::endl;
+  f<<sIndent<<"inline size_t GetBlob"<<sName<<"Size() { return "<<sNamespace<<"::SIZE; }"<<std::endl;
+  f<<std::endl;
+  f<<sIndent<<"// Decodes bytes [offset, offset + length) into pOutput, which needs room for length bytes"<<std::endl;
+  f<<sIndent<<"inline void DecodeBlob"<<sName<<"(void* pOutput, size_t offset = 0, size_t length = "<<sNamespace<<"::SIZE) { "<<sNamespace<<"::Decode(offset, length, static_cast<uint8_t*>(pOutput)); }"<<std::endl;
+  f<<"}"<<std::endl;
+  f<<std::endl;
+  f<<"#endif // "<<sGuard<<std::endl;
+
+  if (!WriteFileIfChanged(sHeaderFilePath, f.str())) return false;
+
+  // Test decryption
+  std::vector<uint8_t> decoded(data.size());
+  if (!data.empty()) discombobulator::DecodeBlob(data.data(), 0, data.size(), seed, decoded.data());
+  assert(decoded == contents);
+
+  std::cout<<"Embedded "<<contents.size()<<" bytes from "<<sInputFilePath<<std::endl;
+
+  return true;
+}
+
+
+// ** Benchmarks
+//
+// Each operation decodes one BENCHMARK_SECRET
+
+const std::string BENCHMARK_SECRET = "correct horse battery staple 123";
+
+// The same work as a header from CreateHeaderForNameAndSecret, one character at a time into a std::ostringstream
+void BenchmarkGeneratedHeader(size_t iterations)
+{
+  static std::vector<uint8_t> secret;
+  static std::vector<uint8_t> random;
+  if (secret.empty()) {
+    std::mt19937_64 generator(1);
+    for (size_t i = 0; i < BENCHMARK_SECRET.length(); i++) {
+      random.push_back(uint8_t(generator()));
+      secret.push_back(uint8_t(BENCHMARK_SECRET[i] - random.back()));
+    }
+  }
+
+  for (size_t i = 0; i < iterations; i++) {
+    std::ostringstream o;
+    for (size_t j = 0; j < secret.size(); j++) o<<char(uint8_t(secret[j]) + uint8_t(random[j]));
+
+    const std::string sDecoded = o.str();
+    DoNotOptimize(sDecoded);
+  }
+}
+REGISTER_BENCHMARK("generated header", BenchmarkGeneratedHeader);
+
+void BenchmarkConstexpr(size_t iterations)
+{
+  const auto secret = DISCOMBOBULATE("correct horse battery staple 123");
+
+  for (size_t i = 0; i < iterations; i++) {
+    const auto decoded = secret.Decode();
+    DoNotOptimize(decoded);
+  }
+}
+REGISTER_BENCHMARK("constexpr header", BenchmarkConstexpr);
+
+// Each operation decodes all of a BENCHMARK_BLOB_SIZE blob
+const size_t BENCHMARK_BLOB_SIZE = 1024 * 1024;
+
+const std::vector<uint8_t>& GetBenchmarkBlob()
+{
+  static std::vector<uint8_t> blob;
+  if (blob.empty()) {
+    std::mt19937_64 generator(1);
+    for (size_t i = 0; i < BENCHMARK_BLOB_SIZE; i++) blob.push_back(uint8_t(generator()));
+  }
+
+  return blob;
+}
+
+// One hash for each byte, like the strings
+void BenchmarkBlobBytes(size_t iterations)
+{
+  const std::vector<uint8_t>& blob = GetBenchmarkBlob();
+  static std::vector<uint8_t> output(BENCHMARK_BLOB_SIZE);
+
+  for (size_t i = 0; i < iterations; i++) {
+    const uint32_t seed = discombobulator::HideFromOptimiser(0x12345678u);
+    for (size_t j = 0; j < BENCHMARK_BLOB_SIZE; j++) output[j] = blob[j] ^ discombobulator::GetKeyByte(seed, j);
+    ClobberMemory();
+  }
+}
+REGISTER_BENCHMARK("blob byte keystream", BenchmarkBlobBytes);
+
+void BenchmarkBlobWords(size_t iterations)
+{
+  const std::vector<uint8_t>& blob = GetBenchmarkBlob();
+  static std::vector<uint8_t> output(BENCHMARK_BLOB_SIZE);
+
+  for (size_t i = 0; i < iterations; i++) {
+    discombobulator::DecodeBlob(blob.data(), 0, BENCHMARK_BLOB_SIZE, 0x12345678u, output.data());
+    ClobberMemory();
+  }
+}
+REGISTER_BENCHMARK("blob word keystream", BenchmarkBlobWords);
+
+void RunBenchmarks(const std::string& sFilter)
+{
+  // The TSC is cheaper to read if the processor has an invariant one
+  if (IsInvariantTSCSupported()) SetClockSource(CLOCK_SOURCE::TSC);
+
+  // Check that the constexpr version decodes correctly before timing it
+  const auto secret = DISCOMBOBULATE("correct horse battery staple 123");
+  if (std::string(secret.Decode().data()) != BENCHMARK_SECRET) std::cout<<"WARNING: The constexpr header did not decode the secret correctly"<<std::endl;
+
+#ifndef __OPTIMIZE__
+  std::cout<<"WARNING: This was built without optimisation, the blob decode isn't vectorised, build with -DCMAKE_BUILD_TYPE=Release"<<std::endl;
+#endif
+
+  const std::vector<cBenchmarkResult> results = RunRegisteredBenchmarks(std::cout, sFilter, cBenchmarkSettings());
+
+  // Bytes per nanosecond is GB/s
+  for (const cBenchmarkResult& result : results) {
+    if ((result.sName.find("blob") == 0) && (result.nsPerOperation > 0.0)) std::cout<<result.sName<<": "<<std::fixed<<std::setprecision(2)<<(double(BENCHMARK_BLOB_SIZE) / result.nsPerOperation)<<" GB/s"<<std::endl;
+  }
 }
 
 void PrintUsage(const std::string& sExecutableName)
 {
-  std::cout<<"Usage: "<<sExecutableName<<" VARIABLE VALUE"<<std::endl;
+  std::cout<<"Usage: "<<sExecutableName<<" [--seed N] VARIABLE VALUE"<<std::endl;
+  std::cout<<"       "<<sExecutableName<<" [--seed N] --manifest FILE [--output HEADER]"<<std::endl;
+  std::cout<<"       "<<sExecutableName<<" [--seed N] --blob VARIABLE FILE [--output HEADER]"<<std::endl;
+  std::cout<<"       "<<sExecutableName<<" --benchmark [FILTER]"<<std::endl;
   std::cout<<"Given a variable and a string it will create a header with a function that can be included in your project to store and decrypt the string"<<std::endl;
+  std::cout<<"The same input always creates the same header, a header that hasn't changed isn't written again"<<std::endl;
+  std::cout<<"  --seed N: Mixed into the seed for each secret, change it to encode the same secrets differently (Default 0)"<<std::endl;
+  std::cout<<"  --manifest FILE: Create one header for every secret in FILE, each line is \"VARIABLE VALUE\", lines starting with # are skipped"<<std::endl;
+  std::cout<<"  --blob VARIABLE FILE: Create a header that embeds the binary FILE as an aligned array with a function to decode it into a buffer"<<std::endl;
+  std::cout<<"  --output HEADER: The header to create for --manifest or --blob (Default discombobulator_secrets.h or discombobulator_VARIABLE.h)"<<std::endl;
+  std::cout<<"  --benchmark [FILTER]: Compare decoding with a generated header and with discombobulator.h instead of creating a header"<<std::endl;
 }
 
 int main(int argc, char** argv)
 {
-  std::string sName;
-  std::string sSecret;
+  uint64_t userSeed = 0;
+  std::string sManifestFilePath;
+  std::string sHeaderFilePath;
+  std::string sBlobName;
+  std::string sBlobFilePath;
+  std::vector<std::string> values;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string sArgument(argv[i]);
+    const bool bHasValue = ((i + 1) < argc);
 
-  if (argc == 3) {
-    sName = argv[1];
-    sSecret = argv[2];
-  } else {
-    // Either "--help" or incorrect number of arguments, either way we just want to print the usage and exit
-    PrintUsage(argv[0]);
-    return EXIT_FAILURE;
+    if ((sArgument == "-h") || (sArgument == "--help")) {
+      PrintUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (sArgument == "--benchmark") {
+      RunBenchmarks(bHasValue ? argv[i + 1] : "");
+      return EXIT_SUCCESS;
+    } else if ((sArgument == "--seed") && bHasValue) {
+      const std::string sSeed(argv[++i]);
+      if (sSeed.empty() || (sSeed.find_first_not_of("0123456789") != std::string::npos)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      userSeed = std::stoull(sSeed);
+    } else if ((sArgument == "--manifest") && bHasValue) sManifestFilePath = argv[++i];
+    else if ((sArgument == "--output") && bHasValue) sHeaderFilePath = argv[++i];
+    else if ((sArgument == "--blob") && ((i + 2) < argc)) {
+      sBlobName = argv[++i];
+      sBlobFilePath = argv[++i];
+    }
+    else values.push_back(sArgument);
   }
 
-  CreateHeaderForNameAndSecret(sName, sSecret);
+  if (!sManifestFilePath.empty() && sBlobName.empty() && values.empty()) {
+    std::vector<cManifestSecret> secrets;
+    if (!ReadManifest(sManifestFilePath, secrets)) return EXIT_FAILURE;
 
-  return EXIT_SUCCESS;
-}
+    return CreateHeaderForManifest(sHeaderFilePath.empty() ? "discombobulator_secrets.h" : sHeaderFilePath, secrets, userSeed) ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else if (!sBlobName.empty() && sManifestFilePath.empty() && values.empty()) {
+    return CreateHeaderForBlob(sBlobName, sBlobFilePath, sHeaderFilePath.empty() ? ("discombobulator_" + string::ToLower(sBlobName) + ".h") : sHeaderFilePath, userSeed) ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else if (sManifestFilePath.empty() && sBlobName.empty() && (values.size() == 2)) {
+    return CreateHeaderForNameAndSecret(values[0], values[1], userSeed) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
+  // Either incorrect arguments or the wrong number of them, either way we just want to print the usage and exit
+  PrintUsage(argv[0]);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+#include <cassert>
+
+#include <algorithm>
+
+#include "biginteger.h"
+
+cBigUnsigned::cBigUnsigned()
+{
+}
+
+cBigUnsigned::cBigUnsigned(uint64_t value)
+{
+  while (value != 0) {
+    limbs.push_back(uint32_t(value));
+    value >>= 32;
+  }
+}
+
+void cBigUnsigned::Trim()
+{
+  while (!limbs.empty() && (limbs.back() == 0)) limbs.pop_back();
+}
+
+void cBigUnsigned::Add(const cBigUnsigned& rhs)
+{
+  if (limbs.size() < rhs.limbs.size()) limbs.resize(rhs.limbs.size(), 0);
+
+  uint64_t carry = 0;
+  for (size_t i = 0; i < limbs.size(); i++) {
+    const uint64_t sum = uint64_t(limbs[i]) + ((i < rhs.limbs.size()) ? rhs.limbs[i] : 0) + carry;
+    limbs[i] = uint32_t(sum);
+    carry = sum >> 32;
+
+    // Nothing left to add
+    if ((carry == 0) && (i >= rhs.limbs.size())) break;
+  }
+
+  if (carry != 0) limbs.push_back(uint32_t(carry));
+}
+
+void cBigUnsigned::Multiply(uint32_t rhs)
+{
+  uint64_t carry = 0;
+  for (uint32_t& limb : limbs) {
+    const uint64_t product = (uint64_t(limb) * rhs) + carry;
+    limb = uint32_t(product);
+    carry = product >> 32;
+  }
+
+  if (carry != 0) limbs.push_back(uint32_t(carry));
+
+  Trim();
+}
+
+void cBigUnsigned::Multiply(const cBigUnsigned& rhs)
+{
+  if (IsZero() || rhs.IsZero()) {
+    limbs.clear();
+    return;
+  }
+
+  // Schoolbook multiplication, the numbers we deal with are only a few limbs long
+  std::vector<uint32_t> result(limbs.size() + rhs.limbs.size(), 0);
+  for (size_t i = 0; i < limbs.size(); i++) {
+    uint64_t carry = 0;
+    for (size_t j = 0; j < rhs.limbs.size(); j++) {
+      const uint64_t product = (uint64_t(limbs[i]) * rhs.limbs[j]) + result[i + j] + carry;
+      result[i + j] = uint32_t(product);
+      carry = product >> 32;
+    }
+    result[i + rhs.limbs.size()] = uint32_t(carry);
+  }
+
+  limbs.swap(result);
+  Trim();
+}
+
+uint32_t cBigUnsigned::Divide(uint32_t rhs)
+{
+  assert(rhs != 0);
+
+  uint64_t remainder = 0;
+  for (size_t i = limbs.size(); i != 0; i--) {
+    const uint64_t value = (remainder << 32) | limbs[i - 1];
+    limbs[i - 1] = uint32_t(value / rhs);
+    remainder = value % rhs;
+  }
+
+  Trim();
+
+  return uint32_t(remainder);
+}
+
+std::string cBigUnsigned::ToString() const
+{
+  if (IsZero()) return "0";
+
+  // Peel off 9 decimal digits at a time
+  cBigUnsigned value(*this);
+  std::vector<uint32_t> groups;
+  while (!value.IsZero()) groups.push_back(value.Divide(1000000000));
+
+  std::string sResult = std::to_string(groups.back());
+  for (size_t i = groups.size() - 1; i != 0; i--) {
+    const std::string sGroup = std::to_string(groups[i - 1]);
+    sResult.append(9 - sGroup.length(), '0');
+    sResult += sGroup;
+  }
+
+  return sResult;
+}
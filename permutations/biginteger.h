@@ -0,0 +1,37 @@
+#ifndef BIGINTEGER_H
+#define BIGINTEGER_H
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+// ** cBigUnsigned
+//
+// An arbitrary size unsigned integer, just enough to count permutations exactly
+// The value is stored as base 2^32 limbs with the least significant limb first, there are never any leading zero limbs
+
+class cBigUnsigned
+{
+public:
+  cBigUnsigned();
+  explicit cBigUnsigned(uint64_t value);
+
+  bool IsZero() const { return limbs.empty(); }
+
+  void Add(const cBigUnsigned& rhs);
+  void Multiply(uint32_t rhs);
+  void Multiply(const cBigUnsigned& rhs);
+
+  // Divides in place and returns the remainder
+  uint32_t Divide(uint32_t rhs);
+
+  std::string ToString() const;
+
+private:
+  void Trim();
+
+  std::vector<uint32_t> limbs;
+};
+
+#endif // BIGINTEGER_H
@@ -0,0 +1,19 @@
+#ifndef CHUNKSLOT_H
+#define CHUNKSLOT_H
+
+#include <cstdint>
+
+#include <vector>
+
+// ** cChunkSlot
+//
+// A slot holds one chunk while it is generated and until it is written out
+// The workers each fill a slot in the same vector, size_test --layout checks it for false sharing
+
+struct cChunkSlot {
+  uint64_t chunk; // The chunk that this slot is for next
+  bool bReady;    // True when the chunk has been generated and is waiting to be written
+  std::vector<char> data;
+};
+
+#endif // CHUNKSLOT_H
@@ -0,0 +1,306 @@
+#include <cstring>
+
+#include <algorithm>
+
+#ifdef BUILD_PERMUTATIONS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef BUILD_PERMUTATIONS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef BUILD_PERMUTATIONS_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "compressor.h"
+
+namespace
+{
+#ifdef BUILD_PERMUTATIONS_ZLIB
+  // ** cGzipCompressor
+
+  class cGzipCompressor : public cCompressor
+  {
+  public:
+    cGzipCompressor();
+    ~cGzipCompressor();
+
+    bool IsValid() const { return bValid; }
+
+    bool Compress(const char* pData, size_t length, std::vector<char>& output) override;
+    bool Finish(std::vector<char>& output) override;
+
+  private:
+    bool Deflate(int flush, std::vector<char>& output);
+
+    z_stream stream;
+    bool bValid;
+  };
+
+  cGzipCompressor::cGzipCompressor() :
+    bValid(false)
+  {
+    memset(&stream, 0, sizeof(stream));
+
+    // Adding 16 to the window bits writes a gzip header and trailer instead of a zlib one
+    bValid = (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  }
+
+  cGzipCompressor::~cGzipCompressor()
+  {
+    if (bValid) deflateEnd(&stream);
+  }
+
+  bool cGzipCompressor::Deflate(int flush, std::vector<char>& output)
+  {
+    const size_t chunk = 64 * 1024;
+
+    while (true) {
+      const size_t before = output.size();
+      output.resize(before + chunk);
+      stream.next_out = reinterpret_cast<Bytef*>(&output[before]);
+      stream.avail_out = uInt(chunk);
+
+      const int result = deflate(&stream, flush);
+      output.resize(before + (chunk - stream.avail_out));
+      if ((result != Z_OK) && (result != Z_STREAM_END) && (result != Z_BUF_ERROR)) return false;
+
+      // Keep going while deflate is filling the output
+      if (flush == Z_FINISH) {
+        if (result == Z_STREAM_END) return true;
+      } else if ((stream.avail_out != 0) && (stream.avail_in == 0)) return true;
+    }
+  }
+
+  bool cGzipCompressor::Compress(const char* pData, size_t length, std::vector<char>& output)
+  {
+    // avail_in is only 32 bits
+    while (length != 0) {
+      const size_t n = std::min<size_t>(length, 1024 * 1024 * 1024);
+      stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pData));
+      stream.avail_in = uInt(n);
+      if (!Deflate(Z_NO_FLUSH, output)) return false;
+
+      pData += n;
+      length -= n;
+    }
+
+    return true;
+  }
+
+  bool cGzipCompressor::Finish(std::vector<char>& output)
+  {
+    stream.next_in = nullptr;
+    stream.avail_in = 0;
+    return Deflate(Z_FINISH, output);
+  }
+#endif
+
+#ifdef BUILD_PERMUTATIONS_ZSTD
+  // ** cZstdCompressor
+
+  class cZstdCompressor : public cCompressor
+  {
+  public:
+    cZstdCompressor();
+    ~cZstdCompressor();
+
+    bool IsValid() const { return (pContext != nullptr); }
+
+    bool Compress(const char* pData, size_t length, std::vector<char>& output) override;
+    bool Finish(std::vector<char>& output) override;
+
+  private:
+    bool CompressStream(ZSTD_inBuffer& input, ZSTD_EndDirective directive, std::vector<char>& output);
+
+    ZSTD_CCtx* pContext;
+  };
+
+  cZstdCompressor::cZstdCompressor() :
+    pContext(ZSTD_createCCtx())
+  {
+    if (pContext != nullptr) ZSTD_CCtx_setParameter(pContext, ZSTD_c_compressionLevel, 1);
+  }
+
+  cZstdCompressor::~cZstdCompressor()
+  {
+    if (pContext != nullptr) ZSTD_freeCCtx(pContext);
+  }
+
+  bool cZstdCompressor::CompressStream(ZSTD_inBuffer& input, ZSTD_EndDirective directive, std::vector<char>& output)
+  {
+    const size_t chunk = ZSTD_CStreamOutSize();
+
+    while (true) {
+      const size_t before = output.size();
+      output.resize(before + chunk);
+      ZSTD_outBuffer buffer = { &output[before], chunk, 0 };
+
+      const size_t remaining = ZSTD_compressStream2(pContext, &buffer, &input, directive);
+      output.resize(before + buffer.pos);
+      if (ZSTD_isError(remaining)) return false;
+
+      // Ending the frame is done when there is nothing left to flush, otherwise we are done once all of the input has been taken
+      if (directive == ZSTD_e_end) {
+        if (remaining == 0) return true;
+      } else if (input.pos == input.size) return true;
+    }
+  }
+
+  bool cZstdCompressor::Compress(const char* pData, size_t length, std::vector<char>& output)
+  {
+    ZSTD_inBuffer input = { pData, length, 0 };
+    return CompressStream(input, ZSTD_e_continue, output);
+  }
+
+  bool cZstdCompressor::Finish(std::vector<char>& output)
+  {
+    ZSTD_inBuffer input = { nullptr, 0, 0 };
+    return CompressStream(input, ZSTD_e_end, output);
+  }
+#endif
+
+#ifdef BUILD_PERMUTATIONS_LZ4
+  // ** cLZ4Compressor
+
+  class cLZ4Compressor : public cCompressor
+  {
+  public:
+    cLZ4Compressor();
+    ~cLZ4Compressor();
+
+    bool IsValid() const { return (pContext != nullptr); }
+
+    bool Compress(const char* pData, size_t length, std::vector<char>& output) override;
+    bool Finish(std::vector<char>& output) override;
+
+  private:
+    // Writes the frame header the first time it is called
+    bool Begin(std::vector<char>& output);
+
+    LZ4F_cctx* pContext;
+    bool bStarted;
+  };
+
+  cLZ4Compressor::cLZ4Compressor() :
+    pContext(nullptr),
+    bStarted(false)
+  {
+    if (LZ4F_isError(LZ4F_createCompressionContext(&pContext, LZ4F_VERSION))) pContext = nullptr;
+  }
+
+  cLZ4Compressor::~cLZ4Compressor()
+  {
+    if (pContext != nullptr) LZ4F_freeCompressionContext(pContext);
+  }
+
+  bool cLZ4Compressor::Begin(std::vector<char>& output)
+  {
+    if (bStarted) return true;
+
+    const size_t before = output.size();
+    output.resize(before + LZ4F_HEADER_SIZE_MAX);
+    const size_t written = LZ4F_compressBegin(pContext, &output[before], LZ4F_HEADER_SIZE_MAX, nullptr);
+    if (LZ4F_isError(written)) {
+      output.resize(before);
+      return false;
+    }
+
+    output.resize(before + written);
+    bStarted = true;
+    return true;
+  }
+
+  bool cLZ4Compressor::Compress(const char* pData, size_t length, std::vector<char>& output)
+  {
+    if (!Begin(output)) return false;
+
+    const size_t before = output.size();
+    const size_t bound = LZ4F_compressBound(length, nullptr);
+    output.resize(before + bound);
+    const size_t written = LZ4F_compressUpdate(pContext, &output[before], bound, pData, length, nullptr);
+    if (LZ4F_isError(written)) {
+      output.resize(before);
+      return false;
+    }
+
+    output.resize(before + written);
+    return true;
+  }
+
+  bool cLZ4Compressor::Finish(std::vector<char>& output)
+  {
+    if (!Begin(output)) return false;
+
+    const size_t before = output.size();
+    const size_t bound = LZ4F_compressBound(0, nullptr);
+    output.resize(before + bound);
+    const size_t written = LZ4F_compressEnd(pContext, &output[before], bound, nullptr);
+    if (LZ4F_isError(written)) {
+      output.resize(before);
+      return false;
+    }
+
+    output.resize(before + written);
+    return true;
+  }
+#endif
+}
+
+const char* GetCompressionName(COMPRESSION compression)
+{
+  switch (compression) {
+    case COMPRESSION::NONE: return "none";
+    case COMPRESSION::GZIP: return "gzip";
+    case COMPRESSION::ZSTD: return "zstd";
+    case COMPRESSION::LZ4: return "lz4";
+    default: return "unknown";
+  }
+}
+
+bool IsCompressionSupported(COMPRESSION compression)
+{
+  switch (compression) {
+    case COMPRESSION::NONE: return true;
+#ifdef BUILD_PERMUTATIONS_ZLIB
+    case COMPRESSION::GZIP: return true;
+#endif
+#ifdef BUILD_PERMUTATIONS_ZSTD
+    case COMPRESSION::ZSTD: return true;
+#endif
+#ifdef BUILD_PERMUTATIONS_LZ4
+    case COMPRESSION::LZ4: return true;
+#endif
+    default: return false;
+  }
+}
+
+std::unique_ptr<cCompressor> CreateCompressor(COMPRESSION compression)
+{
+  switch (compression) {
+#ifdef BUILD_PERMUTATIONS_ZLIB
+    case COMPRESSION::GZIP: {
+      std::unique_ptr<cGzipCompressor> pCompressor(new cGzipCompressor);
+      if (pCompressor->IsValid()) return pCompressor;
+      break;
+    }
+#endif
+#ifdef BUILD_PERMUTATIONS_ZSTD
+    case COMPRESSION::ZSTD: {
+      std::unique_ptr<cZstdCompressor> pCompressor(new cZstdCompressor);
+      if (pCompressor->IsValid()) return pCompressor;
+      break;
+    }
+#endif
+#ifdef BUILD_PERMUTATIONS_LZ4
+    case COMPRESSION::LZ4: {
+      std::unique_ptr<cLZ4Compressor> pCompressor(new cLZ4Compressor);
+      if (pCompressor->IsValid()) return pCompressor;
+      break;
+    }
+#endif
+    default: break;
+  }
+
+  return nullptr;
+}
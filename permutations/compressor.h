@@ -0,0 +1,47 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <cstddef>
+
+#include <memory>
+#include <vector>
+
+// ** Compression
+//
+// Permutation output is extremely repetitive so it compresses very well, compressing it is usually much faster than writing it to a disk
+// Each library is optional, it is only available if it was found when building
+// The fastest level of each format is used so that the compressor can keep up with the generator
+
+enum class COMPRESSION {
+  NONE,
+  GZIP, // zlib
+  ZSTD, // libzstd
+  LZ4,  // liblz4, the frame format
+};
+
+const char* GetCompressionName(COMPRESSION compression);
+
+// Returns true if this build can compress with compression
+bool IsCompressionSupported(COMPRESSION compression);
+
+
+// ** cCompressor
+//
+// A streaming compressor, the output of all the calls together is one complete compressed stream
+
+class cCompressor
+{
+public:
+  virtual ~cCompressor() {}
+
+  // Compresses length bytes and appends any compressed data to output, the compressor may hold on to some of it until later calls
+  virtual bool Compress(const char* pData, size_t length, std::vector<char>& output) = 0;
+
+  // Appends the rest of the compressed data and the end of the stream to output
+  virtual bool Finish(std::vector<char>& output) = 0;
+};
+
+// Returns null if compression is not supported by this build
+std::unique_ptr<cCompressor> CreateCompressor(COMPRESSION compression);
+
+#endif // COMPRESSOR_H
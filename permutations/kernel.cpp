@@ -0,0 +1,118 @@
+#include <cassert>
+#include <cstring>
+
+#include <algorithm>
+
+#ifdef __x86_64__
+#define BUILD_PERMUTATIONS_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#include "kernel.h"
+#include "permutation.h"
+
+namespace
+{
+  // The tail has 5! = 120 orderings, the shuffles take 1920 bytes which easily stays in the L1 cache
+  const size_t MAX_TAIL_LENGTH = 5;
+
+#ifdef BUILD_PERMUTATIONS_SSSE3
+  // pLine holds the symbols and then the newline, each shuffle reorders the tail and leaves the rest of the line where it is
+  template <size_t N>
+  __attribute__((target("ssse3"))) void WriteBlockN(const char* pLine, const std::array<uint8_t, 16>* pShuffles, size_t nShuffles, char* pOutput)
+  {
+    const __m128i line = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pLine));
+
+    for (size_t i = 0; i < nShuffles; i++) {
+      const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pShuffles[i].data()));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput), _mm_shuffle_epi8(line, shuffle));
+
+      // There is no room for the newline in the register when there are 16 symbols
+      if (N == cPermutationKernel::MAX_LENGTH) pOutput[N] = '\n';
+
+      pOutput += N + 1;
+    }
+  }
+#endif
+}
+
+// ** cPermutationKernel
+
+bool cPermutationKernel::IsSupported(const std::string& sSymbols)
+{
+#ifdef BUILD_PERMUTATIONS_SSSE3
+  if (sSymbols.empty() || (sSymbols.length() > MAX_LENGTH)) return false;
+
+  std::string sSorted(sSymbols);
+  SortSymbols(sSorted);
+  if (std::adjacent_find(sSorted.begin(), sSorted.end()) != sSorted.end()) return false;
+
+  return __builtin_cpu_supports("ssse3");
+#else
+  (void)sSymbols;
+  return false;
+#endif
+}
+
+cPermutationKernel::cPermutationKernel(size_t _length) :
+  length(_length),
+  tailLength(std::min(_length, MAX_TAIL_LENGTH)),
+  pWriteBlock(nullptr)
+{
+  assert((length != 0) && (length <= MAX_LENGTH));
+
+  // Build a shuffle for each ordering of the tail in lexicographical order
+  const size_t tailStart = length - tailLength;
+  std::vector<uint8_t> order;
+  for (size_t i = 0; i < tailLength; i++) order.push_back(uint8_t(tailStart + i));
+
+  do {
+    std::array<uint8_t, 16> shuffle;
+    for (size_t i = 0; i < shuffle.size(); i++) shuffle[i] = uint8_t(i);
+    for (size_t i = 0; i < tailLength; i++) shuffle[tailStart + i] = order[i];
+    shuffles.push_back(shuffle);
+  } while (std::next_permutation(order.begin(), order.end()));
+
+#ifdef BUILD_PERMUTATIONS_SSSE3
+  switch (length) {
+    case 1: pWriteBlock = &WriteBlockN<1>; break;
+    case 2: pWriteBlock = &WriteBlockN<2>; break;
+    case 3: pWriteBlock = &WriteBlockN<3>; break;
+    case 4: pWriteBlock = &WriteBlockN<4>; break;
+    case 5: pWriteBlock = &WriteBlockN<5>; break;
+    case 6: pWriteBlock = &WriteBlockN<6>; break;
+    case 7: pWriteBlock = &WriteBlockN<7>; break;
+    case 8: pWriteBlock = &WriteBlockN<8>; break;
+    case 9: pWriteBlock = &WriteBlockN<9>; break;
+    case 10: pWriteBlock = &WriteBlockN<10>; break;
+    case 11: pWriteBlock = &WriteBlockN<11>; break;
+    case 12: pWriteBlock = &WriteBlockN<12>; break;
+    case 13: pWriteBlock = &WriteBlockN<13>; break;
+    case 14: pWriteBlock = &WriteBlockN<14>; break;
+    case 15: pWriteBlock = &WriteBlockN<15>; break;
+    case 16: pWriteBlock = &WriteBlockN<16>; break;
+  }
+#endif
+}
+
+bool cPermutationKernel::IsBlockStart(const std::string& sPermutation) const
+{
+  assert(sPermutation.length() == length);
+  return std::is_sorted(sPermutation.end() - tailLength, sPermutation.end(), IsSymbolLess);
+}
+
+bool cPermutationKernel::WriteBlock(std::string& sPermutation, char* pOutput) const
+{
+  assert(pWriteBlock != nullptr);
+  assert(IsBlockStart(sPermutation));
+
+  char line[16] = { 0 };
+  memcpy(line, sPermutation.data(), length);
+  if (length < MAX_LENGTH) line[length] = '\n';
+
+  pWriteBlock(line, shuffles.data(), shuffles.size(), pOutput);
+
+  // The block finished with the tail in reverse order, step the prefix in front of it on
+  std::reverse(sPermutation.end() - tailLength, sPermutation.end());
+  return NextPermutation(sPermutation.begin(), sPermutation.end());
+}
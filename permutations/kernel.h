@@ -0,0 +1,54 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <string>
+#include <vector>
+
+// ** cPermutationKernel
+//
+// A fast path for permutations of up to 16 distinct symbols, a whole line fits in a 16 byte SSE register
+// In lexicographical order the last few symbols cycle through every ordering before anything in front of them changes,
+// so a block of permutations is generated with one pshufb of the current line per permutation using a precomputed shuffle for each ordering of the tail
+// Each line is written with a single 16 byte store which includes the newline, then the output pointer moves on by the length of the line
+// Only the prefix in front of the tail is stepped with next_permutation, once per block
+// The block writer is a template on the length so each length gets its own fully unrolled loop
+//
+// Repeated symbols would produce duplicate orderings of the tail so those inputs use the string loop instead
+
+class cPermutationKernel
+{
+public:
+  static const size_t MAX_LENGTH = 16;
+
+  // WriteBlock can write up to this many bytes past the end of the block
+  static const size_t OUTPUT_SLACK = 16;
+
+  // Returns true if sSymbols has at most MAX_LENGTH symbols, no repeated symbols and the processor supports SSSE3
+  static bool IsSupported(const std::string& sSymbols);
+
+  explicit cPermutationKernel(size_t length);
+
+  uint64_t GetBlockPermutations() const { return shuffles.size(); }
+  size_t GetBlockBytes() const { return shuffles.size() * (length + 1); }
+
+  // Returns true if sPermutation is the first permutation of a block, the tail of the permutation is in order
+  bool IsBlockStart(const std::string& sPermutation) const;
+
+  // Writes the block of permutations starting at sPermutation to pOutput which must have room for GetBlockBytes() + OUTPUT_SLACK bytes
+  // Then steps sPermutation on to the start of the next block, returns false if this was the last block
+  bool WriteBlock(std::string& sPermutation, char* pOutput) const;
+
+private:
+  typedef void (*write_block_function_t)(const char* pLine, const std::array<uint8_t, 16>* pShuffles, size_t nShuffles, char* pOutput);
+
+  const size_t length;
+  size_t tailLength;
+  std::vector<std::array<uint8_t, 16>> shuffles; // One for each ordering of the tail, in lexicographical order
+  write_block_function_t pWriteBlock;
+};
+
+#endif // KERNEL_H
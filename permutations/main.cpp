@@ -1,23 +1,488 @@
+// Prints every distinct permutation of the input string in lexicographical order, one per line
+// Repeated symbols only produce distinct permutations, the input is sorted first so nothing is missed
+// The permutations are streamed straight into a fixed size output buffer as they are generated so memory use doesn't depend on how many there are
+//
+// With --jobs N the permutations are split into chunks, each worker jumps straight to the start of a chunk by unranking it and then steps through it with next_permutation
+// The chunks are written out in order so the output is exactly the same as with one job
+// With --shard I/N only the I'th of N equal parts of the permutations is printed, so the work can be split across processes or machines
+//
+// Up to 16 distinct symbols use cPermutationKernel which writes a block of permutations with one SSE shuffle and store per line, --benchmark compares it with the string loop
+//
+// The output goes through cOutputBuffer which writes several page aligned batches at once with writev, or with --vmsplice splices them into a pipe
+// With --gzip, --zstd or --lz4 the output is compressed on another thread, the output is so repetitive that this is faster than writing it to most disks
+//
+// With --k K the permutations of each combination of K symbols are printed instead, the combinations are in lexicographical order and so are the permutations of each one
+// With --count nothing is generated, the number of permutations is calculated exactly
+
+#include <cassert>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iomanip>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
-#include <iterator>
+
+#include <unistd.h>
+
+// Application headers
+#include "benchmark.h"
+#include "chunkslot.h"
+#include "kernel.h"
+#include "output.h"
+#include "permutation.h"
+
+// Each chunk is about this big when it is written out
+const size_t CHUNK_BYTES = 1024 * 1024;
+
+// WritePermutations generates about this much directly into the output buffer at a time
+const size_t WRITE_BYTES = 64 * 1024;
+
+void PrintUsage(const std::string& sExecutableName)
+{
+  std::cout<<"Usage: "<<sExecutableName<<" [--count] [--k K] [--jobs N] [--shard I/N] [--gzip|--zstd|--lz4] [--vmsplice] [--benchmark [FILTER]] [STRING]"<<std::endl;
+  std::cout<<"Prints the distinct permutations of STRING in lexicographical order, one per line"<<std::endl;
+  std::cout<<"If STRING is not specified the first line of standard input is used"<<std::endl;
+  std::cout<<"  --count: Print the number of permutations instead of the permutations"<<std::endl;
+  std::cout<<"  --k K: Print the permutations of K of the symbols instead of all of them (Can't be used with --jobs or --shard)"<<std::endl;
+  std::cout<<"  --jobs N: Generate the permutations on N threads, the output is in the same order (0 uses every core)"<<std::endl;
+  std::cout<<"  --shard I/N: Only print the I'th of N equal parts of the output, I is from 1 to N"<<std::endl;
+  std::cout<<"  --gzip, --zstd, --lz4: Compress the output on another thread (If this build has the library)"<<std::endl;
+  std::cout<<"  --vmsplice: When the output is a pipe, map the output into it instead of copying it, only for readers that read from the pipe, a reader that splices it onwards (pv for example) gets corrupt output"<<std::endl;
+  std::cout<<"  --benchmark [FILTER]: Compare generating permutations with the string loop and the SSE kernel instead of printing them"<<std::endl;
+}
+
+// Returns the kernel for sSymbols, or null if the string loop has to be used
+std::unique_ptr<cPermutationKernel> CreateKernel(const std::string& sSymbols)
+{
+  if (!cPermutationKernel::IsSupported(sSymbols)) return nullptr;
+
+  return std::unique_ptr<cPermutationKernel>(new cPermutationKernel(sSymbols.length()));
+}
+
+// Rounds permutations down to whole blocks of the kernel so that the next batch starts at the start of a block
+uint64_t RoundToKernelBlocks(const cPermutationKernel* pKernel, uint64_t permutations)
+{
+  if (pKernel == nullptr) return permutations;
+
+  const uint64_t blockPermutations = pKernel->GetBlockPermutations();
+  return std::max(blockPermutations, permutations - (permutations % blockPermutations));
+}
+
+// Writes up to count permutations starting with permutation to pOutput and steps permutation on past them, whole blocks use the kernel if pKernel isn't null
+// pOutput must have room for count lines plus cPermutationKernel::OUTPUT_SLACK bytes, it is moved on to the end of the output
+// Returns false once the last permutation has been written
+bool WritePermutationsToMemory(std::string& permutation, uint64_t count, const cPermutationKernel* pKernel, char*& pOutput)
+{
+  const size_t length = permutation.length();
+
+  uint64_t i = 0;
+  while (i < count) {
+    if ((pKernel != nullptr) && ((count - i) >= pKernel->GetBlockPermutations()) && pKernel->IsBlockStart(permutation)) {
+      const bool bMore = pKernel->WriteBlock(permutation, pOutput);
+      pOutput += pKernel->GetBlockBytes();
+      i += pKernel->GetBlockPermutations();
+      if (!bMore) return false;
+      continue;
+    }
+
+    std::copy(permutation.begin(), permutation.end(), pOutput);
+    pOutput[length] = '\n';
+    pOutput += length + 1;
+    i++;
+
+    if (!NextPermutation(permutation.begin(), permutation.end())) return false;
+  }
+
+  return true;
+}
+
+// Writes count permutations (Or all of them if count is UINT64_MAX) starting with input
+void WritePermutations(std::string input, uint64_t count, cOutputBuffer& output)
+{
+  const std::unique_ptr<cPermutationKernel> pKernel = CreateKernel(input);
+
+  // The permutations are generated straight into the output buffer, nothing is allocated once we start
+  const size_t lineLength = input.length() + 1;
+  const uint64_t permutationsPerWrite = RoundToKernelBlocks(pKernel.get(), std::max<uint64_t>(1, WRITE_BYTES / lineLength));
+
+  while ((count != 0) && output.IsOK()) {
+    const uint64_t n = std::min(count, permutationsPerWrite);
+
+    char* const pBegin = output.Reserve((size_t(n) * lineLength) + cPermutationKernel::OUTPUT_SLACK);
+    char* pOutput = pBegin;
+    const bool bMore = WritePermutationsToMemory(input, n, pKernel.get(), pOutput);
+    output.Commit(size_t(pOutput - pBegin));
+
+    if (!bMore) break;
+    count -= n;
+  }
+}
+
+// Writes every distinct k-permutation by choosing each combination of k symbols and then writing the permutations of that combination
+// Nothing is generated just to be thrown away, unlike generating the full permutations and skipping the ones with the same prefix
+class cKPermutationWriter
+{
+public:
+  cKPermutationWriter(const std::string& sSortedSymbols, size_t k, cOutputBuffer& output);
+
+  void Write();
+
+private:
+  // Chooses how many of symbols[index] go in the combination, then moves on to the next symbol
+  void Choose(size_t index, size_t remaining);
+
+  const size_t k;
+  cOutputBuffer& output;
+
+  std::vector<char> symbols;         // Each distinct symbol in order
+  std::vector<size_t> counts;        // How many of each symbol there are
+  std::vector<size_t> countsAfter;   // How many symbols there are from this index to the end
+  std::string combination;
+};
+
+cKPermutationWriter::cKPermutationWriter(const std::string& sSortedSymbols, size_t _k, cOutputBuffer& _output) :
+  k(_k),
+  output(_output)
+{
+  for (const char c : sSortedSymbols) {
+    if (symbols.empty() || (symbols.back() != c)) {
+      symbols.push_back(c);
+      counts.push_back(0);
+    }
+    counts.back()++;
+  }
+
+  countsAfter.resize(symbols.size() + 1, 0);
+  for (size_t i = symbols.size(); i != 0; i--) countsAfter[i - 1] = countsAfter[i] + counts[i - 1];
+}
+
+void cKPermutationWriter::Write()
+{
+  if (k > countsAfter[0]) return;
+
+  combination.reserve(k);
+  Choose(0, k);
+}
+
+void cKPermutationWriter::Choose(size_t index, size_t remaining)
+{
+  if (!output.IsOK()) return;
+
+  if (remaining == 0) {
+    // The combination is built in order so it is already the first permutation
+    WritePermutations(combination, UINT64_MAX, output);
+    return;
+  }
+
+  // Not enough symbols left to fill the combination
+  if (remaining > countsAfter[index]) return;
+
+  // Taking more of the smaller symbol comes first lexicographically
+  const size_t maximum = std::min(counts[index], remaining);
+  combination.append(maximum, symbols[index]);
+  for (size_t take = maximum; ; take--) {
+    Choose(index + 1, remaining - take);
+
+    if (take == 0) break;
+    combination.pop_back();
+  }
+}
+
+// Writes count permutations starting at rank first using nJobs worker threads
+void WritePermutationsParallel(const std::string& sSymbols, uint64_t first, uint64_t count, size_t nJobs, cOutputBuffer& output)
+{
+  if (count == 0) return;
+
+  const std::unique_ptr<cPermutationKernel> pKernel = CreateKernel(sSymbols);
+
+  const size_t lineLength = sSymbols.length() + 1;
+  const uint64_t permutationsPerChunk = RoundToKernelBlocks(pKernel.get(), std::max<uint64_t>(1, CHUNK_BYTES / lineLength));
+  const uint64_t nChunks = (count / permutationsPerChunk) + (((count % permutationsPerChunk) != 0) ? 1 : 0);
+
+  // Two slots for each worker so that workers can keep generating while the previous chunks are being written
+  const size_t nSlots = 2 * nJobs;
+  std::vector<cChunkSlot> slots(nSlots);
+  for (size_t i = 0; i < nSlots; i++) {
+    slots[i].chunk = i;
+    slots[i].bReady = false;
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::atomic<uint64_t> nextChunk(0);
+  bool bStop = false;
+
+  auto worker = [&]() {
+    std::string permutation;
+
+    while (true) {
+      const uint64_t chunk = nextChunk++;
+      if (chunk >= nChunks) break;
+
+      // Wait for the writer to finish with the chunk that was in this slot before
+      cChunkSlot& slot = slots[chunk % nSlots];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return bStop || ((slot.chunk == chunk) && !slot.bReady); });
+        if (bStop) break;
+      }
+
+      // The slot is ours until we mark it as ready
+      const uint64_t chunkFirst = first + (chunk * permutationsPerChunk);
+      const uint64_t chunkCount = std::min(permutationsPerChunk, count - (chunk * permutationsPerChunk));
+
+      const bool bResult = UnrankPermutation(sSymbols, chunkFirst, permutation);
+      assert(bResult);
+      (void)bResult;
+
+      slot.data.resize((size_t(chunkCount) * lineLength) + cPermutationKernel::OUTPUT_SLACK);
+      char* pOutput = slot.data.data();
+      WritePermutationsToMemory(permutation, chunkCount, pKernel.get(), pOutput);
+      slot.data.resize(size_t(pOutput - slot.data.data()));
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.bReady = true;
+      }
+      condition.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < nJobs; i++) threads.push_back(std::thread(worker));
+
+  // Write the chunks out in order
+  for (uint64_t chunk = 0; chunk < nChunks; chunk++) {
+    cChunkSlot& slot = slots[chunk % nSlots];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&]() { return slot.bReady; });
+    }
+
+    output.Append(slot.data.data(), slot.data.size());
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.bReady = false;
+      slot.chunk = chunk + nSlots;
+
+      // Tell the workers to give up if the output has gone away
+      if (!output.IsOK()) bStop = true;
+    }
+    condition.notify_all();
+
+    if (!output.IsOK()) break;
+  }
+
+  for (std::thread& thread : threads) thread.join();
+}
+
+// ** Benchmarks
+//
+// Each operation is one permutation of BENCHMARK_SYMBOLS generated into memory, nothing is written out so only generating the lines is measured
+
+const std::string BENCHMARK_SYMBOLS = "ABCDEFGHIJ";
+
+void BenchmarkWritePermutations(size_t iterations, const cPermutationKernel* pKernel)
+{
+  static std::vector<char> buffer(CHUNK_BYTES + cPermutationKernel::OUTPUT_SLACK);
+
+  const uint64_t permutationsPerChunk = RoundToKernelBlocks(pKernel, CHUNK_BYTES / (BENCHMARK_SYMBOLS.length() + 1));
+
+  // This wraps around to the first permutation after the last one
+  std::string permutation(BENCHMARK_SYMBOLS);
+
+  while (iterations != 0) {
+    const uint64_t n = std::min<uint64_t>(iterations, permutationsPerChunk);
+
+    char* pOutput = buffer.data();
+    WritePermutationsToMemory(permutation, n, pKernel, pOutput);
+    ClobberMemory();
+
+    iterations -= size_t(n);
+  }
+}
+
+void BenchmarkStringLoop(size_t iterations)
+{
+  BenchmarkWritePermutations(iterations, nullptr);
+}
+REGISTER_BENCHMARK("string loop", BenchmarkStringLoop);
+
+void BenchmarkKernel(size_t iterations)
+{
+  static const std::unique_ptr<cPermutationKernel> pKernel = CreateKernel(BENCHMARK_SYMBOLS);
+  BenchmarkWritePermutations(iterations, pKernel.get());
+}
+REGISTER_BENCHMARK("SSE kernel", BenchmarkKernel);
+
+void RunBenchmarks(const std::string& sFilter)
+{
+  // The TSC is cheaper to read if the processor has an invariant one
+  if (IsInvariantTSCSupported()) SetClockSource(CLOCK_SOURCE::TSC);
+
+  std::cout<<"Generating the permutations of "<<BENCHMARK_SYMBOLS<<" into memory"<<std::endl;
+  if (!cPermutationKernel::IsSupported(BENCHMARK_SYMBOLS)) std::cout<<"WARNING: The kernel is not supported on this processor, both benchmarks use the string loop"<<std::endl;
+
+  const std::vector<cBenchmarkResult> results = RunRegisteredBenchmarks(std::cout, sFilter, cBenchmarkSettings());
+
+  // Bytes per nanosecond is GB/s
+  const double lineLength = double(BENCHMARK_SYMBOLS.length() + 1);
+  for (const cBenchmarkResult& result : results) {
+    if (result.nsPerOperation > 0.0) std::cout<<result.sName<<": "<<std::fixed<<std::setprecision(2)<<(lineLength / result.nsPerOperation)<<" GB/s"<<std::endl;
+  }
+}
+
+
+// Parses "I/N" where I is from 1 to N
+bool ParseShard(const std::string& sShard, uint64_t& shard, uint64_t& nShards)
+{
+  const size_t slash = sShard.find('/');
+  if ((slash == std::string::npos) || (slash == 0) || (slash == (sShard.length() - 1))) return false;
+
+  const std::string sIndex = sShard.substr(0, slash);
+  const std::string sCount = sShard.substr(slash + 1);
+  if ((sIndex.find_first_not_of("0123456789") != std::string::npos) || (sCount.find_first_not_of("0123456789") != std::string::npos)) return false;
+
+  shard = std::stoull(sIndex);
+  nShards = std::stoull(sCount);
+  return (nShards != 0) && (shard >= 1) && (shard <= nShards);
+}
 
 int main(int argc, char** argv)
 {
-  std::string input = "ABC";
-  std::vector<std::string> perms;
-  perms.push_back(input);
-  std::string::iterator itBegin = input.begin();
-  std::string::iterator itEnd = input.end();
-  while(std::next_permutation(itBegin, itEnd)) {
-    perms.push_back(std::string(itBegin, itEnd));
+  std::string input;
+  bool bInputSpecified = false;
+  size_t nJobs = 1;
+  uint64_t shard = 1;
+  uint64_t nShards = 1;
+  bool bCount = false;
+  bool bK = false;
+  size_t k = 0;
+  bool bBenchmark = false;
+  std::string sBenchmarkFilter;
+  COMPRESSION compression = COMPRESSION::NONE;
+  bool bVmsplice = false;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string sArgument(argv[i]);
+
+    if ((sArgument == "-h") || (sArgument == "--help")) {
+      PrintUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (sArgument == "--count") bCount = true;
+    else if (sArgument == "--gzip") compression = COMPRESSION::GZIP;
+    else if (sArgument == "--zstd") compression = COMPRESSION::ZSTD;
+    else if (sArgument == "--lz4") compression = COMPRESSION::LZ4;
+    else if (sArgument == "--vmsplice") bVmsplice = true;
+    else if (sArgument == "--benchmark") {
+      bBenchmark = true;
+
+      // Read the filter if there is one
+      if (((i + 1) < argc) && (argv[i + 1][0] != '-')) {
+        i++;
+        sBenchmarkFilter = argv[i];
+      }
+    }
+    else if ((sArgument == "--k") && ((i + 1) < argc)) {
+      i++;
+      const std::string sK(argv[i]);
+      if (sK.empty() || (sK.find_first_not_of("0123456789") != std::string::npos)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      k = std::stoul(sK);
+      bK = true;
+    } else if ((sArgument == "--jobs") && ((i + 1) < argc)) {
+      i++;
+      const std::string sJobs(argv[i]);
+      if (sJobs.empty() || (sJobs.find_first_not_of("0123456789") != std::string::npos)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      nJobs = std::stoul(sJobs);
+      if (nJobs == 0) nJobs = std::max(1u, std::thread::hardware_concurrency());
+    } else if ((sArgument == "--shard") && ((i + 1) < argc)) {
+      i++;
+      if (!ParseShard(argv[i], shard, nShards)) {
+        std::cerr<<"Invalid shard "<<argv[i]<<", expected I/N where I is from 1 to N"<<std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (!bInputSpecified && (sArgument.compare(0, 2, "--") != 0)) {
+      input = sArgument;
+      bInputSpecified = true;
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (bBenchmark) {
+    RunBenchmarks(sBenchmarkFilter);
+    return EXIT_SUCCESS;
   }
-  std::copy(perms.begin(), perms.end(), std::ostream_iterator<std::string>(std::cout, "\n"));
 
-  // EXIT_FAILURE
+  if (!bInputSpecified) {
+    std::getline(std::cin, input);
+
+    // Handle files with Windows line endings
+    if (!input.empty() && (input[input.length() - 1] == '\r')) input.erase(input.length() - 1);
+  }
+
+  // Start from the first permutation so that we get all of them
+  SortSymbols(input);
+
+  if (bCount) {
+    const cBigUnsigned count = bK ? CountKPermutations(input, k) : CountPermutations(input);
+    std::cout<<count.ToString()<<std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  if (bK && ((nJobs != 1) || (nShards != 1))) {
+    std::cerr<<"--k can't be used with --jobs or --shard"<<std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!IsCompressionSupported(compression)) {
+    std::cerr<<"This build doesn't support "<<GetCompressionName(compression)<<" compression, the library wasn't found when it was built"<<std::endl;
+    return EXIT_FAILURE;
+  }
+
+  cOutputBuffer output(STDOUT_FILENO, compression, bVmsplice);
+
+  if (bK) {
+    cKPermutationWriter writer(input, k, output);
+    writer.Write();
+  } else if ((nJobs == 1) && (nShards == 1)) {
+    // Just step through them, this works no matter how many permutations there are
+    WritePermutations(input, UINT64_MAX, output);
+  } else {
+    // Work out which range of ranks to print
+    uint64_t total = 0;
+    if (!GetPermutationCount(input, total)) {
+      std::cerr<<"There are too many permutations of \""<<input<<"\" to split into jobs or shards"<<std::endl;
+      return EXIT_FAILURE;
+    }
+
+    const uint64_t first = uint64_t((static_cast<unsigned __int128>(total) * (shard - 1)) / nShards);
+    const uint64_t last = uint64_t((static_cast<unsigned __int128>(total) * shard) / nShards);
+
+    if (nJobs == 1) {
+      std::string permutation;
+      if (first < last) {
+        UnrankPermutation(input, first, permutation);
+        WritePermutations(permutation, last - first, output);
+      }
+    } else WritePermutationsParallel(input, first, last - first, nJobs, output);
+  }
+
+  if (!output.Close()) return EXIT_FAILURE;
 
   return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,331 @@
+#include <cerrno>
+
+#include <algorithm>
+#include <new>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+
+namespace
+{
+  // How many batches are written together with one writev, or compressed while the next ones are filled
+  const size_t WRITEV_BATCHES = 4;
+  const size_t COMPRESS_BATCHES = 4;
+
+  // We ask for a pipe this big, a bigger pipe means fewer context switches with the reader
+  const int PIPE_SIZE = 1024 * 1024;
+}
+
+// ** cOutputBuffer
+
+cOutputBuffer::cOutputBuffer(int _fd, COMPRESSION compression, bool bVmsplice) :
+  fd(_fd),
+  mode(MODE::WRITEV),
+  bOK(true),
+  bClosed(false),
+  current(0),
+  nPendingBatches(0),
+  splicedBytes(0),
+  bFinished(false)
+{
+  size_t nBatches = WRITEV_BATCHES;
+
+  if (compression != COMPRESSION::NONE) {
+    pCompressor = CreateCompressor(compression);
+    if (!pCompressor) bOK = false;
+
+    mode = MODE::COMPRESS;
+    nBatches = COMPRESS_BATCHES;
+  } else if (bVmsplice) {
+    struct stat status;
+    int unread = 0;
+    if ((fstat(fd, &status) == 0) && S_ISFIFO(status.st_mode) && (ioctl(fd, FIONREAD, &unread) == 0)) {
+      // This fails if PIPE_SIZE is bigger than /proc/sys/fs/pipe-max-size, we just use the pipe size that we have
+      fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+
+      const int pipeSize = fcntl(fd, F_GETPIPE_SZ);
+      if (pipeSize > 0) {
+        // The pipe can hold this many batches that we have already spliced, one more is being filled and one more means we rarely have to wait for the reader
+        mode = MODE::VMSPLICE;
+        nBatches = ((size_t(pipeSize) + BATCH_SIZE - 1) / BATCH_SIZE) + 2;
+      }
+    }
+  }
+
+  batches.resize(nBatches);
+  for (cBatch& batch : batches) {
+    batch.pData = nullptr;
+    batch.capacity = 0;
+    batch.used = 0;
+    batch.bSpliced = false;
+    batch.splicedBytesEnd = 0;
+    AllocateBatch(batch, BATCH_SIZE);
+  }
+
+  if (mode == MODE::COMPRESS) {
+    for (size_t i = 1; i < nBatches; i++) emptyBatches.push_back(i);
+    compressorThread = std::thread(&cOutputBuffer::CompressorThreadFunction, this);
+  }
+}
+
+cOutputBuffer::~cOutputBuffer()
+{
+  Close();
+
+  // A pipe can still reference spliced batches, unmapping them is fine because the pipe keeps its own reference to the pages
+  for (cBatch& batch : batches) munmap(batch.pData, batch.capacity);
+}
+
+void cOutputBuffer::AllocateBatch(cBatch& batch, size_t capacity)
+{
+  // mmap gives us whole pages so each page of a batch is one buffer in the pipe
+  void* pData = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pData == MAP_FAILED) throw std::bad_alloc();
+
+  if (batch.pData != nullptr) munmap(batch.pData, batch.capacity);
+
+  batch.pData = static_cast<char*>(pData);
+  batch.capacity = capacity;
+}
+
+void cOutputBuffer::NextBatch(size_t length)
+{
+  if (batches[current].used != 0) {
+    switch (mode) {
+      case MODE::WRITEV: {
+        nPendingBatches++;
+        current = (current + 1) % batches.size();
+        if (nPendingBatches == batches.size()) WritePendingBatches();
+        break;
+      }
+      case MODE::VMSPLICE: {
+        SpliceBatch(batches[current]);
+        current = (current + 1) % batches.size();
+        WaitForSplicedBatch(batches[current]);
+        break;
+      }
+      case MODE::COMPRESS: {
+        std::unique_lock<std::mutex> lock(mutex);
+        fullBatches.push_back(current);
+        condition.notify_all();
+
+        condition.wait(lock, [this]() { return !emptyBatches.empty(); });
+        current = emptyBatches.front();
+        emptyBatches.pop_front();
+        break;
+      }
+    }
+  }
+
+  cBatch& batch = batches[current];
+  assert(batch.used == 0);
+  if (batch.capacity < length) AllocateBatch(batch, length);
+}
+
+void cOutputBuffer::AppendLarge(const char* pData, size_t length)
+{
+  assert(mode == MODE::WRITEV);
+
+  // Queue up the current batch and write it out with the rest of the pending batches and then the data in one go
+  if (batches[current].used != 0) {
+    nPendingBatches++;
+    current = (current + 1) % batches.size();
+  }
+
+  WritePendingBatches(pData, length);
+}
+
+void cOutputBuffer::WritePendingBatches(const char* pExtraData, size_t extraLength)
+{
+  std::vector<struct iovec> iovecs(nPendingBatches + 1);
+  size_t nIovecs = 0;
+
+  const size_t first = (current + batches.size() - nPendingBatches) % batches.size();
+  for (size_t i = 0; i < nPendingBatches; i++) {
+    cBatch& batch = batches[(first + i) % batches.size()];
+    iovecs[nIovecs].iov_base = batch.pData;
+    iovecs[nIovecs].iov_len = batch.used;
+    nIovecs++;
+
+    batch.used = 0;
+  }
+  nPendingBatches = 0;
+
+  if (extraLength != 0) {
+    iovecs[nIovecs].iov_base = const_cast<char*>(pExtraData);
+    iovecs[nIovecs].iov_len = extraLength;
+    nIovecs++;
+  }
+
+  // Once a write has failed there is no point trying again, just throw the output away
+  struct iovec* pIovec = iovecs.data();
+  while (bOK && (nIovecs != 0)) {
+    ssize_t written = writev(fd, pIovec, int(nIovecs));
+    if (written < 0) {
+      if (errno == EINTR) continue;
+
+      bOK = false;
+      break;
+    }
+
+    // Skip over whatever was written
+    while ((nIovecs != 0) && (size_t(written) >= pIovec->iov_len)) {
+      written -= ssize_t(pIovec->iov_len);
+      pIovec++;
+      nIovecs--;
+    }
+    if (nIovecs != 0) {
+      pIovec->iov_base = static_cast<char*>(pIovec->iov_base) + written;
+      pIovec->iov_len -= size_t(written);
+    }
+  }
+}
+
+void cOutputBuffer::SpliceBatch(cBatch& batch)
+{
+  struct iovec iovec = { batch.pData, batch.used };
+  while (bOK && (iovec.iov_len != 0)) {
+    const ssize_t spliced = vmsplice(fd, &iovec, 1, 0);
+    if (spliced < 0) {
+      if (errno == EINTR) continue;
+
+      if ((splicedBytes == 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+        // vmsplice isn't supported here, nothing references the batches yet so we can switch to writing them
+        mode = MODE::WRITEV;
+        WriteAll(static_cast<const char*>(iovec.iov_base), iovec.iov_len);
+        batch.used = 0;
+        return;
+      }
+
+      bOK = false;
+      break;
+    }
+
+    splicedBytes += uint64_t(spliced);
+    iovec.iov_base = static_cast<char*>(iovec.iov_base) + spliced;
+    iovec.iov_len -= size_t(spliced);
+  }
+
+  batch.used = 0;
+  batch.bSpliced = true;
+  batch.splicedBytesEnd = splicedBytes;
+}
+
+void cOutputBuffer::WaitForSplicedBatch(cBatch& batch)
+{
+  if (!batch.bSpliced) return;
+
+  // The pipe is first in first out, if it holds no more than what was spliced after this batch then the reader has read all of this batch
+  // This is usually true straight away because vmsplice blocks while the pipe is full
+  while (bOK) {
+    int unread = 0;
+    if ((ioctl(fd, FIONREAD, &unread) != 0) || (uint64_t(unread) <= (splicedBytes - batch.splicedBytesEnd))) break;
+
+    // Give up if the reader has gone away
+    struct pollfd pollFD = { fd, POLLOUT, 0 };
+    if ((poll(&pollFD, 1, 0) == 1) && ((pollFD.revents & POLLERR) != 0)) {
+      bOK = false;
+      break;
+    }
+
+    usleep(100);
+  }
+
+  batch.bSpliced = false;
+}
+
+void cOutputBuffer::WriteAll(const char* pData, size_t length)
+{
+  // Once a write has failed there is no point trying again, just throw the output away
+  while (bOK && (length != 0)) {
+    const ssize_t written = write(fd, pData, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+
+      bOK = false;
+      break;
+    }
+
+    pData += written;
+    length -= size_t(written);
+  }
+}
+
+void cOutputBuffer::CompressorThreadFunction()
+{
+  std::vector<char> compressed;
+
+  while (true) {
+    size_t index = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return !fullBatches.empty() || bFinished; });
+      if (fullBatches.empty()) break;
+
+      index = fullBatches.front();
+      fullBatches.pop_front();
+    }
+
+    // Keep taking batches after a failure so that the generator never waits forever
+    cBatch& batch = batches[index];
+    if (bOK) {
+      compressed.clear();
+      if (pCompressor->Compress(batch.pData, batch.used, compressed)) WriteAll(compressed.data(), compressed.size());
+      else bOK = false;
+    }
+    batch.used = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      emptyBatches.push_back(index);
+    }
+    condition.notify_all();
+  }
+
+  if (bOK) {
+    compressed.clear();
+    if (pCompressor->Finish(compressed)) WriteAll(compressed.data(), compressed.size());
+    else bOK = false;
+  }
+}
+
+bool cOutputBuffer::Close()
+{
+  if (bClosed) return bOK;
+  bClosed = true;
+
+  switch (mode) {
+    case MODE::WRITEV: {
+      if (batches[current].used != 0) {
+        nPendingBatches++;
+        current = (current + 1) % batches.size();
+      }
+      WritePendingBatches();
+      break;
+    }
+    case MODE::VMSPLICE: {
+      if (batches[current].used != 0) SpliceBatch(batches[current]);
+      break;
+    }
+    case MODE::COMPRESS: {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (batches[current].used != 0) fullBatches.push_back(current);
+        bFinished = true;
+      }
+      condition.notify_all();
+
+      compressorThread.join();
+      break;
+    }
+  }
+
+  return bOK;
+}
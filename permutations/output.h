@@ -0,0 +1,167 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "compressor.h"
+
+// ** cOutputBuffer
+//
+// Output is generated into a small set of fixed size page aligned batches, the memory use never grows and nothing goes through std::cout
+// How a full batch is written depends on where the output is going:
+// - By default: Several full batches are written together with one writev(2), this is also used for pipes
+// - A pipe with bVmsplice: The batch is given to the pipe with vmsplice(2) so the pages are mapped into the pipe instead of being copied
+//   The pipe references our memory until the reader has read it, so a batch is only reused once FIONREAD shows the reader has got past it
+// - Compressed: Full batches are handed to a compressor thread which compresses them and writes the compressed data, the generator carries on with the next batch
+//
+// NOTE: vmsplice is only safe when the reader read(2)s from the pipe, a reader that splice(2)s out of the pipe (pv for example) takes the page references with it
+//       A batch could then change after FIONREAD says it was read, and the reader would silently get the wrong data
+//       Giving each batch fresh pages instead of reusing it is safe but slower than writev, the kernel has to zero every new page
+//
+// Close must be called at the end to write the last batch and finish the compressed stream
+
+class cOutputBuffer
+{
+public:
+  static const size_t BATCH_SIZE = 256 * 1024;
+
+  // bVmsplice is ignored unless fd is a pipe and the output is not compressed, see the note above
+  explicit cOutputBuffer(int fd, COMPRESSION compression = COMPRESSION::NONE, bool bVmsplice = false);
+  ~cOutputBuffer();
+
+  void Append(const char* pData, size_t length);
+  void Append(char c);
+
+  // Returns space for up to length bytes to be written directly into the buffer, Commit then adds however many were actually used
+  // The batch grows if length is bigger than it is
+  char* Reserve(size_t length);
+  void Commit(size_t length);
+
+  // Writes everything that is buffered and ends the compressed stream, returns false if a write failed (For example the reader closed the pipe)
+  bool Close();
+
+  bool IsOK() const { return bOK; }
+
+private:
+  struct cBatch {
+    char* pData;
+    size_t capacity;
+    size_t used;
+    bool bSpliced;             // True if the pipe may still reference this batch
+    uint64_t splicedBytesEnd;  // splicedBytes just after this batch was spliced
+  };
+
+  enum class MODE {
+    WRITEV,
+    VMSPLICE,
+    COMPRESS,
+  };
+
+  cOutputBuffer(const cOutputBuffer&) = delete;
+  cOutputBuffer& operator=(const cOutputBuffer&) = delete;
+
+  void AllocateBatch(cBatch& batch, size_t capacity);
+
+  // Hands the current batch on to be written and moves on to an empty batch with room for at least length bytes
+  void NextBatch(size_t length);
+
+  // Writes the batches that are waiting to be written and then pExtraData with one writev
+  void WritePendingBatches(const char* pExtraData = nullptr, size_t extraLength = 0);
+
+  // Writes data that is at least a batch long without copying it into a batch
+  void AppendLarge(const char* pData, size_t length);
+
+  // Gives the current batch to the pipe with vmsplice
+  void SpliceBatch(cBatch& batch);
+
+  // Waits until the reader has read past batch, or the reader has gone away
+  void WaitForSplicedBatch(cBatch& batch);
+
+  // Writes directly to the file descriptor
+  void WriteAll(const char* pData, size_t length);
+
+  void CompressorThreadFunction();
+
+  const int fd;
+  MODE mode;
+  std::atomic<bool> bOK;
+  bool bClosed;
+
+  std::vector<cBatch> batches;
+  size_t current;
+
+  size_t nPendingBatches;    // WRITEV, these are the batches before the current one
+  uint64_t splicedBytes;     // VMSPLICE, how many bytes have been spliced in total
+
+  // COMPRESS
+  std::unique_ptr<cCompressor> pCompressor;
+  std::thread compressorThread;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<size_t> fullBatches;  // Waiting to be compressed
+  std::deque<size_t> emptyBatches; // Ready to be filled
+  bool bFinished;                  // Set when there are no more batches coming
+};
+
+
+// ** Inlines
+
+inline void cOutputBuffer::Append(const char* pData, size_t length)
+{
+  // Large blocks skip the batches if nothing else needs them to be in a batch
+  if ((mode == MODE::WRITEV) && (length >= BATCH_SIZE)) {
+    AppendLarge(pData, length);
+    return;
+  }
+
+  while (length != 0) {
+    cBatch& batch = batches[current];
+    if (batch.used == batch.capacity) {
+      NextBatch(1);
+      continue;
+    }
+
+    const size_t n = std::min(length, batch.capacity - batch.used);
+    memcpy(batch.pData + batch.used, pData, n);
+    batch.used += n;
+    pData += n;
+    length -= n;
+  }
+}
+
+inline void cOutputBuffer::Append(char c)
+{
+  if (batches[current].used == batches[current].capacity) NextBatch(1);
+
+  cBatch& batch = batches[current];
+  batch.pData[batch.used++] = c;
+}
+
+inline char* cOutputBuffer::Reserve(size_t length)
+{
+  if ((batches[current].capacity - batches[current].used) < length) NextBatch(length);
+
+  cBatch& batch = batches[current];
+  return batch.pData + batch.used;
+}
+
+inline void cOutputBuffer::Commit(size_t length)
+{
+  cBatch& batch = batches[current];
+  assert(length <= (batch.capacity - batch.used));
+  batch.used += length;
+}
+
+#endif // OUTPUT_H
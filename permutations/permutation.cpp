@@ -0,0 +1,168 @@
+#include <cassert>
+
+#include <algorithm>
+#include <vector>
+
+#include "permutation.h"
+
+namespace
+{
+  // How many of each symbol there are
+  class cSymbolCounts
+  {
+  public:
+    explicit cSymbolCounts(const std::string& sSymbols);
+
+    // The distinct permutations of the remaining symbols, n! / (m1! * m2! * ... * mk!)
+    bool GetPermutationCount(uint64_t& count) const;
+
+    size_t total;
+    size_t counts[256];
+  };
+
+  cSymbolCounts::cSymbolCounts(const std::string& sSymbols) :
+    total(sSymbols.length())
+  {
+    std::fill(counts, counts + 256, 0);
+    for (const char c : sSymbols) counts[(unsigned char)(c)]++;
+  }
+
+  bool cSymbolCounts::GetPermutationCount(uint64_t& count) const
+  {
+    // Build up the multinomial as a product of binomials, C(m1, m1) * C(m1 + m2, m2) * ..., each partial product is an exact integer so nothing is rounded
+    unsigned __int128 result = 1;
+    size_t placed = 0;
+    for (size_t symbol = 0; symbol < 256; symbol++) {
+      for (size_t i = 1; i <= counts[symbol]; i++) {
+        placed++;
+        result = (result * placed) / i;
+        if (result > UINT64_MAX) return false;
+      }
+    }
+
+    count = uint64_t(result);
+    return true;
+  }
+}
+
+cBigUnsigned CountPermutations(const std::string& sInput)
+{
+  const cSymbolCounts symbols(sInput);
+
+  // The same product of binomials as cSymbolCounts::GetPermutationCount, multiplying before dividing keeps every step exact
+  cBigUnsigned result(1);
+  uint32_t placed = 0;
+  for (size_t symbol = 0; symbol < 256; symbol++) {
+    for (size_t i = 1; i <= symbols.counts[symbol]; i++) {
+      placed++;
+      result.Multiply(placed);
+      const uint32_t remainder = result.Divide(uint32_t(i));
+      assert(remainder == 0);
+      (void)remainder;
+    }
+  }
+
+  return result;
+}
+
+cBigUnsigned CountKPermutations(const std::string& sInput, size_t k)
+{
+  if (k > sInput.length()) return cBigUnsigned(0);
+
+  const cSymbolCounts symbols(sInput);
+
+  // arrangements[t] is the number of distinct sequences of length t using the symbols considered so far
+  // Adding j copies of the next symbol to a sequence of length t can be done in C(t + j, j) ways
+  std::vector<cBigUnsigned> arrangements(k + 1);
+  arrangements[0] = cBigUnsigned(1);
+
+  for (size_t symbol = 0; symbol < 256; symbol++) {
+    const size_t m = symbols.counts[symbol];
+    if (m == 0) continue;
+
+    std::vector<cBigUnsigned> next(k + 1);
+    for (size_t t = 0; t <= k; t++) {
+      if (arrangements[t].IsZero()) continue;
+
+      cBigUnsigned binomial(1);
+      for (size_t j = 0; (j <= m) && ((t + j) <= k); j++) {
+        if (j != 0) {
+          binomial.Multiply(uint32_t(t + j));
+          binomial.Divide(uint32_t(j));
+        }
+
+        cBigUnsigned ways(arrangements[t]);
+        ways.Multiply(binomial);
+        next[t + j].Add(ways);
+      }
+    }
+
+    arrangements.swap(next);
+  }
+
+  return arrangements[k];
+}
+
+bool GetPermutationCount(const std::string& sInput, uint64_t& count)
+{
+  return cSymbolCounts(sInput).GetPermutationCount(count);
+}
+
+bool RankPermutation(const std::string& sPermutation, uint64_t& rank)
+{
+  cSymbolCounts remaining(sPermutation);
+
+  uint64_t total = 0;
+  if (!remaining.GetPermutationCount(total)) return false;
+
+  rank = 0;
+  for (const char c : sPermutation) {
+    const size_t symbol = (unsigned char)(c);
+
+    // Count the permutations that have a smaller symbol in this position, for distinct symbols this is the Lehmer digit times (n - 1 - i)!
+    // The number of permutations starting with s is total * count[s] / remaining, so we don't have to recalculate the multinomial for each symbol
+    for (size_t smaller = 0; smaller < symbol; smaller++) {
+      if (remaining.counts[smaller] == 0) continue;
+
+      rank += uint64_t((static_cast<unsigned __int128>(total) * remaining.counts[smaller]) / remaining.total);
+    }
+
+    // Move on to the permutations of the rest of the symbols
+    total = uint64_t((static_cast<unsigned __int128>(total) * remaining.counts[symbol]) / remaining.total);
+    remaining.counts[symbol]--;
+    remaining.total--;
+  }
+
+  return true;
+}
+
+bool UnrankPermutation(const std::string& sSymbols, uint64_t rank, std::string& sPermutation)
+{
+  cSymbolCounts remaining(sSymbols);
+
+  uint64_t total = 0;
+  if (!remaining.GetPermutationCount(total) || (rank >= total)) return false;
+
+  sPermutation.clear();
+  sPermutation.reserve(sSymbols.length());
+
+  while (remaining.total != 0) {
+    // Find the symbol whose block of permutations contains rank
+    for (size_t symbol = 0; symbol < 256; symbol++) {
+      if (remaining.counts[symbol] == 0) continue;
+
+      const uint64_t block = uint64_t((static_cast<unsigned __int128>(total) * remaining.counts[symbol]) / remaining.total);
+      if (rank < block) {
+        sPermutation.push_back(char(symbol));
+        total = block;
+        remaining.counts[symbol]--;
+        remaining.total--;
+        break;
+      }
+
+      rank -= block;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+#include <cstdint>
+
+#include <algorithm>
+#include <string>
+
+#include "biginteger.h"
+
+// ** Ranking permutations
+//
+// The rank of a permutation is its index in the lexicographical order of all the distinct permutations of its symbols
+// For distinct symbols this is the factorial number system, the Lehmer code digit for each position is how many of the remaining symbols are smaller than the symbol there
+// and the rank is the sum of each digit multiplied by the factorial of the number of positions after it
+// Repeated symbols are handled by counting the distinct permutations of the remaining symbols instead of using the factorial, so both functions work for any string
+//
+// Each step is O(n * distinct symbols) so ranking or unranking is O(n^2) at worst, which lets a worker jump straight to the start of its range
+
+// Symbols are ordered as unsigned bytes
+inline bool IsSymbolLess(char lhs, char rhs)
+{
+  return ((unsigned char)(lhs) < (unsigned char)(rhs));
+}
+
+// std::next_permutation in the same order as the ranks
+inline bool NextPermutation(std::string::iterator itBegin, std::string::iterator itEnd)
+{
+  return std::next_permutation(itBegin, itEnd, IsSymbolLess);
+}
+
+// Sorts the symbols into the first permutation
+inline void SortSymbols(std::string& sSymbols)
+{
+  std::sort(sSymbols.begin(), sSymbols.end(), IsSymbolLess);
+}
+
+// Exactly counts the distinct permutations of the symbols in sInput, the multinomial n! / (m1! * m2! * ... * mk!) where m is how many times each symbol appears
+cBigUnsigned CountPermutations(const std::string& sInput);
+
+// Exactly counts the distinct k-permutations (Sequences of k of the symbols) of sInput
+cBigUnsigned CountKPermutations(const std::string& sInput, size_t k);
+
+// Gets the number of distinct permutations of the symbols in sInput, returns false if it doesn't fit in 64 bits
+bool GetPermutationCount(const std::string& sInput, uint64_t& count);
+
+// Gets the rank of sPermutation, returns false if the number of permutations doesn't fit in 64 bits
+bool RankPermutation(const std::string& sPermutation, uint64_t& rank);
+
+// Gets the permutation of the symbols in sSymbols (In any order) with the given rank, returns false if rank is out of range
+bool UnrankPermutation(const std::string& sSymbols, uint64_t rank, std::string& sPermutation);
+
+#endif // PERMUTATION_H
@@ -0,0 +1,93 @@
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "cpufeatures.h"
+
+// ** cDispatch
+//
+// Chooses the best implementation of a function for this processor once, when it is constructed, and then calls it through a function pointer
+// Implementations are listed best first with the features each one needs, the first one that the processor supports is used
+// The last implementation should need no features so that there is always one to fall back to
+// Each implementation is compiled for its instruction set with a target attribute so the rest of the program can still be built for the baseline
+//
+//  size_t CountBitsScalar(const uint64_t* pValues, size_t count);
+//  __attribute__((target("popcnt"))) size_t CountBitsPOPCNT(const uint64_t* pValues, size_t count);
+//  __attribute__((target("avx2"))) size_t CountBitsAVX2(const uint64_t* pValues, size_t count);
+//
+//  typedef size_t (*count_bits_t)(const uint64_t* pValues, size_t count);
+//
+//  const cDispatch<count_bits_t> CountBits = {
+//    { CountBitsAVX2, "avx2", { CPU_FEATURE::AVX2 } },
+//    { CountBitsPOPCNT, "popcnt", { CPU_FEATURE::POPCNT } },
+//    { CountBitsScalar, "scalar", {} },
+//  };
+//
+//  const size_t bits = CountBits(pValues, count);
+//
+// A global cDispatch is chosen during static initialisation, after that each call is one indirect call which the branch predictor handles well
+// Call from a loop over a block of data rather than once per element
+
+template <class F>
+class cDispatch
+{
+public:
+  struct cImplementation {
+    F function;
+    const char* szName;
+    std::vector<CPU_FEATURE> requiredFeatures;
+  };
+
+  cDispatch(std::initializer_list<cImplementation> implementations);
+
+  template <class... Args>
+  auto operator()(Args&&... args) const -> decltype(std::declval<F>()(std::forward<Args>(args)...))
+  {
+    return pFunction(std::forward<Args>(args)...);
+  }
+
+  F GetFunction() const { return pFunction; }
+
+  // The name of the implementation that was chosen
+  const char* GetName() const { return szName; }
+
+  // Returns true if implementation can run on this processor
+  static bool IsSupported(const cImplementation& implementation);
+
+private:
+  F pFunction;
+  const char* szName;
+};
+
+
+// ** Inlines
+
+template <class F>
+inline cDispatch<F>::cDispatch(std::initializer_list<cImplementation> implementations) :
+  pFunction(nullptr),
+  szName("none")
+{
+  for (const cImplementation& implementation : implementations) {
+    if (IsSupported(implementation)) {
+      pFunction = implementation.function;
+      szName = implementation.szName;
+      break;
+    }
+  }
+}
+
+template <class F>
+inline bool cDispatch<F>::IsSupported(const cImplementation& implementation)
+{
+  const cCPUFeatures& features = GetCPUFeatures();
+  for (const CPU_FEATURE feature : implementation.requiredFeatures) {
+    if (!features.IsSupported(feature)) return false;
+  }
+
+  return true;
+}
+
+#endif // CPUDISPATCH_H
@@ -0,0 +1,300 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BUILD_CPU_FEATURES_X86
+#include <cpuid.h>
+#endif
+
+#ifdef __linux__
+#include <sys/auxv.h>
+#endif
+
+// ** CPU features
+//
+// Header only so that any tool can include it and choose its kernels at run time, see cpudispatch.h
+// On x86 the features come from cpuid, AVX and AVX-512 also need the OS to save their registers on a context switch which XGETBV tells us
+// On ARM there is no cpuid for user space so the features come from getauxval(AT_HWCAP)
+// Features listed in the CPU_FEATURES_DISABLE environment variable are treated as unsupported, for example CPU_FEATURES_DISABLE=avx2,avx512f
+// This makes it easy to test the fallback paths that older machines in the fleet will take
+
+enum class CPU_FEATURE {
+  // x86
+  SSE2,
+  SSSE3,
+  SSE4_1,
+  SSE4_2,
+  POPCNT,
+  AVX,
+  AVX2,
+  FMA,
+  BMI1,
+  BMI2,
+  AVX512F,
+  AVX512DQ,
+  AVX512CD,
+  AVX512BW,
+  AVX512VL,
+  AVX512VNNI,
+  AVX512VBMI,
+  INVARIANT_TSC,
+
+  // ARM
+  NEON,
+  CRC32,
+  SVE,
+
+  COUNT
+};
+
+const size_t CPU_FEATURE_COUNT = size_t(CPU_FEATURE::COUNT);
+
+inline const char* GetCPUFeatureName(CPU_FEATURE feature)
+{
+  switch (feature) {
+    case CPU_FEATURE::SSE2: return "sse2";
+    case CPU_FEATURE::SSSE3: return "ssse3";
+    case CPU_FEATURE::SSE4_1: return "sse4.1";
+    case CPU_FEATURE::SSE4_2: return "sse4.2";
+    case CPU_FEATURE::POPCNT: return "popcnt";
+    case CPU_FEATURE::AVX: return "avx";
+    case CPU_FEATURE::AVX2: return "avx2";
+    case CPU_FEATURE::FMA: return "fma";
+    case CPU_FEATURE::BMI1: return "bmi1";
+    case CPU_FEATURE::BMI2: return "bmi2";
+    case CPU_FEATURE::AVX512F: return "avx512f";
+    case CPU_FEATURE::AVX512DQ: return "avx512dq";
+    case CPU_FEATURE::AVX512CD: return "avx512cd";
+    case CPU_FEATURE::AVX512BW: return "avx512bw";
+    case CPU_FEATURE::AVX512VL: return "avx512vl";
+    case CPU_FEATURE::AVX512VNNI: return "avx512vnni";
+    case CPU_FEATURE::AVX512VBMI: return "avx512vbmi";
+    case CPU_FEATURE::INVARIANT_TSC: return "invariant-tsc";
+    case CPU_FEATURE::NEON: return "neon";
+    case CPU_FEATURE::CRC32: return "crc32";
+    case CPU_FEATURE::SVE: return "sve";
+    default: return "unknown";
+  }
+}
+
+
+// ** cCPUFeatures
+
+class cCPUFeatures
+{
+public:
+  // Detects the features of the processor that we are running on
+  cCPUFeatures();
+
+  // True if the processor has the feature, the OS supports it and it hasn't been disabled
+  bool IsSupported(CPU_FEATURE feature) const { return bSupported[size_t(feature)]; }
+
+  // True if the processor has the feature even if it can't be used
+  bool IsPresent(CPU_FEATURE feature) const { return bPresent[size_t(feature)]; }
+
+  // True if the processor has the feature but the OS doesn't save its registers (AVX and AVX-512)
+  bool IsDisabledByOS(CPU_FEATURE feature) const { return bDisabledByOS[size_t(feature)]; }
+
+  // True if the feature was listed in CPU_FEATURES_DISABLE
+  bool IsDisabledByEnvironment(CPU_FEATURE feature) const { return bDisabledByEnvironment[size_t(feature)]; }
+
+  // The widest vector registers that can be used in bytes, 64 for AVX-512, 32 for AVX, 16 for SSE2 and NEON, 0 if there are none
+  size_t GetSIMDWidth() const;
+
+  const std::string& GetVendor() const { return sVendor; }
+  const std::string& GetBrand() const { return sBrand; }
+
+  bool IsXGETBVSupported() const { return bOSXSAVE; }
+  uint64_t GetXCR0() const { return xcr0; }
+
+  unsigned long GetHWCAP() const { return hwcap; }
+  unsigned long GetHWCAP2() const { return hwcap2; }
+
+private:
+  void SetPresent(CPU_FEATURE feature, bool bIsPresent) { bPresent[size_t(feature)] = bIsPresent; }
+  void DetectX86();
+  void DetectARM();
+
+  bool bPresent[CPU_FEATURE_COUNT];
+  bool bDisabledByOS[CPU_FEATURE_COUNT];
+  bool bDisabledByEnvironment[CPU_FEATURE_COUNT];
+  bool bSupported[CPU_FEATURE_COUNT];
+
+  std::string sVendor;
+  std::string sBrand;
+
+  bool bOSXSAVE;
+  uint64_t xcr0;
+
+  unsigned long hwcap;
+  unsigned long hwcap2;
+};
+
+// Returns the features of this processor, they are detected the first time this is called
+inline const cCPUFeatures& GetCPUFeatures()
+{
+  static const cCPUFeatures features;
+  return features;
+}
+
+
+// ** Inlines
+
+inline cCPUFeatures::cCPUFeatures() :
+  bOSXSAVE(false),
+  xcr0(0),
+  hwcap(0),
+  hwcap2(0)
+{
+  for (size_t i = 0; i < CPU_FEATURE_COUNT; i++) {
+    bPresent[i] = false;
+    bDisabledByOS[i] = false;
+    bDisabledByEnvironment[i] = false;
+    bSupported[i] = false;
+  }
+
+#ifdef __linux__
+  hwcap = getauxval(AT_HWCAP);
+#ifdef AT_HWCAP2
+  hwcap2 = getauxval(AT_HWCAP2);
+#endif
+#endif
+
+  DetectX86();
+  DetectARM();
+
+  // Parse the comma separated list of features to ignore
+  const char* szDisable = getenv("CPU_FEATURES_DISABLE");
+  if (szDisable != nullptr) {
+    const std::string sDisable = std::string(",") + szDisable + ",";
+    for (size_t i = 0; i < CPU_FEATURE_COUNT; i++) {
+      if (sDisable.find(std::string(",") + GetCPUFeatureName(CPU_FEATURE(i)) + ",") != std::string::npos) bDisabledByEnvironment[i] = true;
+    }
+  }
+
+  for (size_t i = 0; i < CPU_FEATURE_COUNT; i++) bSupported[i] = bPresent[i] && !bDisabledByOS[i] && !bDisabledByEnvironment[i];
+}
+
+inline size_t cCPUFeatures::GetSIMDWidth() const
+{
+  if (IsSupported(CPU_FEATURE::AVX512F)) return 64;
+  else if (IsSupported(CPU_FEATURE::AVX)) return 32;
+  else if (IsSupported(CPU_FEATURE::SSE2) || IsSupported(CPU_FEATURE::NEON)) return 16;
+
+  return 0;
+}
+
+inline void cCPUFeatures::DetectX86()
+{
+#ifdef BUILD_CPU_FEATURES_X86
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return;
+  const unsigned int maxLeaf = eax;
+
+  char szVendor[13];
+  memcpy(szVendor, &ebx, 4);
+  memcpy(szVendor + 4, &edx, 4);
+  memcpy(szVendor + 8, &ecx, 4);
+  szVendor[12] = 0;
+  sVendor = szVendor;
+
+  // Leaf 1 is the original feature flags
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+  SetPresent(CPU_FEATURE::SSE2, (edx & (1u << 26)) != 0);
+  SetPresent(CPU_FEATURE::SSSE3, (ecx & (1u << 9)) != 0);
+  SetPresent(CPU_FEATURE::FMA, (ecx & (1u << 12)) != 0);
+  SetPresent(CPU_FEATURE::SSE4_1, (ecx & (1u << 19)) != 0);
+  SetPresent(CPU_FEATURE::SSE4_2, (ecx & (1u << 20)) != 0);
+  SetPresent(CPU_FEATURE::POPCNT, (ecx & (1u << 23)) != 0);
+  SetPresent(CPU_FEATURE::AVX, (ecx & (1u << 28)) != 0);
+  bOSXSAVE = ((ecx & (1u << 27)) != 0);
+
+  // Leaf 7 is the extended feature flags
+  if (maxLeaf >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    SetPresent(CPU_FEATURE::BMI1, (ebx & (1u << 3)) != 0);
+    SetPresent(CPU_FEATURE::AVX2, (ebx & (1u << 5)) != 0);
+    SetPresent(CPU_FEATURE::BMI2, (ebx & (1u << 8)) != 0);
+    SetPresent(CPU_FEATURE::AVX512F, (ebx & (1u << 16)) != 0);
+    SetPresent(CPU_FEATURE::AVX512DQ, (ebx & (1u << 17)) != 0);
+    SetPresent(CPU_FEATURE::AVX512CD, (ebx & (1u << 28)) != 0);
+    SetPresent(CPU_FEATURE::AVX512BW, (ebx & (1u << 30)) != 0);
+    SetPresent(CPU_FEATURE::AVX512VL, (ebx & (1u << 31)) != 0);
+    SetPresent(CPU_FEATURE::AVX512VBMI, (ecx & (1u << 1)) != 0);
+    SetPresent(CPU_FEATURE::AVX512VNNI, (ecx & (1u << 11)) != 0);
+  }
+
+  // Advanced power management, bit 8 is an invariant TSC
+  if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx)) {
+    const unsigned int maxExtendedLeaf = eax;
+
+    if (maxExtendedLeaf >= 0x80000004) {
+      char szBrand[49];
+      for (unsigned int i = 0; i < 3; i++) {
+        __get_cpuid(0x80000002 + i, &eax, &ebx, &ecx, &edx);
+        memcpy(szBrand + (16 * i), &eax, 4);
+        memcpy(szBrand + (16 * i) + 4, &ebx, 4);
+        memcpy(szBrand + (16 * i) + 8, &ecx, 4);
+        memcpy(szBrand + (16 * i) + 12, &edx, 4);
+      }
+      szBrand[48] = 0;
+      sBrand = szBrand;
+
+      // Some processors pad the start of the brand with spaces
+      const size_t start = sBrand.find_first_not_of(' ');
+      sBrand = (start == std::string::npos) ? "" : sBrand.substr(start);
+    }
+
+    if (maxExtendedLeaf >= 0x80000007) {
+      __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+      SetPresent(CPU_FEATURE::INVARIANT_TSC, (edx & (1u << 8)) != 0);
+    }
+  }
+
+  // The OS has to save the YMM and ZMM registers on a context switch or using them would corrupt other processes
+  // XCR0 bits 1 and 2 are the SSE and AVX state, bits 5, 6 and 7 are the AVX-512 opmask and upper ZMM state
+  if (bOSXSAVE) {
+    unsigned int xcr0Low = 0;
+    unsigned int xcr0High = 0;
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    xcr0 = (uint64_t(xcr0High) << 32) | xcr0Low;
+  }
+
+  const bool bAVXState = ((xcr0 & 0x6) == 0x6);
+  const bool bAVX512State = bAVXState && ((xcr0 & 0xe0) == 0xe0);
+
+  const CPU_FEATURE avxFeatures[] = { CPU_FEATURE::AVX, CPU_FEATURE::AVX2, CPU_FEATURE::FMA };
+  for (const CPU_FEATURE feature : avxFeatures) bDisabledByOS[size_t(feature)] = !bAVXState;
+
+  const CPU_FEATURE avx512Features[] = { CPU_FEATURE::AVX512F, CPU_FEATURE::AVX512DQ, CPU_FEATURE::AVX512CD, CPU_FEATURE::AVX512BW, CPU_FEATURE::AVX512VL, CPU_FEATURE::AVX512VNNI, CPU_FEATURE::AVX512VBMI };
+  for (const CPU_FEATURE feature : avx512Features) bDisabledByOS[size_t(feature)] = !bAVX512State;
+#endif
+}
+
+inline void cCPUFeatures::DetectARM()
+{
+#if defined(__aarch64__) && defined(__linux__)
+#ifdef HWCAP_ASIMD
+  SetPresent(CPU_FEATURE::NEON, (hwcap & HWCAP_ASIMD) != 0);
+#endif
+#ifdef HWCAP_CRC32
+  SetPresent(CPU_FEATURE::CRC32, (hwcap & HWCAP_CRC32) != 0);
+#endif
+#ifdef HWCAP_SVE
+  SetPresent(CPU_FEATURE::SVE, (hwcap & HWCAP_SVE) != 0);
+#endif
+#endif
+}
+
+#endif // CPUFEATURES_H
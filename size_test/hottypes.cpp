@@ -0,0 +1,34 @@
+#include <cstddef>
+#include <cstdint>
+
+#include "hottypes.h"
+
+// Only types that size_test can include are registered, a stand in with copied fields would only check itself
+#include "chunkslot.h"
+#include "profiler.h"
+
+namespace
+{
+  // The workers in permutations each fill a slot in the same vector
+  #define CHUNK_SLOT_FIELDS(FIELD) \
+    FIELD(chunk) \
+    FIELD(bReady) \
+    FIELD(data)
+
+  // Every zone is written into a ring buffer as one of these, a smaller event means fewer cache lines per zone
+  #define PROFILE_EVENT_FIELDS(FIELD) \
+    FIELD(start) \
+    FIELD(end) \
+    FIELD(zoneID) \
+    FIELD(depth)
+}
+
+std::vector<cTypeLayout> GetHotTypeLayouts()
+{
+  std::vector<cTypeLayout> layouts;
+
+  layouts.push_back(LAYOUT_TYPE(cChunkSlot, "cChunkSlot", SHARING::BETWEEN_THREADS, CHUNK_SLOT_FIELDS));
+  layouts.push_back(LAYOUT_TYPE(cProfileEvent, "cProfileEvent", SHARING::NONE, PROFILE_EVENT_FIELDS));
+
+  return layouts;
+}
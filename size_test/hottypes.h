@@ -0,0 +1,16 @@
+#ifndef HOTTYPES_H
+#define HOTTYPES_H
+
+#include <vector>
+
+#include "layout.h"
+
+// ** Hot types
+//
+// The types that the project streams through in hot loops or shares between threads, registered for the layout report
+// Only types from this repository that size_test can include are registered here, so the asserts in --layout-header are measured from the real types
+// Types from other projects such as breathe, spitfire and libopenglmm must be registered with LAYOUT_TYPE in their own project, built with layout.cpp
+
+std::vector<cTypeLayout> GetHotTypeLayouts();
+
+#endif // HOTTYPES_H
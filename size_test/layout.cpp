@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "layout.h"
+
+namespace
+{
+  size_t RoundUp(size_t value, size_t alignment)
+  {
+    return ((value + alignment - 1) / alignment) * alignment;
+  }
+
+  size_t GreatestCommonDivisor(size_t a, size_t b)
+  {
+    while (b != 0) {
+      const size_t remainder = a % b;
+      a = b;
+      b = remainder;
+    }
+
+    return a;
+  }
+
+  // The number of cache lines that bytes [offset, offset + size) touch
+  size_t GetLinesTouched(size_t offset, size_t size, size_t cacheLineSize)
+  {
+    if (size == 0) return 0;
+
+    return ((offset + size - 1) / cacheLineSize) - (offset / cacheLineSize) + 1;
+  }
+
+  // The fewest cache lines that size bytes can touch
+  size_t GetMinimumLines(size_t size, size_t cacheLineSize)
+  {
+    return (size + cacheLineSize - 1) / cacheLineSize;
+  }
+}
+
+cFieldLayout::cFieldLayout(const char* szName, size_t _offset, size_t _size, size_t _alignment) :
+  sName(szName),
+  offset(_offset),
+  size(_size),
+  alignment(_alignment)
+{
+}
+
+cTypeLayout::cTypeLayout(const char* szName, size_t _size, size_t _alignment, SHARING _sharing) :
+  sName(szName),
+  size(_size),
+  alignment(_alignment),
+  sharing(_sharing)
+{
+}
+
+cLayoutAnalysis AnalyseLayout(const cTypeLayout& layout, size_t cacheLineSize)
+{
+  cLayoutAnalysis analysis;
+  analysis.paddingBytes = 0;
+  analysis.minimumSize = 0;
+  analysis.elementsPerPeriod = 0;
+  analysis.straddlingElements = 0;
+  analysis.bFalseSharing = false;
+
+  std::vector<cFieldLayout> fields = layout.fields;
+  std::stable_sort(fields.begin(), fields.end(), [](const cFieldLayout& lhs, const cFieldLayout& rhs) { return lhs.offset < rhs.offset; });
+
+  // Padding holes, fields that weren't listed also show up as holes
+  size_t end = 0;
+  for (const cFieldLayout& field : fields) {
+    if (field.offset > end) analysis.holes.push_back(cPaddingHole{ end, field.offset - end, false });
+    end = std::max(end, field.offset + field.size);
+
+    if (GetLinesTouched(field.offset, field.size, cacheLineSize) > GetMinimumLines(field.size, cacheLineSize)) analysis.straddlingFields.push_back(field.sName);
+  }
+  if (layout.size > end) analysis.holes.push_back(cPaddingHole{ end, layout.size - end, true });
+
+  for (const cPaddingHole& hole : analysis.holes) analysis.paddingBytes += hole.size;
+
+  // Laying the fields out largest alignment first leaves the fewest holes
+  std::stable_sort(fields.begin(), fields.end(), [](const cFieldLayout& lhs, const cFieldLayout& rhs) { return lhs.alignment > rhs.alignment; });
+  size_t offset = 0;
+  for (const cFieldLayout& field : fields) offset = RoundUp(offset, field.alignment) + field.size;
+  analysis.minimumSize = RoundUp(offset, std::max<size_t>(1, layout.alignment));
+
+  // In an array that starts on a cache line the pattern of elements across lines repeats every lcm(size, line) bytes
+  if (layout.size != 0) {
+    analysis.elementsPerPeriod = cacheLineSize / GreatestCommonDivisor(layout.size, cacheLineSize);
+    for (size_t i = 0; i < analysis.elementsPerPeriod; i++) {
+      if (GetLinesTouched(i * layout.size, layout.size, cacheLineSize) > GetMinimumLines(layout.size, cacheLineSize)) analysis.straddlingElements++;
+    }
+  }
+
+  // Neighbours only get their own lines if every element is a whole number of lines and starts on a line
+  analysis.bFalseSharing = (layout.sharing == SHARING::BETWEEN_THREADS) && (((layout.size % cacheLineSize) != 0) || (layout.alignment < cacheLineSize));
+
+  return analysis;
+}
+
+void PrintLayoutReport(std::ostream& o, const std::vector<cTypeLayout>& layouts, size_t cacheLineSize)
+{
+  o<<"Struct layouts ("<<cacheLineSize<<" byte cache lines, arrays are assumed to start on a cache line):"<<std::endl;
+
+  for (const cTypeLayout& layout : layouts) {
+    const cLayoutAnalysis analysis = AnalyseLayout(layout, cacheLineSize);
+
+    o<<std::endl;
+    o<<layout.sName<<": "<<layout.size<<" bytes, "<<layout.alignment<<" byte aligned"<<((layout.sharing == SHARING::BETWEEN_THREADS) ? ", shared between threads" : "")<<std::endl;
+    o<<std::setw(10)<<"offset"<<std::setw(8)<<"size"<<std::setw(8)<<"align"<<"  field"<<std::endl;
+
+    // Interleave the holes with the fields in offset order
+    std::vector<cFieldLayout> fields = layout.fields;
+    std::stable_sort(fields.begin(), fields.end(), [](const cFieldLayout& lhs, const cFieldLayout& rhs) { return lhs.offset < rhs.offset; });
+    size_t hole = 0;
+    for (const cFieldLayout& field : fields) {
+      for (; (hole < analysis.holes.size()) && (analysis.holes[hole].offset < field.offset); hole++) o<<std::setw(10)<<analysis.holes[hole].offset<<std::setw(8)<<analysis.holes[hole].size<<std::setw(8)<<""<<"  (padding)"<<std::endl;
+      o<<std::setw(10)<<field.offset<<std::setw(8)<<field.size<<std::setw(8)<<field.alignment<<"  "<<field.sName<<std::endl;
+    }
+    for (; hole < analysis.holes.size(); hole++) o<<std::setw(10)<<analysis.holes[hole].offset<<std::setw(8)<<analysis.holes[hole].size<<std::setw(8)<<""<<"  (tail padding)"<<std::endl;
+
+    if (analysis.paddingBytes != 0) {
+      o<<"  Padding: "<<analysis.paddingBytes<<" of "<<layout.size<<" bytes";
+      if (analysis.minimumSize < layout.size) o<<", ordering the fields by alignment would make it "<<analysis.minimumSize<<" bytes";
+      o<<std::endl;
+    }
+
+    for (const std::string& sField : analysis.straddlingFields) o<<"  WARNING: "<<sField<<" crosses a cache line boundary"<<std::endl;
+
+    if (analysis.straddlingElements != 0) o<<"  WARNING: In an array "<<analysis.straddlingElements<<" of every "<<analysis.elementsPerPeriod<<" elements cross a cache line boundary, streaming through them touches an extra line each time"<<std::endl;
+
+    if (analysis.bFalseSharing) o<<"  WARNING: Shared between threads but neighbouring objects can share a cache line, add alignas("<<cacheLineSize<<") so each one gets its own lines"<<std::endl;
+  }
+}
+
+bool WriteLayoutAssertsHeader(const std::string& sFilePath, const std::vector<cTypeLayout>& layouts)
+{
+  std::ofstream o(sFilePath);
+  if (!o.good()) return false;
+
+  o<<"// Generated by size_test --layout-header, include this after the types below to lock in their layouts"<<std::endl;
+  o<<"// If one of these fails the type has changed, check the layout with size_test --layout and then run it again to update this"<<std::endl;
+  o<<"// Only the types that size_test includes are listed, types from other projects register themselves with LAYOUT_TYPE in their own project"<<std::endl;
+  o<<std::endl;
+  o<<"#ifndef LAYOUT_ASSERTS_H"<<std::endl;
+  o<<"#define LAYOUT_ASSERTS_H"<<std::endl;
+
+  for (const cTypeLayout& layout : layouts) {
+    o<<std::endl;
+    o<<"static_assert(sizeof("<<layout.sName<<") == "<<layout.size<<", \""<<layout.sName<<" has changed size\");"<<std::endl;
+    o<<"static_assert(alignof("<<layout.sName<<") == "<<layout.alignment<<", \""<<layout.sName<<" has changed alignment\");"<<std::endl;
+  }
+
+  o<<std::endl;
+  o<<"#endif // LAYOUT_ASSERTS_H"<<std::endl;
+
+  return o.good();
+}
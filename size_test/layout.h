@@ -0,0 +1,80 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <cstddef>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ** Struct layout analyser
+//
+// Reports the offset, size and alignment of each field of a type, the padding holes between them, and how the type sits on cache lines when it is streamed through in an array
+// Types are registered with a list of their fields:
+//
+//  #define CHUNK_SLOT_FIELDS(FIELD) FIELD(chunk) FIELD(bReady) FIELD(data)
+//
+//  layouts.push_back(LAYOUT_TYPE(cChunkSlot, "cChunkSlot", SHARING::BETWEEN_THREADS, CHUNK_SLOT_FIELDS));
+//
+// The fields must be accessible and the type should be standard layout for offsetof, bit fields can't be listed
+// LAYOUT_TYPE has to see the real type, a type from another project must be registered in that project rather than copied into a stand in here
+
+enum class SHARING {
+  NONE,            // Each object is only used by one thread at a time
+  BETWEEN_THREADS, // Neighbouring objects in an array are written by different threads
+};
+
+struct cFieldLayout {
+  cFieldLayout(const char* szName, size_t offset, size_t size, size_t alignment);
+
+  std::string sName;
+  size_t offset;
+  size_t size;
+  size_t alignment;
+};
+
+struct cTypeLayout {
+  cTypeLayout(const char* szName, size_t size, size_t alignment, SHARING sharing);
+
+  std::string sName;
+  size_t size;
+  size_t alignment;
+  SHARING sharing;
+  std::vector<cFieldLayout> fields;
+};
+
+#define LAYOUT_FIELD(NAME) layout.fields.push_back(cFieldLayout(#NAME, offsetof(layout_type, NAME), sizeof(layout_type::NAME), alignof(decltype(layout_type::NAME))));
+
+#define LAYOUT_TYPE(TYPE, NAME, SHARING_, FIELDS) \
+  [&]() { \
+    typedef TYPE layout_type; \
+    cTypeLayout layout(NAME, sizeof(TYPE), alignof(TYPE), SHARING_); \
+    FIELDS(LAYOUT_FIELD) \
+    return layout; \
+  }()
+
+// A gap in a type that holds no field
+struct cPaddingHole {
+  size_t offset;
+  size_t size;
+  bool bTail; // After the last field, this is repeated for every element in an array
+};
+
+struct cLayoutAnalysis {
+  std::vector<cPaddingHole> holes;
+  size_t paddingBytes;
+  size_t minimumSize;                  // The size if the fields were sorted by alignment, largest first
+  std::vector<std::string> straddlingFields; // Fields that cross a cache line boundary when the object starts on a line
+  size_t elementsPerPeriod;            // How many elements of an array it takes for the pattern to repeat on cache lines
+  size_t straddlingElements;           // How many of those elements cross a cache line boundary
+  bool bFalseSharing;                  // Shared between threads and neighbouring objects can be on the same cache line
+};
+
+cLayoutAnalysis AnalyseLayout(const cTypeLayout& layout, size_t cacheLineSize);
+
+void PrintLayoutReport(std::ostream& o, const std::vector<cTypeLayout>& layouts, size_t cacheLineSize);
+
+// Writes static_asserts for the size and alignment of each type so that a change to the layout breaks the build
+bool WriteLayoutAssertsHeader(const std::string& sFilePath, const std::vector<cTypeLayout>& layouts);
+
+#endif // LAYOUT_H
@@ -1,8 +1,54 @@
+// Prints the sizes of the built in types and the features of the processor, see cpufeatures.h
+// With --layout it prints the layout of the project's hot types, see layout.h
+// With --topology it prints the NUMA nodes, cores and caches and recommends where to pin worker threads, see topology.h
+// With --memory it also probes the memory hierarchy, cache sizes and latencies, TLB reach and bandwidth, see memoryprobe.h
+
+#include <cstdint>
 #include <cstdlib>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
-int main(int argc, char* argv[])
+#include "cpudispatch.h"
+#include "hottypes.h"
+#include "layout.h"
+#include "memoryprobe.h"
+#include "topology.h"
+
+#ifdef BUILD_CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+void PrintUsage(const std::string& sExecutableName)
+{
+  std::cout<<"Usage: "<<sExecutableName<<" [--memory [--report FILE] [--profile-header FILE] [--max-size MB] [--bandwidth-size MB] [--threads N]] [--layout [--layout-header FILE]] [--topology [--pinning-plan FILE]]"<<std::endl;
+  std::cout<<"Prints the sizes of the built in types and the features of the processor"<<std::endl;
+  std::cout<<"Set CPU_FEATURES_DISABLE to a comma separated list of features to test the fallback paths, for example CPU_FEATURES_DISABLE=avx2,avx512f"<<std::endl;
+  std::cout<<"  --memory: Also measure the cache line size, cache sizes and latencies, TLB reach and memory bandwidth"<<std::endl;
+  std::cout<<"  --report FILE: Also write the memory report to FILE"<<std::endl;
+  std::cout<<"  --profile-header FILE: Write the results as constants to FILE (For example machine_profile.h) for other tools to use"<<std::endl;
+  std::cout<<"  --max-size MB: The largest working set for the latency test (Default 4 times the largest cache)"<<std::endl;
+  std::cout<<"  --bandwidth-size MB: The buffer size for the bandwidth test (Default 4 times the largest cache, 256 MB for --topology)"<<std::endl;
+  std::cout<<"  --threads N: The number of threads for the multi threaded bandwidth test (Default every core)"<<std::endl;
+  std::cout<<"  --layout: Also print the field offsets, padding and cache line use of the project's hot types"<<std::endl;
+  std::cout<<"  --layout-header FILE: Write static_asserts for the sizes of the hot types in this repository to FILE, other projects register their own types with LAYOUT_TYPE"<<std::endl;
+  std::cout<<"  --topology: Also print the NUMA nodes, cores, SMT siblings and shared caches, measure memory between nodes and recommend where to pin workers"<<std::endl;
+  std::cout<<"  --pinning-plan FILE: Write the recommended pinning to FILE for thread pools to read with cPinningPlan"<<std::endl;
+}
+
+// Parses a positive number, returns false if sValue isn't one
+bool ParseCount(const std::string& sValue, size_t& value)
+{
+  if (sValue.empty() || (sValue.find_first_not_of("0123456789") != std::string::npos)) return false;
+
+  value = size_t(std::stoull(sValue));
+  return (value != 0);
+}
+
+void PrintTypeSizes()
 {
   int* int_ptr = NULL;
   void* void_ptr = NULL;
@@ -27,6 +73,229 @@ int main(int argc, char* argv[])
   std::cout<<"sizeof(*function):   "<<sizeof(funct_ptr)<<" bytes"<<std::endl;
   std::cout<<"------------------------------"<<std::endl;
   std::cout<<"Architecture:        "<<8 * sizeof(void_ptr)<<" bit"<<std::endl;
+}
+
+// ** Dispatch example
+//
+// Counts the set bits in an array, this checks that cDispatch picks an implementation that runs and gets the same answer as the others
+
+size_t CountBitsScalar(const uint64_t* pValues, size_t count)
+{
+  size_t bits = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t value = pValues[i];
+    while (value != 0) {
+      value &= value - 1;
+      bits++;
+    }
+  }
+
+  return bits;
+}
+
+#ifdef BUILD_CPU_FEATURES_X86
+__attribute__((target("popcnt")))
+size_t CountBitsPOPCNT(const uint64_t* pValues, size_t count)
+{
+  size_t bits = 0;
+  for (size_t i = 0; i < count; i++) bits += size_t(__builtin_popcountll(pValues[i]));
+
+  return bits;
+}
+
+// Looks up the bit count of each nibble with a shuffle and sums the bytes with psadbw
+__attribute__((target("avx2")))
+size_t CountBitsAVX2(const uint64_t* pValues, size_t count)
+{
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i lowMask = _mm256_set1_epi8(0x0f);
+  __m256i totals = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; (i + 4) <= count; i += 4) {
+    const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pValues + i));
+    const __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(values, lowMask));
+    const __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(values, 4), lowMask));
+    totals = _mm256_add_epi64(totals, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+  }
+
+  size_t bits = size_t(_mm256_extract_epi64(totals, 0) + _mm256_extract_epi64(totals, 1) + _mm256_extract_epi64(totals, 2) + _mm256_extract_epi64(totals, 3));
+  for (; i < count; i++) bits += size_t(__builtin_popcountll(pValues[i]));
+
+  return bits;
+}
+#endif
+
+typedef size_t (*count_bits_t)(const uint64_t* pValues, size_t count);
+
+const cDispatch<count_bits_t> CountBits = {
+#ifdef BUILD_CPU_FEATURES_X86
+  { CountBitsAVX2, "avx2", { CPU_FEATURE::AVX2 } },
+  { CountBitsPOPCNT, "popcnt", { CPU_FEATURE::POPCNT } },
+#endif
+  { CountBitsScalar, "scalar", {} },
+};
+
+void PrintCPUFeatures()
+{
+  const cCPUFeatures& features = GetCPUFeatures();
+
+  if (!features.GetVendor().empty()) std::cout<<"CPU vendor:          "<<features.GetVendor()<<std::endl;
+  if (!features.GetBrand().empty()) std::cout<<"CPU brand:           "<<features.GetBrand()<<std::endl;
+
+  std::cout<<"CPU features:       ";
+  for (size_t i = 0; i < CPU_FEATURE_COUNT; i++) {
+    if (features.IsSupported(CPU_FEATURE(i))) std::cout<<" "<<GetCPUFeatureName(CPU_FEATURE(i));
+  }
+  std::cout<<std::endl;
+
+  // Features that the processor has but can't be used
+  for (size_t i = 0; i < CPU_FEATURE_COUNT; i++) {
+    const CPU_FEATURE feature = CPU_FEATURE(i);
+    if (features.IsPresent(feature) && features.IsDisabledByOS(feature)) std::cout<<"Not enabled by OS:   "<<GetCPUFeatureName(feature)<<std::endl;
+    else if (features.IsPresent(feature) && features.IsDisabledByEnvironment(feature)) std::cout<<"Disabled by env:     "<<GetCPUFeatureName(feature)<<std::endl;
+  }
+
+#ifdef BUILD_CPU_FEATURES_X86
+  std::cout<<"OS saves AVX state:  "<<(((features.GetXCR0() & 0x6) == 0x6) ? "yes" : "no")<<" (XCR0 0x"<<std::hex<<features.GetXCR0()<<std::dec<<")"<<std::endl;
+  std::cout<<"OS saves AVX-512:    "<<(((features.GetXCR0() & 0xe6) == 0xe6) ? "yes" : "no")<<std::endl;
+#endif
+  std::cout<<"AT_HWCAP:            0x"<<std::hex<<features.GetHWCAP()<<", AT_HWCAP2 0x"<<features.GetHWCAP2()<<std::dec<<std::endl;
+  std::cout<<"SIMD width:          "<<(8 * features.GetSIMDWidth())<<" bit"<<std::endl;
+
+  // Check the dispatched implementation against the scalar one
+  std::vector<uint64_t> values(1027);
+  uint64_t value = 0x9e3779b97f4a7c15ull;
+  for (uint64_t& v : values) {
+    value ^= value << 13;
+    value ^= value >> 7;
+    value ^= value << 17;
+    v = value;
+  }
+
+  const bool bMatches = (CountBits(values.data(), values.size()) == CountBitsScalar(values.data(), values.size()));
+  std::cout<<"Dispatch example:    CountBits uses "<<CountBits.GetName()<<(bMatches ? "" : " (WRONG RESULT)")<<std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  bool bMemory = false;
+  bool bLayout = false;
+  std::string sLayoutHeaderFilePath;
+  bool bTopology = false;
+  std::string sPinningPlanFilePath;
+  std::string sReportFilePath;
+  std::string sProfileHeaderFilePath;
+  cMemoryProbeSettings settings;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string sArgument(argv[i]);
+    const bool bHasValue = ((i + 1) < argc);
+
+    if ((sArgument == "-h") || (sArgument == "--help")) {
+      PrintUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (sArgument == "--memory") bMemory = true;
+    else if (sArgument == "--layout") bLayout = true;
+    else if ((sArgument == "--layout-header") && bHasValue) sLayoutHeaderFilePath = argv[++i];
+    else if (sArgument == "--topology") bTopology = true;
+    else if ((sArgument == "--pinning-plan") && bHasValue) sPinningPlanFilePath = argv[++i];
+    else if ((sArgument == "--report") && bHasValue) sReportFilePath = argv[++i];
+    else if ((sArgument == "--profile-header") && bHasValue) sProfileHeaderFilePath = argv[++i];
+    else if (((sArgument == "--max-size") || (sArgument == "--bandwidth-size")) && bHasValue) {
+      size_t mb = 0;
+      if (!ParseCount(argv[++i], mb)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (sArgument == "--max-size") settings.maxLatencySize = mb * MiB;
+      else settings.bandwidthSize = mb * MiB;
+    } else if ((sArgument == "--threads") && bHasValue) {
+      if (!ParseCount(argv[++i], settings.nThreads)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  PrintTypeSizes();
+  PrintCPUFeatures();
+
+  if (bLayout || !sLayoutHeaderFilePath.empty()) {
+    const std::vector<cTypeLayout> layouts = GetHotTypeLayouts();
+
+    if (bLayout) {
+      // Use the OS's cache line size if it reports one
+      size_t cacheLineSize = 64;
+      const std::vector<cCacheInfo> caches = GetCacheInfo();
+      if (!caches.empty() && (caches[0].lineSize != 0)) cacheLineSize = caches[0].lineSize;
+
+      std::cout<<"------------------------------"<<std::endl;
+      PrintLayoutReport(std::cout, layouts, cacheLineSize);
+    }
+
+    if (!sLayoutHeaderFilePath.empty()) {
+      if (!WriteLayoutAssertsHeader(sLayoutHeaderFilePath, layouts)) {
+        std::cerr<<"Error writing the layout header to "<<sLayoutHeaderFilePath<<std::endl;
+        return EXIT_FAILURE;
+      }
+
+      std::cout<<"Wrote "<<sLayoutHeaderFilePath<<std::endl;
+    }
+  }
+
+  if (bTopology || !sPinningPlanFilePath.empty()) {
+    cTopology topology = GetTopology();
+
+    if (bTopology) {
+      std::cout<<"------------------------------"<<std::endl;
+      MeasureNodeMemory(topology, (settings.bandwidthSize != 0) ? settings.bandwidthSize : (256 * MiB), std::cout);
+      std::cout<<std::endl;
+      PrintTopologyReport(std::cout, topology);
+    }
+
+    if (!sPinningPlanFilePath.empty()) {
+      if (!CreatePinningPlan(topology).Write(sPinningPlanFilePath)) {
+        std::cerr<<"Error writing the pinning plan to "<<sPinningPlanFilePath<<std::endl;
+        return EXIT_FAILURE;
+      }
+
+      std::cout<<"Wrote "<<sPinningPlanFilePath<<std::endl;
+    }
+  }
+
+  if (bMemory) {
+    std::cout<<"------------------------------"<<std::endl;
+
+    const cMemoryProfile profile = ProbeMemory(settings, std::cout);
+    std::cout<<std::endl;
+
+    std::ostringstream report;
+    PrintMemoryReport(report, profile);
+    std::cout<<report.str();
+
+    if (!sReportFilePath.empty()) {
+      std::ofstream file(sReportFilePath);
+      file<<report.str();
+      if (!file.good()) {
+        std::cerr<<"Error writing the report to "<<sReportFilePath<<std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (!sProfileHeaderFilePath.empty()) {
+      if (!WriteMachineProfileHeader(sProfileHeaderFilePath, profile)) {
+        std::cerr<<"Error writing the profile header to "<<sProfileHeaderFilePath<<std::endl;
+        return EXIT_FAILURE;
+      }
+
+      std::cout<<"Wrote "<<sProfileHeaderFilePath<<std::endl;
+    }
+  }
 
   return EXIT_SUCCESS;
 }
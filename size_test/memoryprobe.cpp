@@ -0,0 +1,662 @@
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memoryprobe.h"
+
+namespace
+{
+  // A latency this much higher than at the start of a level is the start of the next level
+  const double LEVEL_JUMP_RATIO = 1.3;
+
+  // The latency has settled into the next level once it rises by less than this from one size to the next
+  const double LEVEL_SETTLE_RATIO = 1.1;
+
+  // Each cache level is at least this much slower than the one before it
+  const double LEVEL_MERGE_RATIO = 1.5;
+
+  // Huge pages are 2 MiB on x86-64
+  const size_t HUGE_PAGE_SIZE = 2 * MiB;
+
+  const size_t PAGE_SIZE = 4 * KiB;
+
+  // Stops the compiler from optimising away value or the loop that produced it
+  template <class T>
+  inline void DoNotOptimize(const T& value)
+  {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  uint64_t GetTimeNS()
+  {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  bool ReadFirstLine(const std::string& sFilePath, std::string& sLine)
+  {
+    std::ifstream file(sFilePath);
+    if (!file.good()) return false;
+
+    std::getline(file, sLine);
+    return true;
+  }
+
+  // Parses sizes like "48K" from sysfs
+  size_t ParseSize(const std::string& sSize)
+  {
+    size_t value = size_t(strtoull(sSize.c_str(), nullptr, 10));
+    if (!sSize.empty()) {
+      const char suffix = sSize[sSize.length() - 1];
+      if (suffix == 'K') value *= KiB;
+      else if (suffix == 'M') value *= MiB;
+      else if (suffix == 'G') value *= 1024 * MiB;
+    }
+    return value;
+  }
+
+
+  // ** cBuffer
+  //
+  // Anonymous memory from mmap so that it is page aligned and we can ask for huge pages
+
+  class cBuffer
+  {
+  public:
+    cBuffer(size_t size, bool bHugePages);
+    ~cBuffer();
+
+    bool IsValid() const { return (pData != nullptr); }
+    char* GetData() const { return pData; }
+    size_t GetSize() const { return size; }
+
+  private:
+    cBuffer(const cBuffer&) = delete;
+    cBuffer& operator=(const cBuffer&) = delete;
+
+    char* pMapping;
+    size_t mappingSize;
+    char* pData;
+    size_t size;
+  };
+
+  cBuffer::cBuffer(size_t _size, bool bHugePages) :
+    pMapping(nullptr),
+    mappingSize(0),
+    pData(nullptr),
+    size(_size)
+  {
+    // Huge pages have to be aligned to a huge page so map a bit extra and align it ourselves
+    mappingSize = bHugePages ? (size + HUGE_PAGE_SIZE) : size;
+
+    void* pResult = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pResult == MAP_FAILED) return;
+
+    pMapping = static_cast<char*>(pResult);
+    pData = pMapping;
+
+    if (bHugePages) {
+      pData = reinterpret_cast<char*>((uintptr_t(pMapping) + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1));
+      if (madvise(pData, size, MADV_HUGEPAGE) != 0) {
+        munmap(pMapping, mappingSize);
+        pMapping = nullptr;
+        pData = nullptr;
+        return;
+      }
+    } else madvise(pData, size, MADV_NOHUGEPAGE);
+
+    // Fault every page in now so that page faults aren't timed
+    memset(pData, 0, size);
+  }
+
+  cBuffer::~cBuffer()
+  {
+    if (pMapping != nullptr) munmap(pMapping, mappingSize);
+  }
+
+
+  // ** Pointer chasing
+
+  // Links the nodes into one cycle in a random order, each node holds a pointer to the next one, returns the first node
+  char* LinkRandomCycle(std::vector<char*>& nodes, std::mt19937_64& generator)
+  {
+    std::shuffle(nodes.begin(), nodes.end(), generator);
+
+    for (size_t i = 0; i < nodes.size(); i++) *reinterpret_cast<char**>(nodes[i]) = nodes[(i + 1) % nodes.size()];
+
+    return nodes[0];
+  }
+
+  // Returns the average time for each load of the chain, the best of a few runs
+  double ChaseNS(char* pStart, size_t nNodes)
+  {
+    // Go around the whole cycle first so that everything that fits is in the caches and TLB
+    char* p = pStart;
+    for (size_t i = 0; i < nNodes; i++) p = *reinterpret_cast<char**>(p);
+
+    // Enough loads for the timer to be accurate even for the L1 cache
+    const size_t steps = std::max<size_t>(nNodes, 1 << 20) & ~size_t(7);
+
+    double best = 0.0;
+    for (size_t run = 0; run < 3; run++) {
+      const uint64_t start = GetTimeNS();
+      for (size_t i = 0; i < steps; i += 8) {
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+        p = *reinterpret_cast<char**>(p);
+      }
+      const double ns = double(GetTimeNS() - start) / double(steps);
+      if ((run == 0) || (ns < best)) best = ns;
+    }
+
+    DoNotOptimize(p);
+    return best;
+  }
+
+  // Each node is loaded at offset first which holds 0, then the next node is loaded through it, so the second load depends on the first
+  // The second load is an L1 hit while offset is in the same line as the start of the node
+  double ChaseWithOffsetNS(char* pStart, size_t nNodes, size_t offset)
+  {
+    char* p = pStart;
+    for (size_t i = 0; i < nNodes; i++) p = *reinterpret_cast<char**>(p);
+
+    const size_t steps = std::max<size_t>(nNodes, 1 << 20);
+
+    double best = 0.0;
+    for (size_t run = 0; run < 3; run++) {
+      const uint64_t start = GetTimeNS();
+      for (size_t i = 0; i < steps; i++) {
+        const size_t zero = *reinterpret_cast<const size_t*>(p + offset);
+        p = *reinterpret_cast<char**>(p + zero);
+      }
+      const double ns = double(GetTimeNS() - start) / double(steps);
+      if ((run == 0) || (ns < best)) best = ns;
+    }
+
+    DoNotOptimize(p);
+    return best;
+  }
+
+  size_t MeasureCacheLineSize(size_t l2Size, std::mt19937_64& generator)
+  {
+    // Nodes are spread out so that every offset we try is inside the node, the working set is bigger than the L2 cache so each node misses
+    const size_t nodeSize = 512;
+    const size_t size = std::max<size_t>(8 * MiB, 4 * l2Size);
+    cBuffer buffer(size, false);
+    if (!buffer.IsValid()) return 0;
+
+    std::vector<char*> nodes;
+    for (size_t offset = 0; offset < size; offset += nodeSize) nodes.push_back(buffer.GetData() + offset);
+    char* pStart = LinkRandomCycle(nodes, generator);
+
+    const double baseNS = ChaseWithOffsetNS(pStart, nodes.size(), sizeof(size_t));
+    for (size_t offset = 2 * sizeof(size_t); offset < nodeSize; offset *= 2) {
+      if (ChaseWithOffsetNS(pStart, nodes.size(), offset) > (LEVEL_JUMP_RATIO * baseNS)) return offset;
+    }
+
+    return 0;
+  }
+
+  void MeasureLatencies(cMemoryProfile& profile, size_t maxSize, std::mt19937_64& generator)
+  {
+    cBuffer buffer(maxSize, false);
+    if (!buffer.IsValid()) return;
+
+    const size_t lineSize = (profile.cacheLineSize != 0) ? profile.cacheLineSize : 64;
+
+    // Powers of two and half way between them
+    std::vector<size_t> sizes;
+    for (size_t size = 4 * KiB; size <= maxSize; size *= 2) {
+      sizes.push_back(size);
+      if ((size + (size / 2)) <= maxSize) sizes.push_back(size + (size / 2));
+    }
+
+    std::vector<char*> nodes;
+    for (const size_t size : sizes) {
+      nodes.clear();
+      for (size_t offset = 0; offset < size; offset += lineSize) nodes.push_back(buffer.GetData() + offset);
+
+      char* pStart = LinkRandomCycle(nodes, generator);
+      profile.latencies.push_back({ size, ChaseNS(pStart, nodes.size()) });
+    }
+  }
+
+  // Splits the latency curve into levels where the latency jumps from the start of the level
+  void FindCacheLevels(cMemoryProfile& profile)
+  {
+    const std::vector<cLatencyPoint>& latencies = profile.latencies;
+    if (latencies.empty()) return;
+
+    size_t levelStart = 0;
+    for (size_t i = 1; i < latencies.size(); i++) {
+      if (latencies[i].latencyNS <= (LEVEL_JUMP_RATIO * latencies[levelStart].latencyNS)) continue;
+
+      // The previous size was the last one that fitted, use the median of the plateau as the level's latency
+      std::vector<double> plateau;
+      for (size_t j = levelStart; j < i; j++) plateau.push_back(latencies[j].latencyNS);
+      std::sort(plateau.begin(), plateau.end());
+      const cMeasuredCacheLevel level = { latencies[i - 1].size, plateau[plateau.size() / 2] };
+
+      // A slow rise at the end of a level can look like a level of its own, real levels are much slower than the level before them
+      if (!profile.measuredCacheLevels.empty() && (level.latencyNS < (LEVEL_MERGE_RATIO * profile.measuredCacheLevels.back().latencyNS))) profile.measuredCacheLevels.back().size = level.size;
+      else profile.measuredCacheLevels.push_back(level);
+
+      // Part of the working set still fits just past the end of a level, the next level starts once the latency stops rising
+      while (((i + 1) < latencies.size()) && (latencies[i + 1].latencyNS > (LEVEL_SETTLE_RATIO * latencies[i].latencyNS))) i++;
+      levelStart = i;
+    }
+
+    // Whatever is left is main memory, the largest sizes are the most representative
+    profile.memoryLatencyNS = latencies.back().latencyNS;
+  }
+
+  void MeasureTLB(cMemoryProfile& profile, size_t maxPages, bool bHugePages, std::mt19937_64& generator)
+  {
+    cBuffer buffer(maxPages * PAGE_SIZE, bHugePages);
+    if (!buffer.IsValid()) return;
+
+    profile.bHugePagesUsed = profile.bHugePagesUsed || bHugePages;
+
+    std::vector<char*> nodes;
+    size_t point = 0;
+    for (size_t pages = 16; pages <= maxPages; pages *= 2, point++) {
+      // One line per page at a random offset, the same offset on every page would put every line in the same few cache sets
+      nodes.clear();
+      for (size_t page = 0; page < pages; page++) nodes.push_back(buffer.GetData() + (page * PAGE_SIZE) + ((generator() % (PAGE_SIZE / 64)) * 64));
+
+      char* pStart = LinkRandomCycle(nodes, generator);
+      const double ns = ChaseNS(pStart, nodes.size());
+
+      if (point == profile.tlb.size()) profile.tlb.push_back({ pages, 0.0, 0.0 });
+      if (bHugePages) profile.tlb[point].hugePageLatencyNS = ns;
+      else profile.tlb[point].latencyNS = ns;
+    }
+  }
+
+  void FindTLBEntries(cMemoryProfile& profile)
+  {
+    for (size_t i = 1; i < profile.tlb.size(); i++) {
+      if (profile.tlb[i].latencyNS > (LEVEL_JUMP_RATIO * profile.tlb[i - 1].latencyNS)) {
+        profile.tlbEntries = profile.tlb[i - 1].pages;
+        return;
+      }
+    }
+  }
+
+
+  // ** Bandwidth
+
+  enum class BANDWIDTH_TEST {
+    READ,
+    WRITE,
+    COPY,
+  };
+
+  void RunBandwidthTest(BANDWIDTH_TEST test, char* pData, size_t size)
+  {
+    uint64_t* pWords = reinterpret_cast<uint64_t*>(pData);
+    const size_t nWords = size / sizeof(uint64_t);
+
+    switch (test) {
+      case BANDWIDTH_TEST::READ: {
+        // Several sums so that the adds don't limit the loads
+        uint64_t sum0 = 0;
+        uint64_t sum1 = 0;
+        uint64_t sum2 = 0;
+        uint64_t sum3 = 0;
+        for (size_t i = 0; (i + 4) <= nWords; i += 4) {
+          sum0 += pWords[i];
+          sum1 += pWords[i + 1];
+          sum2 += pWords[i + 2];
+          sum3 += pWords[i + 3];
+        }
+        DoNotOptimize(sum0 + sum1 + sum2 + sum3);
+        break;
+      }
+      case BANDWIDTH_TEST::WRITE: {
+        for (size_t i = 0; i < nWords; i++) pWords[i] = i;
+        DoNotOptimize(pWords[0]);
+        break;
+      }
+      case BANDWIDTH_TEST::COPY: {
+        memcpy(pData + (size / 2), pData, size / 2);
+        DoNotOptimize(pData[size / 2]);
+        break;
+      }
+    }
+  }
+
+  // Returns GB/s, reads and writes are both counted so a copy counts each byte twice like STREAM
+  double MeasureBandwidthGBs(BANDWIDTH_TEST test, const cBuffer& buffer, size_t nThreads)
+  {
+    // Each thread gets its own cache line aligned slice
+    const size_t slice = (buffer.GetSize() / nThreads) & ~size_t(63);
+    const size_t bytes = (test == BANDWIDTH_TEST::COPY) ? (2 * (slice / 2) * nThreads) : (slice * nThreads);
+
+    double best = 0.0;
+    for (size_t run = 0; run < 5; run++) {
+      std::atomic<bool> bGo(false);
+      std::vector<std::thread> threads;
+      for (size_t i = 1; i < nThreads; i++) {
+        threads.push_back(std::thread([&, i]() {
+          while (!bGo) std::this_thread::yield();
+          RunBandwidthTest(test, buffer.GetData() + (i * slice), slice);
+        }));
+      }
+
+      const uint64_t start = GetTimeNS();
+      bGo = true;
+      RunBandwidthTest(test, buffer.GetData(), slice);
+      for (std::thread& thread : threads) thread.join();
+      const uint64_t duration = std::max<uint64_t>(GetTimeNS() - start, 1);
+
+      best = std::max(best, double(bytes) / double(duration));
+    }
+
+    return best;
+  }
+
+  cBandwidth MeasureBandwidth(const cBuffer& buffer, size_t nThreads)
+  {
+    cBandwidth bandwidth;
+    bandwidth.readGBs = MeasureBandwidthGBs(BANDWIDTH_TEST::READ, buffer, nThreads);
+    bandwidth.writeGBs = MeasureBandwidthGBs(BANDWIDTH_TEST::WRITE, buffer, nThreads);
+    bandwidth.copyGBs = MeasureBandwidthGBs(BANDWIDTH_TEST::COPY, buffer, nThreads);
+    return bandwidth;
+  }
+}
+
+// ** cMemoryProbeSettings
+
+cMemoryProbeSettings::cMemoryProbeSettings() :
+  maxLatencySize(0),
+  bandwidthSize(0),
+  nThreads(0)
+{
+}
+
+
+// ** cMemoryProfile
+
+cMemoryProfile::cMemoryProfile() :
+  cacheLineSize(0),
+  measuredCacheLineSize(0),
+  memoryLatencyNS(0.0),
+  bHugePagesUsed(false),
+  tlbEntries(0),
+  bandwidthSize(0),
+  nThreads(1),
+  singleThreadBandwidth({ 0.0, 0.0, 0.0 }),
+  multiThreadBandwidth({ 0.0, 0.0, 0.0 })
+{
+}
+
+size_t cMemoryProfile::GetCacheSize(int level) const
+{
+  for (const cCacheInfo& cache : caches) {
+    if ((cache.level == level) && (cache.sType != "Instruction")) return cache.size;
+  }
+
+  if ((level >= 1) && (size_t(level) <= measuredCacheLevels.size())) return measuredCacheLevels[level - 1].size;
+
+  return 0;
+}
+
+double cMemoryProfile::GetCacheLatencyNS(int level) const
+{
+  if ((level >= 1) && (size_t(level) <= measuredCacheLevels.size())) return measuredCacheLevels[level - 1].latencyNS;
+
+  return 0.0;
+}
+
+
+std::vector<cCacheInfo> GetCacheInfo(size_t cpu)
+{
+  std::vector<cCacheInfo> caches;
+
+  for (size_t index = 0; ; index++) {
+    const std::string sFolder = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index" + std::to_string(index) + "/";
+
+    std::string sLevel;
+    if (!ReadFirstLine(sFolder + "level", sLevel)) break;
+
+    cCacheInfo cache;
+    cache.level = atoi(sLevel.c_str());
+    ReadFirstLine(sFolder + "type", cache.sType);
+
+    std::string sValue;
+    cache.size = ReadFirstLine(sFolder + "size", sValue) ? ParseSize(sValue) : 0;
+    cache.lineSize = ReadFirstLine(sFolder + "coherency_line_size", sValue) ? ParseSize(sValue) : 0;
+    cache.ways = ReadFirstLine(sFolder + "ways_of_associativity", sValue) ? ParseSize(sValue) : 0;
+    ReadFirstLine(sFolder + "shared_cpu_list", cache.sSharedCPUList);
+
+    caches.push_back(cache);
+  }
+
+  return caches;
+}
+
+std::string FormatBytes(size_t bytes)
+{
+  std::ostringstream o;
+  if ((bytes >= MiB) && ((bytes % (MiB / 2)) == 0)) o<<(double(bytes) / double(MiB))<<" MiB";
+  else if ((bytes >= KiB) && ((bytes % (KiB / 2)) == 0)) o<<(double(bytes) / double(KiB))<<" KiB";
+  else o<<bytes<<" bytes";
+  return o.str();
+}
+
+double MeasureChaseLatencyNS(char* pData, size_t size, size_t lineSize)
+{
+  std::mt19937_64 generator(1);
+
+  std::vector<char*> nodes;
+  for (size_t offset = 0; (offset + lineSize) <= size; offset += lineSize) nodes.push_back(pData + offset);
+  if (nodes.empty()) return 0.0;
+
+  char* pStart = LinkRandomCycle(nodes, generator);
+  return ChaseNS(pStart, nodes.size());
+}
+
+double MeasureReadBandwidthGBs(char* pData, size_t size)
+{
+  double best = 0.0;
+  for (size_t run = 0; run < 5; run++) {
+    const uint64_t start = GetTimeNS();
+    RunBandwidthTest(BANDWIDTH_TEST::READ, pData, size);
+    const uint64_t duration = std::max<uint64_t>(GetTimeNS() - start, 1);
+
+    best = std::max(best, double(size) / double(duration));
+  }
+
+  return best;
+}
+
+cMemoryProfile ProbeMemory(const cMemoryProbeSettings& settings, std::ostream& progress)
+{
+  cMemoryProfile profile;
+
+  // The seed is fixed so that each run uses the same cycles
+  std::mt19937_64 generator(12345);
+
+  profile.caches = GetCacheInfo();
+  for (const cCacheInfo& cache : profile.caches) {
+    if ((cache.level == 1) && (cache.sType != "Instruction")) profile.cacheLineSize = cache.lineSize;
+  }
+
+  // Go well past the last cache so that we see main memory
+  size_t largestCache = 0;
+  for (const cCacheInfo& cache : profile.caches) largestCache = std::max(largestCache, cache.size);
+
+  progress<<"Measuring the cache line size"<<std::endl;
+  profile.measuredCacheLineSize = MeasureCacheLineSize(profile.GetCacheSize(2), generator);
+
+  const size_t maxLatencySize = (settings.maxLatencySize != 0) ? settings.maxLatencySize : std::min<size_t>(std::max<size_t>(4 * largestCache, 64 * MiB), 512 * MiB);
+  progress<<"Measuring latency up to "<<FormatBytes(maxLatencySize)<<std::endl;
+  MeasureLatencies(profile, maxLatencySize, generator);
+  FindCacheLevels(profile);
+
+  std::string sHugePages;
+  if (ReadFirstLine("/sys/kernel/mm/transparent_hugepage/enabled", sHugePages)) {
+    // The selected setting is in brackets, "always [madvise] never"
+    const size_t open = sHugePages.find('[');
+    const size_t close = sHugePages.find(']');
+    if ((open != std::string::npos) && (close != std::string::npos) && (open < close)) sHugePages = sHugePages.substr(open + 1, close - open - 1);
+  } else sHugePages = "not available";
+  profile.sHugePages = sHugePages;
+
+  // 32768 pages is 128 MiB, more than any second level TLB covers
+  const size_t maxPages = 32768;
+  progress<<"Measuring the TLB with 4 KiB pages"<<std::endl;
+  MeasureTLB(profile, maxPages, false, generator);
+  FindTLBEntries(profile);
+  if ((profile.sHugePages == "always") || (profile.sHugePages == "madvise")) {
+    progress<<"Measuring the TLB with huge pages"<<std::endl;
+    MeasureTLB(profile, maxPages, true, generator);
+  }
+
+  profile.bandwidthSize = (settings.bandwidthSize != 0) ? settings.bandwidthSize : std::min<size_t>(std::max<size_t>(4 * largestCache, 64 * MiB), 512 * MiB);
+  profile.nThreads = (settings.nThreads != 0) ? settings.nThreads : std::max(1u, std::thread::hardware_concurrency());
+
+  cBuffer buffer(profile.bandwidthSize, false);
+  if (buffer.IsValid()) {
+    progress<<"Measuring bandwidth with 1 thread"<<std::endl;
+    profile.singleThreadBandwidth = MeasureBandwidth(buffer, 1);
+
+    if (profile.nThreads > 1) {
+      progress<<"Measuring bandwidth with "<<profile.nThreads<<" threads"<<std::endl;
+      profile.multiThreadBandwidth = MeasureBandwidth(buffer, profile.nThreads);
+    } else profile.multiThreadBandwidth = profile.singleThreadBandwidth;
+  }
+
+  return profile;
+}
+
+void PrintMemoryReport(std::ostream& o, const cMemoryProfile& profile)
+{
+  o<<std::fixed<<std::setprecision(2);
+
+#ifndef __OPTIMIZE__
+  o<<"WARNING: This was built without optimisation, the bandwidth will be low, build with -DCMAKE_BUILD_TYPE=Release"<<std::endl;
+#endif
+
+  o<<"Caches reported by the OS:"<<std::endl;
+  if (profile.caches.empty()) o<<"  None, /sys/devices/system/cpu/cpu0/cache is not available"<<std::endl;
+  for (const cCacheInfo& cache : profile.caches) {
+    o<<"  L"<<cache.level<<" "<<std::left<<std::setw(12)<<cache.sType<<std::right<<std::setw(10)<<FormatBytes(cache.size)<<", "<<cache.lineSize<<" byte lines, "<<cache.ways<<" way"<<std::endl;
+  }
+  o<<std::endl;
+
+  o<<"Cache line size: ";
+  if (profile.cacheLineSize != 0) o<<profile.cacheLineSize<<" bytes reported by the OS, ";
+  if (profile.measuredCacheLineSize != 0) o<<profile.measuredCacheLineSize<<" bytes measured"<<std::endl;
+  else o<<"the measurement didn't find a jump"<<std::endl;
+  o<<std::endl;
+
+  o<<"Load to use latency (Pointer chase through a random cycle of cache lines):"<<std::endl;
+  o<<std::setw(14)<<"working set"<<std::setw(14)<<"ns/load"<<std::endl;
+  for (const cLatencyPoint& point : profile.latencies) o<<std::setw(14)<<FormatBytes(point.size)<<std::setw(14)<<point.latencyNS<<std::endl;
+  o<<std::endl;
+
+  o<<"Cache levels found from the latency:"<<std::endl;
+  for (size_t i = 0; i < profile.measuredCacheLevels.size(); i++) {
+    const cMeasuredCacheLevel& level = profile.measuredCacheLevels[i];
+    o<<"  L"<<(i + 1)<<": up to about "<<FormatBytes(level.size)<<", "<<level.latencyNS<<" ns"<<std::endl;
+
+    // A virtual machine can report the host's caches, or the whole cache when only part of it is ours
+    const size_t reportedSize = profile.GetCacheSize(int(i + 1));
+    if (reportedSize > (4 * level.size)) o<<"  WARNING: The OS reports L"<<(i + 1)<<" as "<<FormatBytes(reportedSize)<<" but the latency jumped at "<<FormatBytes(level.size)<<", machine_profile.h uses the OS value"<<std::endl;
+  }
+  o<<"  Memory: "<<profile.memoryLatencyNS<<" ns"<<std::endl;
+  o<<std::endl;
+
+  o<<"TLB (Pointer chase through one line on each page, transparent huge pages are \""<<profile.sHugePages<<"\"):"<<std::endl;
+  o<<std::setw(10)<<"pages"<<std::setw(14)<<"footprint"<<std::setw(14)<<"4 KiB ns"<<std::setw(16)<<"huge pages ns"<<std::endl;
+  for (const cTLBPoint& point : profile.tlb) {
+    o<<std::setw(10)<<point.pages<<std::setw(14)<<FormatBytes(point.pages * PAGE_SIZE)<<std::setw(14)<<point.latencyNS;
+    if (profile.bHugePagesUsed) o<<std::setw(16)<<point.hugePageLatencyNS;
+    o<<std::endl;
+  }
+  if (profile.tlbEntries != 0) o<<"TLB reach with 4 KiB pages: about "<<profile.tlbEntries<<" pages, "<<FormatBytes(profile.tlbEntries * PAGE_SIZE)<<std::endl;
+  else o<<"TLB reach with 4 KiB pages: no jump found"<<std::endl;
+  o<<std::endl;
+
+  o<<"Bandwidth in GB/s ("<<FormatBytes(profile.bandwidthSize)<<" buffer, reads and writes are both counted so a copy counts each byte twice):"<<std::endl;
+  o<<std::setw(14)<<"threads"<<std::setw(10)<<"read"<<std::setw(10)<<"write"<<std::setw(10)<<"copy"<<std::endl;
+  o<<std::setw(14)<<1<<std::setw(10)<<profile.singleThreadBandwidth.readGBs<<std::setw(10)<<profile.singleThreadBandwidth.writeGBs<<std::setw(10)<<profile.singleThreadBandwidth.copyGBs<<std::endl;
+  if (profile.nThreads > 1) o<<std::setw(14)<<profile.nThreads<<std::setw(10)<<profile.multiThreadBandwidth.readGBs<<std::setw(10)<<profile.multiThreadBandwidth.writeGBs<<std::setw(10)<<profile.multiThreadBandwidth.copyGBs<<std::endl;
+}
+
+bool WriteMachineProfileHeader(const std::string& sFilePath, const cMemoryProfile& profile)
+{
+  std::ofstream o(sFilePath);
+  if (!o.good()) return false;
+
+  const size_t lineSize = (profile.cacheLineSize != 0) ? profile.cacheLineSize : ((profile.measuredCacheLineSize != 0) ? profile.measuredCacheLineSize : 64);
+  const size_t l1Size = profile.GetCacheSize(1);
+  const size_t l2Size = profile.GetCacheSize(2);
+  const size_t l3Size = profile.GetCacheSize(3);
+
+  o<<std::fixed<<std::setprecision(2);
+  o<<"// Generated by size_test --memory --profile-header, run it again on the target machine to update this"<<std::endl;
+  o<<"// Cache sizes come from the OS where it reports them and otherwise from where the latency jumped"<<std::endl;
+#ifndef __OPTIMIZE__
+  o<<"// WARNING: size_test was built without optimisation, the bandwidths are too low, build with -DCMAKE_BUILD_TYPE=Release and run it again"<<std::endl;
+#endif
+  o<<std::endl;
+  o<<"#ifndef MACHINE_PROFILE_H"<<std::endl;
+  o<<"#define MACHINE_PROFILE_H"<<std::endl;
+  o<<std::endl;
+  o<<"#include <cstddef>"<<std::endl;
+  o<<std::endl;
+  o<<"namespace machine_profile"<<std::endl;
+  o<<"{"<<std::endl;
+  o<<"  const size_t CACHE_LINE_SIZE = "<<lineSize<<";"<<std::endl;
+  o<<std::endl;
+  o<<"  // Data cache sizes in bytes, 0 if there is no cache at that level"<<std::endl;
+  o<<"  const size_t L1_CACHE_SIZE = "<<l1Size<<";"<<std::endl;
+  o<<"  const size_t L2_CACHE_SIZE = "<<l2Size<<";"<<std::endl;
+  o<<"  const size_t L3_CACHE_SIZE = "<<l3Size<<";"<<std::endl;
+  o<<std::endl;
+  o<<"  // Block sizes for tiling a working set so that it stays in each cache, half of the cache leaves room for everything else"<<std::endl;
+  o<<"  const size_t L1_BLOCK_SIZE = "<<(l1Size / 2)<<";"<<std::endl;
+  o<<"  const size_t L2_BLOCK_SIZE = "<<(l2Size / 2)<<";"<<std::endl;
+  o<<"  const size_t L3_BLOCK_SIZE = "<<(l3Size / 2)<<";"<<std::endl;
+  o<<std::endl;
+  o<<"  // Load to use latency in nanoseconds"<<std::endl;
+  o<<"  const double L1_LATENCY_NS = "<<profile.GetCacheLatencyNS(1)<<";"<<std::endl;
+  o<<"  const double L2_LATENCY_NS = "<<profile.GetCacheLatencyNS(2)<<";"<<std::endl;
+  o<<"  const double L3_LATENCY_NS = "<<profile.GetCacheLatencyNS(3)<<";"<<std::endl;
+  o<<"  const double MEMORY_LATENCY_NS = "<<profile.memoryLatencyNS<<";"<<std::endl;
+  o<<std::endl;
+  o<<"  // How much memory the TLB covers with 4 KiB pages, 0 if it wasn't found"<<std::endl;
+  o<<"  const size_t TLB_REACH = "<<(profile.tlbEntries * PAGE_SIZE)<<";"<<std::endl;
+  o<<std::endl;
+  o<<"  // Bandwidth in GB/s, a copy counts each byte twice"<<std::endl;
+  o<<"  const size_t BANDWIDTH_THREADS = "<<profile.nThreads<<";"<<std::endl;
+  o<<"  const double READ_BANDWIDTH_GBS = "<<profile.singleThreadBandwidth.readGBs<<";"<<std::endl;
+  o<<"  const double WRITE_BANDWIDTH_GBS = "<<profile.singleThreadBandwidth.writeGBs<<";"<<std::endl;
+  o<<"  const double COPY_BANDWIDTH_GBS = "<<profile.singleThreadBandwidth.copyGBs<<";"<<std::endl;
+  o<<"  const double MULTI_THREAD_READ_BANDWIDTH_GBS = "<<profile.multiThreadBandwidth.readGBs<<";"<<std::endl;
+  o<<"  const double MULTI_THREAD_WRITE_BANDWIDTH_GBS = "<<profile.multiThreadBandwidth.writeGBs<<";"<<std::endl;
+  o<<"  const double MULTI_THREAD_COPY_BANDWIDTH_GBS = "<<profile.multiThreadBandwidth.copyGBs<<";"<<std::endl;
+  o<<"}"<<std::endl;
+  o<<std::endl;
+  o<<"#endif // MACHINE_PROFILE_H"<<std::endl;
+
+  return o.good();
+}
@@ -0,0 +1,116 @@
+#ifndef MEMORYPROBE_H
+#define MEMORYPROBE_H
+
+#include <cstddef>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ** Memory hierarchy probe
+//
+// Measures the memory characteristics of the machine that we are running on so that data layouts and block sizes can be tuned for it
+// - Cache line size, with a dependent load at increasing offsets from a cache miss, the second load is free until it crosses into the next line
+// - Cache capacities and load to use latency, with a pointer chase through a random cycle of cache lines for increasing working set sizes, the prefetchers can't predict a random cycle
+// - TLB reach, with a pointer chase touching one line per 4 KiB page, once the pages no longer fit in the TLB every load needs a page walk
+//   This is repeated with transparent huge pages to show how much of that cost huge pages would save
+// - Read, write and copy bandwidth with one thread and every thread, similar to STREAM
+//
+// The probe takes a few seconds, the results can be printed as a report and written as machine_profile.h for other tools to use
+
+const size_t KiB = 1024;
+const size_t MiB = 1024 * KiB;
+
+// A cache as reported by the OS in /sys/devices/system/cpu/cpu0/cache
+struct cCacheInfo {
+  int level;
+  std::string sType; // Data, Instruction or Unified
+  size_t size;
+  size_t lineSize;
+  size_t ways;
+  std::string sSharedCPUList; // The logical CPUs that share this cache, like "0-3,8-11"
+};
+
+// A cache level found from the jumps in the latency curve
+struct cMeasuredCacheLevel {
+  size_t size;      // The largest working set that still had this level's latency
+  double latencyNS;
+};
+
+struct cLatencyPoint {
+  size_t size;
+  double latencyNS;
+};
+
+struct cTLBPoint {
+  size_t pages;
+  double latencyNS;          // 4 KiB pages
+  double hugePageLatencyNS;  // Transparent huge pages, 0 if they weren't available
+};
+
+struct cBandwidth {
+  double readGBs;
+  double writeGBs;
+  double copyGBs;
+};
+
+class cMemoryProbeSettings
+{
+public:
+  cMemoryProbeSettings();
+
+  size_t maxLatencySize;  // The largest working set for the latency test, 0 picks one from the cache sizes
+  size_t bandwidthSize;   // The buffer for the bandwidth test, 0 picks one from the cache sizes
+  size_t nThreads;        // For the multi threaded bandwidth test, 0 uses every core
+};
+
+class cMemoryProfile
+{
+public:
+  cMemoryProfile();
+
+  std::vector<cCacheInfo> caches;
+
+  size_t cacheLineSize;          // Reported by the OS, 0 if unknown
+  size_t measuredCacheLineSize;
+
+  std::vector<cLatencyPoint> latencies;
+  std::vector<cMeasuredCacheLevel> measuredCacheLevels;
+  double memoryLatencyNS;
+
+  std::string sHugePages;        // The transparent huge page setting
+  bool bHugePagesUsed;
+  std::vector<cTLBPoint> tlb;
+  size_t tlbEntries;             // The number of 4 KiB pages the TLB can hold before the latency jumps, 0 if there was no jump
+
+  size_t bandwidthSize;
+  size_t nThreads;
+  cBandwidth singleThreadBandwidth;
+  cBandwidth multiThreadBandwidth;
+
+  // Returns the size of the data or unified cache at level, preferring the OS's value, 0 if there isn't one
+  size_t GetCacheSize(int level) const;
+  double GetCacheLatencyNS(int level) const;
+};
+
+// Reads the caches that cpu can use
+std::vector<cCacheInfo> GetCacheInfo(size_t cpu = 0);
+
+// Formats a size like "48 KiB"
+std::string FormatBytes(size_t bytes);
+
+// Returns the load to use latency of a pointer chase through a random cycle of the cache lines in [pData, pData + size), the memory is overwritten
+double MeasureChaseLatencyNS(char* pData, size_t size, size_t lineSize);
+
+// Returns the bandwidth of one thread reading [pData, pData + size) in GB/s
+double MeasureReadBandwidthGBs(char* pData, size_t size);
+
+// Runs every test, progress is printed to progress as each test starts
+cMemoryProfile ProbeMemory(const cMemoryProbeSettings& settings, std::ostream& progress);
+
+void PrintMemoryReport(std::ostream& o, const cMemoryProfile& profile);
+
+// Writes a header of constants for other tools to size their blocks from
+bool WriteMachineProfileHeader(const std::string& sFilePath, const cMemoryProfile& profile);
+
+#endif // MEMORYPROBE_H
@@ -0,0 +1,121 @@
+#ifndef PINNINGPLAN_H
+#define PINNINGPLAN_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// ** Pinning plan
+//
+// Where a thread pool should put its workers, written by size_test --topology --pinning-plan and read by the thread pool at start up
+// Header only so that any tool can include it
+//
+// The file is plain text, one entry per line, blank lines and lines starting with # are ignored:
+//  node <node> <cpu> <cpu> ...  The CPUs in each NUMA node, buffers for the workers in a node should be allocated on that node
+//  worker <cpu> <node>          One worker per physical core, in node order, these come first
+//  smt <cpu> <node>             The other SMT siblings of each core, only worth using when the work stalls on memory
+//
+// A pool of n workers takes the first n workers, then smt entries, then wraps around
+
+struct cPinnedWorker {
+  int cpu;
+  int node;
+  bool bSMTSibling; // True if another worker is already on this core
+};
+
+struct cPinningNode {
+  int node;
+  std::vector<int> cpus;
+};
+
+class cPinningPlan
+{
+public:
+  std::vector<cPinningNode> nodes;
+  std::vector<cPinnedWorker> workers; // Physical cores first, then the SMT siblings
+
+  bool IsEmpty() const { return workers.empty(); }
+
+  // Returns where worker index should go
+  const cPinnedWorker& GetWorker(size_t index) const { return workers[index % workers.size()]; }
+
+  bool Read(const std::string& sFilePath);
+  bool Write(const std::string& sFilePath) const;
+};
+
+// Pins the calling thread to cpu, returns false if the OS wouldn't
+inline bool PinThisThreadToCPU(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+
+// ** Inlines
+
+inline bool cPinningPlan::Read(const std::string& sFilePath)
+{
+  nodes.clear();
+  workers.clear();
+
+  std::ifstream file(sFilePath);
+  if (!file.good()) return false;
+
+  std::string sLine;
+  while (std::getline(file, sLine)) {
+    std::istringstream line(sLine);
+    std::string sKey;
+    if (!(line>>sKey) || (sKey[0] == '#')) continue;
+
+    if (sKey == "node") {
+      cPinningNode node;
+      if (!(line>>node.node)) return false;
+
+      int cpu = 0;
+      while (line>>cpu) node.cpus.push_back(cpu);
+      nodes.push_back(node);
+    } else if ((sKey == "worker") || (sKey == "smt")) {
+      cPinnedWorker worker;
+      if (!(line>>worker.cpu>>worker.node)) return false;
+
+      worker.bSMTSibling = (sKey == "smt");
+      workers.push_back(worker);
+    }
+  }
+
+  return true;
+}
+
+inline bool cPinningPlan::Write(const std::string& sFilePath) const
+{
+  std::ofstream o(sFilePath);
+  if (!o.good()) return false;
+
+  o<<"# Generated by size_test --topology --pinning-plan, read with cPinningPlan from size_test/pinningplan.h"<<std::endl;
+  o<<"# node <node> <cpus>, worker <cpu> <node> for one worker per physical core, smt <cpu> <node> for the other SMT siblings"<<std::endl;
+
+  for (const cPinningNode& node : nodes) {
+    o<<"node "<<node.node;
+    for (const int cpu : node.cpus) o<<" "<<cpu;
+    o<<std::endl;
+  }
+
+  for (const cPinnedWorker& worker : workers) o<<(worker.bSMTSibling ? "smt " : "worker ")<<worker.cpu<<" "<<worker.node<<std::endl;
+
+  return o.good();
+}
+
+#endif // PINNINGPLAN_H
@@ -0,0 +1,352 @@
+#include <cstdlib>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "memoryprobe.h"
+#include "topology.h"
+
+namespace
+{
+  const std::string CPU_FOLDER = "/sys/devices/system/cpu/";
+  const std::string NODE_FOLDER = "/sys/devices/system/node/";
+
+  bool ReadFirstLine(const std::string& sFilePath, std::string& sLine)
+  {
+    std::ifstream file(sFilePath);
+    if (!file.good()) return false;
+
+    std::getline(file, sLine);
+    return true;
+  }
+
+  int ReadInt(const std::string& sFilePath, int defaultValue)
+  {
+    std::string sLine;
+    if (!ReadFirstLine(sFilePath, sLine) || sLine.empty()) return defaultValue;
+
+    return atoi(sLine.c_str());
+  }
+
+  // Parses a CPU list like "0-3,8-11"
+  std::vector<int> ParseCPUList(const std::string& sList)
+  {
+    std::vector<int> cpus;
+
+    std::istringstream list(sList);
+    std::string sRange;
+    while (std::getline(list, sRange, ',')) {
+      if (sRange.empty()) continue;
+
+      const size_t dash = sRange.find('-');
+      const int first = atoi(sRange.c_str());
+      const int last = (dash == std::string::npos) ? first : atoi(sRange.c_str() + dash + 1);
+      for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+
+    return cpus;
+  }
+
+  std::string FormatCPUList(const std::vector<int>& cpus)
+  {
+    std::ostringstream o;
+    for (size_t i = 0; i < cpus.size(); i++) {
+      // Collapse runs into ranges
+      size_t last = i;
+      while (((last + 1) < cpus.size()) && (cpus[last + 1] == (cpus[last] + 1))) last++;
+
+      if (i != 0) o<<",";
+      o<<cpus[i];
+      if (last > i) o<<"-"<<cpus[last];
+      i = last;
+    }
+    return o.str();
+  }
+
+  // Returns the numbers of the folders in sFolder called sPrefix followed by a number, like node0 and node1
+  std::vector<int> ListNumberedFolders(const std::string& sFolder, const std::string& sPrefix)
+  {
+    std::vector<int> numbers;
+
+    DIR* pDirectory = opendir(sFolder.c_str());
+    if (pDirectory == nullptr) return numbers;
+
+    for (dirent* pEntry = readdir(pDirectory); pEntry != nullptr; pEntry = readdir(pDirectory)) {
+      const std::string sName = pEntry->d_name;
+      if ((sName.length() > sPrefix.length()) && (sName.compare(0, sPrefix.length(), sPrefix) == 0) && (sName.find_first_not_of("0123456789", sPrefix.length()) == std::string::npos)) numbers.push_back(atoi(sName.c_str() + sPrefix.length()));
+    }
+
+    closedir(pDirectory);
+
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+  }
+
+  // Runs function on a new thread pinned to cpu so that the calling thread's affinity is left alone
+  template <class F>
+  void RunOnCPU(int cpu, F function)
+  {
+    std::thread thread([cpu, &function]() {
+      PinThisThreadToCPU(cpu);
+      function();
+    });
+    thread.join();
+  }
+}
+
+// ** cTopology
+
+cTopology::cTopology() :
+  nPackages(0),
+  nCores(0)
+{
+}
+
+const cLogicalCPU* cTopology::GetCPU(int cpu) const
+{
+  for (const cLogicalCPU& logicalCPU : cpus) {
+    if (logicalCPU.cpu == cpu) return &logicalCPU;
+  }
+
+  return nullptr;
+}
+
+cTopology GetTopology()
+{
+  cTopology topology;
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  const bool bHaveAffinity = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+
+  std::string sOnline;
+  std::vector<int> online = ReadFirstLine(CPU_FOLDER + "online", sOnline) ? ParseCPUList(sOnline) : ListNumberedFolders(CPU_FOLDER, "cpu");
+
+  for (const int cpu : online) {
+    const std::string sFolder = CPU_FOLDER + "cpu" + std::to_string(cpu) + "/topology/";
+
+    cLogicalCPU logicalCPU;
+    logicalCPU.cpu = cpu;
+    logicalCPU.package = ReadInt(sFolder + "physical_package_id", 0);
+    logicalCPU.core = ReadInt(sFolder + "core_id", cpu);
+    logicalCPU.node = 0;
+
+    std::string sSiblings;
+    logicalCPU.siblings = ReadFirstLine(sFolder + "thread_siblings_list", sSiblings) ? ParseCPUList(sSiblings) : std::vector<int>(1, cpu);
+
+    logicalCPU.bAllowed = !bHaveAffinity || ((cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &allowed));
+
+    topology.cpus.push_back(logicalCPU);
+  }
+
+  // Without NUMA support in the kernel everything is on one node
+  const std::vector<int> nodeNumbers = ListNumberedFolders(NODE_FOLDER, "node");
+  for (const int nodeNumber : nodeNumbers) {
+    const std::string sFolder = NODE_FOLDER + "node" + std::to_string(nodeNumber) + "/";
+
+    cNUMANode node;
+    node.node = nodeNumber;
+
+    std::string sValue;
+    if (ReadFirstLine(sFolder + "cpulist", sValue)) node.cpus = ParseCPUList(sValue);
+
+    if (ReadFirstLine(sFolder + "distance", sValue)) {
+      std::istringstream distances(sValue);
+      int distance = 0;
+      while (distances>>distance) node.distances.push_back(distance);
+    }
+
+    // "Node 0 MemTotal:       5603064 kB"
+    node.memorySize = 0;
+    std::ifstream meminfo(sFolder + "meminfo");
+    std::string sLine;
+    while (std::getline(meminfo, sLine)) {
+      const size_t position = sLine.find("MemTotal:");
+      if (position != std::string::npos) {
+        node.memorySize = size_t(strtoull(sLine.c_str() + position + 9, nullptr, 10)) * KiB;
+        break;
+      }
+    }
+
+    // Nodes with only memory have no CPUs to run workers on but still count for distances
+    topology.nodes.push_back(node);
+
+    for (const int cpu : node.cpus) {
+      for (cLogicalCPU& logicalCPU : topology.cpus) {
+        if (logicalCPU.cpu == cpu) logicalCPU.node = nodeNumber;
+      }
+    }
+  }
+
+  if (topology.nodes.empty()) {
+    cNUMANode node;
+    node.node = 0;
+    for (const cLogicalCPU& logicalCPU : topology.cpus) node.cpus.push_back(logicalCPU.cpu);
+    node.memorySize = 0;
+    node.distances.push_back(10);
+    topology.nodes.push_back(node);
+  }
+
+  std::set<int> packages;
+  std::set<std::pair<int, int>> cores;
+  for (const cLogicalCPU& logicalCPU : topology.cpus) {
+    packages.insert(logicalCPU.package);
+    cores.insert(std::make_pair(logicalCPU.package, logicalCPU.core));
+  }
+  topology.nPackages = packages.size();
+  topology.nCores = cores.size();
+
+  // Each cache is listed under every CPU that shares it, only keep it once
+  std::set<std::string> seenCaches;
+  for (const cLogicalCPU& logicalCPU : topology.cpus) {
+    for (const cCacheInfo& cache : GetCacheInfo(size_t(logicalCPU.cpu))) {
+      const std::string sKey = std::to_string(cache.level) + cache.sType + cache.sSharedCPUList;
+      if (!seenCaches.insert(sKey).second) continue;
+
+      cSharedCache sharedCache;
+      sharedCache.level = cache.level;
+      sharedCache.sType = cache.sType;
+      sharedCache.size = cache.size;
+      sharedCache.cpus = ParseCPUList(cache.sSharedCPUList);
+      topology.caches.push_back(sharedCache);
+    }
+  }
+
+  std::stable_sort(topology.caches.begin(), topology.caches.end(), [](const cSharedCache& lhs, const cSharedCache& rhs) { return lhs.level < rhs.level; });
+
+  return topology;
+}
+
+void MeasureNodeMemory(cTopology& topology, size_t size, std::ostream& progress)
+{
+  const size_t lineSize = 64;
+
+  // The first allowed CPU on each node
+  std::map<int, int> nodeCPUs;
+  for (const cLogicalCPU& logicalCPU : topology.cpus) {
+    if (logicalCPU.bAllowed && (nodeCPUs.find(logicalCPU.node) == nodeCPUs.end())) nodeCPUs[logicalCPU.node] = logicalCPU.cpu;
+  }
+
+  for (const std::pair<const int, int>& memoryNode : nodeCPUs) {
+    void* pResult = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pResult == MAP_FAILED) return;
+    char* pData = static_cast<char*>(pResult);
+
+    // First touch puts the pages on the node of the CPU that touched them
+    RunOnCPU(memoryNode.second, [pData, size]() {
+      for (size_t offset = 0; offset < size; offset += 4 * KiB) pData[offset] = 0;
+    });
+
+    for (const std::pair<const int, int>& cpuNode : nodeCPUs) {
+      progress<<"Measuring node "<<cpuNode.first<<" reading memory on node "<<memoryNode.first<<std::endl;
+
+      cNodeMeasurement measurement;
+      measurement.cpuNode = cpuNode.first;
+      measurement.memoryNode = memoryNode.first;
+      RunOnCPU(cpuNode.second, [&]() {
+        measurement.readGBs = MeasureReadBandwidthGBs(pData, size);
+        measurement.latencyNS = MeasureChaseLatencyNS(pData, size, lineSize);
+      });
+      topology.measurements.push_back(measurement);
+    }
+
+    munmap(pData, size);
+  }
+}
+
+void PrintTopologyReport(std::ostream& o, const cTopology& topology)
+{
+  size_t nAllowed = 0;
+  for (const cLogicalCPU& logicalCPU : topology.cpus) {
+    if (logicalCPU.bAllowed) nAllowed++;
+  }
+
+  o<<std::fixed<<std::setprecision(2);
+  o<<"Topology: "<<topology.nPackages<<" package"<<((topology.nPackages == 1) ? "" : "s")<<", "<<topology.nCores<<" core"<<((topology.nCores == 1) ? "" : "s")<<", "<<topology.cpus.size()<<" logical CPU"<<((topology.cpus.size() == 1) ? "" : "s")<<", "<<topology.nodes.size()<<" NUMA node"<<((topology.nodes.size() == 1) ? "" : "s")<<std::endl;
+  if (nAllowed != topology.cpus.size()) o<<"Our affinity mask only allows "<<nAllowed<<" of the logical CPUs"<<std::endl;
+  o<<std::endl;
+
+  o<<"NUMA nodes:"<<std::endl;
+  for (const cNUMANode& node : topology.nodes) {
+    o<<"  Node "<<node.node<<": CPUs "<<(node.cpus.empty() ? "none" : FormatCPUList(node.cpus));
+    if (node.memorySize != 0) o<<", "<<(node.memorySize / MiB)<<" MiB memory";
+    if (!node.distances.empty()) {
+      o<<", distances";
+      for (const int distance : node.distances) o<<" "<<distance;
+    }
+    o<<std::endl;
+  }
+  o<<std::endl;
+
+  o<<"Logical CPUs:"<<std::endl;
+  o<<std::setw(8)<<"cpu"<<std::setw(10)<<"package"<<std::setw(8)<<"core"<<std::setw(8)<<"node"<<"  SMT siblings"<<std::endl;
+  for (const cLogicalCPU& logicalCPU : topology.cpus) {
+    o<<std::setw(8)<<logicalCPU.cpu<<std::setw(10)<<logicalCPU.package<<std::setw(8)<<logicalCPU.core<<std::setw(8)<<logicalCPU.node<<"  "<<FormatCPUList(logicalCPU.siblings)<<(logicalCPU.bAllowed ? "" : " (not allowed)")<<std::endl;
+  }
+  o<<std::endl;
+
+  o<<"Caches:"<<std::endl;
+  for (const cSharedCache& cache : topology.caches) o<<"  L"<<cache.level<<" "<<std::left<<std::setw(12)<<cache.sType<<std::right<<std::setw(10)<<FormatBytes(cache.size)<<" shared by CPUs "<<FormatCPUList(cache.cpus)<<std::endl;
+
+  if (!topology.measurements.empty()) {
+    o<<std::endl;
+    o<<"Memory by node (Pointer chase latency and single thread read bandwidth):"<<std::endl;
+    o<<std::setw(10)<<"cpu node"<<std::setw(14)<<"memory node"<<std::setw(10)<<"ns/load"<<std::setw(10)<<"GB/s"<<std::endl;
+    for (const cNodeMeasurement& measurement : topology.measurements) o<<std::setw(10)<<measurement.cpuNode<<std::setw(14)<<measurement.memoryNode<<std::setw(10)<<measurement.latencyNS<<std::setw(10)<<measurement.readGBs<<std::endl;
+  }
+
+  const cPinningPlan plan = CreatePinningPlan(topology);
+  size_t nWorkers = 0;
+  for (const cPinnedWorker& worker : plan.workers) {
+    if (!worker.bSMTSibling) nWorkers++;
+  }
+
+  o<<std::endl;
+  o<<"Recommended pinning: "<<nWorkers<<" worker"<<((nWorkers == 1) ? "" : "s")<<", one per physical core, buffers allocated by each worker on its own node"<<std::endl;
+  for (const cPinnedWorker& worker : plan.workers) {
+    if (!worker.bSMTSibling) o<<"  Worker on CPU "<<worker.cpu<<", node "<<worker.node<<std::endl;
+  }
+  if (nWorkers < plan.workers.size()) o<<"  Then "<<(plan.workers.size() - nWorkers)<<" SMT siblings if the work stalls on memory"<<std::endl;
+}
+
+cPinningPlan CreatePinningPlan(const cTopology& topology)
+{
+  cPinningPlan plan;
+
+  for (const cNUMANode& node : topology.nodes) {
+    cPinningNode pinningNode;
+    pinningNode.node = node.node;
+    for (const int cpu : node.cpus) {
+      const cLogicalCPU* pCPU = topology.GetCPU(cpu);
+      if ((pCPU != nullptr) && pCPU->bAllowed) pinningNode.cpus.push_back(cpu);
+    }
+    if (!pinningNode.cpus.empty()) plan.nodes.push_back(pinningNode);
+  }
+
+  // The first allowed sibling of each core gets a worker, the rest are SMT siblings
+  std::vector<cPinnedWorker> smt;
+  std::set<std::pair<int, int>> usedCores;
+  for (const cPinningNode& node : plan.nodes) {
+    for (const int cpu : node.cpus) {
+      const cLogicalCPU* pCPU = topology.GetCPU(cpu);
+      const bool bFirstOnCore = usedCores.insert(std::make_pair(pCPU->package, pCPU->core)).second;
+
+      const cPinnedWorker worker = { cpu, node.node, !bFirstOnCore };
+      if (bFirstOnCore) plan.workers.push_back(worker);
+      else smt.push_back(worker);
+    }
+  }
+
+  plan.workers.insert(plan.workers.end(), smt.begin(), smt.end());
+
+  return plan;
+}
@@ -0,0 +1,74 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstddef>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "pinningplan.h"
+
+// ** CPU and NUMA topology
+//
+// Reads the sockets, cores, SMT siblings, NUMA nodes and shared caches from /sys/devices/system and measures the latency and read bandwidth between each pair of nodes
+// Memory goes on the node of the CPU that first touches it, so a buffer is touched from a CPU on one node and then read from a CPU on another, no libnuma needed
+// Only the CPUs that our affinity mask allows are used, a container or taskset can hide the rest
+
+struct cLogicalCPU {
+  int cpu;
+  int package;
+  int core;  // Unique within its package
+  int node;
+  std::vector<int> siblings; // The SMT threads on the same core, including this one
+  bool bAllowed;             // In our affinity mask
+};
+
+struct cNUMANode {
+  int node;
+  std::vector<int> cpus;
+  size_t memorySize;
+  std::vector<int> distances; // The relative distance from this node to each node, 10 is local
+};
+
+struct cSharedCache {
+  int level;
+  std::string sType;
+  size_t size;
+  std::vector<int> cpus;
+};
+
+struct cNodeMeasurement {
+  int cpuNode;     // Where the thread ran
+  int memoryNode;  // Where the memory was
+  double latencyNS;
+  double readGBs;
+};
+
+class cTopology
+{
+public:
+  cTopology();
+
+  std::vector<cLogicalCPU> cpus;
+  std::vector<cNUMANode> nodes;
+  std::vector<cSharedCache> caches; // Each cache once, with the CPUs that share it
+  size_t nPackages;
+  size_t nCores;
+
+  std::vector<cNodeMeasurement> measurements;
+
+  const cLogicalCPU* GetCPU(int cpu) const;
+};
+
+cTopology GetTopology();
+
+// Measures every pair of nodes with a buffer of size bytes, progress is printed to progress as each pair starts
+void MeasureNodeMemory(cTopology& topology, size_t size, std::ostream& progress);
+
+void PrintTopologyReport(std::ostream& o, const cTopology& topology);
+
+// One worker per allowed physical core, node by node so that neighbouring workers share a cache, then the SMT siblings
+cPinningPlan CreatePinningPlan(const cTopology& topology);
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,938 @@
+// Standard headers
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+// POSIX headers
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// zlib headers
+#include <zlib.h>
+
+// Application headers
+#include "git.h"
+
+namespace git
+{
+  namespace
+  {
+    // Pack files can contain delta chains thousands of objects long, but anything this deep is almost certainly a corrupt pack
+    const size_t MAX_DELTA_DEPTH = 10000;
+
+    // Refs can point to other refs, but only a few levels deep
+    const size_t MAX_REF_DEPTH = 5;
+
+    enum PACK_OBJECT_TYPE {
+      PACK_OBJECT_TYPE_OFS_DELTA = 6,
+      PACK_OBJECT_TYPE_REF_DELTA = 7,
+    };
+
+    bool ReadFile(const std::string& sFilePath, std::string& sContents)
+    {
+      sContents.clear();
+
+      std::ifstream i(sFilePath.c_str(), std::ios::in | std::ios::binary);
+      if (!i) return false;
+
+      std::ostringstream o;
+      o<<i.rdbuf();
+      sContents = o.str();
+
+      return true;
+    }
+
+    bool IsDirectory(const std::string& sPath)
+    {
+      struct stat _stat;
+      return ((stat(sPath.c_str(), &_stat) == 0) && S_ISDIR(_stat.st_mode));
+    }
+
+    bool IsFile(const std::string& sPath)
+    {
+      struct stat _stat;
+      return ((stat(sPath.c_str(), &_stat) == 0) && S_ISREG(_stat.st_mode));
+    }
+
+    std::string GetRealPath(const std::string& sPath)
+    {
+      char szPath[PATH_MAX];
+      if (realpath(sPath.c_str(), szPath) == nullptr) return sPath;
+
+      return szPath;
+    }
+
+    std::string GetParentDirectory(const std::string& sPath)
+    {
+      const std::string::size_type i = sPath.rfind('/');
+      if ((i == std::string::npos) || (i == 0)) return "/";
+
+      return sPath.substr(0, i);
+    }
+
+    // Strips trailing new lines and spaces
+    std::string TrimRight(const std::string& sText)
+    {
+      const std::string::size_type i = sText.find_last_not_of(" \r\n\t");
+      if (i == std::string::npos) return "";
+
+      return sText.substr(0, i + 1);
+    }
+
+    uint32_t ReadBigEndian32(const uint8_t* p)
+    {
+      return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    uint16_t ReadBigEndian16(const uint8_t* p)
+    {
+      return uint16_t((uint16_t(p[0]) << 8) | uint16_t(p[1]));
+    }
+
+    // The variable length offset encoding used by index version 4 path prefixes and pack file offset deltas
+    bool ReadOffsetVarInt(const uint8_t*& p, const uint8_t* pEnd, uint64_t& value)
+    {
+      if (p >= pEnd) return false;
+
+      uint8_t c = *p++;
+      value = c & 0x7F;
+      while ((c & 0x80) != 0) {
+        if (p >= pEnd) return false;
+
+        value += 1;
+        c = *p++;
+        value = (value << 7) + (c & 0x7F);
+      }
+
+      return true;
+    }
+
+    // The little endian variable length size encoding used by delta headers
+    bool ReadSizeVarInt(const uint8_t*& p, const uint8_t* pEnd, uint64_t& value)
+    {
+      value = 0;
+      size_t shift = 0;
+
+      uint8_t c = 0;
+      do {
+        if ((p >= pEnd) || (shift > 63)) return false;
+
+        c = *p++;
+        value |= uint64_t(c & 0x7F) << shift;
+        shift += 7;
+      } while ((c & 0x80) != 0);
+
+      return true;
+    }
+
+    // Inflates zlib compressed data, nExpectedSize is just a hint to avoid growing the output
+    bool Inflate(const uint8_t* pData, size_t nBytes, size_t nExpectedSize, std::string& sOutput)
+    {
+      sOutput.clear();
+      sOutput.resize(std::max<size_t>(nExpectedSize, 64));
+
+      z_stream stream;
+      memset(&stream, 0, sizeof(stream));
+      if (inflateInit(&stream) != Z_OK) return false;
+
+      stream.next_in = const_cast<Bytef*>(pData);
+      stream.avail_in = uInt(std::min<size_t>(nBytes, UINT_MAX));
+
+      size_t nWritten = 0;
+      int result = Z_OK;
+      while (result == Z_OK) {
+        if (nWritten == sOutput.size()) sOutput.resize(sOutput.size() * 2);
+
+        stream.next_out = reinterpret_cast<Bytef*>(&sOutput[nWritten]);
+        stream.avail_out = uInt(sOutput.size() - nWritten);
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        nWritten = sOutput.size() - stream.avail_out;
+      }
+
+      inflateEnd(&stream);
+
+      if (result != Z_STREAM_END) return false;
+
+      sOutput.resize(nWritten);
+      return true;
+    }
+
+    bool ApplyDelta(const std::string& sBase, const uint8_t* pDelta, size_t nDeltaBytes, std::string& sOutput)
+    {
+      const uint8_t* p = pDelta;
+      const uint8_t* pEnd = pDelta + nDeltaBytes;
+
+      uint64_t nSourceSize = 0;
+      uint64_t nTargetSize = 0;
+      if (!ReadSizeVarInt(p, pEnd, nSourceSize) || !ReadSizeVarInt(p, pEnd, nTargetSize)) return false;
+      if (nSourceSize != sBase.size()) return false;
+
+      sOutput.clear();
+      sOutput.reserve(nTargetSize);
+
+      while (p < pEnd) {
+        const uint8_t c = *p++;
+        if ((c & 0x80) != 0) {
+          // Copy from the base object
+          uint32_t offset = 0;
+          uint32_t size = 0;
+          for (size_t i = 0; i < 4; i++) {
+            if ((c & (1 << i)) != 0) {
+              if (p >= pEnd) return false;
+              offset |= uint32_t(*p++) << (8 * i);
+            }
+          }
+          for (size_t i = 0; i < 3; i++) {
+            if ((c & (0x10 << i)) != 0) {
+              if (p >= pEnd) return false;
+              size |= uint32_t(*p++) << (8 * i);
+            }
+          }
+          if (size == 0) size = 0x10000;
+
+          if ((uint64_t(offset) + size) > sBase.size()) return false;
+          sOutput.append(sBase, offset, size);
+        } else if (c != 0) {
+          // Insert new data
+          if ((pEnd - p) < c) return false;
+          sOutput.append(reinterpret_cast<const char*>(p), c);
+          p += c;
+        } else return false; // Reserved
+      }
+
+      return (sOutput.size() == nTargetSize);
+    }
+
+    // Returns the value of a "key value" header line in a commit or tag object
+    bool GetHeaderValue(const std::string& sContents, const std::string& sKey, std::string& sValue)
+    {
+      std::string::size_type i = 0;
+      while (i < sContents.size()) {
+        std::string::size_type iEnd = sContents.find('\n', i);
+        if (iEnd == std::string::npos) iEnd = sContents.size();
+
+        // A blank line separates the headers from the message
+        if (iEnd == i) break;
+
+        if ((sContents.compare(i, sKey.size(), sKey) == 0) && (sContents[i + sKey.size()] == ' ')) {
+          const std::string::size_type iValue = i + sKey.size() + 1;
+          sValue = sContents.substr(iValue, iEnd - iValue);
+          return true;
+        }
+
+        i = iEnd + 1;
+      }
+
+      return false;
+    }
+  }
+
+  bool ParseSHA1(const std::string& sText, sha1_t& sha1)
+  {
+    if (sText.length() != 40) return false;
+
+    for (size_t i = 0; i < 20; i++) {
+      uint8_t value = 0;
+      for (size_t j = 0; j < 2; j++) {
+        const char c = sText[(2 * i) + j];
+        value <<= 4;
+        if ((c >= '0') && (c <= '9')) value |= uint8_t(c - '0');
+        else if ((c >= 'a') && (c <= 'f')) value |= uint8_t(10 + (c - 'a'));
+        else if ((c >= 'A') && (c <= 'F')) value |= uint8_t(10 + (c - 'A'));
+        else return false;
+      }
+      sha1[i] = value;
+    }
+
+    return true;
+  }
+
+  std::string SHA1ToString(const sha1_t& sha1)
+  {
+    const char* szHex = "0123456789abcdef";
+
+    std::string sText;
+    sText.reserve(40);
+    for (const uint8_t value : sha1) {
+      sText += szHex[value >> 4];
+      sText += szHex[value & 0xF];
+    }
+
+    return sText;
+  }
+
+
+  // ** cIndex
+
+  bool cIndex::Load(const std::string& sFilePath)
+  {
+    entries.clear();
+    cachedTrees.clear();
+
+    std::string sContents;
+    if (!ReadFile(sFilePath, sContents)) {
+      std::cerr<<"cIndex::Load Could not read "<<sFilePath<<std::endl;
+      return false;
+    }
+
+    const uint8_t* pBegin = reinterpret_cast<const uint8_t*>(sContents.data());
+    const size_t nBytes = sContents.size();
+
+    // Header (12 bytes) and the trailing checksum (20 bytes)
+    if ((nBytes < 32) || (memcmp(pBegin, "DIRC", 4) != 0)) {
+      std::cerr<<"cIndex::Load "<<sFilePath<<" is not a git index"<<std::endl;
+      return false;
+    }
+
+    const uint32_t version = ReadBigEndian32(pBegin + 4);
+    if ((version < 2) || (version > 4)) {
+      std::cerr<<"cIndex::Load Unsupported index version "<<version<<std::endl;
+      return false;
+    }
+
+    const uint32_t nEntries = ReadBigEndian32(pBegin + 8);
+    entries.reserve(nEntries);
+
+    const uint8_t* p = pBegin + 12;
+    const uint8_t* pEnd = pBegin + nBytes - 20;
+
+    std::string sPreviousPath;
+
+    for (uint32_t iEntry = 0; iEntry < nEntries; iEntry++) {
+      const uint8_t* pEntry = p;
+      if ((pEnd - pEntry) < 62) return false;
+
+      cIndexEntry entry;
+      entry.mtimeSeconds = ReadBigEndian32(pEntry + 8);
+      entry.mtimeNanoSeconds = ReadBigEndian32(pEntry + 12);
+      entry.mode = ReadBigEndian32(pEntry + 24);
+      entry.size = ReadBigEndian32(pEntry + 36);
+      memcpy(entry.sha1.data(), pEntry + 40, 20);
+
+      const uint16_t flags = ReadBigEndian16(pEntry + 60);
+      entry.stage = uint8_t((flags >> 12) & 0x3);
+      entry.bSkipWorkTree = false;
+      entry.bIntentToAdd = false;
+
+      size_t nHeaderBytes = 62;
+      if ((flags & 0x4000) != 0) {
+        // Extended flags
+        if ((version < 3) || ((pEnd - pEntry) < 64)) return false;
+
+        const uint16_t extendedFlags = ReadBigEndian16(pEntry + 62);
+        entry.bSkipWorkTree = ((extendedFlags & 0x4000) != 0);
+        entry.bIntentToAdd = ((extendedFlags & 0x2000) != 0);
+        nHeaderBytes = 64;
+      }
+
+      p = pEntry + nHeaderBytes;
+
+      if (version == 4) {
+        // The path is stored as the number of characters to remove from the end of the previous path, followed by the characters to append
+        uint64_t nStrip = 0;
+        if (!ReadOffsetVarInt(p, pEnd, nStrip) || (nStrip > sPreviousPath.length())) return false;
+
+        const uint8_t* pNull = static_cast<const uint8_t*>(memchr(p, 0, pEnd - p));
+        if (pNull == nullptr) return false;
+
+        entry.sPath = sPreviousPath.substr(0, sPreviousPath.length() - nStrip);
+        entry.sPath.append(reinterpret_cast<const char*>(p), pNull - p);
+        p = pNull + 1;
+      } else {
+        const uint8_t* pNull = static_cast<const uint8_t*>(memchr(p, 0, pEnd - p));
+        if (pNull == nullptr) return false;
+
+        entry.sPath.assign(reinterpret_cast<const char*>(p), pNull - p);
+
+        // Entries are padded with 1 to 8 null characters to a multiple of 8 bytes
+        p = pEntry + ((nHeaderBytes + entry.sPath.length() + 8) & ~size_t(7));
+        if (p > pEnd) return false;
+      }
+
+      sPreviousPath = entry.sPath;
+      entries.push_back(entry);
+    }
+
+    // Extensions
+    while ((pEnd - p) >= 8) {
+      const uint32_t nExtensionBytes = ReadBigEndian32(p + 4);
+      if (uint64_t(pEnd - (p + 8)) < nExtensionBytes) return false;
+
+      if (memcmp(p, "TREE", 4) == 0) {
+        // The cached tree is only an optimisation, if it is broken we just do without it
+        if (!ParseCachedTreeExtension(p + 8, nExtensionBytes)) cachedTrees.clear();
+      } else if (memcmp(p, "link", 4) == 0) {
+        std::cerr<<"cIndex::Load Split indexes are not supported"<<std::endl;
+        return false;
+      }
+
+      p += 8 + nExtensionBytes;
+    }
+
+    return true;
+  }
+
+  bool cIndex::ParseCachedTreeExtension(const uint8_t* pData, size_t nBytes)
+  {
+    const uint8_t* p = pData;
+    const uint8_t* pEnd = pData + nBytes;
+
+    // Each node is "path\0entry_count subtree_count\n" followed by the tree sha1 if entry_count is not -1, then the children follow in order
+    std::vector<std::pair<std::string, size_t>> stack; // Directory and the number of subtrees still to read
+
+    while (p < pEnd) {
+      const uint8_t* pNull = static_cast<const uint8_t*>(memchr(p, 0, pEnd - p));
+      if (pNull == nullptr) return false;
+
+      const std::string sName(reinterpret_cast<const char*>(p), pNull - p);
+      p = pNull + 1;
+
+      const uint8_t* pNewLine = static_cast<const uint8_t*>(memchr(p, '\n', pEnd - p));
+      if (pNewLine == nullptr) return false;
+
+      const std::string sCounts(reinterpret_cast<const char*>(p), pNewLine - p);
+      p = pNewLine + 1;
+
+      long entryCount = 0;
+      long subtreeCount = 0;
+      std::istringstream counts(sCounts);
+      if (!(counts>>entryCount>>subtreeCount) || (subtreeCount < 0)) return false;
+
+      // Work out the full path of this directory from its parent
+      while (!stack.empty() && (stack.back().second == 0)) stack.pop_back();
+
+      std::string sDirectory;
+      if (!stack.empty()) {
+        stack.back().second--;
+        sDirectory = stack.back().first.empty() ? sName : (stack.back().first + "/" + sName);
+      } else sDirectory = sName;
+
+      if (entryCount >= 0) {
+        if ((pEnd - p) < 20) return false;
+
+        sha1_t sha1;
+        memcpy(sha1.data(), p, 20);
+        p += 20;
+
+        cachedTrees[sDirectory] = sha1;
+      }
+
+      stack.push_back(std::make_pair(sDirectory, size_t(subtreeCount)));
+    }
+
+    return true;
+  }
+
+  bool cIndex::GetCachedTree(const std::string& sDirectory, sha1_t& sha1) const
+  {
+    std::unordered_map<std::string, sha1_t>::const_iterator iter = cachedTrees.find(sDirectory);
+    if (iter == cachedTrees.end()) return false;
+
+    sha1 = iter->second;
+    return true;
+  }
+
+
+  // ** cPackFile
+  //
+  // A memory mapped pack file and its version 2 index
+
+  class cPackFile
+  {
+  public:
+    cPackFile();
+    ~cPackFile();
+
+    bool Open(const std::string& sIndexFilePath, const std::string& sPackFilePath);
+
+    bool Contains(const sha1_t& sha1, uint64_t& offset) const;
+
+    bool ReadObject(const cRepository& repository, uint64_t offset, OBJECT_TYPE& type, std::string& sContents, size_t depth) const;
+
+  private:
+    std::string sIndex;
+    uint32_t nObjects;
+
+    const uint8_t* pPack;
+    size_t nPackBytes;
+  };
+
+  cPackFile::cPackFile() :
+    nObjects(0),
+    pPack(nullptr),
+    nPackBytes(0)
+  {
+  }
+
+  cPackFile::~cPackFile()
+  {
+    if (pPack != nullptr) munmap(const_cast<uint8_t*>(pPack), nPackBytes);
+  }
+
+  bool cPackFile::Open(const std::string& sIndexFilePath, const std::string& sPackFilePath)
+  {
+    if (!ReadFile(sIndexFilePath, sIndex)) return false;
+
+    // Header, fan out table and the trailing checksums
+    const uint8_t* pIndex = reinterpret_cast<const uint8_t*>(sIndex.data());
+    if ((sIndex.size() < (8 + (256 * 4) + 40)) || (memcmp(pIndex, "\377tOc", 4) != 0) || (ReadBigEndian32(pIndex + 4) != 2)) {
+      std::cerr<<"cPackFile::Open Unsupported pack index "<<sIndexFilePath<<std::endl;
+      return false;
+    }
+
+    nObjects = ReadBigEndian32(pIndex + 8 + (255 * 4));
+    if (sIndex.size() < (8 + (256 * 4) + (uint64_t(nObjects) * (20 + 4 + 4)) + 40)) return false;
+
+    const int fd = open(sPackFilePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat _stat;
+    if (fstat(fd, &_stat) != 0) {
+      close(fd);
+      return false;
+    }
+
+    nPackBytes = size_t(_stat.st_size);
+    void* pMapped = mmap(nullptr, nPackBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pMapped == MAP_FAILED) {
+      nPackBytes = 0;
+      return false;
+    }
+
+    pPack = static_cast<const uint8_t*>(pMapped);
+
+    return true;
+  }
+
+  bool cPackFile::Contains(const sha1_t& sha1, uint64_t& offset) const
+  {
+    const uint8_t* pIndex = reinterpret_cast<const uint8_t*>(sIndex.data());
+    const uint8_t* pFanOut = pIndex + 8;
+    const uint8_t* pNames = pFanOut + (256 * 4);
+    const uint8_t* pOffsets = pNames + (size_t(nObjects) * (20 + 4));
+    const uint8_t* pLargeOffsets = pOffsets + (size_t(nObjects) * 4);
+
+    // The fan out table tells us the range of objects that start with this byte
+    uint32_t low = (sha1[0] == 0) ? 0 : ReadBigEndian32(pFanOut + ((sha1[0] - 1) * 4));
+    uint32_t high = ReadBigEndian32(pFanOut + (sha1[0] * 4));
+
+    while (low < high) {
+      const uint32_t middle = low + ((high - low) / 2);
+      const int result = memcmp(pNames + (size_t(middle) * 20), sha1.data(), 20);
+      if (result == 0) {
+        const uint32_t value = ReadBigEndian32(pOffsets + (size_t(middle) * 4));
+        if ((value & 0x80000000) != 0) {
+          // Packs larger than 2 GB store the offset in a separate 64 bit table
+          const uint8_t* pLarge = pLargeOffsets + (size_t(value & 0x7FFFFFFF) * 8);
+          if ((pLarge + 8) > (pIndex + sIndex.size())) return false;
+
+          offset = (uint64_t(ReadBigEndian32(pLarge)) << 32) | ReadBigEndian32(pLarge + 4);
+        } else offset = value;
+
+        return true;
+      } else if (result < 0) low = middle + 1;
+      else high = middle;
+    }
+
+    return false;
+  }
+
+  bool cPackFile::ReadObject(const cRepository& repository, uint64_t offset, OBJECT_TYPE& type, std::string& sContents, size_t depth) const
+  {
+    if ((depth > MAX_DELTA_DEPTH) || (offset >= nPackBytes)) return false;
+
+    const uint8_t* p = pPack + offset;
+    const uint8_t* pEnd = pPack + nPackBytes;
+
+    // Type and inflated size
+    uint8_t c = *p++;
+    const int packType = (c >> 4) & 0x7;
+    uint64_t size = c & 0xF;
+    size_t shift = 4;
+    while ((c & 0x80) != 0) {
+      if ((p >= pEnd) || (shift > 63)) return false;
+
+      c = *p++;
+      size |= uint64_t(c & 0x7F) << shift;
+      shift += 7;
+    }
+
+    if ((packType >= int(OBJECT_TYPE::COMMIT)) && (packType <= int(OBJECT_TYPE::TAG))) {
+      type = OBJECT_TYPE(packType);
+      return Inflate(p, pEnd - p, size, sContents) && (sContents.size() == size);
+    }
+
+    std::string sBase;
+    if (packType == PACK_OBJECT_TYPE_OFS_DELTA) {
+      uint64_t relativeOffset = 0;
+      if (!ReadOffsetVarInt(p, pEnd, relativeOffset) || (relativeOffset == 0) || (relativeOffset > offset)) return false;
+
+      if (!ReadObject(repository, offset - relativeOffset, type, sBase, depth + 1)) return false;
+    } else if (packType == PACK_OBJECT_TYPE_REF_DELTA) {
+      if ((pEnd - p) < 20) return false;
+
+      sha1_t base;
+      memcpy(base.data(), p, 20);
+      p += 20;
+
+      // The base may be in another pack or a loose object
+      if (!repository.ReadObject(base, type, sBase)) return false;
+    } else return false;
+
+    std::string sDelta;
+    if (!Inflate(p, pEnd - p, size, sDelta)) return false;
+
+    return ApplyDelta(sBase, reinterpret_cast<const uint8_t*>(sDelta.data()), sDelta.size(), sContents);
+  }
+
+
+  // ** cRepository
+
+  cRepository::cRepository()
+  {
+  }
+
+  cRepository::~cRepository()
+  {
+  }
+
+  bool cRepository::Open(const std::string& sPath)
+  {
+    sWorkTreeDirectory.clear();
+    sGitDirectory.clear();
+    sCommonDirectory.clear();
+    packFiles.clear();
+
+    std::string sDirectory = GetRealPath(sPath);
+    while (true) {
+      const std::string sDotGit = (sDirectory == "/") ? "/.git" : (sDirectory + "/.git");
+      if (IsDirectory(sDotGit)) {
+        sGitDirectory = sDotGit;
+        break;
+      } else if (IsFile(sDotGit)) {
+        // Submodules and linked work trees have a .git file pointing to the real git directory
+        std::string sContents;
+        ReadFile(sDotGit, sContents);
+        sContents = TrimRight(sContents);
+
+        const std::string sPrefix = "gitdir: ";
+        if (sContents.compare(0, sPrefix.length(), sPrefix) != 0) return false;
+
+        std::string sGitDir = sContents.substr(sPrefix.length());
+        if (sGitDir.empty()) return false;
+        if (sGitDir[0] != '/') sGitDir = sDirectory + "/" + sGitDir;
+
+        sGitDirectory = GetRealPath(sGitDir);
+        break;
+      }
+
+      if (sDirectory == "/") return false;
+      sDirectory = GetParentDirectory(sDirectory);
+    }
+
+    sWorkTreeDirectory = sDirectory;
+
+    // Linked work trees have their own HEAD and index but share everything else
+    sCommonDirectory = sGitDirectory;
+    std::string sCommonDir;
+    if (ReadFile(sGitDirectory + "/commondir", sCommonDir)) {
+      sCommonDir = TrimRight(sCommonDir);
+      if (!sCommonDir.empty()) sCommonDirectory = GetRealPath((sCommonDir[0] == '/') ? sCommonDir : (sGitDirectory + "/" + sCommonDir));
+    }
+
+    LoadPackFiles();
+
+    return true;
+  }
+
+  void cRepository::LoadPackFiles()
+  {
+    const std::string sPackDirectory = sCommonDirectory + "/objects/pack";
+
+    DIR* dp = opendir(sPackDirectory.c_str());
+    if (dp == nullptr) return;
+
+    struct dirent* dirp;
+    while ((dirp = readdir(dp)) != nullptr) {
+      const std::string sName(dirp->d_name);
+      const std::string sExtension = ".idx";
+      if ((sName.length() <= sExtension.length()) || (sName.compare(sName.length() - sExtension.length(), sExtension.length(), sExtension) != 0)) continue;
+
+      const std::string sBase = sPackDirectory + "/" + sName.substr(0, sName.length() - sExtension.length());
+
+      std::unique_ptr<cPackFile> pPackFile(new cPackFile);
+      if (pPackFile->Open(sBase + ".idx", sBase + ".pack")) packFiles.push_back(std::move(pPackFile));
+    }
+
+    closedir(dp);
+  }
+
+  bool cRepository::ReadLooseObject(const sha1_t& sha1, OBJECT_TYPE& type, std::string& sContents) const
+  {
+    const std::string sHex = SHA1ToString(sha1);
+    const std::string sFilePath = sCommonDirectory + "/objects/" + sHex.substr(0, 2) + "/" + sHex.substr(2);
+
+    std::string sCompressed;
+    if (!ReadFile(sFilePath, sCompressed)) return false;
+
+    std::string sObject;
+    if (!Inflate(reinterpret_cast<const uint8_t*>(sCompressed.data()), sCompressed.size(), sCompressed.size() * 2, sObject)) return false;
+
+    // "type size\0contents"
+    const std::string::size_type iSpace = sObject.find(' ');
+    const std::string::size_type iNull = sObject.find('\0');
+    if ((iSpace == std::string::npos) || (iNull == std::string::npos) || (iSpace > iNull)) return false;
+
+    const std::string sType = sObject.substr(0, iSpace);
+    if (sType == "commit") type = OBJECT_TYPE::COMMIT;
+    else if (sType == "tree") type = OBJECT_TYPE::TREE;
+    else if (sType == "blob") type = OBJECT_TYPE::BLOB;
+    else if (sType == "tag") type = OBJECT_TYPE::TAG;
+    else return false;
+
+    sContents = sObject.substr(iNull + 1);
+
+    return true;
+  }
+
+  bool cRepository::ReadObject(const sha1_t& sha1, OBJECT_TYPE& type, std::string& sContents) const
+  {
+    type = OBJECT_TYPE::INVALID;
+    sContents.clear();
+
+    for (const std::unique_ptr<cPackFile>& pPackFile : packFiles) {
+      uint64_t offset = 0;
+      if (pPackFile->Contains(sha1, offset)) return pPackFile->ReadObject(*this, offset, type, sContents, 0);
+    }
+
+    return ReadLooseObject(sha1, type, sContents);
+  }
+
+  bool cRepository::ReadPackedRef(const std::string& sRef, sha1_t& sha1) const
+  {
+    std::ifstream i((sCommonDirectory + "/packed-refs").c_str());
+    if (!i) return false;
+
+    // "sha1 refname" lines, with comments starting with '#' and peeled tags starting with '^'
+    std::string sLine;
+    while (std::getline(i, sLine)) {
+      if (sLine.empty() || (sLine[0] == '#') || (sLine[0] == '^')) continue;
+
+      if ((sLine.length() > 41) && (sLine[40] == ' ') && (TrimRight(sLine.substr(41)) == sRef)) return ParseSHA1(sLine.substr(0, 40), sha1);
+    }
+
+    return false;
+  }
+
+  bool cRepository::ReadRef(const std::string& sRef, sha1_t& sha1, size_t depth) const
+  {
+    if (depth > MAX_REF_DEPTH) return false;
+
+    // HEAD is per work tree, everything else is shared
+    const bool bIsPerWorkTree = (sRef.find('/') == std::string::npos);
+    const std::string sFilePath = (bIsPerWorkTree ? sGitDirectory : sCommonDirectory) + "/" + sRef;
+
+    std::string sContents;
+    if (IsFile(sFilePath) && ReadFile(sFilePath, sContents)) {
+      sContents = TrimRight(sContents);
+
+      const std::string sPrefix = "ref: ";
+      if (sContents.compare(0, sPrefix.length(), sPrefix) == 0) return ReadRef(sContents.substr(sPrefix.length()), sha1, depth + 1);
+
+      return ParseSHA1(sContents, sha1);
+    }
+
+    return ReadPackedRef(sRef, sha1);
+  }
+
+  bool cRepository::ResolveRevision(const std::string& sRevision, sha1_t& sha1) const
+  {
+    if (ParseSHA1(sRevision, sha1)) return true;
+
+    // Only HEAD like refs are allowed directly in the git directory, otherwise names such as "config" or "index" would resolve
+    const bool bIsHeadLike = ((sRevision == "HEAD") || (sRevision == "ORIG_HEAD") || (sRevision == "FETCH_HEAD") || (sRevision == "MERGE_HEAD"));
+    if ((bIsHeadLike || (sRevision.compare(0, 5, "refs/") == 0)) && ReadRef(sRevision, sha1, 0)) return true;
+
+    // The same search order as git uses
+    const std::string candidates[] = {
+      "refs/" + sRevision,
+      "refs/tags/" + sRevision,
+      "refs/heads/" + sRevision,
+      "refs/remotes/" + sRevision,
+      "refs/remotes/" + sRevision + "/HEAD",
+    };
+
+    for (const std::string& sCandidate : candidates) {
+      if (ReadRef(sCandidate, sha1, 0)) return true;
+    }
+
+    return false;
+  }
+
+  bool cRepository::GetTreeForRevision(const sha1_t& sha1, sha1_t& tree) const
+  {
+    sha1_t current = sha1;
+
+    for (size_t i = 0; i < MAX_REF_DEPTH; i++) {
+      OBJECT_TYPE type = OBJECT_TYPE::INVALID;
+      std::string sContents;
+      if (!ReadObject(current, type, sContents)) {
+        std::cerr<<"cRepository::GetTreeForRevision Could not read object "<<SHA1ToString(current)<<std::endl;
+        return false;
+      }
+
+      std::string sValue;
+      if (type == OBJECT_TYPE::TREE) {
+        tree = current;
+        return true;
+      } else if (type == OBJECT_TYPE::COMMIT) {
+        return GetHeaderValue(sContents, "tree", sValue) && ParseSHA1(sValue, tree);
+      } else if (type == OBJECT_TYPE::TAG) {
+        // Peel the annotated tag
+        if (!GetHeaderValue(sContents, "object", sValue) || !ParseSHA1(sValue, current)) return false;
+      } else return false;
+    }
+
+    return false;
+  }
+
+  bool cRepository::ReadTreeRecursive(const sha1_t& tree, const std::string& sDirectory, const cIndex* pIndex, std::unordered_map<std::string, sha1_t>& files, std::vector<std::string>& skippedDirectories) const
+  {
+    // If the index already has exactly this tree for this directory then nothing in here has changed
+    sha1_t cached;
+    if ((pIndex != nullptr) && pIndex->GetCachedTree(sDirectory, cached) && (cached == tree)) {
+      skippedDirectories.push_back(sDirectory);
+      return true;
+    }
+
+    OBJECT_TYPE type = OBJECT_TYPE::INVALID;
+    std::string sContents;
+    if (!ReadObject(tree, type, sContents) || (type != OBJECT_TYPE::TREE)) {
+      std::cerr<<"cRepository::ReadTreeRecursive Could not read tree "<<SHA1ToString(tree)<<std::endl;
+      return false;
+    }
+
+    // Each entry is "mode name\0" followed by a 20 byte sha1
+    std::string::size_type i = 0;
+    while (i < sContents.size()) {
+      const std::string::size_type iSpace = sContents.find(' ', i);
+      if (iSpace == std::string::npos) return false;
+
+      const std::string::size_type iNull = sContents.find('\0', iSpace);
+      if ((iNull == std::string::npos) || ((iNull + 21) > sContents.size())) return false;
+
+      const std::string sMode = sContents.substr(i, iSpace - i);
+      const std::string sName = sContents.substr(iSpace + 1, iNull - (iSpace + 1));
+      const std::string sPath = sDirectory.empty() ? sName : (sDirectory + "/" + sName);
+
+      sha1_t sha1;
+      memcpy(sha1.data(), &sContents[iNull + 1], 20);
+
+      i = iNull + 21;
+
+      if (sMode == "40000") {
+        if (!ReadTreeRecursive(sha1, sPath, pIndex, files, skippedDirectories)) return false;
+      } else if (sMode != "160000") files[sPath] = sha1; // Skip submodules
+    }
+
+    return true;
+  }
+
+
+  bool GetChangedFiles(const cRepository& repository, const std::string& sRevision, bool bIncludeWorkTree, std::vector<std::string>& files)
+  {
+    files.clear();
+
+    cIndex index;
+    if (!index.Load(repository.GetGitDirectory() + "/index")) return false;
+
+    sha1_t revision;
+    if (!repository.ResolveRevision(sRevision, revision)) {
+      std::cerr<<"GetChangedFiles Unknown revision "<<sRevision<<std::endl;
+      return false;
+    }
+
+    sha1_t tree;
+    if (!repository.GetTreeForRevision(revision, tree)) return false;
+
+    std::unordered_map<std::string, sha1_t> revisionFiles;
+    std::vector<std::string> skippedDirectories;
+    if (!repository.ReadTreeRecursive(tree, "", &index, revisionFiles, skippedDirectories)) return false;
+
+    const std::unordered_set<std::string> skipped(skippedDirectories.begin(), skippedDirectories.end());
+
+    // The index is sorted so consecutive entries are usually in the same directory
+    std::string sLastDirectory;
+    bool bLastDirectorySkipped = false;
+    bool bFirst = true;
+
+    auto IsInSkippedDirectory = [&](const std::string& sPath) -> bool {
+      const std::string::size_type iSlash = sPath.rfind('/');
+      const std::string sDirectory = (iSlash == std::string::npos) ? "" : sPath.substr(0, iSlash);
+      if (!bFirst && (sDirectory == sLastDirectory)) return bLastDirectorySkipped;
+
+      bFirst = false;
+      sLastDirectory = sDirectory;
+
+      // Check the root and then each parent directory
+      bLastDirectorySkipped = (skipped.find("") != skipped.end());
+      std::string::size_type i = 0;
+      while (!bLastDirectorySkipped && (i != std::string::npos)) {
+        i = sPath.find('/', i + 1);
+        if (i != std::string::npos) bLastDirectorySkipped = (skipped.find(sPath.substr(0, i)) != skipped.end());
+      }
+
+      return bLastDirectorySkipped;
+    };
+
+    std::string sLastPath;
+
+    for (const cIndexEntry& entry : index.GetEntries()) {
+      // Skip sparse checkout entries that aren't in the working tree, submodules and symlinks
+      const uint32_t type = entry.mode & 0170000;
+      if (entry.bSkipWorkTree || (type == 0160000) || (type == 0120000)) continue;
+
+      // Merge conflicts have multiple entries for the same path
+      if (entry.sPath == sLastPath) continue;
+
+      bool bChanged = false;
+      if ((entry.stage != 0) || entry.bIntentToAdd) bChanged = true;
+      else if (!IsInSkippedDirectory(entry.sPath)) {
+        std::unordered_map<std::string, sha1_t>::const_iterator iter = revisionFiles.find(entry.sPath);
+        bChanged = ((iter == revisionFiles.end()) || (iter->second != entry.sha1));
+      }
+
+      if (!bChanged && bIncludeWorkTree) {
+        // If the file has been touched since it was staged then it has probably been modified
+        struct stat _stat;
+        if (lstat((repository.GetWorkTreeDirectory() + "/" + entry.sPath).c_str(), &_stat) == 0) {
+          bChanged = (
+            (uint32_t(_stat.st_mtim.tv_sec) != entry.mtimeSeconds) ||
+            ((entry.mtimeNanoSeconds != 0) && (uint32_t(_stat.st_mtim.tv_nsec) != entry.mtimeNanoSeconds)) ||
+            (uint32_t(_stat.st_size) != entry.size)
+          );
+        }
+      }
+
+      if (bChanged) {
+        files.push_back(entry.sPath);
+        sLastPath = entry.sPath;
+      }
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,128 @@
+#ifndef GIT_H
+#define GIT_H
+
+// A tiny read only git repository reader, just enough to find the files that have changed since a revision without spawning git or linking to libgit2
+//
+// Supported:
+// .git/index versions 2, 3 and 4 including the cached tree extension
+// Loose objects and pack files (Including offset and reference deltas)
+// Refs, packed refs, annotated tags and "gitdir:" files
+//
+// Not supported:
+// SHA-256 repositories, alternates, shallow clones, reflog syntax such as "HEAD~1" or abbreviated hashes
+
+#include <cstdint>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace git
+{
+  typedef std::array<uint8_t, 20> sha1_t;
+
+  bool ParseSHA1(const std::string& sText, sha1_t& sha1);
+  std::string SHA1ToString(const sha1_t& sha1);
+
+  enum class OBJECT_TYPE {
+    INVALID = 0,
+    COMMIT = 1,
+    TREE = 2,
+    BLOB = 3,
+    TAG = 4,
+  };
+
+
+  // ** cIndexEntry
+  //
+  // A file in the index, the stat data is used to tell if the file in the working tree has been modified since it was staged
+
+  class cIndexEntry
+  {
+  public:
+    std::string sPath;
+    sha1_t sha1;
+    uint32_t mode;
+    uint32_t mtimeSeconds;
+    uint32_t mtimeNanoSeconds;
+    uint32_t size;
+    uint8_t stage;
+    bool bSkipWorkTree;
+    bool bIntentToAdd;
+  };
+
+
+  // ** cIndex
+  //
+  // The parsed contents of .git/index
+
+  class cIndex
+  {
+  public:
+    bool Load(const std::string& sFilePath);
+
+    const std::vector<cIndexEntry>& GetEntries() const { return entries; }
+
+    // Returns the sha1 of the tree for sDirectory ("" is the root) if the index has a valid cached tree for it
+    bool GetCachedTree(const std::string& sDirectory, sha1_t& sha1) const;
+
+  private:
+    bool ParseCachedTreeExtension(const uint8_t* pData, size_t nBytes);
+
+    std::vector<cIndexEntry> entries;
+    std::unordered_map<std::string, sha1_t> cachedTrees;
+  };
+
+
+  class cPackFile;
+
+  // ** cRepository
+  //
+  // Reads refs and objects from a repository
+
+  class cRepository
+  {
+  public:
+    cRepository();
+    ~cRepository();
+
+    // Searches sPath and then each parent directory until a .git folder or .git file is found
+    bool Open(const std::string& sPath);
+
+    const std::string& GetWorkTreeDirectory() const { return sWorkTreeDirectory; }
+    const std::string& GetGitDirectory() const { return sGitDirectory; }
+
+    // sRevision can be a full 40 character hash, "HEAD", or the name of a branch, tag or remote branch
+    bool ResolveRevision(const std::string& sRevision, sha1_t& sha1) const;
+
+    bool ReadObject(const sha1_t& sha1, OBJECT_TYPE& type, std::string& sContents) const;
+
+    // Follows annotated tags and commits through to the root tree
+    bool GetTreeForRevision(const sha1_t& sha1, sha1_t& tree) const;
+
+    // Adds every file in the tree to files, skipping any directory where the index has an identical cached tree
+    // skippedDirectories receives the directories that were skipped because they are unchanged
+    bool ReadTreeRecursive(const sha1_t& tree, const std::string& sDirectory, const cIndex* pIndex, std::unordered_map<std::string, sha1_t>& files, std::vector<std::string>& skippedDirectories) const;
+
+  private:
+    bool ReadLooseObject(const sha1_t& sha1, OBJECT_TYPE& type, std::string& sContents) const;
+    bool ReadRef(const std::string& sRef, sha1_t& sha1, size_t depth) const;
+    bool ReadPackedRef(const std::string& sRef, sha1_t& sha1) const;
+    void LoadPackFiles();
+
+    std::string sWorkTreeDirectory;
+    std::string sGitDirectory;
+    std::string sCommonDirectory; // For linked work trees the objects and refs live in the main repository
+    std::vector<std::unique_ptr<cPackFile>> packFiles;
+  };
+
+
+  // Returns the paths relative to the work tree of files that are staged and differ from sRevision
+  // If bIncludeWorkTree is true then files in the working tree that have been modified since they were staged are added too
+  bool GetChangedFiles(const cRepository& repository, const std::string& sRevision, bool bIncludeWorkTree, std::vector<std::string>& files);
+}
+
+#endif // GIT_H
@@ -9,10 +9,16 @@
 // Remove trailing spaces
 // Remove trailing new lines
 // Make sure that there is a newline at the end of the file
+//
+// In --check mode nothing is written, each file is scanned and the number of changes that would be made is reported instead
+//
+// In --since REV and --staged modes only the files that git says have changed are processed instead of the whole directory
 
 #include <cassert>
 #include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -23,8 +29,13 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 
+// Application headers
+#include "git.h"
+
 #if defined(__LINUX__) || defined(__APPLE__)
 #define BUILD_LINUX_OR_UNIX
 #endif
@@ -309,12 +320,295 @@ bool cFileCleaner::Write(std::ofstream& o, const std::vector<std::string>& vLine
    return true;
 }
 
+// ** cFileStatistics
+//
+// The changes that cFileCleaner would make to a file
+
+class cFileStatistics
+{
+public:
+  cFileStatistics();
+
+  bool IsClean() const;
+
+  bool bError;
+  size_t nTabs;
+  size_t nTrailingWhitespaceLines;
+  size_t nCarriageReturns;
+  size_t nTrailingBlankLines;
+  bool bMissingNewLineAtEndOfFile;
+};
+
+cFileStatistics::cFileStatistics() :
+  bError(false),
+  nTabs(0),
+  nTrailingWhitespaceLines(0),
+  nCarriageReturns(0),
+  nTrailingBlankLines(0),
+  bMissingNewLineAtEndOfFile(false)
+{
+}
+
+bool cFileStatistics::IsClean() const
+{
+  // NOTE: Carriage returns in the middle of a line are left alone by the cleaner, carriage returns at the end of a line are counted as trailing whitespace
+  return (!bError && (nTabs == 0) && (nTrailingWhitespaceLines == 0) && (nTrailingBlankLines == 0) && !bMissingNewLineAtEndOfFile);
+}
+
+
+// ** cFileScanner
+//
+// Reads a whole file in one go and counts what cFileCleaner would change without building any lines or writing anything
+// Each thread should have its own scanner so that the read buffer can be reused between files
+
+class cFileScanner
+{
+public:
+  bool Scan(const std::string& sFilename, cFileStatistics& statistics);
+
+private:
+  void ScanBuffer(const char* pBuffer, size_t nBytes, cFileStatistics& statistics) const;
+
+  std::vector<char> buffer;
+};
+
+bool cFileScanner::Scan(const std::string& sFilename, cFileStatistics& statistics)
+{
+  statistics = cFileStatistics();
+
+  const int fd = open(sFilename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    statistics.bError = true;
+    return false;
+  }
+
+  struct stat _stat;
+  if (fstat(fd, &_stat) != 0) {
+    close(fd);
+    statistics.bError = true;
+    return false;
+  }
+
+  const size_t nBytes = size_t(_stat.st_size);
+  if (buffer.size() < nBytes) buffer.resize(nBytes);
+
+  size_t nRead = 0;
+  while (nRead < nBytes) {
+    const ssize_t result = read(fd, &buffer[nRead], nBytes - nRead);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      statistics.bError = true;
+      return false;
+    } else if (result == 0) break; // The file was truncated while we were reading it
+
+    nRead += size_t(result);
+  }
+
+  close(fd);
+
+  ScanBuffer(buffer.data(), nRead, statistics);
+
+  return true;
+}
+
+void cFileScanner::ScanBuffer(const char* pBuffer, size_t nBytes, cFileStatistics& statistics) const
+{
+  // Lines that only contain whitespace at the end of the file, these are reset each time we find a line with some text in it
+  size_t nBlankLines = 0;
+
+  bool bLineIsBlank = true;
+  char cLast = '\n';
+
+  for (size_t i = 0; i < nBytes; i++) {
+    const char c = pBuffer[i];
+    switch (c) {
+      case '\t': {
+        statistics.nTabs++;
+        break;
+      }
+      case '\r': {
+        statistics.nCarriageReturns++;
+        break;
+      }
+      case '\n': {
+        if ((cLast == ' ') || (cLast == '\t') || (cLast == '\r')) statistics.nTrailingWhitespaceLines++;
+
+        if (bLineIsBlank) nBlankLines++;
+        else nBlankLines = 0;
+
+        bLineIsBlank = true;
+        break;
+      }
+      case ' ': {
+        break;
+      }
+      default: {
+        bLineIsBlank = false;
+      }
+    }
+
+    cLast = c;
+  }
+
+  // Handle the last line if it doesn't end in a new line
+  if (cLast != '\n') {
+    if ((cLast == ' ') || (cLast == '\t') || (cLast == '\r')) statistics.nTrailingWhitespaceLines++;
+
+    if (bLineIsBlank) nBlankLines++;
+    else {
+      nBlankLines = 0;
+
+      // The cleaner always writes a new line after the last line
+      statistics.bMissingNewLineAtEndOfFile = true;
+    }
+  }
+
+  statistics.nTrailingBlankLines = nBlankLines;
+}
+
+
+// ** Check mode
+//
+// Scans every file on all cores and reports the files that would be changed
+
+void EscapeJSONString(std::ostream& o, const std::string& sText)
+{
+  for (const char c : sText) {
+    switch (c) {
+      case '"': o<<"\\\""; break;
+      case '\\': o<<"\\\\"; break;
+      case '\n': o<<"\\n"; break;
+      case '\r': o<<"\\r"; break;
+      case '\t': o<<"\\t"; break;
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          const char* szHex = "0123456789abcdef";
+          o<<"\\u00"<<szHex[(c >> 4) & 0xF]<<szHex[c & 0xF];
+        } else o<<c;
+      }
+    }
+  }
+}
+
+void ScanFiles(const std::vector<std::string>& files, std::vector<cFileStatistics>& statistics)
+{
+  const size_t nFiles = files.size();
+  statistics.resize(nFiles);
+
+  size_t nThreads = std::thread::hardware_concurrency();
+  if (nThreads == 0) nThreads = 1;
+  nThreads = std::min(nThreads, std::max<size_t>(nFiles, 1));
+
+  // Each thread grabs the next batch of files, this keeps the threads busy even when the files are very different sizes
+  const size_t nBatchSize = 64;
+  std::atomic<size_t> nextFile(0);
+
+  auto worker = [&]() {
+    cFileScanner scanner;
+
+    while (true) {
+      const size_t iStart = nextFile.fetch_add(nBatchSize);
+      if (iStart >= nFiles) break;
+
+      const size_t iEnd = std::min(iStart + nBatchSize, nFiles);
+      for (size_t i = iStart; i < iEnd; i++) scanner.Scan(files[i], statistics[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nThreads; i++) threads.push_back(std::thread(worker));
+
+  // Do some of the work on this thread too
+  worker();
+
+  for (auto& thread : threads) thread.join();
+}
+
+void PrintCheckResultsText(std::ostream& o, const std::vector<std::string>& files, const std::vector<cFileStatistics>& statistics, const cFileStatistics& total, size_t nMissingNewLines, size_t nFilesChanged, size_t nErrors)
+{
+  const size_t n = files.size();
+  for (size_t i = 0; i < n; i++) {
+    const cFileStatistics& s = statistics[i];
+    if (s.bError) o<<files[i]<<": error"<<std::endl;
+    else if (!s.IsClean()) {
+      o<<files[i]<<": tabs="<<s.nTabs<<" trailing_whitespace="<<s.nTrailingWhitespaceLines<<" cr="<<s.nCarriageReturns<<" trailing_blank_lines="<<s.nTrailingBlankLines<<" missing_newline="<<(s.bMissingNewLineAtEndOfFile ? 1 : 0)<<std::endl;
+    }
+  }
+
+  o<<"files="<<n<<" changed="<<nFilesChanged<<" errors="<<nErrors<<" tabs="<<total.nTabs<<" trailing_whitespace="<<total.nTrailingWhitespaceLines<<" cr="<<total.nCarriageReturns<<" trailing_blank_lines="<<total.nTrailingBlankLines<<" missing_newline="<<nMissingNewLines<<std::endl;
+}
+
+void PrintCheckResultsJSON(std::ostream& o, const std::vector<std::string>& files, const std::vector<cFileStatistics>& statistics, const cFileStatistics& total, size_t nMissingNewLines, size_t nFilesChanged, size_t nErrors)
+{
+  o<<"{"<<std::endl;
+  o<<"  \"files\": ["<<std::endl;
+
+  bool bFirst = true;
+
+  const size_t n = files.size();
+  for (size_t i = 0; i < n; i++) {
+    const cFileStatistics& s = statistics[i];
+    if (!s.bError && s.IsClean()) continue;
+
+    if (bFirst) bFirst = false;
+    else o<<","<<std::endl;
+
+    o<<"    { \"path\": \"";
+    EscapeJSONString(o, files[i]);
+    o<<"\"";
+    if (s.bError) o<<", \"error\": true }";
+    else o<<", \"tabs\": "<<s.nTabs<<", \"trailing_whitespace\": "<<s.nTrailingWhitespaceLines<<", \"cr\": "<<s.nCarriageReturns<<", \"trailing_blank_lines\": "<<s.nTrailingBlankLines<<", \"missing_newline\": "<<(s.bMissingNewLineAtEndOfFile ? "true" : "false")<<" }";
+  }
+
+  if (!bFirst) o<<std::endl;
+
+  o<<"  ],"<<std::endl;
+  o<<"  \"total\": { \"files\": "<<n<<", \"changed\": "<<nFilesChanged<<", \"errors\": "<<nErrors<<", \"tabs\": "<<total.nTabs<<", \"trailing_whitespace\": "<<total.nTrailingWhitespaceLines<<", \"cr\": "<<total.nCarriageReturns<<", \"trailing_blank_lines\": "<<total.nTrailingBlankLines<<", \"missing_newline\": "<<nMissingNewLines<<" }"<<std::endl;
+  o<<"}"<<std::endl;
+}
+
+// Returns true if every file is already clean
+bool CheckFiles(const std::vector<std::string>& files, bool bJSON)
+{
+  std::vector<cFileStatistics> statistics;
+  ScanFiles(files, statistics);
+
+  cFileStatistics total;
+  size_t nMissingNewLines = 0;
+  size_t nFilesChanged = 0;
+  size_t nErrors = 0;
+
+  for (const cFileStatistics& s : statistics) {
+    if (s.bError) {
+      nErrors++;
+      continue;
+    }
+
+    total.nTabs += s.nTabs;
+    total.nTrailingWhitespaceLines += s.nTrailingWhitespaceLines;
+    total.nCarriageReturns += s.nCarriageReturns;
+    total.nTrailingBlankLines += s.nTrailingBlankLines;
+    if (s.bMissingNewLineAtEndOfFile) nMissingNewLines++;
+    if (!s.IsClean()) nFilesChanged++;
+  }
+
+  if (bJSON) PrintCheckResultsJSON(std::cout, files, statistics, total, nMissingNewLines, nFilesChanged, nErrors);
+  else PrintCheckResultsText(std::cout, files, statistics, total, nMissingNewLines, nFilesChanged, nErrors);
+
+  return ((nFilesChanged == 0) && (nErrors == 0));
+}
+
 void PrintUsage(const std::string& sExecutableName)
 {
-  std::cout<<"Usage: "<<sExecutableName<<" [DIRECTORY]"<<std::endl;
+  std::cout<<"Usage: "<<sExecutableName<<" [--check [--json]] [--since REV | --staged] [DIRECTORY]"<<std::endl;
   std::cout<<"Search recursively in DIRECTORY for *.txt, *.cpp, *.h, *.html files to clean up"<<std::endl;
   std::cout<<"Cleaning up involves replacing tabs with 2 spaces"<<std::endl;
   std::cout<<"If no directory is specified the current directory is searched"<<std::endl;
+  std::cout<<"  --check: Don't modify any files, print the files that would be changed and exit with a non-zero status if there are any"<<std::endl;
+  std::cout<<"  --json: Print the --check results as JSON instead of text"<<std::endl;
+  std::cout<<"  --since REV: Only process files that are different in the index or working tree to REV, REV can be a full hash, HEAD, or a branch or tag name"<<std::endl;
+  std::cout<<"  --staged: Only process files that are staged to be committed"<<std::endl;
 }
 
 class cDirectoryReader
@@ -378,7 +672,20 @@ void cDirectoryReader::Clear()
   directories.clear();
 }
 
-void ProcessDirectory(const cDirectoryReader& dir, cFileCleaner& cleaner)
+bool IsSourceFile(const std::string& sFilename)
+{
+  const std::string extension(GetExtension(sFilename));
+  return (
+    (extension == "txt") ||
+    (extension == "cpp") ||
+    (extension == "h") ||
+    (extension == "html") ||
+    (extension == "htm") ||
+    (extension == "xml")
+  );
+}
+
+void GatherSourceFiles(const cDirectoryReader& dir, std::vector<std::string>& sourceFiles)
 {
   //std::cout<<"Directory \""<<dir.GetFullPath()<<"\""<<std::endl;
 
@@ -386,15 +693,7 @@ void ProcessDirectory(const cDirectoryReader& dir, cFileCleaner& cleaner)
     const std::vector<std::string>& files = dir.GetFiles();
     const size_t n = files.size();
     for (size_t i = 0; i < n; i++) {
-      std::string extension(GetExtension(files[i]));
-      if (
-        (extension == "txt") ||
-        (extension == "cpp") ||
-        (extension == "h") ||
-        (extension == "html") ||
-        (extension == "htm") ||
-        (extension == "xml")
-        ) cleaner.Clean(files[i]);
+      if (IsSourceFile(files[i])) sourceFiles.push_back(files[i]);
     }
   }
 
@@ -402,36 +701,107 @@ void ProcessDirectory(const cDirectoryReader& dir, cFileCleaner& cleaner)
     const std::vector<cDirectoryReader*>& directories = dir.GetDirectories();
     const size_t n = directories.size();
     for (size_t i = 0; i < n; i++) {
-      ProcessDirectory(*directories[i], cleaner);
+      GatherSourceFiles(*directories[i], sourceFiles);
     }
   }
 }
 
+bool IsHiddenPath(const std::string& sPath)
+{
+  // Matches cDirectoryReader which skips anything starting with a "."
+  return ((!sPath.empty() && (sPath[0] == '.')) || (sPath.find("/.") != std::string::npos));
+}
+
+// Asks git for the files that have changed since sRevision instead of searching the whole directory
+bool GatherChangedSourceFiles(const std::string& sDirectory, const std::string& sRevision, bool bIncludeWorkTree, std::vector<std::string>& sourceFiles)
+{
+  git::cRepository repository;
+  if (!repository.Open(sDirectory)) {
+    std::cerr<<"No git repository found for "<<sDirectory<<std::endl;
+    return false;
+  }
+
+  std::vector<std::string> changedFiles;
+  if (!git::GetChangedFiles(repository, sRevision, bIncludeWorkTree, changedFiles)) return false;
+
+  // Only keep the files that are inside the directory we were asked to process
+  const std::string& sWorkTreeDirectory = repository.GetWorkTreeDirectory();
+  std::string sPrefix;
+  {
+    char szDirectory[PATH_MAX];
+    if (realpath(sDirectory.c_str(), szDirectory) == nullptr) return false;
+
+    const std::string sRealDirectory(szDirectory);
+    if (sRealDirectory != sWorkTreeDirectory) sPrefix = sRealDirectory.substr(sWorkTreeDirectory.length() + ((sWorkTreeDirectory == "/") ? 0 : 1)) + "/";
+  }
+
+  for (const std::string& sPath : changedFiles) {
+    if ((sPath.compare(0, sPrefix.length(), sPrefix) != 0) || IsHiddenPath(sPath) || !IsSourceFile(sPath)) continue;
+
+    // Files that have been deleted from the working tree don't need cleaning
+    const std::string sFullPath = ((sWorkTreeDirectory == "/") ? "" : sWorkTreeDirectory) + "/" + sPath;
+    struct stat _stat;
+    if ((lstat(sFullPath.c_str(), &_stat) == 0) && S_ISREG(_stat.st_mode)) sourceFiles.push_back(sFullPath);
+  }
+
+  return true;
+}
+
 int main(int argc, char** argv)
 {
   std::string sDirectory(GetCurrentDirectory());
+  bool bCheck = false;
+  bool bJSON = false;
+  bool bDirectorySpecified = false;
+  std::string sRevision;
+  bool bStaged = false;
 
-  if (argc == 2) {
-    std::string sArgument1(argv[1]);
+  for (int i = 1; i < argc; i++) {
+    const std::string sArgument(argv[i]);
 
-    if (sArgument1 == "--help") {
+    if (sArgument == "--help") {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    } else if (sArgument == "--check") bCheck = true;
+    else if (sArgument == "--json") bJSON = true;
+    else if ((sArgument == "--since") && ((i + 1) < argc) && sRevision.empty()) {
+      i++;
+      sRevision = argv[i];
+    } else if (sArgument == "--staged") bStaged = true;
+    else if (!bDirectorySpecified && (sArgument.compare(0, 2, "--") != 0)) {
+      // Set the directory to this argument
+      sDirectory = sArgument;
+      bDirectorySpecified = true;
+    } else {
+      // Unknown or too many arguments
       PrintUsage(argv[0]);
       return EXIT_FAILURE;
     }
+  }
 
-    // Else set the directory to the first argument
-    sDirectory = sArgument1;
-  } else if (argc != 1) {
-    // Incorrect number of arguments
+  if ((bJSON && !bCheck) || (bStaged && !sRevision.empty())) {
     PrintUsage(argv[0]);
     return EXIT_FAILURE;
   }
 
+  std::vector<std::string> files;
+
+  if (bStaged) {
+    // Staged files are the ones in the index that are different to HEAD, the working tree isn't looked at
+    if (!GatherChangedSourceFiles(sDirectory, "HEAD", false, files)) return EXIT_FAILURE;
+  } else if (!sRevision.empty()) {
+    if (!GatherChangedSourceFiles(sDirectory, sRevision, true, files)) return EXIT_FAILURE;
+  } else {
+    cDirectoryReader dir(sDirectory);
+    GatherSourceFiles(dir, files);
+  }
+
+  if (bCheck) return CheckFiles(files, bJSON) ? EXIT_SUCCESS : EXIT_FAILURE;
+
   cFileCleaner cleaner;
 
-  cDirectoryReader dir(sDirectory);
-  ProcessDirectory(dir, cleaner);
+  const size_t n = files.size();
+  for (size_t i = 0; i < n; i++) cleaner.Clean(files[i]);
 
   return EXIT_SUCCESS;
 }
-
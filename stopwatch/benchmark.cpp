@@ -0,0 +1,251 @@
+#include <cassert>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#include "benchmark.h"
+
+namespace
+{
+  struct cRegisteredBenchmark {
+    std::string sName;
+    benchmark_function_t function;
+  };
+
+  std::vector<cRegisteredBenchmark>& GetRegisteredBenchmarks()
+  {
+    // A function static so that it is constructed before the first registration regardless of the order that files are initialised in
+    static std::vector<cRegisteredBenchmark> benchmarks;
+    return benchmarks;
+  }
+
+  // Returns the duration of one call in nanoseconds
+  durationns_t TimeBenchmark(const benchmark_function_t& function, size_t iterations)
+  {
+    const durationns_t start = GetTimeNS();
+    function(iterations);
+    ClobberMemory();
+    return GetTimeNS() - start;
+  }
+
+  double GetMedian(std::vector<double> values)
+  {
+    assert(!values.empty());
+    std::sort(values.begin(), values.end());
+
+    const size_t middle = values.size() / 2;
+    if ((values.size() % 2) == 0) return (values[middle - 1] + values[middle]) / 2.0;
+    return values[middle];
+  }
+
+  // Splits samples into groups of nSamplesPerGroup and returns the median of the group means
+  double GetMedianOfMeans(const std::vector<double>& samples, size_t nSamplesPerGroup)
+  {
+    assert(!samples.empty());
+    nSamplesPerGroup = std::max<size_t>(nSamplesPerGroup, 1);
+
+    std::vector<double> means;
+    for (size_t i = 0; i < samples.size(); i += nSamplesPerGroup) {
+      const size_t end = std::min(i + nSamplesPerGroup, samples.size());
+
+      double total = 0.0;
+      for (size_t j = i; j < end; j++) total += samples[j];
+      means.push_back(total / double(end - i));
+    }
+
+    return GetMedian(means);
+  }
+
+  bool ReadFirstLine(const std::string& sFilePath, std::string& sLine)
+  {
+    std::ifstream file(sFilePath);
+    if (!file.good()) return false;
+
+    std::getline(file, sLine);
+    return true;
+  }
+}
+
+// ** cBenchmarkSettings
+
+cBenchmarkSettings::cBenchmarkSettings() :
+  warmUpMS(200),
+  targetSampleMS(10),
+  nSamples(30),
+  nSamplesPerGroup(3),
+  nBootstrapResamples(1000),
+  confidenceLevel(0.95)
+{
+}
+
+
+// ** cBenchmarkResult
+
+cBenchmarkResult::cBenchmarkResult() :
+  bIsTooFast(false),
+  iterationsPerSample(0),
+  nsPerOperation(0.0),
+  confidenceIntervalLowNS(0.0),
+  confidenceIntervalHighNS(0.0),
+  minimumNSPerOperation(0.0),
+  medianNSPerOperation(0.0)
+{
+}
+
+
+cBenchmarkResult RunBenchmark(const std::string& sName, const benchmark_function_t& function, const cBenchmarkSettings& settings)
+{
+  cBenchmarkResult result;
+  result.sName = sName;
+
+  const durationns_t targetSampleNS = std::max<durationms_t>(settings.targetSampleMS, 1) * 1000000;
+  const durationns_t warmUpStart = GetTimeNS();
+
+  // Find out roughly how many iterations fit in a sample, grow by 10x until a call takes long enough to measure accurately
+  size_t iterations = 1;
+  while (true) {
+    const durationns_t duration = TimeBenchmark(function, iterations);
+    if (duration >= (targetSampleNS / 10)) {
+      iterations = std::min(MAX_ITERATIONS_PER_SAMPLE, std::max<size_t>(1, size_t((double(iterations) * double(targetSampleNS)) / double(duration))));
+      break;
+    }
+
+    if (iterations >= MAX_ITERATIONS_PER_SAMPLE) {
+      result.bIsTooFast = true;
+      result.iterationsPerSample = iterations;
+      return result;
+    }
+
+    iterations = std::min(MAX_ITERATIONS_PER_SAMPLE, iterations * 10);
+  }
+
+  // Warm up the caches, branch predictors and CPU frequency, then correct the estimate now that everything is warm
+  durationns_t warmUpDuration = 0;
+  size_t nWarmUpCalls = 0;
+  while ((GetTimeNS() - warmUpStart) < (settings.warmUpMS * 1000000)) {
+    warmUpDuration += TimeBenchmark(function, iterations);
+    nWarmUpCalls++;
+  }
+  if (nWarmUpCalls != 0) {
+    const double nsPerCall = double(warmUpDuration) / double(nWarmUpCalls);
+    iterations = std::min(MAX_ITERATIONS_PER_SAMPLE, std::max<size_t>(1, size_t((double(iterations) * double(targetSampleNS)) / std::max(nsPerCall, 1.0))));
+  }
+
+  result.iterationsPerSample = iterations;
+
+  const size_t nSamples = std::max<size_t>(settings.nSamples, 1);
+  result.samplesNSPerOperation.reserve(nSamples);
+  for (size_t i = 0; i < nSamples; i++) {
+    const durationns_t duration = TimeBenchmark(function, iterations);
+    result.samplesNSPerOperation.push_back(double(duration) / double(iterations));
+  }
+
+  result.nsPerOperation = GetMedianOfMeans(result.samplesNSPerOperation, settings.nSamplesPerGroup);
+  result.medianNSPerOperation = GetMedian(result.samplesNSPerOperation);
+  result.minimumNSPerOperation = *std::min_element(result.samplesNSPerOperation.begin(), result.samplesNSPerOperation.end());
+
+  // Bootstrap the confidence interval, resample the samples with replacement and look at the spread of the estimate
+  // The seed is fixed so that the same samples always give the same interval
+  std::mt19937 generator(12345);
+  std::uniform_int_distribution<size_t> distribution(0, nSamples - 1);
+  std::vector<double> resample(nSamples);
+  std::vector<double> estimates;
+  estimates.reserve(settings.nBootstrapResamples);
+  for (size_t i = 0; i < settings.nBootstrapResamples; i++) {
+    for (size_t j = 0; j < nSamples; j++) resample[j] = result.samplesNSPerOperation[distribution(generator)];
+    estimates.push_back(GetMedianOfMeans(resample, settings.nSamplesPerGroup));
+  }
+
+  if (estimates.empty()) {
+    result.confidenceIntervalLowNS = result.nsPerOperation;
+    result.confidenceIntervalHighNS = result.nsPerOperation;
+  } else {
+    std::sort(estimates.begin(), estimates.end());
+    const double tail = (1.0 - std::min(std::max(settings.confidenceLevel, 0.0), 1.0)) / 2.0;
+    const size_t low = size_t(tail * double(estimates.size() - 1));
+    const size_t high = size_t((1.0 - tail) * double(estimates.size() - 1));
+    result.confidenceIntervalLowNS = estimates[low];
+    result.confidenceIntervalHighNS = estimates[high];
+  }
+
+  return result;
+}
+
+void PrintBenchmarkResultsHeader(std::ostream& o)
+{
+  o<<std::left<<std::setw(32)<<"benchmark"<<std::right<<std::setw(14)<<"iterations"<<std::setw(12)<<"ns/op"<<std::setw(24)<<"confidence interval"<<std::setw(12)<<"min"<<std::setw(12)<<"median"<<std::endl;
+}
+
+void PrintBenchmarkResult(std::ostream& o, const cBenchmarkResult& result)
+{
+  if (result.bIsTooFast) {
+    o<<std::left<<std::setw(32)<<result.sName<<std::right<<std::setw(14)<<result.iterationsPerSample<<"  too fast to measure, has the optimiser removed the body?"<<std::endl;
+    return;
+  }
+
+  std::ostringstream interval;
+  interval<<std::fixed<<std::setprecision(2)<<result.confidenceIntervalLowNS<<" - "<<result.confidenceIntervalHighNS;
+
+  o<<std::left<<std::setw(32)<<result.sName<<std::right<<std::setw(14)<<result.iterationsPerSample<<std::fixed<<std::setprecision(2)
+    <<std::setw(12)<<result.nsPerOperation
+    <<std::setw(24)<<interval.str()
+    <<std::setw(12)<<result.minimumNSPerOperation
+    <<std::setw(12)<<result.medianNSPerOperation;
+
+  // Flag results where the interval is more than 5% either side of the estimate
+  const double halfWidth = (result.confidenceIntervalHighNS - result.confidenceIntervalLowNS) / 2.0;
+  if ((result.nsPerOperation > 0.0) && (halfWidth > (0.05 * result.nsPerOperation))) o<<"  noisy";
+
+  o<<std::endl;
+}
+
+std::vector<std::string> GetBenchmarkEnvironmentWarnings()
+{
+  std::vector<std::string> warnings;
+
+#ifndef __OPTIMIZE__
+  warnings.push_back("This was built without optimisation, build with -DCMAKE_BUILD_TYPE=Release for meaningful results");
+#endif
+
+  std::string sLine;
+  if (ReadFirstLine("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", sLine)) {
+    if (sLine != "performance") warnings.push_back("The CPU frequency governor is \"" + sLine + "\", the frequency may change during the run, set it to \"performance\" for stable results");
+  } else warnings.push_back("CPU frequency scaling information is not available (No cpufreq in sysfs, for example in a virtual machine), results may vary with the host's CPU frequency");
+
+  if (ReadFirstLine("/sys/devices/system/cpu/intel_pstate/no_turbo", sLine) && (sLine == "0")) warnings.push_back("Turbo boost is enabled, results depend on temperature and how many cores are busy");
+  else if (ReadFirstLine("/sys/devices/system/cpu/cpufreq/boost", sLine) && (sLine == "1")) warnings.push_back("CPU boost is enabled, results depend on temperature and how many cores are busy");
+
+  if ((GetClockSource() == CLOCK_SOURCE::STEADY_CLOCK) && IsInvariantTSCSupported()) warnings.push_back("Using steady_clock, select the TSC with --clock rdtsc for lower timing overhead");
+
+  return warnings;
+}
+
+
+// ** Registered benchmarks
+
+cBenchmarkRegistration::cBenchmarkRegistration(const char* szName, const benchmark_function_t& function)
+{
+  GetRegisteredBenchmarks().push_back({ szName, function });
+}
+
+std::vector<cBenchmarkResult> RunRegisteredBenchmarks(std::ostream& o, const std::string& sFilter, const cBenchmarkSettings& settings)
+{
+  const std::vector<std::string> warnings = GetBenchmarkEnvironmentWarnings();
+  for (const std::string& sWarning : warnings) o<<"WARNING: "<<sWarning<<std::endl;
+
+  o<<"Clock source "<<GetClockSourceName(GetClockSource())<<", "<<settings.nSamples<<" samples of "<<settings.targetSampleMS<<" ms, "<<int(settings.confidenceLevel * 100.0)<<"% confidence interval"<<std::endl;
+  PrintBenchmarkResultsHeader(o);
+
+  std::vector<cBenchmarkResult> results;
+  for (const cRegisteredBenchmark& benchmark : GetRegisteredBenchmarks()) {
+    if (!sFilter.empty() && (benchmark.sName.find(sFilter) == std::string::npos)) continue;
+
+    results.push_back(RunBenchmark(benchmark.sName, benchmark.function, settings));
+    PrintBenchmarkResult(o, results.back());
+  }
+
+  return results;
+}
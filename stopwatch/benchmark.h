@@ -0,0 +1,121 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "stopwatch.h"
+
+// ** Benchmark runner
+//
+// A small statistical micro benchmark runner built on GetTimeNS
+// A benchmark is a function that runs its operation iterations times, the runner picks iterations so that each sample takes about targetSampleMS
+//
+//  void BenchmarkSomething(size_t iterations)
+//  {
+//    for (size_t i = 0; i < iterations; i++) {
+//      uint64_t result = Something();
+//      DoNotOptimize(result);
+//    }
+//  }
+//  REGISTER_BENCHMARK("something", BenchmarkSomething);
+//
+// Each benchmark is warmed up, then timed for a number of samples, the estimate is the median of the means of groups of samples which ignores the odd sample hit by an interrupt
+// The confidence interval is a bootstrap of the same estimate
+// Other tools can add benchmark.cpp, stopwatch.cpp, histogram.cpp and perfcounters.cpp to their build, register their own benchmarks and call RunRegisteredBenchmarks (See permutations)
+
+#define BENCHMARK_CONCAT_INTERNAL(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_INTERNAL(a, b)
+
+#define REGISTER_BENCHMARK(szName, function) \
+  static const cBenchmarkRegistration BENCHMARK_CONCAT(benchmarkRegistration, __LINE__)(szName, function)
+
+
+// Stops the compiler from optimising away value or the calculation that produced it
+template <class T>
+inline void DoNotOptimize(T& value)
+{
+  asm volatile("" : "+r,m"(value) : : "memory");
+}
+
+template <class T>
+inline void DoNotOptimize(const T& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Forces the compiler to assume that all memory has been read and written, so pending stores have to happen
+inline void ClobberMemory()
+{
+  asm volatile("" : : : "memory");
+}
+
+
+typedef std::function<void(size_t iterations)> benchmark_function_t;
+
+// ** cBenchmarkSettings
+
+class cBenchmarkSettings
+{
+public:
+  cBenchmarkSettings();
+
+  durationms_t warmUpMS;       // How long to run the benchmark before measuring
+  durationms_t targetSampleMS; // How long each sample should take
+  size_t nSamples;
+  size_t nSamplesPerGroup;     // For the median of means
+  size_t nBootstrapResamples;
+  double confidenceLevel;      // From 0.0 to 1.0
+};
+
+
+// The calibration stops growing the iterations here, so a body that the optimiser removed doesn't loop forever
+const size_t MAX_ITERATIONS_PER_SAMPLE = 1000000000;
+
+
+// ** cBenchmarkResult
+
+class cBenchmarkResult
+{
+public:
+  cBenchmarkResult();
+
+  std::string sName;
+  bool bIsTooFast; // Even MAX_ITERATIONS_PER_SAMPLE iterations were too quick to time, the optimiser has probably removed the body, the statistics are all 0
+  size_t iterationsPerSample;
+  std::vector<double> samplesNSPerOperation;
+
+  double nsPerOperation; // The median of means
+  double confidenceIntervalLowNS;
+  double confidenceIntervalHighNS;
+  double minimumNSPerOperation;
+  double medianNSPerOperation;
+};
+
+// Runs one benchmark and returns the statistics
+cBenchmarkResult RunBenchmark(const std::string& sName, const benchmark_function_t& function, const cBenchmarkSettings& settings);
+
+void PrintBenchmarkResultsHeader(std::ostream& o);
+void PrintBenchmarkResult(std::ostream& o, const cBenchmarkResult& result);
+
+// Returns warnings about things that make benchmark results unreliable, such as the CPU frequency governor or turbo boost
+std::vector<std::string> GetBenchmarkEnvironmentWarnings();
+
+
+// ** Registered benchmarks
+
+class cBenchmarkRegistration
+{
+public:
+  cBenchmarkRegistration(const char* szName, const benchmark_function_t& function);
+};
+
+// Runs every registered benchmark whose name contains sFilter (All of them if sFilter is empty), prints the results and returns them
+std::vector<cBenchmarkResult> RunRegisteredBenchmarks(std::ostream& o, const std::string& sFilter, const cBenchmarkSettings& settings);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,81 @@
+#include <climits>
+
+#include <time.h>
+
+#include "deadline.h"
+
+namespace detail
+{
+  // Starts with no checks left so that the first GetCoarseTimeNS on each thread reads the clock
+  thread_local cCoarseClock coarseClock = { 0, 0 };
+}
+
+durationns_t RefreshCoarseClock()
+{
+  durationns_t now = 0;
+  if (GetClockSource() == CLOCK_SOURCE::STEADY_CLOCK) {
+    // The steady clock is CLOCK_MONOTONIC so the coarse version has the same time base
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (durationns_t(ts.tv_sec) * 1000000000) + durationns_t(ts.tv_nsec);
+  } else {
+    // Reading the TSC is already cheap
+    now = GetTimeNS();
+  }
+
+  detail::cCoarseClock& clock = detail::coarseClock;
+
+  // Never go backwards, GetTimeNS may have been used to create a deadline just after the coarse clock ticked
+  if (now > clock.now) clock.now = now;
+  clock.checksUntilRefresh = COARSE_CLOCK_CHECKS_PER_REFRESH;
+
+  return clock.now;
+}
+
+
+// ** cDeadline
+
+cDeadline::cDeadline() :
+  deadline(NEVER)
+{
+}
+
+cDeadline::cDeadline(durationns_t _deadline) :
+  deadline(_deadline)
+{
+}
+
+cDeadline::cDeadline(const cTimeOut& timeout) :
+  deadline(timeout.GetDeadlineNS())
+{
+}
+
+cDeadline cDeadline::NarrowNS(durationns_t timeout) const
+{
+  const durationns_t now = GetTimeNS();
+
+  // Avoid overflowing for very long timeouts
+  const durationns_t childDeadline = (timeout >= (NEVER - now)) ? NEVER : (now + timeout);
+  return cDeadline((childDeadline < deadline) ? childDeadline : deadline);
+}
+
+durationns_t cDeadline::GetRemainingNS() const
+{
+  const durationns_t now = GetTimeNS();
+  return (now < deadline) ? (deadline - now) : 0;
+}
+
+durationms_t cDeadline::GetRemainingMS() const
+{
+  return GetRemainingNS() / 1000000;
+}
+
+int cDeadline::GetPollTimeoutMS() const
+{
+  if (IsNever()) return -1;
+
+  // Round up so that we don't wake up just before the deadline and spin
+  const durationns_t remaining = GetRemainingNS();
+  const durationms_t remainingMS = (remaining / 1000000) + (((remaining % 1000000) != 0) ? 1 : 0);
+  return (remainingMS > durationms_t(INT_MAX)) ? INT_MAX : int(remainingMS);
+}
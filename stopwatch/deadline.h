@@ -0,0 +1,101 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <cstdint>
+
+#include "stopwatch.h"
+
+// ** Coarse clock
+//
+// A per thread cached time that is cheap enough to check on every iteration of a hot loop
+// It is refreshed every COARSE_CLOCK_CHECKS_PER_REFRESH checks, or explicitly with RefreshCoarseClock (For example once per loop)
+// With the steady clock it is refreshed from CLOCK_MONOTONIC_COARSE which is a vDSO read of the last timer tick, with the TSC it is refreshed from the TSC
+// The cached time lags behind the real time (By up to a timer tick, usually 1 to 4 ms, plus however long since it was refreshed) but it is never ahead
+
+const uint32_t COARSE_CLOCK_CHECKS_PER_REFRESH = 64;
+
+namespace detail
+{
+  struct cCoarseClock {
+    durationns_t now;
+    uint32_t checksUntilRefresh;
+  };
+
+  extern thread_local cCoarseClock coarseClock;
+}
+
+// Reads the clock and updates this thread's cached time, returns the new time
+durationns_t RefreshCoarseClock();
+
+// Returns this thread's cached time, refreshing it every COARSE_CLOCK_CHECKS_PER_REFRESH calls
+inline durationns_t GetCoarseTimeNS()
+{
+  detail::cCoarseClock& clock = detail::coarseClock;
+  if (clock.checksUntilRefresh == 0) return RefreshCoarseClock();
+
+  clock.checksUntilRefresh--;
+  return clock.now;
+}
+
+
+// ** cDeadline
+//
+// An absolute point in time (From GetTimeNS) that an operation and everything it calls has to finish by
+// Pass a cDeadline down the call chain instead of a number of milliseconds, each layer can narrow it for its own child operations but never extend it
+//
+//  bool HandleRequest(const cDeadline& deadline)
+//  {
+//    // Parsing gets at most 20 ms of whatever is left
+//    if (!Parse(deadline.Narrow(20))) return false;
+//
+//    while (!bDone) {
+//      if (deadline.IsExpiredCoarse()) return false;
+//      ...
+//    }
+//  }
+
+class cDeadline
+{
+public:
+  // A deadline that never expires
+  cDeadline();
+
+  // The same deadline as timeout
+  explicit cDeadline(const cTimeOut& timeout);
+
+  static cDeadline Never() { return cDeadline(); }
+  static cDeadline At(durationns_t deadline) { return cDeadline(deadline); }
+  static cDeadline FromNowMS(durationms_t timeout) { return cDeadline(GetTimeNS() + (timeout * 1000000)); }
+  static cDeadline FromNowNS(durationns_t timeout) { return cDeadline(GetTimeNS() + timeout); }
+
+  bool IsNever() const { return (deadline == NEVER); }
+  durationns_t GetDeadlineNS() const { return deadline; }
+
+  // Returns the earlier of this deadline and timeout from now, for a child operation that should take at most timeout
+  cDeadline Narrow(durationms_t timeout) const { return NarrowNS(timeout * 1000000); }
+  cDeadline NarrowNS(durationns_t timeout) const;
+  cDeadline Narrow(const cDeadline& rhs) const { return (rhs.deadline < deadline) ? rhs : *this; }
+
+  // Expired once the clock is past the deadline, the same as cTimeOut, so a deadline created from a timeout expires at the same time
+  bool IsExpired() const { return (GetTimeNS() > deadline); }
+  bool IsExpired(durationns_t now) const { return (now > deadline); }
+
+  // Uses this thread's cached coarse clock, this never reads the clock directly so it can be called on every iteration of a hot loop
+  // It can report that the deadline has expired a little late, but never early
+  bool IsExpiredCoarse() const { return (GetCoarseTimeNS() > deadline); }
+
+  durationns_t GetRemainingNS() const;
+  durationms_t GetRemainingMS() const;
+
+  // Returns the remaining time rounded up to a millisecond for epoll_wait and poll, -1 if the deadline never expires
+  int GetPollTimeoutMS() const;
+
+private:
+  static const durationns_t NEVER = UINT64_MAX;
+
+  explicit cDeadline(durationns_t deadline);
+
+  durationns_t deadline;
+};
+
+#endif // DEADLINE_H
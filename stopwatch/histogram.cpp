@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "histogram.h"
+
+cHDRHistogram::cHDRHistogram(uint64_t _lowestDiscernibleValue, uint64_t _highestTrackableValue, unsigned int _significantFigures) :
+  lowestDiscernibleValue(std::max<uint64_t>(_lowestDiscernibleValue, 1)),
+  highestTrackableValue(std::max(_highestTrackableValue, 2 * std::max<uint64_t>(_lowestDiscernibleValue, 1))),
+  significantFigures(std::min(std::max(_significantFigures, 1u), 5u)),
+  unitMagnitude(0),
+  subBucketHalfCountMagnitude(0),
+  subBucketCount(0),
+  subBucketHalfCount(0),
+  subBucketMask(0),
+  totalCount(0),
+  minimum(UINT64_MAX),
+  maximum(0)
+{
+  assert(_lowestDiscernibleValue >= 1);
+  assert(_highestTrackableValue >= 2 * _lowestDiscernibleValue);
+  assert((_significantFigures >= 1) && (_significantFigures <= 5));
+
+  // We need enough linear sub buckets to tell apart every value up to 2 * 10^significantFigures
+  uint64_t largestValueWithSingleUnitResolution = 2;
+  for (unsigned int i = 0; i < significantFigures; i++) largestValueWithSingleUnitResolution *= 10;
+
+  unsigned int subBucketCountMagnitude = 0;
+  while ((uint64_t(1) << subBucketCountMagnitude) < largestValueWithSingleUnitResolution) subBucketCountMagnitude++;
+
+  subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+  unitMagnitude = 63 - __builtin_clzll(lowestDiscernibleValue);
+  subBucketCount = size_t(1) << (subBucketHalfCountMagnitude + 1);
+  subBucketHalfCount = subBucketCount / 2;
+  subBucketMask = uint64_t(subBucketCount - 1) << unitMagnitude;
+
+  // Each bucket covers twice the range of the previous one, add buckets until we reach the highest value
+  size_t nBuckets = 1;
+  uint64_t smallestUntrackableValue = uint64_t(subBucketCount) << unitMagnitude;
+  while (smallestUntrackableValue <= highestTrackableValue) {
+    if (smallestUntrackableValue > (UINT64_MAX / 2)) {
+      nBuckets++;
+      break;
+    }
+    smallestUntrackableValue <<= 1;
+    nBuckets++;
+  }
+
+  counts.resize((nBuckets + 1) * subBucketHalfCount, 0);
+}
+
+void cHDRHistogram::Reset()
+{
+  std::fill(counts.begin(), counts.end(), 0);
+  totalCount = 0;
+  minimum = UINT64_MAX;
+  maximum = 0;
+}
+
+uint64_t cHDRHistogram::GetValueFromIndex(size_t index) const
+{
+  int bucketIndex = int(index >> subBucketHalfCountMagnitude) - 1;
+  size_t subBucketIndex = (index & (subBucketHalfCount - 1)) + subBucketHalfCount;
+  if (bucketIndex < 0) {
+    subBucketIndex -= subBucketHalfCount;
+    bucketIndex = 0;
+  }
+
+  return uint64_t(subBucketIndex) << (unsigned int)(bucketIndex + int(unitMagnitude));
+}
+
+uint64_t cHDRHistogram::GetHighestEquivalentValue(uint64_t value) const
+{
+  // Find the range of values that share a sub bucket with this one
+  const size_t index = GetCountsIndex(value);
+  const uint64_t lowestEquivalentValue = GetValueFromIndex(index);
+
+  const unsigned int pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask);
+  unsigned int bucketIndex = pow2Ceiling - unitMagnitude - (subBucketHalfCountMagnitude + 1);
+  const size_t subBucketIndex = size_t(value >> (bucketIndex + unitMagnitude));
+  if (subBucketIndex >= subBucketCount) bucketIndex++;
+
+  const uint64_t sizeOfEquivalentRange = uint64_t(1) << (unitMagnitude + bucketIndex);
+  return lowestEquivalentValue + sizeOfEquivalentRange - 1;
+}
+
+void cHDRHistogram::Merge(const cHDRHistogram& rhs)
+{
+  if (rhs.totalCount == 0) return;
+
+  const bool bSameLayout = (rhs.unitMagnitude == unitMagnitude) && (rhs.subBucketHalfCountMagnitude == subBucketHalfCountMagnitude) && (rhs.counts.size() <= counts.size());
+  if (bSameLayout) {
+    // The common case, every index means the same thing in both histograms
+    for (size_t i = 0; i < rhs.counts.size(); i++) counts[i] += rhs.counts[i];
+    totalCount += rhs.totalCount;
+    minimum = std::min(minimum, rhs.minimum);
+    maximum = std::max(maximum, rhs.maximum);
+    return;
+  }
+
+  // Otherwise record the value of each of rhs's sub buckets, the exact extremes are kept rather than the rounded sub bucket values
+  const uint64_t mergedMinimum = std::min(minimum, rhs.minimum);
+  const uint64_t mergedMaximum = std::max(maximum, rhs.maximum);
+
+  for (size_t i = 0; i < rhs.counts.size(); i++) {
+    if (rhs.counts[i] != 0) RecordCount(rhs.GetValueFromIndex(i), rhs.counts[i]);
+  }
+
+  minimum = mergedMinimum;
+  maximum = mergedMaximum;
+}
+
+double cHDRHistogram::GetMean() const
+{
+  if (totalCount == 0) return 0.0;
+
+  // Use the middle of each sub bucket
+  double total = 0.0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    if (counts[i] == 0) continue;
+
+    const uint64_t lowest = GetValueFromIndex(i);
+    const uint64_t highest = GetHighestEquivalentValue(lowest);
+    total += double(counts[i]) * ((double(lowest) + double(highest)) / 2.0);
+  }
+
+  return total / double(totalCount);
+}
+
+uint64_t cHDRHistogram::GetValueAtPercentile(double percentile) const
+{
+  if (totalCount == 0) return 0;
+
+  // The rank of the value we are looking for, at least 1 so that 0% is the first value
+  const double clampedPercentile = std::min(std::max(percentile, 0.0), 100.0);
+  uint64_t rank = uint64_t(((clampedPercentile / 100.0) * double(totalCount)) + 0.5);
+  if (rank == 0) rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if (seen >= rank) return std::max(std::min(GetHighestEquivalentValue(GetValueFromIndex(i)), maximum), minimum);
+  }
+
+  return maximum;
+}
+
+void cHDRHistogram::PrintPercentiles(std::ostream& o, double unitDivisor) const
+{
+  o<<std::fixed<<std::setprecision(3)
+    <<"count "<<totalCount
+    <<", min "<<(double(GetMin()) / unitDivisor)
+    <<", p50 "<<(double(GetValueAtPercentile(50.0)) / unitDivisor)
+    <<", p90 "<<(double(GetValueAtPercentile(90.0)) / unitDivisor)
+    <<", p99 "<<(double(GetValueAtPercentile(99.0)) / unitDivisor)
+    <<", p99.9 "<<(double(GetValueAtPercentile(99.9)) / unitDivisor)
+    <<", max "<<(double(GetMax()) / unitDivisor);
+}
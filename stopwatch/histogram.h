@@ -0,0 +1,100 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+#include <iostream>
+#include <vector>
+
+// ** cHDRHistogram
+//
+// A high dynamic range histogram, values from lowestDiscernibleValue to highestTrackableValue are recorded with significantFigures decimal digits of precision
+// For example 1 ns to 1 hour with 3 significant figures keeps every value to within 0.1% and uses about 270 KB
+// All the memory is allocated by the constructor, Record never allocates and is O(1)
+// Values above highestTrackableValue are recorded as highestTrackableValue, GetMax still returns the real maximum
+//
+// Each thread should record into its own histogram, histograms can then be combined with Merge
+// The layout follows Gil Tene's HdrHistogram, buckets double in size and each bucket is split into linear sub buckets
+
+class cHDRHistogram
+{
+public:
+  // lowestDiscernibleValue must be at least 1, significantFigures is from 1 to 5
+  cHDRHistogram(uint64_t lowestDiscernibleValue, uint64_t highestTrackableValue, unsigned int significantFigures);
+
+  void Record(uint64_t value);
+  void RecordCount(uint64_t value, uint64_t count);
+
+  // Adds every value recorded in rhs, rhs can have a different range and precision
+  void Merge(const cHDRHistogram& rhs);
+
+  void Reset();
+
+  uint64_t GetLowestDiscernibleValue() const { return lowestDiscernibleValue; }
+  uint64_t GetHighestTrackableValue() const { return highestTrackableValue; }
+  unsigned int GetSignificantFigures() const { return significantFigures; }
+  size_t GetMemoryUsageBytes() const { return sizeof(*this) + (counts.size() * sizeof(uint64_t)); }
+
+  uint64_t GetCount() const { return totalCount; }
+  uint64_t GetMin() const { return (totalCount != 0) ? minimum : 0; }
+  uint64_t GetMax() const { return maximum; }
+  double GetMean() const;
+
+  // percentile is from 0.0 to 100.0, returns the highest value that is equivalent to the value at that percentile (ie. it never under reports)
+  uint64_t GetValueAtPercentile(double percentile) const;
+
+  // Prints the count, min, p50, p90, p99, p99.9 and max on one line, values are divided by unitDivisor (eg. 1000 to print nanoseconds as microseconds)
+  void PrintPercentiles(std::ostream& o, double unitDivisor) const;
+
+private:
+  size_t GetCountsIndex(uint64_t value) const;
+  uint64_t GetValueFromIndex(size_t index) const;
+  uint64_t GetHighestEquivalentValue(uint64_t value) const;
+
+  uint64_t lowestDiscernibleValue;
+  uint64_t highestTrackableValue;
+  unsigned int significantFigures;
+
+  unsigned int unitMagnitude;
+  unsigned int subBucketHalfCountMagnitude;
+  size_t subBucketCount;
+  size_t subBucketHalfCount;
+  uint64_t subBucketMask;
+
+  uint64_t totalCount;
+  uint64_t minimum;
+  uint64_t maximum;
+  std::vector<uint64_t> counts;
+};
+
+
+// ** cHDRHistogram inlines
+
+inline size_t cHDRHistogram::GetCountsIndex(uint64_t value) const
+{
+  // The bucket is the position of the highest bit above the sub bucket range, the sub bucket is the bits below it
+  const unsigned int pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask);
+  const unsigned int bucketIndex = pow2Ceiling - unitMagnitude - (subBucketHalfCountMagnitude + 1);
+  const size_t subBucketIndex = size_t(value >> (bucketIndex + unitMagnitude));
+  return (size_t(bucketIndex + 1) << subBucketHalfCountMagnitude) + (subBucketIndex - subBucketHalfCount);
+}
+
+inline void cHDRHistogram::RecordCount(uint64_t value, uint64_t count)
+{
+  if (value < minimum) minimum = value;
+  if (value > maximum) maximum = value;
+
+  const size_t index = GetCountsIndex((value <= highestTrackableValue) ? value : highestTrackableValue);
+  assert(index < counts.size());
+  counts[index] += count;
+  totalCount += count;
+}
+
+inline void cHDRHistogram::Record(uint64_t value)
+{
+  RecordCount(value, 1);
+}
+
+#endif // HISTOGRAM_H
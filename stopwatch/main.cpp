@@ -2,158 +2,598 @@
 #include <cstdlib>
 #include <cstdio>
 
+#include <time.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <random>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "deadline.h"
+#include "histogram.h"
+#include "perfcounters.h"
+#include "profiler.h"
+#include "stopwatch.h"
+#include "timerwheel.h"
+#include "trace.h"
+
+// Calls readClock iterations times and returns the average time per call in nanoseconds
+template <class F>
+double MeasureClockOverheadNS(F readClock, size_t iterations)
+{
+  // Use the result so that the compiler can't remove the calls
+  volatile uint64_t sink = 0;
+  uint64_t total = 0;
 
-typedef uint64_t durationms_t;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-// Get the time since epoch in milliseconds
-durationms_t GetTimeMS()
-{
-  static const std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+  for (size_t i = 0; i < iterations; i++) total += uint64_t(readClock());
+
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-  const std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-  return std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+  sink = total;
+  (void)sink;
+
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(iterations);
 }
 
-void DurationToString(std::ostream& o, durationms_t duration)
+uint64_t ReadClockGetTime(clockid_t clock)
 {
-  o<<std::setfill('0')<<std::setw(2)<<((duration / 60000) % 3600)<<":"<<std::setfill('0')<<std::setw(2)<<((duration / 1000) % 60)<<":"<<std::setfill('0')<<std::setw(3)<<(duration % 1000);
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t(ts.tv_sec) * 1000000000) + ts.tv_nsec;
 }
 
+void PrintClockOverhead(const std::string& sName, double overheadNS)
+{
+  std::cout<<"  "<<std::left<<std::setfill(' ')<<std::setw(30)<<sName<<std::right<<std::fixed<<std::setprecision(2)<<std::setw(8)<<overheadNS<<" ns/call"<<std::endl;
+}
 
-// ** cStopWatch
-//
-// A stop watch that behaves like a real life stop watch, it has start, stop, reset and a total duration
+void RunClockBenchmark()
+{
+  const size_t iterations = 5000000;
+
+  std::cout<<"Invariant TSC: "<<(IsInvariantTSCSupported() ? "yes" : "no")<<std::endl;
+  std::cout<<"Clock overhead ("<<iterations<<" calls each):"<<std::endl;
+
+  PrintClockOverhead("std::chrono::system_clock", MeasureClockOverheadNS([]() { return std::chrono::system_clock::now().time_since_epoch().count(); }, iterations));
+  PrintClockOverhead("std::chrono::steady_clock", MeasureClockOverheadNS([]() { return std::chrono::steady_clock::now().time_since_epoch().count(); }, iterations));
+  PrintClockOverhead("CLOCK_MONOTONIC", MeasureClockOverheadNS([]() { return ReadClockGetTime(CLOCK_MONOTONIC); }, iterations));
+  PrintClockOverhead("CLOCK_MONOTONIC_RAW", MeasureClockOverheadNS([]() { return ReadClockGetTime(CLOCK_MONOTONIC_RAW); }, iterations));
+  PrintClockOverhead("CLOCK_MONOTONIC_COARSE", MeasureClockOverheadNS([]() { return ReadClockGetTime(CLOCK_MONOTONIC_COARSE); }, iterations));
 
-class cStopWatch
+  const CLOCK_SOURCE previousSource = GetClockSource();
+
+  const CLOCK_SOURCE sources[] = { CLOCK_SOURCE::STEADY_CLOCK, CLOCK_SOURCE::TSC, CLOCK_SOURCE::TSCP };
+  for (const CLOCK_SOURCE source : sources) {
+    const std::string sName = std::string("GetTimeNS (") + GetClockSourceName(source) + ")";
+    if (!SetClockSource(source)) {
+      std::cout<<"  "<<std::left<<std::setw(30)<<sName<<std::right<<" not supported"<<std::endl;
+      continue;
+    }
+
+    if (source == CLOCK_SOURCE::TSC) {
+      PrintClockOverhead("rdtsc", MeasureClockOverheadNS([]() { return detail::ReadTSC(); }, iterations));
+      PrintClockOverhead("rdtscp", MeasureClockOverheadNS([]() { return detail::ReadTSCP(); }, iterations));
+    }
+
+    PrintClockOverhead(sName, MeasureClockOverheadNS([]() { return GetTimeNS(); }, iterations));
+  }
+
+  if (GetTSCFrequencyHz() != 0) std::cout<<"Calibrated TSC frequency: "<<std::fixed<<std::setprecision(3)<<(double(GetTSCFrequencyHz()) / 1000000000.0)<<" GHz"<<std::endl;
+
+  SetClockSource(previousSource);
+}
+
+// A connection that owns a timeout
+class cSession : public cTimerWheelEntry
 {
 public:
-  cStopWatch();
+  uint64_t expectedTick;
+};
+
+double NSPerOperation(durationns_t duration, size_t operations)
+{
+  return (operations != 0) ? (double(duration) / double(operations)) : 0.0;
+}
+
+void BenchmarkTimerWheel(size_t nTimers)
+{
+  const durationns_t tickDuration = 1000000; // 1 ms
+  const uint64_t maxTimeoutTicks = 10000;    // Up to 10 seconds
 
-  void Start();
-  void Stop();
-  void Reset();
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<uint64_t> distribution(1, maxTimeoutTicks);
 
-  durationms_t GetTotalDurationMS() const;
+  std::vector<uint64_t> timeouts(nTimers);
+  for (size_t i = 0; i < nTimers; i++) timeouts[i] = distribution(rng);
 
-private:
-  bool running;
-  durationms_t started;
-  durationms_t totalDuration;
-};
+  // The wheel is driven by a simulated clock so that we measure the wheel and not how long we sleep for
+  cTimerWheel wheel(tickDuration, 0);
+  std::vector<cSession> sessions(nTimers);
+
+  durationns_t start = GetTimeNS();
+  for (size_t i = 0; i < nTimers; i++) {
+    sessions[i].expectedTick = timeouts[i];
+    wheel.ScheduleTicks(sessions[i], timeouts[i]);
+  }
+  const durationns_t scheduleDuration = GetTimeNS() - start;
+
+  // Resetting a timeout is the common case, a session gets some traffic and pushes its timeout back
+  start = GetTimeNS();
+  for (size_t i = 0; i < nTimers; i++) wheel.ScheduleTicks(sessions[i], timeouts[i]);
+  const durationns_t rescheduleDuration = GetTimeNS() - start;
+
+  size_t nFired = 0;
+  size_t nLate = 0;
+  start = GetTimeNS();
+  for (uint64_t tick = 0; tick <= maxTimeoutTicks; tick++) {
+    nFired += wheel.AdvanceToTick(tick, [&](cTimerWheelEntry& entry) {
+      if (static_cast<cSession&>(entry).expectedTick != tick) nLate++;
+    });
+  }
+  const durationns_t advanceDuration = GetTimeNS() - start;
+
+  for (size_t i = 0; i < nTimers; i++) wheel.ScheduleTicks(sessions[i], timeouts[i]);
+  start = GetTimeNS();
+  for (size_t i = 0; i < nTimers; i++) wheel.Cancel(sessions[i]);
+  const durationns_t cancelDuration = GetTimeNS() - start;
+
+  // The naive way, each session has a cTimeOut and we check all of them every tick
+  std::vector<cTimeOut> naive;
+  naive.reserve(nTimers);
+  for (size_t i = 0; i < nTimers; i++) naive.push_back(cTimeOut(timeouts[i]));
+
+  const size_t nNaiveTicks = 10;
+  size_t nNaiveExpired = 0;
+  start = GetTimeNS();
+  for (size_t tick = 0; tick < nNaiveTicks; tick++) {
+    for (const cTimeOut& timeout : naive) {
+      if (timeout.IsExpired()) nNaiveExpired++;
+    }
+  }
+  const durationns_t naiveDuration = GetTimeNS() - start;
+
+  std::cout<<std::setw(10)<<nTimers<<std::fixed<<std::setprecision(1)
+    <<std::setw(14)<<NSPerOperation(scheduleDuration, nTimers)
+    <<std::setw(14)<<NSPerOperation(rescheduleDuration, nTimers)
+    <<std::setw(12)<<NSPerOperation(cancelDuration, nTimers)
+    <<std::setw(16)<<NSPerOperation(advanceDuration, maxTimeoutTicks + 1)
+    <<std::setw(16)<<NSPerOperation(naiveDuration, nNaiveTicks)
+    <<"  "<<nFired<<"/"<<nTimers<<(nLate != 0 ? " FIRED ON THE WRONG TICK" : "")<<std::endl;
 
-cStopWatch::cStopWatch() :
-  running(false),
-  started(0),
-  totalDuration(0)
+  (void)nNaiveExpired;
+}
+
+void RunTimerWheelBenchmark(const std::vector<size_t>& counts)
 {
+  std::cout<<"Timer wheel (1 ms ticks, timeouts from 1 ms to 10 s) compared to checking every cTimeOut each tick"<<std::endl;
+  std::cout<<std::setw(10)<<"timers"<<std::setw(14)<<"schedule ns"<<std::setw(14)<<"reschedule ns"<<std::setw(12)<<"cancel ns"<<std::setw(16)<<"wheel ns/tick"<<std::setw(16)<<"naive ns/tick"<<"  fired"<<std::endl;
+
+  for (const size_t nTimers : counts) BenchmarkTimerWheel(nTimers);
 }
 
-void cStopWatch::Start()
+// Returns the average time per iteration in nanoseconds of a loop that enters one zone per iteration
+double MeasureProfileZoneOverheadNS(bool bWithZone)
 {
-  assert(!running);
+  const size_t nBatches = 100;
+  const size_t nIterationsPerBatch = 50000; // Less than the ring buffer size so that nothing is dropped
+
+  volatile uint64_t work = 0;
+  durationns_t total = 0;
+
+  for (size_t batch = 0; batch < nBatches; batch++) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (bWithZone) {
+      for (size_t i = 0; i < nIterationsPerBatch; i++) {
+        PROFILE_ZONE("benchmark");
+        work = work + 1;
+      }
+    } else {
+      for (size_t i = 0; i < nIterationsPerBatch; i++) {
+        work = work + 1;
+      }
+    }
+
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    total += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
 
-  // Started our stop watch
-  started = GetTimeMS();
+    // Drain outside of the timed section
+    cProfiler::Get().Collect();
+  }
 
-  running = true;
+  return double(total) / double(nBatches * nIterationsPerBatch);
 }
 
-void cStopWatch::Stop()
+void RunProfilerBenchmark()
 {
-  assert(running);
+  const CLOCK_SOURCE previousSource = GetClockSource();
+
+  // Make sure this thread's ring buffer is already allocated
+  GetProfileThreadBuffer();
 
-  // Get the time now
-  const durationms_t now = GetTimeMS();
+  const double baselineNS = MeasureProfileZoneOverheadNS(false);
+  std::cout<<"Profile zone overhead (Loop without a zone "<<std::fixed<<std::setprecision(2)<<baselineNS<<" ns/iteration):"<<std::endl;
 
-  // Add the duration for this period
-  totalDuration += now - started;
+  SetProfilingEnabled(false);
+  PrintClockOverhead("disabled", MeasureProfileZoneOverheadNS(true) - baselineNS);
+  SetProfilingEnabled(true);
 
-  // Reset our start time
-  started = 0;
+  const CLOCK_SOURCE sources[] = { CLOCK_SOURCE::STEADY_CLOCK, CLOCK_SOURCE::TSC, CLOCK_SOURCE::TSCP };
+  for (const CLOCK_SOURCE source : sources) {
+    const std::string sName = std::string("enabled (") + GetClockSourceName(source) + ")";
+    if (!SetClockSource(source)) {
+      std::cout<<"  "<<std::left<<std::setw(30)<<sName<<std::right<<" not supported"<<std::endl;
+      continue;
+    }
+
+    PrintClockOverhead(sName, MeasureProfileZoneOverheadNS(true) - baselineNS);
+  }
 
-  running = false;
+  SetClockSource(previousSource);
 }
 
-void cStopWatch::Reset()
+void ProfileDemoWorker(size_t index, size_t iterations, cTraceWriter* pTrace)
 {
-  started = 0;
-  totalDuration = 0;
+  if (pTrace != nullptr) pTrace->SetThreadName("worker " + std::to_string(index));
 
-  running = false;
+  for (size_t i = 0; i < iterations; i++) {
+    PROFILE_ZONE("worker");
+
+    {
+      PROFILE_ZONE("small job");
+      volatile uint64_t work = 0;
+      for (size_t j = 0; j < 100; j++) work = work + j;
+    }
+
+    if ((i % 10) == 0) {
+      PROFILE_ZONE("large job");
+      volatile uint64_t work = 0;
+      for (size_t j = 0; j < 10000; j++) work = work + j;
+    }
+
+    if ((pTrace != nullptr) && ((i % 10000) == 0)) pTrace->AddCounter("iterations " + std::to_string(index), int64_t(i));
+  }
+
+  if (pTrace != nullptr) pTrace->AddMark("worker finished");
 }
 
-durationms_t cStopWatch::GetTotalDurationMS() const
+void RunProfileDemo(cTraceWriter* pTrace)
 {
-  if (running) {
-    // Get the time now
-    const durationms_t now = GetTimeMS();
+  cProfiler& profiler = cProfiler::Get();
+  profiler.StartBackgroundThread(10);
+
+  if (pTrace != nullptr) pTrace->SetThreadName("main");
+
+  // A timeout that the workers are expected to finish inside
+  cTimeOut timeout(1000);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; i++) threads.push_back(std::thread(ProfileDemoWorker, i, 100000, pTrace));
+  for (std::thread& thread : threads) thread.join();
+
+  if (pTrace != nullptr) pTrace->AddTimeOut("workers timeout", timeout);
 
-    // Return the previous duration plus the duration of the current period
-    return totalDuration + (now - started);
+  profiler.StopBackgroundThread();
+  profiler.PrintReport(std::cout);
+}
+
+void LapDemoWorker(size_t iterations, cHDRHistogram& histogram)
+{
+  std::mt19937 generator(uint32_t(iterations + size_t(&histogram)));
+  std::exponential_distribution<double> workDistribution(1.0 / 2000.0);
+
+  cStopWatch stopWatch;
+  stopWatch.Start();
+
+  for (size_t i = 0; i < iterations; i++) {
+    // Mostly short requests with the occasional long one
+    const size_t work = size_t(workDistribution(generator));
+    volatile uint64_t sum = 0;
+    for (size_t j = 0; j < work; j++) sum = sum + j;
+
+    stopWatch.Lap(histogram);
   }
 
-  return totalDuration;
+  stopWatch.Stop();
 }
 
+void RunLapDemo()
+{
+  // 1 ns to 10 s with 3 significant figures
+  const uint64_t highestTrackableValue = 10000000000ull;
+  const size_t nThreads = 4;
+  const size_t nIterations = 200000;
+
+  // Each thread records into its own histogram, they are merged at the end
+  std::vector<cHDRHistogram> histograms(nThreads, cHDRHistogram(1, highestTrackableValue, 3));
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < nThreads; i++) threads.push_back(std::thread(LapDemoWorker, nIterations, std::ref(histograms[i])));
+  for (std::thread& thread : threads) thread.join();
+
+  cHDRHistogram merged(1, highestTrackableValue, 3);
+  for (size_t i = 0; i < nThreads; i++) {
+    std::cout<<"Thread "<<i<<" lap us: ";
+    histograms[i].PrintPercentiles(std::cout, 1000.0);
+    std::cout<<std::endl;
 
+    merged.Merge(histograms[i]);
+  }
 
+  std::cout<<"Merged lap us: ";
+  merged.PrintPercentiles(std::cout, 1000.0);
+  std::cout<<std::endl;
+  std::cout<<"Each histogram uses "<<merged.GetMemoryUsageBytes()<<" bytes"<<std::endl;
 
+  // How long does recording a lap take?
+  cHDRHistogram overhead(1, highestTrackableValue, 3);
+  cStopWatch stopWatch;
+  stopWatch.Start();
+  const durationns_t start = GetTimeNS();
+  for (size_t i = 0; i < nIterations; i++) stopWatch.Lap(overhead);
+  const durationns_t duration = GetTimeNS() - start;
+  std::cout<<"cStopWatch::Lap with a histogram takes "<<std::fixed<<std::setprecision(1)<<NSPerOperation(duration, nIterations)<<" ns"<<std::endl;
+}
 
-// ** cTimeOut
-//
-// For use in a loop for example to work out when we something has expired
+// Runs work with the stop watch and the counters and prints the time and counters
+template <class F>
+void MeasureWithPerfCounters(const std::string& sName, cPerfCounters& counters, F work)
+{
+  cStopWatch stopWatch;
+  if (counters.IsValid()) stopWatch.SetPerfCounters(&counters);
 
-class cTimeOut {
-public:
-  explicit cTimeOut(durationms_t timeout);
+  stopWatch.Reset();
+  stopWatch.Start();
+  const uint64_t result = work();
+  stopWatch.Stop();
 
-  void Reset();
+  std::cout<<std::left<<std::setw(22)<<sName<<std::right<<std::fixed<<std::setprecision(3)<<std::setw(10)<<(double(stopWatch.GetTotalDurationNS()) / 1000000.0)<<" ms";
 
-  bool IsExpired() const;
+  cPerfCounterValues values;
+  if (counters.Read(values)) {
+    std::cout<<", ";
+    PrintPerfCounters(std::cout, values);
+  }
 
-  durationms_t GetRemainingMS() const;
+  std::cout<<" (result "<<result<<")"<<std::endl;
+}
 
-private:
-  const durationms_t timeout;
-  durationms_t startTime;
-};
+void RunPerfCountersDemo()
+{
+  cPerfCounters counters;
+  if (!counters.Open()) std::cout<<"Performance counters are not available ("<<counters.GetError()<<"), only reporting the time"<<std::endl;
+  else if (!counters.GetError().empty()) std::cout<<"Some performance counters are not available ("<<counters.GetError()<<")"<<std::endl;
+
+  const size_t n = 16 * 1024 * 1024;
+  std::vector<uint32_t> values(n);
+  std::mt19937 generator(1234);
+  for (size_t i = 0; i < n; i++) values[i] = generator();
+
+  // A random cycle through the array for the pointer chase
+  std::vector<uint32_t> next(n);
+  {
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = uint32_t(i);
+    std::shuffle(order.begin(), order.end(), generator);
+    for (size_t i = 0; i < n; i++) next[order[i]] = order[(i + 1) % n];
+  }
+
+  MeasureWithPerfCounters("sequential sum", counters, [&values]() {
+    uint64_t sum = 0;
+    for (const uint32_t value : values) sum += value;
+    return sum;
+  });
+
+  MeasureWithPerfCounters("unpredictable branch", counters, [&values]() {
+    uint64_t count = 0;
+    for (const uint32_t value : values) {
+      if ((value & 1) != 0) count += value >> 8;
+      else count ^= value;
+    }
+    return count;
+  });
+
+  MeasureWithPerfCounters("pointer chase", counters, [&next]() {
+    uint32_t index = 0;
+    for (size_t i = 0; i < (4 * 1024 * 1024); i++) index = next[index];
+    return uint64_t(index);
+  });
+
+  MeasureWithPerfCounters("sleep 10 ms", counters, []() {
+    usleep(10000);
+    return uint64_t(0);
+  });
+}
+
+// ** Benchmarks for the benchmark runner
+
+void BenchmarkGetTimeNS(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++) {
+    const durationns_t now = GetTimeNS();
+    DoNotOptimize(now);
+  }
+}
+REGISTER_BENCHMARK("GetTimeNS", BenchmarkGetTimeNS);
+
+void BenchmarkTimeOutIsExpired(size_t iterations)
+{
+  const cTimeOut timeout(1000);
+  for (size_t i = 0; i < iterations; i++) {
+    const bool bExpired = timeout.IsExpired();
+    DoNotOptimize(bExpired);
+  }
+}
+REGISTER_BENCHMARK("cTimeOut::IsExpired", BenchmarkTimeOutIsExpired);
 
-cTimeOut::cTimeOut(durationms_t _timeout) :
-  timeout(_timeout),
-  startTime(GetTimeMS())
+void BenchmarkStopWatchLap(size_t iterations)
 {
+  static cHDRHistogram histogram(1, 10000000000ull, 3);
+  cStopWatch stopWatch;
+  stopWatch.Start();
+  for (size_t i = 0; i < iterations; i++) stopWatch.Lap(histogram);
+  stopWatch.Stop();
 }
+REGISTER_BENCHMARK("cStopWatch::Lap with histogram", BenchmarkStopWatchLap);
 
-void cTimeOut::Reset()
+void BenchmarkHDRHistogramRecord(size_t iterations)
 {
-  startTime = GetTimeMS();
+  static cHDRHistogram histogram(1, 10000000000ull, 3);
+  uint64_t value = 1;
+  for (size_t i = 0; i < iterations; i++) {
+    // A cheap pseudo random spread of values
+    value = (value * 6364136223846793005ull) + 1442695040888963407ull;
+    histogram.Record(value >> 34);
+  }
+  ClobberMemory();
 }
+REGISTER_BENCHMARK("cHDRHistogram::Record", BenchmarkHDRHistogramRecord);
 
-bool cTimeOut::IsExpired() const
+void BenchmarkTimerWheelScheduleCancel(size_t iterations)
 {
-  return ((GetTimeMS() - startTime) > timeout);
+  cTimerWheel wheel(1000000, GetTimeNS());
+  cSession session;
+  for (size_t i = 0; i < iterations; i++) {
+    wheel.ScheduleTicks(session, 1 + (i & 0xFFFF));
+    wheel.Cancel(session);
+  }
 }
+REGISTER_BENCHMARK("cTimerWheel schedule and cancel", BenchmarkTimerWheelScheduleCancel);
 
-durationms_t cTimeOut::GetRemainingMS() const
+void BenchmarkDeadlineIsExpired(size_t iterations)
 {
-  // Get the total time this timeout uhas been running for so far
-  const int64_t duration = int64_t(GetTimeMS()) - int64_t(startTime);
+  const cDeadline deadline = cDeadline::FromNowMS(1000);
+  for (size_t i = 0; i < iterations; i++) {
+    const bool bExpired = deadline.IsExpired();
+    DoNotOptimize(bExpired);
+  }
+}
+REGISTER_BENCHMARK("cDeadline::IsExpired", BenchmarkDeadlineIsExpired);
 
-  // Calculate the remaining time
-  const int64_t remaining = (int64_t(timeout) - duration);
+void BenchmarkDeadlineIsExpiredCoarse(size_t iterations)
+{
+  const cDeadline deadline = cDeadline::FromNowMS(1000);
+  for (size_t i = 0; i < iterations; i++) {
+    const bool bExpired = deadline.IsExpiredCoarse();
+    DoNotOptimize(bExpired);
+  }
+}
+REGISTER_BENCHMARK("cDeadline::IsExpiredCoarse", BenchmarkDeadlineIsExpiredCoarse);
 
-  // Return the remaining time if there is any left
-  return (remaining >= 0) ? remaining : 0;
+// A child operation that spins until its deadline, checking it on every iteration, returns the number of iterations
+uint64_t DeadlineDemoStage(const cDeadline& deadline)
+{
+  uint64_t iterations = 0;
+  volatile uint64_t work = 0;
+  while (!deadline.IsExpiredCoarse()) {
+    work = work + iterations;
+    iterations++;
+  }
+
+  return iterations;
 }
 
+void RunDeadlineDemo()
+{
+  // The whole request has 100 ms, the first stage gets at most 30 ms of that and the second stage gets whatever is left
+  const cTimeOut requestTimeout(100);
+  const cDeadline deadline(requestTimeout);
+
+  const cDeadline firstStageDeadline = deadline.Narrow(30);
+  const uint64_t firstStageIterations = DeadlineDemoStage(firstStageDeadline);
+  const durationns_t firstStageLateNS = GetTimeNS() - firstStageDeadline.GetDeadlineNS();
+
+  // Asking for more time than is left doesn't extend the deadline
+  const cDeadline secondStageDeadline = deadline.Narrow(1000);
+  const uint64_t secondStageIterations = DeadlineDemoStage(secondStageDeadline);
+  const durationns_t secondStageLateNS = GetTimeNS() - secondStageDeadline.GetDeadlineNS();
+
+  std::cout<<"First stage checked its deadline "<<firstStageIterations<<" times and finished "<<(firstStageLateNS / 1000)<<" us after it"<<std::endl;
+  std::cout<<"Second stage checked its deadline "<<secondStageIterations<<" times and finished "<<(secondStageLateNS / 1000)<<" us after it"<<std::endl;
+  std::cout<<"Request timeout "<<(requestTimeout.IsExpired() ? "expired" : "not expired")<<", the second stage deadline was "<<(secondStageDeadline.GetDeadlineNS() == deadline.GetDeadlineNS() ? "the request deadline" : "narrowed")<<std::endl;
+}
 
-int main(int argc, char* argv[])
+void PrintStatus(const cStopWatch& stopWatch, const cTimeOut& timeout)
+{
+  // Print out some debug information about the stop watch and time out
+  const durationns_t now = GetTimeNS();
+  std::cout<<"Stop watch time: ";
+  DurationToString(std::cout, stopWatch.GetTotalDurationMS());
+  std::cout<<", Timeout: "<<(timeout.IsExpired(now) ? "expired" : "not expired")<<", remaining: ";
+  DurationToString(std::cout, timeout.GetRemainingNS(now) / 1000000);
+  std::cout<<std::endl;
+}
+
+// Each worker registers new zones and enters them straight away while another thread keeps collecting
+void ProfilerTestWorker(size_t index, size_t nZones, size_t iterations)
+{
+  for (size_t i = 0; i < nZones; i++) {
+    const cProfileZone zone(("test zone " + std::to_string(index) + " " + std::to_string(i)).c_str());
+    for (size_t j = 0; j < iterations; j++) {
+      const cScopedProfileZone scopedZone(zone);
+    }
+  }
+}
+
+bool RunProfilerTest()
+{
+  const size_t nThreads = 8;
+  const size_t nZones = 200;
+  const size_t iterations = 10;
+
+  cProfiler& profiler = cProfiler::Get();
+
+  std::atomic<bool> bStopCollecting(false);
+  std::thread collector([&profiler, &bStopCollecting]() {
+    while (!bStopCollecting.load()) profiler.Collect();
+  });
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < nThreads; i++) threads.push_back(std::thread(ProfilerTestWorker, i, nZones, iterations));
+  for (std::thread& thread : threads) thread.join();
+
+  bStopCollecting = true;
+  collector.join();
+  profiler.Collect();
+
+  if (profiler.GetDroppedCount() != 0) {
+    std::cout<<"RunProfilerTest dropped zones FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  size_t nTestZones = 0;
+  for (const cProfileZoneStatistics& zone : profiler.GetStatistics()) {
+    if (zone.sName.find("test zone ") != 0) continue;
+
+    if (zone.count != iterations) {
+      std::cout<<"RunProfilerTest "<<zone.sName<<" count "<<zone.count<<" FAILED, returning false"<<std::endl;
+      return false;
+    }
+
+    nTestZones++;
+  }
+
+  if (nTestZones != nThreads * nZones) {
+    std::cout<<"RunProfilerTest zones registered while collecting FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool RunDemo(cTraceWriter* pTrace)
 {
   // Just a little test of the stop watch and timeout
 
@@ -162,39 +602,216 @@ int main(int argc, char* argv[])
   // Create a 5 second time out
   cTimeOut timeout(5000);
 
+  // The time out and a timer to print the status every 200 milliseconds are both waited on with epoll, an application would add its sockets and pipes to the same epoll set
+  cTimerFD timeoutTimer;
+  cTimerFD statusTimer;
+  const int epollfd = epoll_create1(EPOLL_CLOEXEC);
+  if (!timeoutTimer.IsValid() || !statusTimer.IsValid() || (epollfd < 0)) {
+    std::cerr<<"RunDemo Failed to create the timers"<<std::endl;
+    if (epollfd >= 0) close(epollfd);
+    return false;
+  }
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = timeoutTimer.GetFD();
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, timeoutTimer.GetFD(), &event);
+  event.data.fd = statusTimer.GetFD();
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, statusTimer.GetFD(), &event);
+
   // Run through 3 5 second time outs
   for (size_t i = 0; i < 3; i++) {
     // Start a new time out
     timeout.Reset();
+    timeoutTimer.Arm(timeout);
+    statusTimer.ArmInterval(200000000);
 
     // Start the stop watch
     stopWatch.Start();
 
-    // Wait until the time out is expired
-    while (!timeout.IsExpired()) {
-      // Print out some debug information about the stop watch and time out
-      std::cout<<"Stop watch time: ";
-      DurationToString(std::cout, stopWatch.GetTotalDurationMS());
-      std::cout<<", Timeout: "<<(timeout.IsExpired() ? "expired" : "not expired")<<", remaining: ";
-      DurationToString(std::cout, timeout.GetRemainingMS());
-      std::cout<<std::endl;
-
-      // Sleep for 200 milliseconds (Avoids hogging the CPU and we don't have to update that frequently
-      const uint64_t timeout_ms = 200;
-      ::usleep(timeout_ms * 1000);
+    PrintStatus(stopWatch, timeout);
+
+    // Wait until the time out is expired, we only wake up when one of the timers fires
+    bool bExpired = false;
+    while (!bExpired) {
+      struct epoll_event events[2];
+      const int n = epoll_wait(epollfd, events, 2, -1);
+      for (int iEvent = 0; iEvent < n; iEvent++) {
+        if (events[iEvent].data.fd == timeoutTimer.GetFD()) {
+          if (timeoutTimer.Acknowledge() != 0) bExpired = true;
+        } else if (statusTimer.Acknowledge() != 0) {
+          PrintStatus(stopWatch, timeout);
+          if (pTrace != nullptr) pTrace->AddMark("status");
+        }
+      }
     }
 
     // Stop the stop watch
     stopWatch.Stop();
+    statusTimer.Disarm();
+
+    if (pTrace != nullptr) {
+      pTrace->AddTimeOut("timeout " + std::to_string(i), timeout);
+      pTrace->AddCounter("stop watch ms", int64_t(stopWatch.GetTotalDurationMS()));
+    }
 
     // Print out some debug information about the stop watch and time out
-    std::cout<<"Stop watch time: ";
-    DurationToString(std::cout, stopWatch.GetTotalDurationMS());
-    std::cout<<", Timeout: "<<(timeout.IsExpired() ? "expired" : "not expired")<<", remaining: ";
-    DurationToString(std::cout, timeout.GetRemainingMS());
-    std::cout<<std::endl;
+    const durationns_t lateNS = GetTimeNS() - timeout.GetDeadlineNS();
+    PrintStatus(stopWatch, timeout);
+    std::cout<<"Woke up "<<(lateNS / 1000)<<" us after the deadline"<<std::endl;
     std::cout<<std::endl;
   }
 
-  return EXIT_SUCCESS;
+  close(epollfd);
+
+  // Wait can be used when there is nothing else to do
+  timeout.Reset();
+  timeout.Wait();
+  std::cout<<"cTimeOut::Wait woke up "<<((GetTimeNS() - timeout.GetDeadlineNS()) / 1000)<<" us after the deadline"<<std::endl;
+
+  return true;
+}
+
+void PrintUsage(const std::string& sExecutableName)
+{
+  std::cout<<"Usage: "<<sExecutableName<<" [--clock steady_clock|rdtsc|rdtscp] [--benchmark-clocks] [--benchmark-timer-wheel [COUNT...]] [--benchmark-profiler] [--profile-demo] [--lap-demo] [--perf-counters] [--benchmark [FILTER]] [--deadline-demo] [--test-profiler] [--trace FILE]"<<std::endl;
+  std::cout<<"Runs a little test of the stop watch and timeout"<<std::endl;
+  std::cout<<"  --clock SOURCE: Select the clock source used for timing"<<std::endl;
+  std::cout<<"  --benchmark-clocks: Print the overhead of reading each clock source instead of running the test"<<std::endl;
+  std::cout<<"  --benchmark-timer-wheel: Compare the timer wheel against checking each cTimeOut for COUNT timers (Default 10000, 1000000 and 10000000)"<<std::endl;
+  std::cout<<"  --benchmark-profiler: Print the overhead of a PROFILE_ZONE with each clock source"<<std::endl;
+  std::cout<<"  --profile-demo: Profile some work on several threads and print the report"<<std::endl;
+  std::cout<<"  --lap-demo: Time laps on several threads and print the percentiles of each thread and all of them merged"<<std::endl;
+  std::cout<<"  --perf-counters: Time some workloads with the hardware performance counters (Just the time if perf is not available)"<<std::endl;
+  std::cout<<"  --benchmark: Run the registered micro benchmarks, or just the ones with FILTER in their name"<<std::endl;
+  std::cout<<"  --deadline-demo: Split a deadline between two stages that check it with the coarse clock on every iteration"<<std::endl;
+  std::cout<<"  --test-profiler: Check that zones registered on several threads while another thread collects are all counted"<<std::endl;
+  std::cout<<"  --trace FILE: Write the profiling zones, marks, timeouts and counters from the test or the profile demo to FILE in the Chrome trace_event format"<<std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  bool bBenchmarkClocks = false;
+  bool bBenchmarkTimerWheel = false;
+  bool bBenchmarkProfiler = false;
+  bool bProfileDemo = false;
+  bool bLapDemo = false;
+  bool bPerfCountersDemo = false;
+  bool bBenchmark = false;
+  bool bDeadlineDemo = false;
+  bool bTestProfiler = false;
+  std::string sBenchmarkFilter;
+  std::vector<size_t> timerWheelCounts;
+  std::string sTraceFilePath;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string sArgument(argv[i]);
+
+    if ((sArgument == "--clock") && ((i + 1) < argc)) {
+      i++;
+      const std::string sSource(argv[i]);
+
+      CLOCK_SOURCE source = CLOCK_SOURCE::STEADY_CLOCK;
+      if (sSource == GetClockSourceName(CLOCK_SOURCE::TSC)) source = CLOCK_SOURCE::TSC;
+      else if (sSource == GetClockSourceName(CLOCK_SOURCE::TSCP)) source = CLOCK_SOURCE::TSCP;
+      else if (sSource != GetClockSourceName(CLOCK_SOURCE::STEADY_CLOCK)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (!SetClockSource(source)) {
+        std::cerr<<"Clock source "<<sSource<<" is not supported on this machine"<<std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (sArgument == "--benchmark-clocks") bBenchmarkClocks = true;
+    else if (sArgument == "--benchmark-profiler") bBenchmarkProfiler = true;
+    else if (sArgument == "--profile-demo") bProfileDemo = true;
+    else if (sArgument == "--lap-demo") bLapDemo = true;
+    else if (sArgument == "--perf-counters") bPerfCountersDemo = true;
+    else if (sArgument == "--deadline-demo") bDeadlineDemo = true;
+    else if (sArgument == "--test-profiler") bTestProfiler = true;
+    else if (sArgument == "--benchmark") {
+      bBenchmark = true;
+
+      // Read the filter if there is one
+      if (((i + 1) < argc) && (argv[i + 1][0] != '-')) {
+        i++;
+        sBenchmarkFilter = argv[i];
+      }
+    }
+    else if ((sArgument == "--trace") && ((i + 1) < argc)) {
+      i++;
+      sTraceFilePath = argv[i];
+    }
+    else if (sArgument == "--benchmark-timer-wheel") {
+      bBenchmarkTimerWheel = true;
+
+      // Read any counts that follow
+      while (((i + 1) < argc) && (argv[i + 1][0] >= '0') && (argv[i + 1][0] <= '9')) {
+        i++;
+        timerWheelCounts.push_back(std::stoul(argv[i]));
+      }
+    }
+    else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (bBenchmarkClocks) {
+    RunClockBenchmark();
+    return EXIT_SUCCESS;
+  }
+
+  if (bBenchmarkTimerWheel) {
+    if (timerWheelCounts.empty()) timerWheelCounts = { 10000, 1000000, 10000000 };
+    RunTimerWheelBenchmark(timerWheelCounts);
+    return EXIT_SUCCESS;
+  }
+
+  if (bBenchmarkProfiler) {
+    RunProfilerBenchmark();
+    return EXIT_SUCCESS;
+  }
+
+  if (bLapDemo) {
+    RunLapDemo();
+    return EXIT_SUCCESS;
+  }
+
+  if (bBenchmark) {
+    RunRegisteredBenchmarks(std::cout, sBenchmarkFilter, cBenchmarkSettings());
+    return EXIT_SUCCESS;
+  }
+
+  if (bDeadlineDemo) {
+    RunDeadlineDemo();
+    return EXIT_SUCCESS;
+  }
+
+  if (bTestProfiler) {
+    const bool bIsSuccess = RunProfilerTest();
+    std::cout<<"Tests "<<(bIsSuccess ? "Passed" : "Failed")<<std::endl;
+    return bIsSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (bPerfCountersDemo) {
+    RunPerfCountersDemo();
+    return EXIT_SUCCESS;
+  }
+
+  cTraceWriter trace;
+  if (!sTraceFilePath.empty() && !trace.Open(sTraceFilePath, 100)) {
+    std::cerr<<"Failed to create the trace file "<<sTraceFilePath<<std::endl;
+    return EXIT_FAILURE;
+  }
+  cTraceWriter* pTrace = trace.IsOpen() ? &trace : nullptr;
+
+  bool bResult = true;
+  if (bProfileDemo) RunProfileDemo(pTrace);
+  else bResult = RunDemo(pTrace);
+
+  trace.Close();
+
+  return bResult ? EXIT_SUCCESS : EXIT_FAILURE;
 }
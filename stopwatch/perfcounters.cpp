@@ -0,0 +1,223 @@
+#include <cerrno>
+#include <cstring>
+
+#include <iomanip>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfcounters.h"
+
+namespace
+{
+  struct cPerfCounterType {
+    uint32_t type;
+    uint64_t config;
+  };
+
+  const cPerfCounterType PERF_COUNTER_TYPES[PERF_COUNTER_COUNT] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  };
+
+  int PerfEventOpen(struct perf_event_attr& attr, int groupFD)
+  {
+    // Measure the calling thread on any CPU
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, groupFD, PERF_FLAG_FD_CLOEXEC));
+  }
+}
+
+const char* GetPerfCounterName(PERF_COUNTER counter)
+{
+  switch (counter) {
+    case PERF_COUNTER::CYCLES: return "cycles";
+    case PERF_COUNTER::INSTRUCTIONS: return "instructions";
+    case PERF_COUNTER::CACHE_MISSES: return "cache-misses";
+    case PERF_COUNTER::BRANCH_MISSES: return "branch-misses";
+    case PERF_COUNTER::CONTEXT_SWITCHES: return "context-switches";
+    default: return "unknown";
+  }
+}
+
+
+// ** cPerfCounterValues
+
+cPerfCounterValues::cPerfCounterValues() :
+  bMultiplexed(false)
+{
+  for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+    bAvailable[i] = false;
+    values[i] = 0;
+  }
+}
+
+double cPerfCounterValues::GetInstructionsPerCycle() const
+{
+  if (!IsAvailable(PERF_COUNTER::CYCLES) || !IsAvailable(PERF_COUNTER::INSTRUCTIONS) || (GetValue(PERF_COUNTER::CYCLES) == 0)) return 0.0;
+
+  return double(GetValue(PERF_COUNTER::INSTRUCTIONS)) / double(GetValue(PERF_COUNTER::CYCLES));
+}
+
+double cPerfCounterValues::GetPerThousandInstructions(PERF_COUNTER counter) const
+{
+  if (!IsAvailable(counter) || !IsAvailable(PERF_COUNTER::INSTRUCTIONS) || (GetValue(PERF_COUNTER::INSTRUCTIONS) == 0)) return 0.0;
+
+  return (1000.0 * double(GetValue(counter))) / double(GetValue(PERF_COUNTER::INSTRUCTIONS));
+}
+
+void PrintPerfCounters(std::ostream& o, const cPerfCounterValues& values)
+{
+  bool bFirst = true;
+  for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+    if (!values.bAvailable[i]) continue;
+
+    if (!bFirst) o<<", ";
+    bFirst = false;
+
+    o<<GetPerfCounterName(PERF_COUNTER(i))<<" "<<values.values[i];
+  }
+
+  if (bFirst) {
+    o<<"no counters";
+    return;
+  }
+
+  o<<std::fixed<<std::setprecision(2);
+  if (values.IsAvailable(PERF_COUNTER::CYCLES) && values.IsAvailable(PERF_COUNTER::INSTRUCTIONS)) o<<", IPC "<<values.GetInstructionsPerCycle();
+  if (values.IsAvailable(PERF_COUNTER::CACHE_MISSES) && values.IsAvailable(PERF_COUNTER::INSTRUCTIONS)) o<<", cache-misses/1k instructions "<<values.GetPerThousandInstructions(PERF_COUNTER::CACHE_MISSES);
+  if (values.IsAvailable(PERF_COUNTER::BRANCH_MISSES) && values.IsAvailable(PERF_COUNTER::INSTRUCTIONS)) o<<", branch-misses/1k instructions "<<values.GetPerThousandInstructions(PERF_COUNTER::BRANCH_MISSES);
+  if (values.bMultiplexed) o<<" (scaled, the counters were multiplexed)";
+}
+
+
+// ** cPerfCounters
+
+cPerfCounters::cPerfCounters() :
+  leaderFD(-1)
+{
+  for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+    fds[i] = -1;
+    ids[i] = 0;
+  }
+}
+
+cPerfCounters::~cPerfCounters()
+{
+  Close();
+}
+
+bool cPerfCounters::Open()
+{
+  Close();
+
+  for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_COUNTER_TYPES[i].type;
+    attr.config = PERF_COUNTER_TYPES[i].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_hv = 1;
+
+    // Context switches happen in the kernel so only exclude the kernel from the hardware counters
+    attr.exclude_kernel = (attr.type == PERF_TYPE_HARDWARE) ? 1 : 0;
+
+    // The first counter that opens leads the group, it starts disabled and the others follow it
+    attr.disabled = (leaderFD == -1) ? 1 : 0;
+
+    int fd = PerfEventOpen(attr, leaderFD);
+    if ((fd == -1) && (errno == EACCES) && (attr.exclude_kernel == 0)) {
+      // perf_event_paranoid 2 doesn't let unprivileged users count in the kernel
+      attr.exclude_kernel = 1;
+      fd = PerfEventOpen(attr, leaderFD);
+    }
+
+    if (fd == -1) {
+      // Keep going, a virtual machine may not have a PMU but the software counters still work
+      if (sError.empty()) sError = std::string(GetPerfCounterName(PERF_COUNTER(i))) + ": " + strerror(errno);
+      continue;
+    }
+
+    if (ioctl(fd, PERF_EVENT_IOC_ID, &ids[i]) == -1) {
+      close(fd);
+      continue;
+    }
+
+    fds[i] = fd;
+    if (leaderFD == -1) leaderFD = fd;
+  }
+
+  return IsValid();
+}
+
+void cPerfCounters::Close()
+{
+  // Close the leader last
+  for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+    if ((fds[i] != -1) && (fds[i] != leaderFD)) close(fds[i]);
+    fds[i] = -1;
+    ids[i] = 0;
+  }
+
+  if (leaderFD != -1) {
+    close(leaderFD);
+    leaderFD = -1;
+  }
+
+  sError.clear();
+}
+
+void cPerfCounters::Reset()
+{
+  if (leaderFD != -1) ioctl(leaderFD, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void cPerfCounters::Enable()
+{
+  if (leaderFD != -1) ioctl(leaderFD, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void cPerfCounters::Disable()
+{
+  if (leaderFD != -1) ioctl(leaderFD, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool cPerfCounters::Read(cPerfCounterValues& values) const
+{
+  values = cPerfCounterValues();
+  if (leaderFD == -1) return false;
+
+  // nr, time_enabled, time_running and then a value and id for each counter
+  uint64_t buffer[3 + (2 * PERF_COUNTER_COUNT)];
+  const ssize_t nBytes = read(leaderFD, buffer, sizeof(buffer));
+  if (nBytes < ssize_t(3 * sizeof(uint64_t))) return false;
+
+  const uint64_t nCounters = buffer[0];
+  const uint64_t timeEnabled = buffer[1];
+  const uint64_t timeRunning = buffer[2];
+  if ((nCounters > PERF_COUNTER_COUNT) || (size_t(nBytes) < ((3 + (2 * nCounters)) * sizeof(uint64_t)))) return false;
+
+  values.bMultiplexed = (timeRunning != 0) && (timeRunning < timeEnabled);
+
+  for (uint64_t i = 0; i < nCounters; i++) {
+    uint64_t value = buffer[3 + (2 * i)];
+    const uint64_t id = buffer[3 + (2 * i) + 1];
+
+    if (values.bMultiplexed) value = uint64_t((double(value) * double(timeEnabled)) / double(timeRunning));
+
+    for (size_t counter = 0; counter < PERF_COUNTER_COUNT; counter++) {
+      if ((fds[counter] != -1) && (ids[counter] == id)) {
+        values.bAvailable[counter] = true;
+        values.values[counter] = value;
+        break;
+      }
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <iostream>
+#include <string>
+
+// ** cPerfCounters
+//
+// A group of hardware and software counters opened with perf_event_open, they are scheduled onto the PMU together and read with a single read()
+// Only the calling thread is counted, and the hardware counters only count user space so that this works with the default perf_event_paranoid setting
+//
+// perf is often unavailable in containers and virtual machines, Open opens whichever counters it can and IsValid is false if there aren't any
+// Callers should then just report the time
+// If the kernel has to multiplex the counters the values are scaled up by how long the group was actually running
+
+enum class PERF_COUNTER {
+  CYCLES,
+  INSTRUCTIONS,
+  CACHE_MISSES,
+  BRANCH_MISSES,
+  CONTEXT_SWITCHES,
+
+  COUNT
+};
+
+const size_t PERF_COUNTER_COUNT = size_t(PERF_COUNTER::COUNT);
+
+const char* GetPerfCounterName(PERF_COUNTER counter);
+
+
+// ** cPerfCounterValues
+
+class cPerfCounterValues
+{
+public:
+  cPerfCounterValues();
+
+  bool IsAvailable(PERF_COUNTER counter) const { return bAvailable[size_t(counter)]; }
+  uint64_t GetValue(PERF_COUNTER counter) const { return values[size_t(counter)]; }
+
+  // Instructions per cycle, 0 if either counter is unavailable
+  double GetInstructionsPerCycle() const;
+
+  // Events per 1000 instructions, 0 if either counter is unavailable
+  double GetPerThousandInstructions(PERF_COUNTER counter) const;
+
+  bool bAvailable[PERF_COUNTER_COUNT];
+  uint64_t values[PERF_COUNTER_COUNT];
+  bool bMultiplexed; // True if the values were scaled because the group didn't run the whole time it was enabled
+};
+
+// Prints the counters and the derived IPC and misses per 1k instructions on one line
+void PrintPerfCounters(std::ostream& o, const cPerfCounterValues& values);
+
+
+class cPerfCounters
+{
+public:
+  cPerfCounters();
+  ~cPerfCounters();
+
+  // Returns true if at least one counter could be opened, the counters start disabled
+  bool Open();
+  void Close();
+
+  bool IsValid() const { return (leaderFD != -1); }
+  bool IsAvailable(PERF_COUNTER counter) const { return (fds[size_t(counter)] != -1); }
+
+  // Why Open failed, for example "Permission denied" in a container without CAP_PERFMON
+  const std::string& GetError() const { return sError; }
+
+  // These act on the whole group at once
+  void Reset();
+  void Enable();
+  void Disable();
+
+  // Reads every counter with one read() of the group leader
+  bool Read(cPerfCounterValues& values) const;
+
+private:
+  cPerfCounters(const cPerfCounters&) = delete;
+  cPerfCounters& operator=(const cPerfCounters&) = delete;
+
+  int leaderFD;
+  int fds[PERF_COUNTER_COUNT];
+  uint64_t ids[PERF_COUNTER_COUNT];
+  std::string sError;
+};
+
+#endif // PERFCOUNTERS_H
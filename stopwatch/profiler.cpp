@@ -0,0 +1,350 @@
+#include <cstring>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "profiler.h"
+
+namespace detail
+{
+  std::atomic<bool> bProfilingEnabled(true);
+
+  thread_local cProfileThreadBuffer* pProfileThreadBuffer = nullptr;
+
+  // Lets cProfiler know when a thread has exited so that its buffer can be freed once it has been drained
+  class cProfileThreadBufferOwner
+  {
+  public:
+    ~cProfileThreadBufferOwner()
+    {
+      if (pBuffer) pBuffer->bThreadExited.store(true, std::memory_order_release);
+      pProfileThreadBuffer = nullptr;
+    }
+
+    std::shared_ptr<cProfileThreadBuffer> pBuffer;
+  };
+
+  thread_local cProfileThreadBufferOwner profileThreadBufferOwner;
+}
+
+void SetProfilingEnabled(bool bEnabled)
+{
+  detail::bProfilingEnabled.store(bEnabled, std::memory_order_relaxed);
+}
+
+
+// ** cProfileZone
+
+cProfileZone::cProfileZone(const char* szName) :
+  id(cProfiler::Get().RegisterZone(szName))
+{
+}
+
+
+// ** cProfileThreadBuffer
+
+cProfileThreadBuffer::cProfileThreadBuffer() :
+  threadID(0),
+  osThreadID(0),
+  depth(0),
+  bThreadExited(false),
+  head(0),
+  cachedTail(0),
+  dropped(0),
+  tail(0)
+{
+}
+
+
+// ** cLogHistogram
+
+cLogHistogram::cLogHistogram() :
+  total(0)
+{
+  memset(counts, 0, sizeof(counts));
+}
+
+size_t cLogHistogram::GetBucket(uint64_t value)
+{
+  // Small values get a bucket each
+  if (value < SUB_BUCKETS) return size_t(value);
+
+  // Otherwise the bucket is the position of the highest bit and the next few bits below it
+  const size_t highestBit = 63 - __builtin_clzll(value);
+  const size_t subBucket = (value >> (highestBit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+  return ((highestBit - SUB_BUCKET_BITS + 1) * SUB_BUCKETS) + subBucket;
+}
+
+uint64_t cLogHistogram::GetBucketMidpoint(size_t bucket)
+{
+  if (bucket < SUB_BUCKETS) return bucket;
+
+  const size_t highestBit = (bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+  const size_t subBucket = bucket % SUB_BUCKETS;
+  const size_t shift = highestBit - SUB_BUCKET_BITS;
+  const uint64_t lower = uint64_t(SUB_BUCKETS + subBucket) << shift;
+  return lower + ((uint64_t(1) << shift) / 2);
+}
+
+void cLogHistogram::Add(uint64_t value)
+{
+  counts[GetBucket(value)]++;
+  total++;
+}
+
+void cLogHistogram::Merge(const cLogHistogram& rhs)
+{
+  for (size_t i = 0; i < BUCKETS; i++) counts[i] += rhs.counts[i];
+  total += rhs.total;
+}
+
+uint64_t cLogHistogram::GetPercentile(double percentile) const
+{
+  if (total == 0) return 0;
+
+  // The rank of the value we are looking for, rounded up so that 100% is the last value
+  uint64_t rank = uint64_t((std::min(std::max(percentile, 0.0), 100.0) / 100.0) * double(total) + 0.5);
+  if (rank == 0) rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= rank) return GetBucketMidpoint(i);
+  }
+
+  return GetBucketMidpoint(BUCKETS - 1);
+}
+
+
+// ** cProfileZoneStatistics
+
+cProfileZoneStatistics::cProfileZoneStatistics() :
+  count(0),
+  total(0),
+  minimum(UINT64_MAX),
+  maximum(0)
+{
+}
+
+
+// ** cProfiler
+
+cProfiler& cProfiler::Get()
+{
+  static cProfiler profiler;
+  return profiler;
+}
+
+cProfiler::cProfiler() :
+  nextThreadID(1),
+  droppedFromExitedThreads(0),
+  bStopBackgroundThread(false)
+{
+}
+
+cProfiler::~cProfiler()
+{
+  StopBackgroundThread();
+}
+
+uint32_t cProfiler::RegisterZone(const char* szName)
+{
+  std::lock_guard<std::mutex> lock(mutexRegistry);
+
+  const uint32_t id = uint32_t(zoneNames.size());
+  zoneNames.push_back(szName);
+
+  return id;
+}
+
+cProfileThreadBuffer* cProfiler::RegisterThread()
+{
+  std::shared_ptr<cProfileThreadBuffer> pBuffer = std::make_shared<cProfileThreadBuffer>();
+  pBuffer->osThreadID = uint32_t(syscall(SYS_gettid));
+
+  {
+    std::lock_guard<std::mutex> lock(mutexRegistry);
+    pBuffer->threadID = nextThreadID++;
+    threads.push_back(pBuffer);
+  }
+
+  detail::profileThreadBufferOwner.pBuffer = pBuffer;
+  detail::pProfileThreadBuffer = pBuffer.get();
+
+  return pBuffer.get();
+}
+
+void cProfiler::Collect()
+{
+  // Take a copy of the list of threads so that new threads can register while we drain
+  std::vector<std::shared_ptr<cProfileThreadBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(mutexRegistry);
+    buffers = threads;
+  }
+
+  std::lock_guard<std::mutex> lock(mutexStatistics);
+
+  for (const std::shared_ptr<cProfileThreadBuffer>& pBuffer : buffers) {
+    // Check this before draining, any events pushed before the thread exited are then guaranteed to be drained
+    const bool bThreadExited = pBuffer->bThreadExited.load(std::memory_order_acquire);
+
+    const cProfileThreadBuffer& thread = *pBuffer;
+    pBuffer->Drain([this, &thread](const cProfileEvent& event) {
+      // Zones can be registered by other threads while we drain, so statistics grows as their events arrive, GetStatistics fills in the names
+      if (event.zoneID >= statistics.size()) statistics.resize(event.zoneID + 1);
+      cProfileZoneStatistics& zone = statistics[event.zoneID];
+      const durationns_t duration = event.end - event.start;
+      zone.count++;
+      zone.total += duration;
+      zone.minimum = std::min(zone.minimum, duration);
+      zone.maximum = std::max(zone.maximum, duration);
+      zone.histogram.Add(duration);
+
+      for (cProfileEventListener* pListener : listeners) pListener->OnProfileEvent(thread, event);
+    });
+
+    if (bThreadExited) {
+      droppedFromExitedThreads += pBuffer->GetDroppedCount();
+
+      std::lock_guard<std::mutex> lockRegistry(mutexRegistry);
+      threads.erase(std::remove(threads.begin(), threads.end(), pBuffer), threads.end());
+    }
+  }
+}
+
+void cProfiler::ResetStatistics()
+{
+  std::lock_guard<std::mutex> lock(mutexStatistics);
+
+  const size_t n = statistics.size();
+  statistics.clear();
+  statistics.resize(n);
+}
+
+std::vector<cProfileZoneStatistics> cProfiler::GetStatistics() const
+{
+  std::vector<cProfileZoneStatistics> result;
+  {
+    std::lock_guard<std::mutex> lock(mutexStatistics);
+    result = statistics;
+  }
+
+  std::lock_guard<std::mutex> lock(mutexRegistry);
+  if (result.size() < zoneNames.size()) result.resize(zoneNames.size());
+  for (size_t i = 0; i < result.size(); i++) result[i].sName = zoneNames[i];
+
+  return result;
+}
+
+std::vector<std::string> cProfiler::GetZoneNames() const
+{
+  std::lock_guard<std::mutex> lock(mutexRegistry);
+  return zoneNames;
+}
+
+void cProfiler::AddListener(cProfileEventListener& listener)
+{
+  std::lock_guard<std::mutex> lock(mutexStatistics);
+  listeners.push_back(&listener);
+}
+
+void cProfiler::RemoveListener(cProfileEventListener& listener)
+{
+  std::lock_guard<std::mutex> lock(mutexStatistics);
+  listeners.erase(std::remove(listeners.begin(), listeners.end(), &listener), listeners.end());
+}
+
+uint64_t cProfiler::GetDroppedCount() const
+{
+  uint64_t dropped = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutexStatistics);
+    dropped = droppedFromExitedThreads;
+  }
+
+  std::lock_guard<std::mutex> lock(mutexRegistry);
+  for (const std::shared_ptr<cProfileThreadBuffer>& pBuffer : threads) dropped += pBuffer->GetDroppedCount();
+
+  return dropped;
+}
+
+void cProfiler::PrintReport(std::ostream& o) const
+{
+  const std::vector<cProfileZoneStatistics> zones = GetStatistics();
+
+  // Several PROFILE_ZONE macros can use the same name, combine them
+  std::vector<cProfileZoneStatistics> combined;
+  for (const cProfileZoneStatistics& zone : zones) {
+    if (zone.count == 0) continue;
+
+    std::vector<cProfileZoneStatistics>::iterator iter = std::find_if(combined.begin(), combined.end(), [&zone](const cProfileZoneStatistics& rhs) { return (rhs.sName == zone.sName); });
+    if (iter == combined.end()) combined.push_back(zone);
+    else {
+      iter->count += zone.count;
+      iter->total += zone.total;
+      iter->minimum = std::min(iter->minimum, zone.minimum);
+      iter->maximum = std::max(iter->maximum, zone.maximum);
+      iter->histogram.Merge(zone.histogram);
+    }
+  }
+
+  // Most expensive first
+  std::sort(combined.begin(), combined.end(), [](const cProfileZoneStatistics& lhs, const cProfileZoneStatistics& rhs) { return (lhs.total > rhs.total); });
+
+  o<<std::left<<std::setw(24)<<"zone"<<std::right<<std::setw(12)<<"count"<<std::setw(14)<<"total ms"<<std::setw(12)<<"mean ns"<<std::setw(12)<<"min ns"<<std::setw(12)<<"p50 ns"<<std::setw(12)<<"p99 ns"<<std::setw(12)<<"max ns"<<std::endl;
+  for (const cProfileZoneStatistics& zone : combined) {
+    o<<std::left<<std::setw(24)<<zone.sName<<std::right<<std::setw(12)<<zone.count
+      <<std::setw(14)<<std::fixed<<std::setprecision(3)<<(double(zone.total) / 1000000.0)
+      <<std::setw(12)<<(zone.total / zone.count)
+      <<std::setw(12)<<zone.minimum
+      <<std::setw(12)<<zone.histogram.GetPercentile(50.0)
+      <<std::setw(12)<<zone.histogram.GetPercentile(99.0)
+      <<std::setw(12)<<zone.maximum<<std::endl;
+  }
+
+  const uint64_t dropped = GetDroppedCount();
+  if (dropped != 0) o<<"Dropped "<<dropped<<" zones because the ring buffers were full"<<std::endl;
+}
+
+void cProfiler::StartBackgroundThread(durationms_t interval)
+{
+  std::lock_guard<std::mutex> lock(mutexBackgroundThread);
+  if (backgroundThread.joinable()) return;
+
+  bStopBackgroundThread = false;
+  backgroundThread = std::thread(&cProfiler::BackgroundThreadMain, this, interval);
+}
+
+void cProfiler::StopBackgroundThread()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutexBackgroundThread);
+    if (!backgroundThread.joinable()) return;
+
+    bStopBackgroundThread = true;
+  }
+
+  conditionBackgroundThread.notify_all();
+  backgroundThread.join();
+
+  // Pick up anything that was pushed after the last collection
+  Collect();
+}
+
+void cProfiler::BackgroundThreadMain(durationms_t interval)
+{
+  std::unique_lock<std::mutex> lock(mutexBackgroundThread);
+  while (!bStopBackgroundThread) {
+    conditionBackgroundThread.wait_for(lock, std::chrono::milliseconds(interval));
+    if (bStopBackgroundThread) break;
+
+    lock.unlock();
+    Collect();
+    lock.lock();
+  }
+}
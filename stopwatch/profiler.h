@@ -0,0 +1,320 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stopwatch.h"
+
+// ** Profiling zones
+//
+// PROFILE_ZONE("name") at the top of a scope records how long the scope took
+// Each thread writes its zones into its own lock free ring buffer, the only allocation is the ring buffer the first time a thread enters a zone
+// cProfiler drains the ring buffers, either when Collect is called or from a background thread, and keeps statistics for each zone name
+// Profiling can be turned off at runtime with SetProfilingEnabled(false), a disabled zone doesn't read the clock
+// For the lowest overhead select the TSC clock source with SetClockSource
+//
+// If a ring buffer fills up before it is drained the zones are dropped rather than blocking, GetDroppedCount reports how many
+
+#define PROFILE_ZONE_CONCAT_INTERNAL(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_INTERNAL(a, b)
+
+#define PROFILE_ZONE(szName) \
+  static const cProfileZone PROFILE_ZONE_CONCAT(profileZone, __LINE__)(szName); \
+  const cScopedProfileZone PROFILE_ZONE_CONCAT(scopedProfileZone, __LINE__)(PROFILE_ZONE_CONCAT(profileZone, __LINE__))
+
+
+namespace detail
+{
+  extern std::atomic<bool> bProfilingEnabled;
+}
+
+inline bool IsProfilingEnabled()
+{
+  return detail::bProfilingEnabled.load(std::memory_order_relaxed);
+}
+
+void SetProfilingEnabled(bool bEnabled);
+
+
+// ** cProfileZone
+//
+// A named zone, there should only be one of these for each place that is profiled (The PROFILE_ZONE macro makes a static one)
+
+class cProfileZone
+{
+public:
+  explicit cProfileZone(const char* szName);
+
+  uint32_t GetID() const { return id; }
+
+private:
+  uint32_t id;
+};
+
+
+// ** cProfileEvent
+//
+// One completed zone as it is stored in the ring buffer
+
+struct cProfileEvent {
+  durationns_t start;
+  durationns_t end;
+  uint32_t zoneID;
+  uint32_t depth; // How many zones this zone is nested inside on this thread
+};
+
+
+// ** cProfileThreadBuffer
+//
+// A single producer, single consumer ring buffer, the owning thread writes and cProfiler reads
+
+class cProfileThreadBuffer
+{
+public:
+  static const size_t CAPACITY = 65536; // Must be a power of 2
+
+  cProfileThreadBuffer();
+
+  // Producer side, only called by the owning thread
+  void Push(const cProfileEvent& event);
+
+  // Consumer side, only called by cProfiler, returns the number of events drained
+  template <class F>
+  size_t Drain(F onEvent);
+
+  uint64_t GetDroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+  uint32_t threadID;
+  uint32_t osThreadID; // From gettid
+  uint32_t depth;      // Only touched by the owning thread
+  std::atomic<bool> bThreadExited;
+
+private:
+  alignas(64) std::atomic<uint64_t> head; // Written by the producer
+  uint64_t cachedTail;                    // The producer's copy of tail so that it doesn't have to read the consumer's cache line on every push
+  std::atomic<uint64_t> dropped;
+
+  alignas(64) std::atomic<uint64_t> tail; // Written by the consumer
+
+  alignas(64) cProfileEvent events[CAPACITY];
+};
+
+// Returns this thread's buffer, creating and registering it on the first call
+cProfileThreadBuffer& GetProfileThreadBuffer();
+
+namespace detail
+{
+  extern thread_local cProfileThreadBuffer* pProfileThreadBuffer;
+}
+
+
+// ** cScopedProfileZone
+//
+// Records the time from construction to destruction
+
+class cScopedProfileZone
+{
+public:
+  explicit cScopedProfileZone(const cProfileZone& zone);
+  ~cScopedProfileZone();
+
+private:
+  cScopedProfileZone(const cScopedProfileZone&) = delete;
+  cScopedProfileZone& operator=(const cScopedProfileZone&) = delete;
+
+  cProfileThreadBuffer* pBuffer; // nullptr if profiling was disabled when the zone was entered
+  uint32_t zoneID;
+  durationns_t start;
+};
+
+
+// ** cLogHistogram
+//
+// A fixed size histogram with 8 buckets for each power of 2, percentiles are accurate to within about 6%
+
+class cLogHistogram
+{
+public:
+  cLogHistogram();
+
+  void Add(uint64_t value);
+  void Merge(const cLogHistogram& rhs);
+
+  // percentile is from 0.0 to 100.0
+  uint64_t GetPercentile(double percentile) const;
+
+private:
+  static const size_t SUB_BUCKET_BITS = 3;
+  static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  static size_t GetBucket(uint64_t value);
+  static uint64_t GetBucketMidpoint(size_t bucket);
+
+  uint64_t total;
+  uint64_t counts[BUCKETS];
+};
+
+
+// ** cProfileZoneStatistics
+
+class cProfileZoneStatistics
+{
+public:
+  cProfileZoneStatistics();
+
+  std::string sName;
+  uint64_t count;
+  durationns_t total;
+  durationns_t minimum;
+  durationns_t maximum;
+  cLogHistogram histogram;
+};
+
+
+// ** cProfileEventListener
+//
+// Receives every event as it is drained from the ring buffers, called from whichever thread calls cProfiler::Collect
+
+class cProfileEventListener
+{
+public:
+  virtual ~cProfileEventListener() {}
+
+  virtual void OnProfileEvent(const cProfileThreadBuffer& thread, const cProfileEvent& event) = 0;
+};
+
+
+// ** cProfiler
+//
+// Collects the zones from every thread
+
+class cProfiler
+{
+public:
+  static cProfiler& Get();
+
+  ~cProfiler();
+
+  // Drains every thread's ring buffer periodically on a background thread
+  void StartBackgroundThread(durationms_t interval);
+  void StopBackgroundThread();
+
+  // Drains every thread's ring buffer now
+  void Collect();
+
+  // Clears the statistics but keeps the zones
+  void ResetStatistics();
+
+  std::vector<cProfileZoneStatistics> GetStatistics() const;
+  uint64_t GetDroppedCount() const;
+
+  void PrintReport(std::ostream& o) const;
+
+  std::vector<std::string> GetZoneNames() const;
+
+  // The listener must be removed with RemoveListener before it is destroyed
+  void AddListener(cProfileEventListener& listener);
+  void RemoveListener(cProfileEventListener& listener);
+
+  // Called by cProfileZone and GetProfileThreadBuffer
+  uint32_t RegisterZone(const char* szName);
+  cProfileThreadBuffer* RegisterThread();
+
+private:
+  cProfiler();
+
+  void BackgroundThreadMain(durationms_t interval);
+
+  // Protects zones and threads, never taken on the hot path
+  mutable std::mutex mutexRegistry;
+  std::vector<std::string> zoneNames;
+  std::vector<std::shared_ptr<cProfileThreadBuffer>> threads;
+  uint32_t nextThreadID;
+
+  // Protects statistics and serialises draining the ring buffers
+  mutable std::mutex mutexStatistics;
+  std::vector<cProfileZoneStatistics> statistics;
+  uint64_t droppedFromExitedThreads;
+  std::vector<cProfileEventListener*> listeners;
+
+  std::mutex mutexBackgroundThread;
+  std::condition_variable conditionBackgroundThread;
+  bool bStopBackgroundThread;
+  std::thread backgroundThread;
+};
+
+
+// ** Inlines
+
+inline void cProfileThreadBuffer::Push(const cProfileEvent& event)
+{
+  const uint64_t currentHead = head.load(std::memory_order_relaxed);
+  if ((currentHead - cachedTail) >= CAPACITY) {
+    // We might be full, see how far the consumer has got
+    cachedTail = tail.load(std::memory_order_acquire);
+    if ((currentHead - cachedTail) >= CAPACITY) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  events[currentHead & (CAPACITY - 1)] = event;
+  head.store(currentHead + 1, std::memory_order_release);
+}
+
+template <class F>
+inline size_t cProfileThreadBuffer::Drain(F onEvent)
+{
+  const uint64_t currentTail = tail.load(std::memory_order_relaxed);
+  const uint64_t currentHead = head.load(std::memory_order_acquire);
+
+  for (uint64_t i = currentTail; i != currentHead; i++) onEvent(events[i & (CAPACITY - 1)]);
+
+  tail.store(currentHead, std::memory_order_release);
+
+  return size_t(currentHead - currentTail);
+}
+
+inline cProfileThreadBuffer& GetProfileThreadBuffer()
+{
+  cProfileThreadBuffer* pBuffer = detail::pProfileThreadBuffer;
+  if (pBuffer == nullptr) pBuffer = cProfiler::Get().RegisterThread();
+
+  return *pBuffer;
+}
+
+inline cScopedProfileZone::cScopedProfileZone(const cProfileZone& zone) :
+  pBuffer(nullptr),
+  zoneID(zone.GetID()),
+  start(0)
+{
+  if (!IsProfilingEnabled()) return;
+
+  pBuffer = &GetProfileThreadBuffer();
+  pBuffer->depth++;
+  start = GetTimeNS();
+}
+
+inline cScopedProfileZone::~cScopedProfileZone()
+{
+  if (pBuffer == nullptr) return;
+
+  const durationns_t end = GetTimeNS();
+  pBuffer->depth--;
+
+  const cProfileEvent event = { start, end, zoneID, pBuffer->depth };
+  pBuffer->Push(event);
+}
+
+#endif // PROFILER_H
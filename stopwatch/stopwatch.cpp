@@ -0,0 +1,397 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstdio>
+
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "histogram.h"
+#include "perfcounters.h"
+#include "stopwatch.h"
+
+#ifdef BUILD_STOPWATCH_X86
+#include <cpuid.h>
+#endif
+
+namespace detail
+{
+  CLOCK_SOURCE clockSource = CLOCK_SOURCE::STEADY_CLOCK;
+  cTSCCalibration tscCalibration = { 0, 0, 0, 0 };
+}
+
+namespace
+{
+  const uint32_t TSC_SHIFT = 32;
+
+  // How long to measure the TSC for when calibrating, longer is more accurate
+  const durationns_t TSC_CALIBRATION_NS = 20000000;
+
+  const durationns_t NS_PER_SECOND = 1000000000;
+
+  uint64_t tscFrequencyHz = 0;
+
+  durationns_t GetMonotonicRawTimeNS()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (durationns_t(ts.tv_sec) * 1000000000) + ts.tv_nsec;
+  }
+
+  bool IsRDTSCPSupported()
+  {
+#ifdef BUILD_STOPWATCH_X86
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) return false;
+
+    return ((edx & (1 << 27)) != 0);
+#else
+    return false;
+#endif
+  }
+
+  // Reads the TSC either side of reading a clock and returns the pair with the smallest gap, this minimises the error from being preempted
+  template <class F>
+  void ReadTSCAndClock(F readClock, uint64_t& tsc, durationns_t& ns)
+  {
+    uint64_t bestGap = UINT64_MAX;
+
+    for (size_t i = 0; i < 10; i++) {
+      const uint64_t before = detail::ReadTSCP();
+      const durationns_t now = readClock();
+      const uint64_t after = detail::ReadTSCP();
+
+      if ((after - before) < bestGap) {
+        bestGap = after - before;
+        tsc = before + ((after - before) / 2);
+        ns = now;
+      }
+    }
+  }
+
+  bool CalibrateTSC()
+  {
+    if (tscFrequencyHz != 0) return true;
+
+    if (!IsInvariantTSCSupported() || !IsRDTSCPSupported()) return false;
+
+    // Work out the frequency against the raw monotonic clock, this isn't slewed by NTP
+    uint64_t tscStart = 0;
+    durationns_t nsStart = 0;
+    ReadTSCAndClock(GetMonotonicRawTimeNS, tscStart, nsStart);
+
+    ::usleep(TSC_CALIBRATION_NS / 1000);
+
+    uint64_t tscEnd = 0;
+    durationns_t nsEnd = 0;
+    ReadTSCAndClock(GetMonotonicRawTimeNS, tscEnd, nsEnd);
+
+    if ((tscEnd <= tscStart) || (nsEnd <= nsStart)) return false;
+
+    const unsigned __int128 ticks = tscEnd - tscStart;
+    const unsigned __int128 ns = nsEnd - nsStart;
+    tscFrequencyHz = uint64_t((ticks * 1000000000) / ns);
+
+    // Then line the TSC up with the steady clock so that switching clock sources doesn't make the time jump
+    detail::cTSCCalibration calibration;
+    ReadTSCAndClock(detail::GetSteadyClockTimeNS, calibration.tscBase, calibration.nsBase);
+    calibration.shift = TSC_SHIFT;
+    calibration.multiplier = uint64_t(((unsigned __int128)(1000000000) << TSC_SHIFT) / tscFrequencyHz);
+
+    detail::tscCalibration = calibration;
+
+    return true;
+  }
+}
+
+const char* GetClockSourceName(CLOCK_SOURCE source)
+{
+  switch (source) {
+    case CLOCK_SOURCE::TSC: return "rdtsc";
+    case CLOCK_SOURCE::TSCP: return "rdtscp";
+    default: return "steady_clock";
+  }
+}
+
+bool IsInvariantTSCSupported()
+{
+#ifdef BUILD_STOPWATCH_X86
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+
+  // Check that the extended leaf is available
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007)) return false;
+
+  // Advanced power management information, bit 8 is invariant TSC
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+
+  return ((edx & (1 << 8)) != 0);
+#else
+  return false;
+#endif
+}
+
+bool SetClockSource(CLOCK_SOURCE source)
+{
+  if ((source == CLOCK_SOURCE::TSC) || (source == CLOCK_SOURCE::TSCP)) {
+    if (!CalibrateTSC()) return false;
+  }
+
+  detail::clockSource = source;
+
+  return true;
+}
+
+CLOCK_SOURCE GetClockSource()
+{
+  return detail::clockSource;
+}
+
+uint64_t GetTSCFrequencyHz()
+{
+  return tscFrequencyHz;
+}
+
+durationns_t ToMonotonicClockTimeNS(durationns_t timeNS)
+{
+  // The steady clock is CLOCK_MONOTONIC so there is nothing to do
+  if (detail::clockSource == CLOCK_SOURCE::STEADY_CLOCK) return timeNS;
+
+  // The TSC was lined up with the steady clock when it was calibrated but NTP may have slewed CLOCK_MONOTONIC since then, so convert via the difference from now
+  const int64_t difference = int64_t(timeNS) - int64_t(GetTimeNS());
+  return durationns_t(int64_t(detail::GetSteadyClockTimeNS()) + difference);
+}
+
+void DurationToString(std::ostream& o, durationms_t duration)
+{
+  o<<std::setfill('0')<<std::setw(2)<<((duration / 60000) % 3600)<<":"<<std::setfill('0')<<std::setw(2)<<((duration / 1000) % 60)<<":"<<std::setfill('0')<<std::setw(3)<<(duration % 1000);
+}
+
+
+// ** cStopWatch
+
+cStopWatch::cStopWatch() :
+  pPerfCounters(nullptr),
+  running(false),
+  started(0),
+  totalDuration(0),
+  lapStartDuration(0)
+{
+}
+
+void cStopWatch::Start()
+{
+  assert(!running);
+
+  if (pPerfCounters != nullptr) pPerfCounters->Enable();
+
+  // Started our stop watch
+  started = GetTimeNS();
+
+  running = true;
+}
+
+void cStopWatch::Stop()
+{
+  assert(running);
+
+  // Get the time now
+  const durationns_t now = GetTimeNS();
+
+  if (pPerfCounters != nullptr) pPerfCounters->Disable();
+
+  // Add the duration for this period
+  totalDuration += now - started;
+
+  // Reset our start time
+  started = 0;
+
+  running = false;
+}
+
+void cStopWatch::Reset()
+{
+  started = 0;
+  totalDuration = 0;
+  lapStartDuration = 0;
+
+  if (pPerfCounters != nullptr) {
+    if (running) pPerfCounters->Disable();
+    pPerfCounters->Reset();
+  }
+
+  running = false;
+}
+
+void cStopWatch::SetPerfCounters(cPerfCounters* pCounters)
+{
+  pPerfCounters = pCounters;
+}
+
+durationns_t cStopWatch::Lap()
+{
+  const durationns_t total = GetTotalDurationNS();
+  const durationns_t lap = total - lapStartDuration;
+  lapStartDuration = total;
+
+  return lap;
+}
+
+durationns_t cStopWatch::Lap(cHDRHistogram& histogram)
+{
+  const durationns_t lap = Lap();
+  histogram.Record(lap);
+
+  return lap;
+}
+
+durationms_t cStopWatch::GetTotalDurationMS() const
+{
+  return GetTotalDurationNS() / 1000000;
+}
+
+durationns_t cStopWatch::GetTotalDurationNS() const
+{
+  if (running) {
+    // Get the time now
+    const durationns_t now = GetTimeNS();
+
+    // Return the previous duration plus the duration of the current period
+    return totalDuration + (now - started);
+  }
+
+  return totalDuration;
+}
+
+
+// ** cTimeOut
+
+cTimeOut::cTimeOut(durationms_t _timeout) :
+  timeout(_timeout * 1000000),
+  startTime(GetTimeNS())
+{
+}
+
+void cTimeOut::Reset()
+{
+  startTime = GetTimeNS();
+}
+
+bool cTimeOut::IsExpired() const
+{
+  return IsExpired(GetTimeNS());
+}
+
+bool cTimeOut::IsExpired(durationns_t now) const
+{
+  return ((now - startTime) > timeout);
+}
+
+durationms_t cTimeOut::GetRemainingMS() const
+{
+  return GetRemainingNS() / 1000000;
+}
+
+durationns_t cTimeOut::GetRemainingNS() const
+{
+  return GetRemainingNS(GetTimeNS());
+}
+
+durationns_t cTimeOut::GetRemainingNS(durationns_t now) const
+{
+  // Get the total time this timeout has been running for so far
+  const int64_t duration = int64_t(now) - int64_t(startTime);
+
+  // Calculate the remaining time
+  const int64_t remaining = (int64_t(timeout) - duration);
+
+  // Return the remaining time if there is any left
+  return (remaining >= 0) ? remaining : 0;
+}
+
+void cTimeOut::Wait() const
+{
+  // IsExpired is true once we are past the deadline so sleep until 1 ns after it
+  const durationns_t deadline = ToMonotonicClockTimeNS(GetDeadlineNS() + 1);
+
+  struct timespec ts;
+  ts.tv_sec = deadline / NS_PER_SECOND;
+  ts.tv_nsec = deadline % NS_PER_SECOND;
+
+  // clock_nanosleep returns the error rather than setting errno, keep sleeping if a signal interrupts us
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+
+  // If the TSC is running slightly fast compared to CLOCK_MONOTONIC we may still be a tiny bit early
+  while (!IsExpired()) {
+  }
+}
+
+
+// ** cTimerFD
+
+cTimerFD::cTimerFD() :
+  fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+{
+  if (fd < 0) std::cerr<<"cTimerFD::cTimerFD timerfd_create FAILED, errno="<<errno<<std::endl;
+}
+
+cTimerFD::~cTimerFD()
+{
+  if (fd >= 0) close(fd);
+}
+
+bool cTimerFD::Arm(const cTimeOut& timeout)
+{
+  const durationns_t deadline = ToMonotonicClockTimeNS(timeout.GetDeadlineNS() + 1);
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value.tv_sec = deadline / NS_PER_SECOND;
+  spec.it_value.tv_nsec = deadline % NS_PER_SECOND;
+
+  // A zero it_value would disarm the timer instead
+  if ((spec.it_value.tv_sec == 0) && (spec.it_value.tv_nsec == 0)) spec.it_value.tv_nsec = 1;
+
+  return (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0);
+}
+
+bool cTimerFD::ArmInterval(durationns_t interval)
+{
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval / NS_PER_SECOND;
+  spec.it_interval.tv_nsec = interval % NS_PER_SECOND;
+  spec.it_value = spec.it_interval;
+
+  return (timerfd_settime(fd, 0, &spec, nullptr) == 0);
+}
+
+bool cTimerFD::Disarm()
+{
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value = spec.it_interval;
+
+  return (timerfd_settime(fd, 0, &spec, nullptr) == 0);
+}
+
+uint64_t cTimerFD::Acknowledge()
+{
+  uint64_t expirations = 0;
+  const ssize_t result = read(fd, &expirations, sizeof(expirations));
+
+  // EAGAIN means the timer hasn't fired yet
+  return (result == sizeof(expirations)) ? expirations : 0;
+}
@@ -0,0 +1,213 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+#include <cstdint>
+
+#include <chrono>
+#include <iostream>
+
+#ifdef __x86_64__
+#define BUILD_STOPWATCH_X86
+#include <x86intrin.h>
+#endif
+
+typedef uint64_t durationms_t;
+typedef uint64_t durationns_t;
+
+class cHDRHistogram;
+class cPerfCounters;
+
+
+// ** Clock sources
+//
+// STEADY_CLOCK is the default and is always available, it is monotonic so it doesn't jump when NTP adjusts the time
+// TSC and TSCP read the time stamp counter directly which avoids the vDSO call, they are only available on x86 processors with an invariant TSC
+// The TSC is calibrated against CLOCK_MONOTONIC_RAW the first time it is selected, this takes a few milliseconds
+// NOTE: The clock source should be selected at start up before anything is timed, switching during a measurement can make the time jump slightly
+
+enum class CLOCK_SOURCE {
+  STEADY_CLOCK,
+  TSC,  // rdtsc, cheapest but can be reordered with the surrounding instructions
+  TSCP, // rdtscp, waits for the previous instructions to complete before reading the counter
+};
+
+const char* GetClockSourceName(CLOCK_SOURCE source);
+
+// Returns true if the processor has an invariant TSC (Constant rate in all power states and across cores)
+bool IsInvariantTSCSupported();
+
+// Returns false and leaves the current clock source alone if source is not supported
+bool SetClockSource(CLOCK_SOURCE source);
+CLOCK_SOURCE GetClockSource();
+
+// Returns the calibrated TSC frequency in Hz, or 0 if the TSC has not been calibrated
+uint64_t GetTSCFrequencyHz();
+
+
+namespace detail
+{
+  // Fixed point conversion from TSC ticks to nanoseconds, ns = nsBase + (((tsc - tscBase) * multiplier) >> shift)
+  struct cTSCCalibration {
+    uint64_t tscBase;
+    uint64_t nsBase;
+    uint64_t multiplier;
+    uint32_t shift;
+  };
+
+  extern CLOCK_SOURCE clockSource;
+  extern cTSCCalibration tscCalibration;
+
+  inline uint64_t ReadTSC()
+  {
+#ifdef BUILD_STOPWATCH_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  inline uint64_t ReadTSCP()
+  {
+#ifdef BUILD_STOPWATCH_X86
+    unsigned int aux = 0;
+    return __rdtscp(&aux);
+#else
+    return 0;
+#endif
+  }
+
+  inline durationns_t GetSteadyClockTimeNS()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  inline durationns_t TSCToNS(uint64_t tsc)
+  {
+    const unsigned __int128 ticks = tsc - tscCalibration.tscBase;
+    return tscCalibration.nsBase + uint64_t((ticks * tscCalibration.multiplier) >> tscCalibration.shift);
+  }
+}
+
+// Get the time in nanoseconds since an arbitrary point, this is monotonic
+inline durationns_t GetTimeNS()
+{
+  switch (detail::clockSource) {
+    case CLOCK_SOURCE::TSC: return detail::TSCToNS(detail::ReadTSC());
+    case CLOCK_SOURCE::TSCP: return detail::TSCToNS(detail::ReadTSCP());
+    default: return detail::GetSteadyClockTimeNS();
+  }
+}
+
+// Get the time in milliseconds since an arbitrary point, this is monotonic
+inline durationms_t GetTimeMS()
+{
+  return GetTimeNS() / 1000000;
+}
+
+void DurationToString(std::ostream& o, durationms_t duration);
+
+
+// ** cStopWatch
+//
+// A stop watch that behaves like a real life stop watch, it has start, stop, reset, laps and a total duration
+// A lap is the running time since the previous lap (Or since the stop watch was reset), time while the stop watch is stopped doesn't count
+// Optionally a cPerfCounters group can be attached, it is enabled while the stop watch is running and reset with it
+
+class cStopWatch
+{
+public:
+  cStopWatch();
+
+  void Start();
+  void Stop();
+  void Reset();
+
+  // Ends the current lap and starts the next one, returns the duration of the lap that just ended
+  durationns_t Lap();
+
+  // As above and also records the lap duration in nanoseconds in histogram, this doesn't allocate
+  durationns_t Lap(cHDRHistogram& histogram);
+
+  durationms_t GetTotalDurationMS() const;
+  durationns_t GetTotalDurationNS() const;
+
+  // Call this while the stop watch is stopped, pCounters must outlive the stop watch (Or be removed by setting nullptr), it is not owned
+  void SetPerfCounters(cPerfCounters* pCounters);
+
+private:
+  cPerfCounters* pPerfCounters;
+  bool running;
+  durationns_t started;
+  durationns_t totalDuration;
+  durationns_t lapStartDuration; // The total duration when the current lap started
+};
+
+
+// Converts a time from GetTimeNS to the CLOCK_MONOTONIC time base used by the kernel, these are the same unless the TSC is selected
+durationns_t ToMonotonicClockTimeNS(durationns_t timeNS);
+
+
+// ** cTimeOut
+//
+// For use in a loop for example to work out when we something has expired
+// The overloads that take "now" let a loop read the clock once and check many things against it
+
+class cTimeOut {
+public:
+  explicit cTimeOut(durationms_t timeout);
+
+  void Reset();
+
+  bool IsExpired() const;
+  bool IsExpired(durationns_t now) const;
+
+  durationms_t GetRemainingMS() const;
+  durationns_t GetRemainingNS() const;
+  durationns_t GetRemainingNS(durationns_t now) const;
+
+  // The time (From GetTimeNS) when this timeout was last reset and when it expires
+  durationns_t GetStartTimeNS() const { return startTime; }
+  durationns_t GetDeadlineNS() const { return startTime + timeout; }
+
+  // Blocks until the timeout has expired, returns straight away if it already has
+  void Wait() const;
+
+private:
+  const durationns_t timeout;
+  durationns_t startTime;
+};
+
+
+// ** cTimerFD
+//
+// A timerfd that becomes readable when a cTimeOut expires, this allows timeouts to be waited on in an epoll or poll loop along with other file descriptors
+// The timer is set to the absolute deadline so it doesn't drift no matter how long it takes to get around to arming it
+
+class cTimerFD
+{
+public:
+  cTimerFD();
+  ~cTimerFD();
+
+  bool IsValid() const { return (fd >= 0); }
+  int GetFD() const { return fd; }
+
+  // Arms the timer to fire when timeout expires, if it has already expired the timer fires immediately
+  bool Arm(const cTimeOut& timeout);
+
+  // Arms the timer to fire every interval, starting one interval from now
+  bool ArmInterval(durationns_t interval);
+
+  bool Disarm();
+
+  // Call this when the fd is readable, returns the number of times the timer has fired since the last call, or 0 if it hasn't
+  uint64_t Acknowledge();
+
+private:
+  cTimerFD(const cTimerFD&) = delete;
+  cTimerFD& operator=(const cTimerFD&) = delete;
+
+  int fd;
+};
+
+#endif // STOPWATCH_H
@@ -0,0 +1,227 @@
+#include <cassert>
+
+#include "timerwheel.h"
+
+namespace
+{
+  const uint64_t MAX_TICKS = 0xFFFFFFFF;
+
+  void ListInit(detail::cTimerWheelListNode& head)
+  {
+    head.pPrevious = &head;
+    head.pNext = &head;
+  }
+
+  bool ListIsEmpty(const detail::cTimerWheelListNode& head)
+  {
+    return (head.pNext == &head);
+  }
+
+  void ListPushBack(detail::cTimerWheelListNode& head, detail::cTimerWheelListNode& node)
+  {
+    node.pPrevious = head.pPrevious;
+    node.pNext = &head;
+    head.pPrevious->pNext = &node;
+    head.pPrevious = &node;
+  }
+
+  void ListRemove(detail::cTimerWheelListNode& node)
+  {
+    node.pPrevious->pNext = node.pNext;
+    node.pNext->pPrevious = node.pPrevious;
+    node.pPrevious = nullptr;
+    node.pNext = nullptr;
+  }
+
+  // Moves every node from one list to the end of another
+  void ListSplice(detail::cTimerWheelListNode& from, detail::cTimerWheelListNode& to)
+  {
+    if (ListIsEmpty(from)) return;
+
+    from.pNext->pPrevious = to.pPrevious;
+    to.pPrevious->pNext = from.pNext;
+    from.pPrevious->pNext = &to;
+    to.pPrevious = from.pPrevious;
+
+    ListInit(from);
+  }
+
+  size_t CountTrailingZeros(uint64_t value)
+  {
+    assert(value != 0);
+    return __builtin_ctzll(value);
+  }
+}
+
+
+// ** cTimerWheelEntry
+
+cTimerWheelEntry::cTimerWheelEntry() :
+  pWheel(nullptr),
+  expires(0),
+  bucket(0)
+{
+  pPrevious = nullptr;
+  pNext = nullptr;
+}
+
+cTimerWheelEntry::~cTimerWheelEntry()
+{
+  if (pWheel != nullptr) pWheel->Cancel(*this);
+}
+
+
+// ** cTimerWheel
+
+cTimerWheel::cTimerWheel(durationns_t _tickDuration, durationns_t now) :
+  tickDuration((_tickDuration != 0) ? _tickDuration : 1),
+  startTime(now),
+  currentTick(0),
+  nScheduled(0)
+{
+  for (size_t i = 0; i < BUCKETS; i++) ListInit(buckets[i]);
+  ListInit(firing);
+
+  for (size_t i = 0; i < (LEVEL_0_BUCKETS / 64); i++) level0Occupied[i] = 0;
+}
+
+cTimerWheel::~cTimerWheel()
+{
+  // Detach any entries that are still scheduled so that they don't try to cancel themselves on a wheel that no longer exists
+  for (size_t i = 0; i < BUCKETS; i++) {
+    while (!ListIsEmpty(buckets[i])) Unlink(*static_cast<cTimerWheelEntry*>(buckets[i].pNext));
+  }
+  while (!ListIsEmpty(firing)) Unlink(*static_cast<cTimerWheelEntry*>(firing.pNext));
+}
+
+void cTimerWheel::Schedule(cTimerWheelEntry& entry, durationns_t timeout)
+{
+  // Round up so that we never fire early
+  ScheduleTicks(entry, (timeout / tickDuration) + (((timeout % tickDuration) != 0) ? 1 : 0));
+}
+
+void cTimerWheel::ScheduleTicks(cTimerWheelEntry& entry, uint64_t ticks)
+{
+  if (entry.pWheel != nullptr) entry.pWheel->Unlink(entry);
+
+  entry.pWheel = this;
+  entry.expires = currentTick + ticks;
+  nScheduled++;
+
+  Insert(entry);
+}
+
+void cTimerWheel::Cancel(cTimerWheelEntry& entry)
+{
+  if (entry.pWheel != this) return;
+
+  Unlink(entry);
+}
+
+void cTimerWheel::Insert(cTimerWheelEntry& entry)
+{
+  // Entries that are already due go in the current bucket
+  const uint64_t expires = (entry.expires < currentTick) ? currentTick : entry.expires;
+  uint64_t ticks = expires - currentTick;
+
+  size_t bucket = 0;
+  if (ticks < LEVEL_0_BUCKETS) {
+    const size_t index = expires & (LEVEL_0_BUCKETS - 1);
+    level0Occupied[index / 64] |= uint64_t(1) << (index % 64);
+    bucket = index;
+  } else {
+    // Anything past the end of the last level is parked at the end and will be cascaded down and reinserted later
+    uint64_t slotExpires = expires;
+    if (ticks > MAX_TICKS) {
+      ticks = MAX_TICKS;
+      slotExpires = currentTick + MAX_TICKS;
+    }
+
+    size_t level = 1;
+    while ((level < (LEVELS - 1)) && (ticks >= (uint64_t(1) << (LEVEL_0_BITS + (level * LEVEL_N_BITS))))) level++;
+
+    const size_t shift = LEVEL_0_BITS + ((level - 1) * LEVEL_N_BITS);
+    bucket = LEVEL_0_BUCKETS + ((level - 1) * LEVEL_N_BUCKETS) + ((slotExpires >> shift) & (LEVEL_N_BUCKETS - 1));
+  }
+
+  entry.bucket = uint16_t(bucket);
+  ListPushBack(buckets[bucket], entry);
+}
+
+void cTimerWheel::Unlink(cTimerWheelEntry& entry)
+{
+  assert(entry.pWheel == this);
+
+  ListRemove(entry);
+
+  // Keep the occupied bits up to date so that Advance doesn't stop at empty buckets
+  if ((entry.bucket < LEVEL_0_BUCKETS) && ListIsEmpty(buckets[entry.bucket])) level0Occupied[entry.bucket / 64] &= ~(uint64_t(1) << (entry.bucket % 64));
+
+  entry.pWheel = nullptr;
+  nScheduled--;
+}
+
+void cTimerWheel::CascadeBucket(size_t bucket)
+{
+  // Take the whole list first because reinserting can never put an entry back in the same bucket
+  detail::cTimerWheelListNode list;
+  ListInit(list);
+  ListSplice(buckets[bucket], list);
+
+  while (!ListIsEmpty(list)) {
+    cTimerWheelEntry& entry = *static_cast<cTimerWheelEntry*>(list.pNext);
+    ListRemove(entry);
+    Insert(entry);
+  }
+}
+
+void cTimerWheel::Cascade()
+{
+  // Called when level 0 wraps around, cascade the next bucket of level 1, and if that wrapped around too then level 2 and so on
+  for (size_t level = 1; level < LEVELS; level++) {
+    const size_t shift = LEVEL_0_BITS + ((level - 1) * LEVEL_N_BITS);
+    const size_t index = (currentTick >> shift) & (LEVEL_N_BUCKETS - 1);
+    CascadeBucket(LEVEL_0_BUCKETS + ((level - 1) * LEVEL_N_BUCKETS) + index);
+
+    if (index != 0) break;
+  }
+}
+
+bool cTimerWheel::TakeExpiredBucket()
+{
+  const size_t index = currentTick & (LEVEL_0_BUCKETS - 1);
+  if (ListIsEmpty(buckets[index])) return false;
+
+  // Mark each entry as firing so that Unlink knows it isn't in a bucket any more
+  for (detail::cTimerWheelListNode* pNode = buckets[index].pNext; pNode != &buckets[index]; pNode = pNode->pNext) {
+    static_cast<cTimerWheelEntry*>(pNode)->bucket = FIRING;
+  }
+
+  ListSplice(buckets[index], firing);
+  level0Occupied[index / 64] &= ~(uint64_t(1) << (index % 64));
+
+  return true;
+}
+
+uint64_t cTimerWheel::GetNextInterestingTick() const
+{
+  const size_t index = currentTick & (LEVEL_0_BUCKETS - 1);
+
+  // We always have to stop at the start of each rotation to cascade
+  if (index == 0) return currentTick;
+
+  // Find the first occupied bucket from index to the end of level 0
+  size_t word = index / 64;
+  uint64_t bits = level0Occupied[word] & (~uint64_t(0) << (index % 64));
+  while (true) {
+    if (bits != 0) return (currentTick - index) + (word * 64) + CountTrailingZeros(bits);
+
+    word++;
+    if (word == (LEVEL_0_BUCKETS / 64)) break;
+
+    bits = level0Occupied[word];
+  }
+
+  // Nothing until the next rotation
+  return (currentTick - index) + LEVEL_0_BUCKETS;
+}
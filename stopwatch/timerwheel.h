@@ -0,0 +1,163 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+#include "stopwatch.h"
+
+// ** cTimerWheel
+//
+// A hierarchical hashed timer wheel for managing a very large number of timeouts, for example one per connection
+// Schedule, Cancel and reschedule are O(1) and Advance only visits buckets that have timers in them (Plus one cascade every 256 ticks)
+// Time is measured in ticks, a timer fires on the first tick at or after its timeout so the resolution is one tick
+//
+// Level 0 has 256 buckets of 1 tick each, levels 1 to 4 have 64 buckets each covering 256, 16384, 1048576 and 67108864 ticks
+// When level 0 wraps around the next bucket of level 1 is cascaded down into level 0 and so on
+// Timeouts longer than 2^32 ticks are parked in the last level and cascaded down again until they are due
+//
+// NOTE: This is not thread safe, each wheel should be owned by a single thread
+
+class cTimerWheel;
+
+namespace detail
+{
+  struct cTimerWheelListNode {
+    cTimerWheelListNode* pPrevious;
+    cTimerWheelListNode* pNext;
+  };
+}
+
+// ** cTimerWheelEntry
+//
+// An intrusive timer, derive from this (Or embed it) in the object that owns the timeout so that scheduling never allocates
+
+class cTimerWheelEntry : private detail::cTimerWheelListNode
+{
+public:
+  cTimerWheelEntry();
+  ~cTimerWheelEntry();
+
+  bool IsScheduled() const { return (pWheel != nullptr); }
+
+private:
+  friend class cTimerWheel;
+
+  cTimerWheelEntry(const cTimerWheelEntry&) = delete;
+  cTimerWheelEntry& operator=(const cTimerWheelEntry&) = delete;
+
+  cTimerWheel* pWheel;
+  uint64_t expires; // The tick when this timer is due
+  uint16_t bucket;  // Level 0 buckets are 0 to 255, then 64 buckets for each of the other levels, FIRING is used while being fired
+};
+
+class cTimerWheel
+{
+public:
+  // tickDuration is the resolution of the wheel, now is the time that tick 0 starts at
+  cTimerWheel(durationns_t tickDuration, durationns_t now);
+  ~cTimerWheel();
+
+  durationns_t GetTickDurationNS() const { return tickDuration; }
+  uint64_t GetCurrentTick() const { return currentTick; }
+  size_t GetScheduledCount() const { return nScheduled; }
+
+  // Schedules the timer to fire timeout after the current tick, if it is already scheduled it is moved
+  void Schedule(cTimerWheelEntry& entry, durationns_t timeout);
+  void ScheduleTicks(cTimerWheelEntry& entry, uint64_t ticks);
+
+  // Does nothing if the entry is not scheduled
+  void Cancel(cTimerWheelEntry& entry);
+
+  // Processes every tick up to and including now, onExpired(cTimerWheelEntry&) is called for each timer that fires
+  // onExpired can schedule or cancel any timer, including the one that just fired
+  // Returns the number of timers that fired
+  template <class F>
+  size_t Advance(durationns_t now, F onExpired);
+
+  template <class F>
+  size_t AdvanceToTick(uint64_t targetTick, F onExpired);
+
+private:
+  cTimerWheel(const cTimerWheel&) = delete;
+  cTimerWheel& operator=(const cTimerWheel&) = delete;
+
+  static const size_t LEVEL_0_BITS = 8;
+  static const size_t LEVEL_N_BITS = 6;
+  static const size_t LEVEL_0_BUCKETS = 1 << LEVEL_0_BITS;
+  static const size_t LEVEL_N_BUCKETS = 1 << LEVEL_N_BITS;
+  static const size_t LEVELS = 5;
+  static const size_t BUCKETS = LEVEL_0_BUCKETS + ((LEVELS - 1) * LEVEL_N_BUCKETS);
+  static const uint16_t FIRING = 0xFFFF;
+
+  void Insert(cTimerWheelEntry& entry);
+  void Unlink(cTimerWheelEntry& entry);
+  void Cascade();
+  void CascadeBucket(size_t bucket);
+
+  // Moves every entry in the level 0 bucket for the current tick onto the firing list
+  bool TakeExpiredBucket();
+
+  // Returns the first tick after the current tick that could have something to do
+  uint64_t GetNextInterestingTick() const;
+
+  const durationns_t tickDuration;
+  const durationns_t startTime;
+  uint64_t currentTick; // The next tick to be processed
+  size_t nScheduled;
+
+  detail::cTimerWheelListNode buckets[BUCKETS];
+  detail::cTimerWheelListNode firing;
+
+  // A bit is set for each non empty level 0 bucket, this lets Advance skip straight to the next bucket with something in it
+  uint64_t level0Occupied[LEVEL_0_BUCKETS / 64];
+};
+
+
+// ** cTimerWheel inlines
+
+template <class F>
+inline size_t cTimerWheel::Advance(durationns_t now, F onExpired)
+{
+  if (now < startTime) return 0;
+
+  return AdvanceToTick((now - startTime) / tickDuration, onExpired);
+}
+
+template <class F>
+inline size_t cTimerWheel::AdvanceToTick(uint64_t targetTick, F onExpired)
+{
+  size_t nFired = 0;
+
+  while (currentTick <= targetTick) {
+    if (nScheduled == 0) {
+      // Nothing to do, just jump straight to the end
+      currentTick = targetTick + 1;
+      break;
+    }
+
+    if ((currentTick & (LEVEL_0_BUCKETS - 1)) == 0) Cascade();
+
+    // Move the expired timers to a separate list before firing them, the current tick is moved on first so that anything scheduled from onExpired lands in a later tick
+    const bool bAnyExpired = TakeExpiredBucket();
+    currentTick++;
+
+    if (bAnyExpired) {
+      while (firing.pNext != &firing) {
+        cTimerWheelEntry& entry = *static_cast<cTimerWheelEntry*>(firing.pNext);
+        Unlink(entry);
+        nFired++;
+        onExpired(entry);
+      }
+    }
+
+    // Skip the empty buckets, GetNextInterestingTick stops at each cascade so we never miss one
+    const uint64_t nextTick = GetNextInterestingTick();
+    currentTick = (nextTick > (targetTick + 1)) ? (targetTick + 1) : nextTick;
+  }
+
+  return nFired;
+}
+
+#endif // TIMERWHEEL_H
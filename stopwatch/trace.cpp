@@ -0,0 +1,293 @@
+#include <cinttypes>
+
+#include <algorithm>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace
+{
+  uint32_t GetCurrentThreadID()
+  {
+    static thread_local const uint32_t threadID = uint32_t(syscall(SYS_gettid));
+    return threadID;
+  }
+
+  // Splits nanoseconds into the whole microseconds and the fraction so that they can be printed as "%" PRIu64 ".%03u" which is much faster than %f
+  struct cTraceTime {
+    uint64_t us;
+    unsigned int fraction;
+  };
+
+  cTraceTime ToTraceTime(int64_t timeNS)
+  {
+    if (timeNS < 0) timeNS = 0;
+    return { uint64_t(timeNS) / 1000, (unsigned int)(uint64_t(timeNS) % 1000) };
+  }
+
+  std::string EscapeJSONString(const std::string& sText)
+  {
+    std::string sResult;
+    sResult.reserve(sText.length());
+
+    for (char c : sText) {
+      switch (c) {
+        case '"': sResult += "\\\""; break;
+        case '\\': sResult += "\\\\"; break;
+        case '\n': sResult += "\\n"; break;
+        case '\r': sResult += "\\r"; break;
+        case '\t': sResult += "\\t"; break;
+        default: {
+          if ((unsigned char)(c) < 0x20) {
+            char szEscaped[8];
+            snprintf(szEscaped, sizeof(szEscaped), "\\u%04x", (unsigned int)(c));
+            sResult += szEscaped;
+          } else sResult += c;
+        }
+      }
+    }
+
+    return sResult;
+  }
+}
+
+cTraceWriter::cTraceWriter() :
+  processID(getpid()),
+  monotonicClockOffsetNS(0),
+  pFile(nullptr),
+  bFileHasEvents(false),
+  lastZoneThreadID(0),
+  bStopBackgroundThread(false)
+{
+}
+
+cTraceWriter::~cTraceWriter()
+{
+  Close();
+}
+
+bool cTraceWriter::Open(const std::string& sFilePath, durationms_t flushInterval)
+{
+  Close();
+
+  FILE* pNewFile = fopen(sFilePath.c_str(), "w");
+  if (pNewFile == nullptr) return false;
+
+  fputs("[\n", pNewFile);
+
+  // Work out the offset to CLOCK_MONOTONIC once so that every event is converted the same way
+  const durationns_t now = GetTimeNS();
+  monotonicClockOffsetNS = int64_t(ToMonotonicClockTimeNS(now)) - int64_t(now);
+
+  {
+    std::lock_guard<std::mutex> lock(mutexFile);
+    pFile = pNewFile;
+    bFileHasEvents = false;
+    zoneNames.clear();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutexPending);
+    sPending.clear();
+    pendingZones.clear();
+    namedThreads.clear();
+    lastZoneThreadID = 0;
+  }
+
+  cProfiler::Get().AddListener(*this);
+
+  bStopBackgroundThread = false;
+  backgroundThread = std::thread(&cTraceWriter::BackgroundThreadMain, this, flushInterval);
+
+  return true;
+}
+
+void cTraceWriter::Close()
+{
+  if (pFile == nullptr) return;
+
+  cProfiler::Get().RemoveListener(*this);
+
+  {
+    std::lock_guard<std::mutex> lock(mutexBackgroundThread);
+    bStopBackgroundThread = true;
+  }
+  conditionBackgroundThread.notify_all();
+  if (backgroundThread.joinable()) backgroundThread.join();
+
+  Flush();
+
+  std::lock_guard<std::mutex> lock(mutexFile);
+  fputs("\n]\n", pFile);
+  fclose(pFile);
+  pFile = nullptr;
+}
+
+void cTraceWriter::Flush()
+{
+  std::lock_guard<std::mutex> lockFile(mutexFile);
+  if (pFile == nullptr) return;
+
+  // Swap the buffers out so that other threads and cProfiler::Collect can keep adding events while we format and write
+  std::string sChunk;
+  std::vector<cPendingZone> zones;
+  {
+    std::lock_guard<std::mutex> lock(mutexPending);
+    sChunk.swap(sPending);
+    zones.swap(pendingZones);
+  }
+
+  for (const cPendingZone& zone : zones) FormatZone(zone, sChunk);
+
+  if (sChunk.empty()) return;
+
+  if (bFileHasEvents) fputs(",\n", pFile);
+  bFileHasEvents = true;
+
+  fwrite(sChunk.data(), 1, sChunk.length(), pFile);
+  fflush(pFile);
+}
+
+void cTraceWriter::BackgroundThreadMain(durationms_t interval)
+{
+  std::unique_lock<std::mutex> lock(mutexBackgroundThread);
+  while (!bStopBackgroundThread) {
+    conditionBackgroundThread.wait_for(lock, std::chrono::milliseconds(interval));
+    if (bStopBackgroundThread) break;
+
+    lock.unlock();
+    Flush();
+    lock.lock();
+  }
+}
+
+void cTraceWriter::AddThreadNameLocked(uint32_t threadID, const std::string& sName)
+{
+  std::vector<uint32_t>::iterator iter = std::lower_bound(namedThreads.begin(), namedThreads.end(), threadID);
+  const bool bAlreadyNamed = ((iter != namedThreads.end()) && (*iter == threadID));
+  if (!bAlreadyNamed) namedThreads.insert(iter, threadID);
+  else if (sName.empty()) return;
+
+  const std::string sThreadName = sName.empty() ? ("Thread " + std::to_string(threadID)) : sName;
+
+  if (!sPending.empty()) sPending += ",\n";
+
+  sPending += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + std::to_string(processID) + ",\"tid\":" + std::to_string(threadID) + ",\"args\":{\"name\":\"" + EscapeJSONString(sThreadName) + "\"}}";
+}
+
+void cTraceWriter::AddEvent(uint32_t threadID, const char* szEvent, size_t length)
+{
+  bool bFlushNow = false;
+  {
+    std::lock_guard<std::mutex> lock(mutexPending);
+
+    // Give each thread a default name so that the viewer shows the thread id
+    if (!std::binary_search(namedThreads.begin(), namedThreads.end(), threadID)) AddThreadNameLocked(threadID, "");
+
+    if (!sPending.empty()) sPending += ",\n";
+
+    char szIDs[64];
+    const int idsLength = snprintf(szIDs, sizeof(szIDs), "{\"pid\":%d,\"tid\":%" PRIu32 ",", processID, threadID);
+    sPending.append(szIDs, idsLength);
+    sPending.append(szEvent, length);
+    sPending += '}';
+
+    bFlushNow = (sPending.length() >= MAX_PENDING_BYTES);
+  }
+
+  if (bFlushNow) Flush();
+}
+
+void cTraceWriter::SetThreadName(const std::string& sName)
+{
+  std::lock_guard<std::mutex> lock(mutexPending);
+  AddThreadNameLocked(GetCurrentThreadID(), sName);
+}
+
+void cTraceWriter::AddMark(const std::string& sName)
+{
+  const cTraceTime time = ToTraceTime(ToTraceTimeNS(GetTimeNS()));
+
+  char szValues[128];
+  snprintf(szValues, sizeof(szValues), "\",\"cat\":\"mark\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ".%03u", time.us, time.fraction);
+
+  const std::string sEvent = "\"name\":\"" + EscapeJSONString(sName) + szValues;
+  AddEvent(GetCurrentThreadID(), sEvent.c_str(), sEvent.length());
+}
+
+void cTraceWriter::AddCounter(const std::string& sName, int64_t value)
+{
+  const cTraceTime time = ToTraceTime(ToTraceTimeNS(GetTimeNS()));
+
+  char szValues[128];
+  snprintf(szValues, sizeof(szValues), "\",\"ph\":\"C\",\"ts\":%" PRIu64 ".%03u,\"args\":{\"value\":%" PRId64 "}", time.us, time.fraction, value);
+
+  const std::string sEvent = "\"name\":\"" + EscapeJSONString(sName) + szValues;
+  AddEvent(GetCurrentThreadID(), sEvent.c_str(), sEvent.length());
+}
+
+void cTraceWriter::AddTimeOut(const std::string& sName, const cTimeOut& timeout)
+{
+  const cTraceTime start = ToTraceTime(ToTraceTimeNS(timeout.GetStartTimeNS()));
+  const cTraceTime duration = ToTraceTime(int64_t(timeout.GetDeadlineNS() - timeout.GetStartTimeNS()));
+
+  char szValues[192];
+  snprintf(szValues, sizeof(szValues), "\",\"cat\":\"timeout\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,\"args\":{\"expired\":%s}",
+    start.us, start.fraction, duration.us, duration.fraction, timeout.IsExpired() ? "true" : "false");
+
+  const std::string sEvent = "\"name\":\"" + EscapeJSONString(sName) + szValues;
+  AddEvent(GetCurrentThreadID(), sEvent.c_str(), sEvent.length());
+}
+
+void cTraceWriter::OnProfileEvent(const cProfileThreadBuffer& thread, const cProfileEvent& event)
+{
+  // This is called for every zone while cProfiler is draining the ring buffers, so just copy it, FormatZone does the rest on the background thread
+  bool bWakeBackgroundThread = false;
+  {
+    std::lock_guard<std::mutex> lock(mutexPending);
+
+    // Give each thread a default name so that the viewer shows the thread id
+    if (thread.osThreadID != lastZoneThreadID) {
+      if (!std::binary_search(namedThreads.begin(), namedThreads.end(), thread.osThreadID)) AddThreadNameLocked(thread.osThreadID, "");
+      lastZoneThreadID = thread.osThreadID;
+    }
+
+    pendingZones.push_back({ thread.osThreadID, event });
+    bWakeBackgroundThread = (pendingZones.size() == MAX_PENDING_ZONES);
+  }
+
+  if (bWakeBackgroundThread) conditionBackgroundThread.notify_all();
+}
+
+void cTraceWriter::FormatZone(const cPendingZone& zone, std::string& sChunk)
+{
+  const cProfileEvent& event = zone.event;
+
+  // Zones can be registered at any time, refresh our copy of the names when we see a new one
+  if (event.zoneID >= zoneNames.size()) {
+    zoneNames = cProfiler::Get().GetZoneNames();
+    for (std::string& sName : zoneNames) sName = EscapeJSONString(sName);
+  }
+
+  const char* szName = (event.zoneID < zoneNames.size()) ? zoneNames[event.zoneID].c_str() : "";
+
+  // Format straight into a buffer on the stack, zone names are nearly always short enough to fit
+  char szEvent[320];
+  const char* szFormat = "{\"pid\":%d,\"tid\":%" PRIu32 ",\"name\":\"%s\",\"cat\":\"zone\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,\"args\":{\"depth\":%" PRIu32 "}}";
+  const cTraceTime start = ToTraceTime(ToTraceTimeNS(event.start));
+  const cTraceTime duration = ToTraceTime(int64_t(event.end - event.start));
+  const int length = snprintf(szEvent, sizeof(szEvent), szFormat, processID, zone.osThreadID, szName, start.us, start.fraction, duration.us, duration.fraction, event.depth);
+
+  if (!sChunk.empty()) sChunk += ",\n";
+
+  if (length < int(sizeof(szEvent))) {
+    sChunk.append(szEvent, size_t(length));
+    return;
+  }
+
+  std::vector<char> longEvent(size_t(length) + 1);
+  snprintf(longEvent.data(), longEvent.size(), szFormat, processID, zone.osThreadID, szName, start.us, start.fraction, duration.us, duration.fraction, event.depth);
+  sChunk.append(longEvent.data(), size_t(length));
+}
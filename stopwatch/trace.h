@@ -0,0 +1,107 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+#include "stopwatch.h"
+
+// ** cTraceWriter
+//
+// Streams profiling zones, marks, timeouts and counters to a file in the Chrome trace_event JSON format
+// The file can be opened in chrome://tracing or https://ui.perfetto.dev
+//
+// Zones are complete ("X") events on the thread that recorded them, the viewer nests them by their start and end times
+// Marks are instant ("i") events, timeouts are complete events from when they were reset to their deadline and counters are ("C") events
+// Times are CLOCK_MONOTONIC in microseconds so that they line up with other traces of the same machine
+//
+// Marks, timeouts and counters are formatted into a memory buffer and written to the file periodically from a background thread
+// Zones arrive inside cProfiler::Collect while it is draining the ring buffers, so they are only copied there and are formatted on the background thread
+// The file is a JSON array which the viewers accept even without the closing bracket, so a trace is still usable if the process dies before Close
+
+class cTraceWriter : public cProfileEventListener
+{
+public:
+  cTraceWriter();
+  ~cTraceWriter();
+
+  // Creates the file, registers with cProfiler and starts writing every flushInterval milliseconds
+  bool Open(const std::string& sFilePath, durationms_t flushInterval);
+
+  // Writes everything that is pending and finishes the file
+  // Call cProfiler::Collect (Or cProfiler::StopBackgroundThread) first to pick up any zones still in the ring buffers
+  void Close();
+
+  bool IsOpen() const { return (pFile != nullptr); }
+
+  // These can be called from any thread, the event is recorded against the calling thread
+  void SetThreadName(const std::string& sName);
+  void AddMark(const std::string& sName);
+  void AddCounter(const std::string& sName, int64_t value);
+  void AddTimeOut(const std::string& sName, const cTimeOut& timeout);
+
+  // Writes the pending events to the file now
+  void Flush();
+
+  // cProfileEventListener, called by cProfiler::Collect
+  virtual void OnProfileEvent(const cProfileThreadBuffer& thread, const cProfileEvent& event) override;
+
+private:
+  cTraceWriter(const cTraceWriter&) = delete;
+  cTraceWriter& operator=(const cTraceWriter&) = delete;
+
+  // If the pending buffer gets this big the thread adding the event writes it out instead of waiting for the background thread
+  static const size_t MAX_PENDING_BYTES = 4 * 1024 * 1024;
+
+  // If this many zones are waiting the background thread is woken up early, the zones are never dropped and Collect never waits for the file
+  static const size_t MAX_PENDING_ZONES = 256 * 1024;
+
+  struct cPendingZone {
+    uint32_t osThreadID;
+    cProfileEvent event;
+  };
+
+  void BackgroundThreadMain(durationms_t interval);
+
+  // Formats one zone onto the end of sChunk, mutexFile must be held
+  void FormatZone(const cPendingZone& zone, std::string& sChunk);
+
+  // Adds one event, szEvent is the body of the JSON object without the braces or the pid and tid
+  void AddEvent(uint32_t threadID, const char* szEvent, size_t length);
+
+  // Adds a thread_name metadata event the first time we see a thread, mutexPending must be held
+  void AddThreadNameLocked(uint32_t threadID, const std::string& sName);
+
+  // Converts a time from GetTimeNS to CLOCK_MONOTONIC
+  int64_t ToTraceTimeNS(durationns_t timeNS) const { return int64_t(timeNS) + monotonicClockOffsetNS; }
+
+  const int processID;
+  int64_t monotonicClockOffsetNS;
+
+  // Protects the file and keeps chunks in order when both the background thread and an event writer flush
+  std::mutex mutexFile;
+  FILE* pFile;
+  bool bFileHasEvents;
+  std::vector<std::string> zoneNames; // Escaped, refreshed when a zone we haven't seen turns up
+
+  // Protects everything that is waiting to be written, sPending holds formatted events separated by ",\n"
+  std::mutex mutexPending;
+  std::string sPending;
+  std::vector<cPendingZone> pendingZones;
+  std::vector<uint32_t> namedThreads;
+  uint32_t lastZoneThreadID; // Collect drains one thread at a time, so a zone from the same thread as the last one doesn't need to check namedThreads
+
+  std::mutex mutexBackgroundThread;
+  std::condition_variable conditionBackgroundThread;
+  bool bStopBackgroundThread;
+  std::thread backgroundThread;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,636 @@
+// Standard headers
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+// POSIX headers
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+// Application headers
+#include "cachestore.h"
+
+namespace cache
+{
+  namespace
+  {
+    const char* INDEX_HEADER = "cachestore 1";
+
+    // A temporary file is removed once the process that was writing it has gone, or it is this old, in case the pid has been reused
+    const time_t STALE_TEMPORARY_FILE_SECONDS = 24 * 60 * 60;
+
+    const size_t KEY_LENGTH = 32;
+
+    // Returned for empty objects, there is nothing to map but the buffer should still be valid
+    uint8_t emptyObject = 0;
+
+    // The murmur3 64 bit finaliser
+    uint64_t Mix64(uint64_t x)
+    {
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdull;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53ull;
+      x ^= x >> 33;
+      return x;
+    }
+
+    // FNV-1a over the bytes in hash[0], and a word at a time multiply and rotate hash in hash[1], the two are independent enough that both colliding won't happen by accident
+    void HashBytes(uint64_t hash[2], const void* pData, size_t size)
+    {
+      const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+      for (size_t i = 0; i < size; i++) hash[0] = (hash[0] ^ pBytes[i]) * 1099511628211ull;
+
+      size_t i = 0;
+      for (; (i + 8) <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, pBytes + i, sizeof(word));
+        hash[1] ^= Mix64(word);
+        hash[1] = ((hash[1] << 27) | (hash[1] >> 37)) * 5 + 0x52dce729ull;
+      }
+
+      uint64_t tail = 0;
+      memcpy(&tail, pBytes + i, size - i);
+      hash[1] ^= Mix64(tail ^ (uint64_t(size) << 56) ^ size);
+    }
+
+    bool IsKey(const std::string& sName)
+    {
+      return (sName.length() == KEY_LENGTH) && (sName.find_first_not_of("0123456789abcdef") == std::string::npos);
+    }
+
+    // Temporary files are named <key>.tmp.<pid>.<counter>
+    bool IsStaleTemporaryFile(const std::string& sName, const struct stat& _stat)
+    {
+      const size_t position = sName.find(".tmp.");
+      const pid_t pid = pid_t(atol(sName.c_str() + position + 5));
+      const bool bIsWriterRunning = (pid > 0) && ((kill(pid, 0) == 0) || (errno != ESRCH));
+      return !bIsWriterRunning || ((time(nullptr) - _stat.st_mtime) > STALE_TEMPORARY_FILE_SECONDS);
+    }
+
+    uint64_t GetTimeNanoSeconds()
+    {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      return (uint64_t(now.tv_sec) * 1000000000ull) + uint64_t(now.tv_nsec);
+    }
+
+    bool CreateDirectories(const std::string& sDirectory)
+    {
+      for (size_t i = 1; i <= sDirectory.length(); i++) {
+        if ((i == sDirectory.length()) || (sDirectory[i] == '/')) {
+          const std::string sParent = sDirectory.substr(0, i);
+          if ((mkdir(sParent.c_str(), 0755) != 0) && (errno != EEXIST)) {
+            std::cerr<<"CreateDirectories Could not create "<<sParent<<", "<<strerror(errno)<<std::endl;
+            return false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    bool WriteAll(int fd, const void* pData, size_t size)
+    {
+      const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+      while (size != 0) {
+        const ssize_t written = write(fd, pBytes, size);
+        if (written < 0) {
+          if (errno == EINTR) continue;
+          return false;
+        }
+
+        pBytes += written;
+        size -= size_t(written);
+      }
+
+      return true;
+    }
+
+    // ** cLock
+    //
+    // Holds a flock on the store's lock file until it goes out of scope
+
+    class cLock
+    {
+    public:
+      cLock(int fd, int operation);
+      ~cLock();
+
+      bool IsLocked() const { return bIsLocked; }
+
+    private:
+      int fd;
+      bool bIsLocked;
+    };
+
+    cLock::cLock(int _fd, int operation) :
+      fd(_fd),
+      bIsLocked(false)
+    {
+      int result = 0;
+      do {
+        result = flock(fd, operation);
+      } while ((result != 0) && (errno == EINTR));
+
+      bIsLocked = (result == 0);
+    }
+
+    cLock::~cLock()
+    {
+      if (bIsLocked) flock(fd, LOCK_UN);
+    }
+  }
+
+  std::string GetCacheHomeDirectory()
+  {
+    const char* szCacheHome = getenv("XDG_CACHE_HOME");
+    if ((szCacheHome != nullptr) && (szCacheHome[0] == '/')) return szCacheHome;
+
+    const char* szHome = getenv("HOME");
+    return std::string((szHome != nullptr) ? szHome : "") + "/.cache";
+  }
+
+
+  // ** cKey
+
+  cKey::cKey()
+  {
+    hash[0] = 14695981039346656037ull;
+    hash[1] = 0x9e3779b97f4a7c15ull;
+  }
+
+  cKey cKey::FromData(const void* pData, size_t size)
+  {
+    cKey key;
+    key.Append(pData, size);
+    return key;
+  }
+
+  cKey cKey::FromString(const std::string& sText)
+  {
+    return FromData(sText.data(), sText.length());
+  }
+
+  void cKey::Append(const void* pData, size_t size)
+  {
+    HashBytes(hash, pData, size);
+  }
+
+  std::string cKey::ToString() const
+  {
+    const char* szHex = "0123456789abcdef";
+
+    std::string sKey;
+    for (size_t i = 0; i < 2; i++) {
+      for (int shift = 60; shift >= 0; shift -= 4) sKey += szHex[(hash[i] >> shift) & 0xf];
+    }
+
+    return sKey;
+  }
+
+
+  // ** cBuffer
+
+  cBuffer::cBuffer() :
+    pData(nullptr),
+    size(0)
+  {
+  }
+
+  cBuffer::cBuffer(cBuffer&& rhs) :
+    pData(rhs.pData),
+    size(rhs.size)
+  {
+    rhs.pData = nullptr;
+    rhs.size = 0;
+  }
+
+  cBuffer::~cBuffer()
+  {
+    Clear();
+  }
+
+  cBuffer& cBuffer::operator=(cBuffer&& rhs)
+  {
+    if (this != &rhs) {
+      Clear();
+      std::swap(pData, rhs.pData);
+      std::swap(size, rhs.size);
+    }
+
+    return *this;
+  }
+
+  void cBuffer::Clear()
+  {
+    if ((pData != nullptr) && (size != 0)) munmap(pData, size);
+
+    pData = nullptr;
+    size = 0;
+  }
+
+
+  // ** cStore
+
+  cStore::cStore() :
+    maxBytes(0),
+    fdLock(-1),
+    fdJournal(-1)
+  {
+  }
+
+  cStore::~cStore()
+  {
+    Close();
+  }
+
+  bool cStore::Open(const std::string& _sDirectory, uint64_t _maxBytes)
+  {
+    Close();
+
+    if (!CreateDirectories(_sDirectory + "/objects")) return false;
+
+    fdLock = open((_sDirectory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fdLock < 0) {
+      std::cerr<<"cStore::Open Could not open "<<_sDirectory<<"/lock, "<<strerror(errno)<<std::endl;
+      return false;
+    }
+
+    fdJournal = open((_sDirectory + "/journal").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fdJournal < 0) {
+      std::cerr<<"cStore::Open Could not open "<<_sDirectory<<"/journal, "<<strerror(errno)<<std::endl;
+      Close();
+      return false;
+    }
+
+    sDirectory = _sDirectory;
+    maxBytes = _maxBytes;
+
+    // Pick up anything a crashed process left behind, and apply our budget
+    bool bIsIndexWritten = false;
+    {
+      cLock lock(fdLock, LOCK_EX);
+      if (lock.IsLocked()) {
+        std::vector<cIndexEntry> entries;
+        ReadIndex(entries);
+        Reconcile(entries);
+        MergeJournal(entries);
+        EvictLeastRecentlyUsed(entries, "");
+
+        bIsIndexWritten = WriteIndex(entries);
+      }
+    }
+
+    if (!bIsIndexWritten) {
+      Close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void cStore::Close()
+  {
+    if (fdJournal != -1) close(fdJournal);
+    if (fdLock != -1) close(fdLock);
+
+    fdJournal = -1;
+    fdLock = -1;
+    sDirectory.clear();
+    maxBytes = 0;
+  }
+
+  std::string cStore::GetObjectFilePath(const std::string& sKey) const
+  {
+    return sDirectory + "/objects/" + sKey;
+  }
+
+  bool cStore::Get(const cKey& key, cBuffer& buffer)
+  {
+    buffer.Clear();
+
+    if (!IsOpen()) return false;
+
+    // Shared so that a put can't evict the object between opening and mapping it, once it is mapped it doesn't matter
+    cLock lock(fdLock, LOCK_SH);
+    if (!lock.IsLocked()) return false;
+
+    const std::string sKey = key.ToString();
+
+    const int fd = open(GetObjectFilePath(sKey).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat _stat;
+    if (fstat(fd, &_stat) != 0) {
+      close(fd);
+      return false;
+    }
+
+    const size_t size = size_t(_stat.st_size);
+    if (size == 0) buffer.pData = &emptyObject;
+    else {
+      void* pMapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (pMapped == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+
+      buffer.pData = pMapped;
+      buffer.size = size;
+    }
+
+    close(fd);
+
+    // One write with O_APPEND so lines from different processes don't interleave, the next put merges it into the index
+    std::ostringstream o;
+    o<<sKey<<" "<<GetTimeNanoSeconds()<<"\n";
+    const std::string sLine = o.str();
+    WriteAll(fdJournal, sLine.data(), sLine.length());
+
+    return true;
+  }
+
+  bool cStore::Put(const cKey& key, const void* pData, size_t size)
+  {
+    if (!IsOpen() || (size > maxBytes)) return false;
+
+    const std::string sKey = key.ToString();
+    const std::string sObjectFilePath = GetObjectFilePath(sKey);
+
+    // Write the object without holding the lock, the file name is unique to this process and call
+    static std::atomic<unsigned int> counter(0);
+    std::ostringstream oTemporary;
+    oTemporary<<sObjectFilePath<<".tmp."<<getpid()<<"."<<counter++;
+    const std::string sTemporaryFilePath = oTemporary.str();
+
+    const int fd = open(sTemporaryFilePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      std::cerr<<"cStore::Put Could not create "<<sTemporaryFilePath<<", "<<strerror(errno)<<std::endl;
+      return false;
+    }
+
+    const bool bIsWritten = WriteAll(fd, pData, size);
+    if ((close(fd) != 0) || !bIsWritten) {
+      std::cerr<<"cStore::Put Could not write "<<sTemporaryFilePath<<std::endl;
+      unlink(sTemporaryFilePath.c_str());
+      return false;
+    }
+
+    cLock lock(fdLock, LOCK_EX);
+    if (!lock.IsLocked()) {
+      unlink(sTemporaryFilePath.c_str());
+      return false;
+    }
+
+    if (rename(sTemporaryFilePath.c_str(), sObjectFilePath.c_str()) != 0) {
+      std::cerr<<"cStore::Put Could not rename "<<sTemporaryFilePath<<", "<<strerror(errno)<<std::endl;
+      unlink(sTemporaryFilePath.c_str());
+      return false;
+    }
+
+    std::vector<cIndexEntry> entries;
+    if (!ReadIndex(entries)) Reconcile(entries);
+    MergeJournal(entries);
+
+    const uint64_t now = GetTimeNanoSeconds();
+
+    bool bFound = false;
+    for (cIndexEntry& entry : entries) {
+      if (entry.sKey == sKey) {
+        entry.size = size;
+        entry.lastAccess = now;
+        bFound = true;
+        break;
+      }
+    }
+
+    if (!bFound) {
+      cIndexEntry entry;
+      entry.sKey = sKey;
+      entry.size = size;
+      entry.lastAccess = now;
+      entries.push_back(entry);
+    }
+
+    EvictLeastRecentlyUsed(entries, sKey);
+
+    // An object that isn't in the index would never be evicted
+    if (!WriteIndex(entries)) {
+      unlink(sObjectFilePath.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  bool cStore::Remove(const cKey& key)
+  {
+    if (!IsOpen()) return false;
+
+    cLock lock(fdLock, LOCK_EX);
+    if (!lock.IsLocked()) return false;
+
+    const std::string sKey = key.ToString();
+    const bool bIsRemoved = (unlink(GetObjectFilePath(sKey).c_str()) == 0);
+
+    std::vector<cIndexEntry> entries;
+    if (!ReadIndex(entries)) Reconcile(entries);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&sKey](const cIndexEntry& entry) { return (entry.sKey == sKey); }), entries.end());
+
+    return WriteIndex(entries) && bIsRemoved;
+  }
+
+  bool cStore::Clear()
+  {
+    if (!IsOpen()) return false;
+
+    cLock lock(fdLock, LOCK_EX);
+    if (!lock.IsLocked()) return false;
+
+    // Everything in the objects directory, including temporary files and objects that never made it into the index
+    const std::string sObjectsDirectory = sDirectory + "/objects";
+    DIR* pDirectory = opendir(sObjectsDirectory.c_str());
+    if (pDirectory == nullptr) return false;
+
+    while (const struct dirent* pEntry = readdir(pDirectory)) {
+      if (pEntry->d_name[0] != '.') unlink((sObjectsDirectory + "/" + pEntry->d_name).c_str());
+    }
+
+    closedir(pDirectory);
+
+    if (ftruncate(fdJournal, 0) != 0) return false;
+
+    return WriteIndex(std::vector<cIndexEntry>());
+  }
+
+  bool cStore::GetStatistics(cStatistics& statistics)
+  {
+    statistics.nEntries = 0;
+    statistics.totalBytes = 0;
+    statistics.maxBytes = maxBytes;
+
+    if (!IsOpen()) return false;
+
+    std::vector<cIndexEntry> entries;
+    bool bIsIndexRead = false;
+    {
+      cLock lock(fdLock, LOCK_SH);
+      if (!lock.IsLocked()) return false;
+
+      bIsIndexRead = ReadIndex(entries);
+    }
+
+    if (!bIsIndexRead) {
+      cLock lock(fdLock, LOCK_EX);
+      if (!lock.IsLocked()) return false;
+
+      if (!ReadIndex(entries)) {
+        Reconcile(entries);
+        EvictLeastRecentlyUsed(entries, "");
+        if (!WriteIndex(entries)) return false;
+      }
+    }
+
+    statistics.nEntries = entries.size();
+    for (const cIndexEntry& entry : entries) statistics.totalBytes += entry.size;
+
+    return true;
+  }
+
+  bool cStore::ReadIndex(std::vector<cIndexEntry>& entries) const
+  {
+    entries.clear();
+
+    // A new cache doesn't have an index yet
+    std::ifstream file(sDirectory + "/index");
+    if (!file.good()) return false;
+
+    std::string sLine;
+    if (!std::getline(file, sLine) || (sLine != INDEX_HEADER)) {
+      std::cerr<<"cStore::ReadIndex Unsupported index in "<<sDirectory<<", rebuilding it from the objects"<<std::endl;
+      return false;
+    }
+
+    while (std::getline(file, sLine)) {
+      std::istringstream line(sLine);
+      cIndexEntry entry;
+      if (line>>entry.sKey>>entry.size>>entry.lastAccess) entries.push_back(entry);
+    }
+
+    return true;
+  }
+
+  bool cStore::WriteIndex(const std::vector<cIndexEntry>& entries) const
+  {
+    // Write then rename, so readers see either the old index or the new one
+    const std::string sIndexFilePath = sDirectory + "/index";
+    const std::string sTemporaryFilePath = sIndexFilePath + ".tmp";
+
+    {
+      std::ofstream o(sTemporaryFilePath);
+      o<<INDEX_HEADER<<"\n";
+      for (const cIndexEntry& entry : entries) o<<entry.sKey<<" "<<entry.size<<" "<<entry.lastAccess<<"\n";
+
+      if (!o.good()) {
+        std::cerr<<"cStore::WriteIndex Could not write "<<sTemporaryFilePath<<std::endl;
+        return false;
+      }
+    }
+
+    return (rename(sTemporaryFilePath.c_str(), sIndexFilePath.c_str()) == 0);
+  }
+
+  void cStore::Reconcile(std::vector<cIndexEntry>& entries) const
+  {
+    std::unordered_map<std::string, size_t> indices;
+    for (size_t i = 0; i < entries.size(); i++) indices[entries[i].sKey] = i;
+
+    const std::string sObjectsDirectory = sDirectory + "/objects";
+    DIR* pDirectory = opendir(sObjectsDirectory.c_str());
+    if (pDirectory == nullptr) return;
+
+    std::vector<cIndexEntry> found;
+    while (const struct dirent* pEntry = readdir(pDirectory)) {
+      const std::string sName = pEntry->d_name;
+      if (sName[0] == '.') continue;
+
+      const std::string sFilePath = sObjectsDirectory + "/" + sName;
+      struct stat _stat;
+      if ((stat(sFilePath.c_str(), &_stat) != 0) || !S_ISREG(_stat.st_mode)) continue;
+
+      if (sName.find(".tmp.") != std::string::npos) {
+        if (IsStaleTemporaryFile(sName, _stat)) unlink(sFilePath.c_str());
+        continue;
+      }
+
+      if (!IsKey(sName)) continue;
+
+      // Objects we didn't know about are as old as their modification time, the file size is always right
+      cIndexEntry entry;
+      entry.sKey = sName;
+      entry.size = uint64_t(_stat.st_size);
+      entry.lastAccess = (uint64_t(_stat.st_mtim.tv_sec) * 1000000000ull) + uint64_t(_stat.st_mtim.tv_nsec);
+
+      std::unordered_map<std::string, size_t>::const_iterator iter = indices.find(sName);
+      if (iter != indices.end()) entry.lastAccess = std::max(entry.lastAccess, entries[iter->second].lastAccess);
+
+      found.push_back(entry);
+    }
+
+    closedir(pDirectory);
+
+    // Entries whose object has gone are dropped
+    entries.swap(found);
+  }
+
+  void cStore::MergeJournal(std::vector<cIndexEntry>& entries) const
+  {
+    std::unordered_map<std::string, size_t> indices;
+    for (size_t i = 0; i < entries.size(); i++) indices[entries[i].sKey] = i;
+
+    std::ifstream file(sDirectory + "/journal");
+    std::string sKey;
+    uint64_t lastAccess = 0;
+    while (file>>sKey>>lastAccess) {
+      std::unordered_map<std::string, size_t>::const_iterator iter = indices.find(sKey);
+      if (iter != indices.end()) entries[iter->second].lastAccess = std::max(entries[iter->second].lastAccess, lastAccess);
+    }
+
+    // Hits hold the shared lock while they append, so nothing can be written between reading and truncating
+    if (ftruncate(fdJournal, 0) != 0) std::cerr<<"cStore::MergeJournal Could not truncate the journal, "<<strerror(errno)<<std::endl;
+  }
+
+  void cStore::EvictLeastRecentlyUsed(std::vector<cIndexEntry>& entries, const std::string& sKeepKey) const
+  {
+    uint64_t totalBytes = 0;
+    for (const cIndexEntry& entry : entries) totalBytes += entry.size;
+
+    // Oldest first
+    std::sort(entries.begin(), entries.end(), [](const cIndexEntry& lhs, const cIndexEntry& rhs) { return (lhs.lastAccess < rhs.lastAccess); });
+
+    std::vector<cIndexEntry> kept;
+    for (const cIndexEntry& entry : entries) {
+      if ((totalBytes > maxBytes) && (entry.sKey != sKeepKey)) {
+        unlink(GetObjectFilePath(entry.sKey).c_str());
+        totalBytes -= entry.size;
+      } else kept.push_back(entry);
+    }
+
+    entries.swap(kept);
+  }
+}
@@ -0,0 +1,152 @@
+#ifndef CACHESTORE_H
+#define CACHESTORE_H
+
+// A size bounded disk cache for build artefacts such as compiled shader binaries, pre-processed meshes and source_cleaner indexes
+//
+// Entries live in <cache home>/<name>/objects and are named by a hash of whatever they were built from, so a changed input is just a miss
+// Objects are written to a temporary file and renamed into place, a reader never sees half an object
+// Hits are mapped read only with mmap, the mapping stays valid even if another process evicts the object while we are using it
+// The index holds the size and last access time of each object, when a put takes the total over the budget the least recently used objects are deleted
+// Hits don't rewrite the index, they append a line to the access journal which the next put merges in
+// Several processes can share a cache, flock on the lock file is shared for hits and exclusive for puts
+//
+// Open and any put that finds the index missing or unreadable reconcile it with the objects directory, so objects from a crashed writer still count towards the budget
+// There is no fsync, after a power cut the last few objects may be missing or empty, which looks like a miss
+// Linux and other POSIX systems only
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace cache
+{
+  // $XDG_CACHE_HOME if it is set, otherwise $HOME/.cache
+  std::string GetCacheHomeDirectory();
+
+
+  // ** cKey
+  //
+  // A 128 bit hash of the inputs that an artefact was built from, not cryptographic but wide enough that accidental collisions won't happen
+
+  class cKey
+  {
+  public:
+    cKey();
+
+    static cKey FromData(const void* pData, size_t size);
+    static cKey FromString(const std::string& sText);
+
+    // Combines the hash of more data into this key, for example the compiler options after the source
+    void Append(const void* pData, size_t size);
+
+    // 32 hex characters
+    std::string ToString() const;
+
+    bool operator==(const cKey& rhs) const { return (hash[0] == rhs.hash[0]) && (hash[1] == rhs.hash[1]); }
+    bool operator!=(const cKey& rhs) const { return !(*this == rhs); }
+
+  private:
+    uint64_t hash[2];
+  };
+
+
+  // ** cBuffer
+  //
+  // A read only mapping of a cached object, unmapped when it is destroyed
+
+  class cBuffer
+  {
+  public:
+    cBuffer();
+    cBuffer(cBuffer&& rhs);
+    ~cBuffer();
+
+    cBuffer& operator=(cBuffer&& rhs);
+
+    bool IsValid() const { return (pData != nullptr); }
+
+    const uint8_t* GetData() const { return static_cast<const uint8_t*>(pData); }
+    size_t GetSize() const { return size; }
+
+    void Clear();
+
+  private:
+    cBuffer(const cBuffer&) = delete;
+    cBuffer& operator=(const cBuffer&) = delete;
+
+    friend class cStore;
+
+    void* pData;
+    size_t size;
+  };
+
+
+  // ** cStatistics
+
+  struct cStatistics {
+    size_t nEntries;
+    uint64_t totalBytes;
+    uint64_t maxBytes;
+  };
+
+
+  // ** cStore
+
+  class cStore
+  {
+  public:
+    cStore();
+    ~cStore();
+
+    // Opens or creates the cache in sDirectory, the budget is per store, the last process to put decides what is kept
+    bool Open(const std::string& sDirectory, uint64_t maxBytes);
+    void Close();
+
+    bool IsOpen() const { return (fdLock != -1); }
+
+    const std::string& GetDirectory() const { return sDirectory; }
+
+    // Returns false on a miss, buffer is cleared
+    bool Get(const cKey& key, cBuffer& buffer);
+
+    // Returns false if the object is larger than the budget or couldn't be written, the cache is unchanged
+    bool Put(const cKey& key, const void* pData, size_t size);
+
+    bool Remove(const cKey& key);
+
+    // Removes every object
+    bool Clear();
+
+    bool GetStatistics(cStatistics& statistics);
+
+  private:
+    cStore(const cStore&) = delete;
+    cStore& operator=(const cStore&) = delete;
+
+    struct cIndexEntry {
+      std::string sKey;
+      uint64_t size;
+      uint64_t lastAccess; // Nanoseconds since the epoch
+    };
+
+    std::string GetObjectFilePath(const std::string& sKey) const;
+
+    // Returns false if the index is missing or unreadable, entries is then empty and should be rebuilt with Reconcile
+    bool ReadIndex(std::vector<cIndexEntry>& entries) const;
+
+    // These must be called with the exclusive lock held
+    bool WriteIndex(const std::vector<cIndexEntry>& entries) const;
+    void Reconcile(std::vector<cIndexEntry>& entries) const;
+    void MergeJournal(std::vector<cIndexEntry>& entries) const;
+    void EvictLeastRecentlyUsed(std::vector<cIndexEntry>& entries, const std::string& sKeepKey) const;
+
+    std::string sDirectory;
+    uint64_t maxBytes;
+    int fdLock;
+    int fdJournal;
+  };
+}
+
+#endif // CACHESTORE_H
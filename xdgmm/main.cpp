@@ -1,6 +1,8 @@
 #include <cassert>
 #include <cmath>
 
+#include <chrono>
+#include <fstream>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -12,6 +14,13 @@
 // libxdgmm headers
 #include <libxdgmm/libxdgmm.h>
 
+// POSIX headers
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Application headers
+#include "cachestore.h"
+
 bool RunTest()
 {
   if (!xdg::IsInstalled()) {
@@ -48,12 +57,197 @@ bool RunTest()
     return false;
   }
 
+  if (getenv("XDG_CACHE_HOME") == nullptr) {
+    if (cache::GetCacheHomeDirectory() != sHome + "/.cache") {
+      std::cout<<"RunTest cache::GetCacheHomeDirectory FAILED, returning false"<<std::endl;
+      return false;
+    }
+  }
+
   return true;
 }
 
+std::vector<uint8_t> CreateArtefact(size_t index, size_t size)
+{
+  std::vector<uint8_t> artefact(size);
+  for (size_t i = 0; i < size; i++) artefact[i] = uint8_t((index * 131) + (i * 7));
+  return artefact;
+}
+
+cache::cKey GetArtefactKey(size_t index)
+{
+  std::ostringstream o;
+  o<<"shaders/artefact"<<index<<".frag -O2";
+  return cache::cKey::FromString(o.str());
+}
+
+bool IsArtefactInCache(cache::cStore& store, size_t index, size_t size)
+{
+  cache::cBuffer buffer;
+  if (!store.Get(GetArtefactKey(index), buffer)) return false;
+
+  const std::vector<uint8_t> artefact = CreateArtefact(index, size);
+  return (buffer.GetSize() == size) && std::equal(artefact.begin(), artefact.end(), buffer.GetData());
+}
+
+bool RunCacheTest()
+{
+  const size_t nArtefactBytes = 64 * 1024;
+
+  cache::cStore store;
+  if (!store.Open(cache::GetCacheHomeDirectory() + "/xdgmm_test", 4 * nArtefactBytes) || !store.Clear()) {
+    std::cout<<"RunCacheTest cStore::Open FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  if (cache::cKey::FromString("a") == cache::cKey::FromString("b")) {
+    std::cout<<"RunCacheTest cKey FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  if (IsArtefactInCache(store, 0, nArtefactBytes)) {
+    std::cout<<"RunCacheTest miss FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  // Fill the cache to the budget
+  for (size_t i = 0; i < 4; i++) {
+    const std::vector<uint8_t> artefact = CreateArtefact(i, nArtefactBytes);
+    if (!store.Put(GetArtefactKey(i), artefact.data(), artefact.size())) {
+      std::cout<<"RunCacheTest cStore::Put FAILED, returning false"<<std::endl;
+      return false;
+    }
+  }
+
+  // Use the oldest artefact so that the second oldest is evicted instead
+  if (!IsArtefactInCache(store, 0, nArtefactBytes)) {
+    std::cout<<"RunCacheTest hit FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  const std::vector<uint8_t> artefact = CreateArtefact(4, nArtefactBytes);
+  store.Put(GetArtefactKey(4), artefact.data(), artefact.size());
+
+  if (!IsArtefactInCache(store, 0, nArtefactBytes) || IsArtefactInCache(store, 1, nArtefactBytes) || !IsArtefactInCache(store, 4, nArtefactBytes)) {
+    std::cout<<"RunCacheTest eviction FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  const std::vector<uint8_t> tooLarge(5 * nArtefactBytes);
+  if (store.Put(cache::cKey::FromString("too large"), tooLarge.data(), tooLarge.size())) {
+    std::cout<<"RunCacheTest budget FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  // A corrupt index is rebuilt from the objects, so they still count towards the budget and get evicted
+  {
+    std::ofstream file(store.GetDirectory() + "/index");
+    file<<"corrupt"<<std::endl;
+  }
+
+  const std::vector<uint8_t> afterCorruption = CreateArtefact(5, nArtefactBytes);
+  cache::cStatistics statistics;
+  if (!store.Put(GetArtefactKey(5), afterCorruption.data(), afterCorruption.size()) || !store.GetStatistics(statistics) || (statistics.nEntries != 4) || (statistics.totalBytes != (4 * nArtefactBytes))) {
+    std::cout<<"RunCacheTest index rebuild FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  // Several processes putting and getting at the same time
+  const size_t nProcesses = 4;
+  const size_t nArtefactsPerProcess = 50;
+  std::vector<pid_t> children;
+  for (size_t process = 0; process < nProcesses; process++) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      cache::cStore childStore;
+      if (!childStore.Open(store.GetDirectory(), 4 * nArtefactBytes)) _exit(EXIT_FAILURE);
+
+      for (size_t i = 0; i < nArtefactsPerProcess; i++) {
+        const size_t index = 100 + (process * nArtefactsPerProcess) + i;
+        const std::vector<uint8_t> childArtefact = CreateArtefact(index, nArtefactBytes / 4);
+        if (!childStore.Put(GetArtefactKey(index), childArtefact.data(), childArtefact.size())) _exit(EXIT_FAILURE);
+
+        // Anything we get back must be complete, even if another process evicts it straight away
+        cache::cBuffer buffer;
+        if (childStore.Get(GetArtefactKey(index), buffer) && !std::equal(childArtefact.begin(), childArtefact.end(), buffer.GetData())) _exit(EXIT_FAILURE);
+      }
+
+      _exit(EXIT_SUCCESS);
+    }
+
+    children.push_back(pid);
+  }
+
+  bool bIsChildSuccess = true;
+  for (const pid_t pid : children) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bIsChildSuccess = bIsChildSuccess && WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS);
+  }
+
+  if (!bIsChildSuccess || !store.GetStatistics(statistics) || (statistics.totalBytes > statistics.maxBytes)) {
+    std::cout<<"RunCacheTest concurrent processes FAILED, returning false"<<std::endl;
+    return false;
+  }
+
+  return store.Clear();
+}
+
+void RunCacheBenchmark()
+{
+  const size_t nArtefactBytes = 256 * 1024;
+  const size_t nIterations = 10000;
+
+  cache::cStore store;
+  if (!store.Open(cache::GetCacheHomeDirectory() + "/xdgmm_benchmark", 64 * nArtefactBytes) || !store.Clear()) return;
+
+  const std::vector<uint8_t> artefact = CreateArtefact(0, nArtefactBytes);
+  const cache::cKey hitKey = GetArtefactKey(0);
+  const cache::cKey missKey = GetArtefactKey(1);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < 100; i++) store.Put(GetArtefactKey(1000 + i), artefact.data(), artefact.size());
+  const double putMicroSeconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / 100;
+
+  store.Put(hitKey, artefact.data(), artefact.size());
+
+  // Touch every page so that a hit includes the page faults of reading it
+  size_t total = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nIterations; i++) {
+    cache::cBuffer buffer;
+    store.Get(hitKey, buffer);
+    for (size_t j = 0; j < buffer.GetSize(); j += 4096) total += buffer.GetData()[j];
+  }
+  const double hitMicroSeconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nIterations;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nIterations; i++) {
+    cache::cBuffer buffer;
+    total += store.Get(missKey, buffer) ? 1 : 0;
+  }
+  const double missMicroSeconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nIterations;
+
+  cache::cStatistics statistics;
+  store.GetStatistics(statistics);
+
+  std::cout<<"Cache "<<store.GetDirectory()<<", "<<(nArtefactBytes / 1024)<<" KiB artefacts, "<<statistics.nEntries<<" entries using "<<(statistics.totalBytes / 1024)<<" of "<<(statistics.maxBytes / 1024)<<" KiB"<<std::endl;
+  std::cout<<"Put with eviction: "<<putMicroSeconds<<" us"<<std::endl;
+  std::cout<<"Hit: "<<hitMicroSeconds<<" us"<<std::endl;
+  std::cout<<"Miss: "<<missMicroSeconds<<" us"<<std::endl;
+
+  // Keep the reads from being optimised away
+  volatile size_t sink = total;
+  (void)sink;
+
+  store.Clear();
+}
+
 int main(int argc, char** argv)
 {
-  bool bIsSuccess = RunTest();
+  bool bIsSuccess = RunTest() && RunCacheTest();
+
+  if (bIsSuccess && (argc > 1) && (std::string(argv[1]) == "--benchmark")) RunCacheBenchmark();
 
   std::cout<<"Tests "<<(bIsSuccess ? "Passed" : "Failed")<<std::endl;
   return bIsSuccess ? EXIT_SUCCESS : EXIT_FAILURE;